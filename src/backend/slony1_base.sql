@@ -270,7 +270,9 @@ comment on column @NAMESPACE@.sl_event.ev_type is 'The type of event this record
 				DROP_SET			=
 				MERGE_SET			=
 				SET_ADD_TABLE		=
+				SET_ADD_TABLES		=
 				SET_ADD_SEQUENCE	=
+				SET_ADD_SEQUENCES	=
 				STORE_TRIGGER		=
 				DROP_TRIGGER		=
 				MOVE_SET			=
@@ -444,7 +446,7 @@ comment on column @NAMESPACE@.sl_log_script.log_origin is 'Origin name from whic
 comment on column @NAMESPACE@.sl_log_script.log_txid is 'Transaction ID on the origin node';
 comment on column @NAMESPACE@.sl_log_script.log_actionseq is 'The sequence number in which actions will be applied on replicas';
 comment on column @NAMESPACE@.sl_log_2.log_cmdtype is 'Replication action to take. S = Script statement, s = Script complete';
-comment on column @NAMESPACE@.sl_log_script.log_cmdargs is 'The DDL statement, optionally followed by selected nodes to execute it on.';
+comment on column @NAMESPACE@.sl_log_script.log_cmdargs is 'The DDL statement, followed by the selected nodes to execute it on, the sequence values to set before and any further statements of the same batch.';
 
 -- ----------------------------------------------------------------------
 -- TABLE sl_registry
@@ -500,6 +502,79 @@ comment on column @NAMESPACE@.sl_apply_stats.as_cache_evict is 'Number of apply
 comment on column @NAMESPACE@.sl_apply_stats.as_cache_prepare_max is 'Maximum number of apply queries prepared in one SYNC group';
 
 
+-- ----------------------------------------------------------------------
+-- TABLE sl_apply_table_stats
+-- ----------------------------------------------------------------------
+create table @NAMESPACE@.sl_apply_table_stats (
+	ats_origin			int4,
+	ats_tab_id			int4,
+	ats_cache_prepare	int8,
+	ats_cache_hit		int8,
+	ats_cache_evict		int8,
+	ats_cache_inval		int8,
+	ats_apply_last		timestamptz
+) WITHOUT OIDS;
+
+create index sl_apply_table_stats_idx1 on @NAMESPACE@.sl_apply_table_stats
+	(ats_origin, ats_tab_id);
+
+comment on table @NAMESPACE@.sl_apply_table_stats is 'Local apply query cache statistics per table (running totals)';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_origin is 'Origin of the SYNCs';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_tab_id is 'Table ID';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_cache_prepare is 'Number of apply queries prepared for the table (cache misses)';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_cache_hit is 'Number of apply query cache hits';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_cache_evict is 'Number of apply queries evicted to make room for others';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_cache_inval is 'Number of apply queries discarded because the table was altered';
+comment on column @NAMESPACE@.sl_apply_table_stats.ats_apply_last is 'Timestamp of most recent update';
+
+
+-- ----------------------------------------------------------------------
+-- TABLE sl_sync_metrics
+--
+--	Ring buffer of per SYNC group timings.  The slon writes one row per
+--	applied SYNC group into slot (nextval(sl_sync_metrics_seq) % size),
+--	where size is the slon configuration parameter sync_metrics_size.
+-- ----------------------------------------------------------------------
+create table @NAMESPACE@.sl_sync_metrics (
+	sm_slot				int4,
+	sm_origin			int4,
+	sm_seqno			int8,
+	sm_group_size		int4,
+	sm_log_rows			int8,
+	sm_copy_bytes		int8,
+	sm_prov_query		interval,
+	sm_first_row		interval,
+	sm_copy				interval,
+	sm_apply			interval,
+	sm_confirm			interval,
+	sm_commit			interval,
+	sm_total			interval,
+	sm_timestamp		timestamptz,
+
+	CONSTRAINT "sl_sync_metrics-pkey"
+		PRIMARY KEY (sm_slot)
+) WITHOUT OIDS;
+
+create index sl_sync_metrics_idx1 on @NAMESPACE@.sl_sync_metrics
+	(sm_origin, sm_total);
+
+comment on table @NAMESPACE@.sl_sync_metrics is 'Timing breakdown of the most recently applied SYNC groups (ring buffer)';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_slot is 'Ring buffer slot';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_origin is 'Origin of the SYNCs';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_seqno is 'Event sequence number of the last SYNC in the group';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_group_size is 'Number of SYNC events applied in this group';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_log_rows is 'Number of sl_log rows copied from the provider(s)';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_copy_bytes is 'Number of bytes of log data copied from the provider(s)';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_prov_query is 'Time spent in control queries against the provider(s)';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_first_row is 'Time from starting the log selection until the first row arrived';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_copy is 'Time spent streaming log rows after the first row (includes the logApply trigger)';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_apply is 'Time spent in queries against the local node (sequences, setsync)';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_confirm is 'Time the local node spent storing the forwarded events and confirmations';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_commit is 'Time of the final round trip, forwarding and commit, of the previous SYNC group from this origin';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_total is 'Total time from start of the SYNC group until it was recorded, just before the commit';
+comment on column @NAMESPACE@.sl_sync_metrics.sm_timestamp is 'Time at which the SYNC group was recorded, just before its commit';
+
+
 -- **********************************************************************
 -- * Views
 -- **********************************************************************
@@ -516,7 +591,81 @@ create view @NAMESPACE@.sl_seqlastvalue as
 			"pg_catalog".pg_class PGC, "pg_catalog".pg_namespace PGN
 		where S.set_id = SQ.seq_set
 			and PGC.oid = SQ.seq_reloid and PGN.oid = PGC.relnamespace;
-		
+
+
+-- ----------------------------------------------------------------------
+-- VIEW sl_sync_metrics_summary
+--
+--	Per origin averages and throughput over the SYNC groups currently
+--	held in sl_sync_metrics.
+-- ----------------------------------------------------------------------
+create view @NAMESPACE@.sl_sync_metrics_summary as
+	select sm_origin,
+			count(*) as sm_num_groups,
+			sum(sm_group_size) as sm_num_syncs,
+			avg(sm_group_size) as sm_avg_group_size,
+			sum(sm_log_rows) as sm_log_rows,
+			sum(sm_copy_bytes) as sm_copy_bytes,
+			avg(sm_prov_query) as sm_avg_prov_query,
+			avg(sm_first_row) as sm_avg_first_row,
+			avg(sm_copy) as sm_avg_copy,
+			avg(sm_apply) as sm_avg_apply,
+			avg(sm_confirm) as sm_avg_confirm,
+			avg(sm_commit) as sm_avg_commit,
+			avg(sm_total) as sm_avg_total,
+			max(sm_total) as sm_max_total,
+			sum(sm_log_rows) / greatest(extract(epoch from sum(sm_total)), 0.001)
+				as sm_rows_per_sec,
+			sum(sm_copy_bytes) / greatest(extract(epoch from sum(sm_total)), 0.001)
+				as sm_bytes_per_sec,
+			min(sm_timestamp) as sm_first,
+			max(sm_timestamp) as sm_last
+		from @NAMESPACE@.sl_sync_metrics
+		group by sm_origin;
+comment on view @NAMESPACE@.sl_sync_metrics_summary is 'Per origin averages and throughput of the SYNC groups in sl_sync_metrics';
+
+
+-- ----------------------------------------------------------------------
+-- VIEW sl_sync_metrics_percentiles
+--
+--	Per origin latency percentiles of the SYNC groups currently held
+--	in sl_sync_metrics.  Percentiles are picked by rank (no
+--	interpolation) so that this works on all supported PostgreSQL
+--	versions.
+-- ----------------------------------------------------------------------
+create view @NAMESPACE@.sl_sync_metrics_percentiles as
+	select O.sm_origin, O.sm_num_groups,
+			(select M.sm_total from @NAMESPACE@.sl_sync_metrics M
+				where M.sm_origin = O.sm_origin order by M.sm_total
+				offset floor(0.50 * (O.sm_num_groups - 1))::int8 limit 1)
+				as sm_total_p50,
+			(select M.sm_total from @NAMESPACE@.sl_sync_metrics M
+				where M.sm_origin = O.sm_origin order by M.sm_total
+				offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+				as sm_total_p90,
+			(select M.sm_total from @NAMESPACE@.sl_sync_metrics M
+				where M.sm_origin = O.sm_origin order by M.sm_total
+				offset floor(0.99 * (O.sm_num_groups - 1))::int8 limit 1)
+				as sm_total_p99,
+			(select M.sm_first_row from @NAMESPACE@.sl_sync_metrics M
+				where M.sm_origin = O.sm_origin order by M.sm_first_row
+				offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+				as sm_first_row_p90,
+			(select M.sm_copy from @NAMESPACE@.sl_sync_metrics M
+				where M.sm_origin = O.sm_origin order by M.sm_copy
+				offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+				as sm_copy_p90,
+			(select M.sm_commit from @NAMESPACE@.sl_sync_metrics M
+				where M.sm_origin = O.sm_origin order by M.sm_commit
+				offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+				as sm_commit_p90,
+			O.sm_max_total
+		from (select sm_origin, count(*) as sm_num_groups,
+					max(sm_total) as sm_max_total
+				from @NAMESPACE@.sl_sync_metrics
+				group by sm_origin) O;
+comment on view @NAMESPACE@.sl_sync_metrics_percentiles is 'Per origin SYNC group latency percentiles from sl_sync_metrics';
+
 
 create view @NAMESPACE@.sl_failover_targets as
 select  set_id,
@@ -570,6 +719,37 @@ FROM
 	    where subs3.sub_receiver is null
 	    );
 
+
+-- ----------------------------------------------------------------------
+-- VIEW sl_failover_readiness
+--
+--	For every set origin and failover candidate the newest event of the
+--	origin that the candidate has confirmed, as far as this node knows.
+--	FAILOVER promotes the most advanced candidate, so this shows ahead
+--	of time which node that will be and how far behind it is.
+-- ----------------------------------------------------------------------
+create view @NAMESPACE@.sl_failover_readiness as
+	select T.set_origin as fr_origin,
+			T.backup_id as fr_candidate,
+			T.fr_num_sets,
+			C.fr_confirmed_seqno,
+			C.fr_confirmed_time,
+			E.fr_origin_seqno - C.fr_confirmed_seqno as fr_lag_events
+		from (select set_origin, backup_id, count(*) as fr_num_sets
+				from @NAMESPACE@.sl_failover_targets
+				group by set_origin, backup_id) T
+		left join (select con_origin, con_received,
+					max(con_seqno) as fr_confirmed_seqno,
+					max(con_timestamp) as fr_confirmed_time
+				from @NAMESPACE@.sl_confirm
+				group by con_origin, con_received) C
+			on (C.con_origin = T.set_origin and C.con_received = T.backup_id)
+		left join (select ev_origin, max(ev_seqno) as fr_origin_seqno
+				from @NAMESPACE@.sl_event
+				group by ev_origin) E
+			on (E.ev_origin = T.set_origin);
+comment on view @NAMESPACE@.sl_failover_readiness is 'Per origin and failover candidate the last confirmed event of the origin and the lag in events';
+
 		      
 	
 
@@ -611,6 +791,15 @@ select setval('@NAMESPACE@.sl_event_seq', 5000000000);
 create sequence @NAMESPACE@.sl_action_seq;
 comment on sequence @NAMESPACE@.sl_action_seq is 'The sequence to number statements in the transaction logs, so that the replication engines can figure out the "agreeable" order of statements.';
 
+-- ----------------------------------------------------------------------
+-- SEQUENCE sl_sync_metrics_seq
+--
+--	Used to pick the next slot in the sl_sync_metrics ring buffer.
+-- ----------------------------------------------------------------------
+create sequence @NAMESPACE@.sl_sync_metrics_seq;
+comment on sequence @NAMESPACE@.sl_sync_metrics_seq is 'Used to pick the next slot in the sl_sync_metrics ring buffer.';
+
+
 
 
 
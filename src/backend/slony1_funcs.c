@@ -33,6 +33,7 @@
 #include "access/xact.h"
 #include "access/transam.h"
 #include "access/hash.h"
+#include "storage/lmgr.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/guc.h"
@@ -41,6 +42,7 @@
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/timestamp.h"
 #include "utils/int8.h"
 #ifdef HAVE_GETACTIVESNAPSHOT
@@ -76,9 +78,11 @@ PG_FUNCTION_INFO_V1(versionFunc(getModuleVersion));
 PG_FUNCTION_INFO_V1(versionFunc(logTrigger));
 PG_FUNCTION_INFO_V1(versionFunc(denyAccess));
 PG_FUNCTION_INFO_V1(versionFunc(logApply));
+PG_FUNCTION_INFO_V1(versionFunc(logApplyArchive));
 PG_FUNCTION_INFO_V1(versionFunc(logApplySetCacheSize));
 PG_FUNCTION_INFO_V1(versionFunc(logApplySaveStats));
 PG_FUNCTION_INFO_V1(versionFunc(lockedSet));
+PG_FUNCTION_INFO_V1(versionFunc(waitXmin));
 PG_FUNCTION_INFO_V1(versionFunc(killBackend));
 PG_FUNCTION_INFO_V1(versionFunc(seqtrack));
 
@@ -95,9 +99,11 @@ Datum		versionFunc(getModuleVersion) (PG_FUNCTION_ARGS);
 Datum		versionFunc(logTrigger) (PG_FUNCTION_ARGS);
 Datum		versionFunc(denyAccess) (PG_FUNCTION_ARGS);
 Datum		versionFunc(logApply) (PG_FUNCTION_ARGS);
+Datum		versionFunc(logApplyArchive) (PG_FUNCTION_ARGS);
 Datum		versionFunc(logApplySetCacheSize) (PG_FUNCTION_ARGS);
 Datum		versionFunc(logApplySaveStats) (PG_FUNCTION_ARGS);
 Datum		versionFunc(lockedSet) (PG_FUNCTION_ARGS);
+Datum		versionFunc(waitXmin) (PG_FUNCTION_ARGS);
 Datum		versionFunc(killBackend) (PG_FUNCTION_ARGS);
 Datum		versionFunc(seqtrack) (PG_FUNCTION_ARGS);
 
@@ -148,6 +154,8 @@ typedef struct slony_I_cluster_status
 	void	   *plan_table_info;
 	void	   *plan_apply_stats_update;
 	void	   *plan_apply_stats_insert;
+	void	   *plan_apply_table_stats_update;
+	void	   *plan_apply_table_stats_insert;
 
 	text	   *cmdtype_I;
 	text	   *cmdtype_U;
@@ -165,12 +173,30 @@ typedef struct slony_I_cluster_status
  */
 #define APPLY_CACHE_VERIFY
 
+/*
+ * Apply cache counters per replicated table. They outlive the cache
+ * entries of the table and are added to sl_apply_table_stats by
+ * logApplySaveStats().
+ */
+typedef struct apply_table_stats
+{
+	int32		tab_id;			/* hash key */
+	int64		num_prepare;
+	int64		num_hit;
+	int64		num_evict;
+	int64		num_inval;
+}	ApplyTableStats;
+
 typedef struct apply_cache_entry
 {
 	char	   *queryKey;
 
 	void	   *plan;
 	bool		forward;
+	TransactionId forwardXid;	/* transaction forward was looked up in */
+	Oid			relid;			/* target relation of the query */
+	bool		stale;			/* relation was invalidated since prepare */
+	ApplyTableStats *stats;
 	struct apply_cache_entry *prev;
 	struct apply_cache_entry *next;
 
@@ -191,9 +217,16 @@ static ApplyCacheEntry *applyCacheHead = NULL;
 static ApplyCacheEntry *applyCacheTail = NULL;
 static int	applyCacheSize = 100;
 static int	applyCacheUsed = 0;
+static bool applyCacheStale = false;
+static bool applyCacheArchive = false;
+static HTAB *applyTableStatsHash = NULL;
 
 static uint32 applyCache_hash(const void *kp, Size ksize);
 static int	applyCache_cmp(const void *kp1, const void *kp2, Size ksize);
+static void applyCache_relcache_cb(Datum arg, Oid relid);
+static void applyCacheEvict(ApplyCacheEntry * evict);
+static void applyCacheSweep(void);
+static void applyCacheFlush(void);
 
 static char *applyQuery = NULL;
 static char *applyQueryPos = NULL;
@@ -211,6 +244,14 @@ static int64 apply_num_prepare;
 static int64 apply_num_hit;
 static int64 apply_num_evict;
 
+/*
+ * Transaction the apply cache was built in when it is used by
+ * logApplyArchive(), which has no cluster status to keep it in.
+ */
+static TransactionId applyArchiveXid = InvalidTransactionId;
+
+static Datum logApply_int(FunctionCallInfo fcinfo, bool archive);
+
 
 /*@null@*/
 static Slony_I_ClusterStatus *clusterStatusList = NULL;
@@ -814,16 +855,14 @@ versionFunc(denyAccess) (PG_FUNCTION_ARGS)
 	if (tg->tg_trigger->tgnargs != 1)
 		elog(ERROR, "Slony-I: denyAccess() must be defined with 1 arg");
 
-	/*
-	 * Connect to the SPI manager
-	 */
-	if (SPI_connect() < 0)
-		elog(ERROR, "Slony-I: SPI_connect() failed in denyAccess()");
-
 	/*
 	 * If the replication role is: ORIGIN - default role --> FAIL REPLICA -
 	 * this trigger will not fire in --> N/A LOCAL - role when running "local
 	 * updates" --> PERMIT UPDATE
+	 *
+	 * This is all the trigger does, so it does not connect to the SPI
+	 * manager. Local updates of many rows on a subscriber pay no more
+	 * than the function call per row.
 	 */
 	if (SessionReplicationRole == SESSION_REPLICATION_ROLE_ORIGIN)
 		elog(ERROR,
@@ -831,7 +870,6 @@ versionFunc(denyAccess) (PG_FUNCTION_ARGS)
 			 "modified on a subscriber node - role=%d",
 		  NameStr(tg->tg_relation->rd_rel->relname), SessionReplicationRole);
 
-	SPI_finish();
 	if (TRIGGER_FIRED_BY_UPDATE(tg->tg_event))
 		return PointerGetDatum(tg->tg_newtuple);
 	else
@@ -841,9 +879,34 @@ versionFunc(denyAccess) (PG_FUNCTION_ARGS)
 
 Datum
 versionFunc(logApply) (PG_FUNCTION_ARGS)
+{
+	return logApply_int(fcinfo, false);
+}
+
+
+/*
+ * versionFunc(logApplyArchive)()
+ *
+ *	Apply trigger for sl_log_archive on a log shipping target. The
+ *	COPY of sl_log rows in an archive is applied through the same
+ *	apply query cache as on a subscriber, but nothing in the Slony-I
+ *	schema other than the trigger's table is needed. DDL is executed
+ *	regardless of its node list, rows are never kept and no apply
+ *	statistics are saved.
+ */
+Datum
+versionFunc(logApplyArchive) (PG_FUNCTION_ARGS)
+{
+	return logApply_int(fcinfo, true);
+}
+
+
+static Datum
+logApply_int(FunctionCallInfo fcinfo, bool archive)
 {
 	TransactionId newXid = GetTopTransactionId();
-	Slony_I_ClusterStatus *cs;
+	Slony_I_ClusterStatus *cs = NULL;
+	TransactionId *currentXid;
 	TriggerData *tg;
 	HeapTuple	new_row;
 	TupleDesc	tupdesc;
@@ -909,33 +972,30 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 	 */
 	cluster_name = DatumGetName(DirectFunctionCall1(namein,
 								CStringGetDatum(tg->tg_trigger->tgargs[0])));
-	cs = getClusterStatus(cluster_name, PLAN_APPLY_QUERIES);
+	if (archive)
+		currentXid = &applyArchiveXid;
+	else
+	{
+		cs = getClusterStatus(cluster_name, PLAN_APPLY_QUERIES);
+		currentXid = &(cs->currentXid);
+	}
 
 	/*
-	 * Do the following only once per transaction.
+	 * The apply cache is created once per session and kept across
+	 * transactions. Only a switch between log shipping and regular
+	 * replication throws it away.
 	 */
-	if (!TransactionIdEquals(cs->currentXid, newXid))
+	if (applyCacheHash == NULL)
 	{
 		HASHCTL		hctl;
 
-		/*
-		 * Free all prepared apply queries.
-		 */
-		for (cacheEnt = applyCacheHead; cacheEnt; cacheEnt = cacheEnt->next)
-		{
-			if (cacheEnt->plan != NULL)
-				SPI_freeplan(cacheEnt->plan);
-			cacheEnt->plan = NULL;
-		}
-		applyCacheHead = NULL;
-		applyCacheTail = NULL;
-		applyCacheUsed = 0;
+		applyCacheContext = AllocSetContextCreate(
+												  TopMemoryContext,
+												  "Slony-I apply query keys",
+												  ALLOCSET_DEFAULT_MINSIZE,
+												  ALLOCSET_DEFAULT_INITSIZE,
+												  ALLOCSET_DEFAULT_MAXSIZE);
 
-		/*
-		 * Destroy and recreate the hashtable for the apply cache
-		 */
-		if (applyCacheHash != NULL)
-			hash_destroy(applyCacheHash);
 		memset(&hctl, 0, sizeof(hctl));
 		hctl.keysize = sizeof(char *);
 		hctl.entrysize = sizeof(ApplyCacheEntry);
@@ -945,23 +1005,33 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 									 50, &hctl,
 								   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
 
+		memset(&hctl, 0, sizeof(hctl));
+		hctl.keysize = sizeof(int32);
+		hctl.entrysize = sizeof(ApplyTableStats);
+		hctl.hash = tag_hash;
+		applyTableStatsHash = hash_create("Slony-I apply table stats",
+										  50, &hctl,
+										  HASH_ELEM | HASH_FUNCTION);
+
 		/*
-		 * Reset or create the apply cache key memory context.
+		 * DDL replayed by us or executed by anyone else marks the cached
+		 * queries of the relations it touched stale through this callback.
 		 */
-		if (applyCacheContext == NULL)
-		{
-			applyCacheContext = AllocSetContextCreate(
-													  TopMemoryContext,
-												  "Slony-I apply query keys",
-													ALLOCSET_DEFAULT_MINSIZE,
-												   ALLOCSET_DEFAULT_INITSIZE,
-												   ALLOCSET_DEFAULT_MAXSIZE);
-		}
-		else
-		{
-			MemoryContextReset(applyCacheContext);
-		}
+		CacheRegisterRelcacheCallback(applyCache_relcache_cb, (Datum) 0);
 
+		applyCacheArchive = archive;
+	}
+	else if (applyCacheArchive != archive)
+	{
+		applyCacheFlush();
+		applyCacheArchive = archive;
+	}
+
+	/*
+	 * Do the following only once per transaction.
+	 */
+	if (!TransactionIdEquals(*currentXid, newXid))
+	{
 		/*
 		 * Reset statistic counters.
 		 */
@@ -974,7 +1044,7 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 		apply_num_hit = 0;
 		apply_num_evict = 0;
 
-		cs->currentXid = newXid;
+		*currentXid = newXid;
 	}
 
 	/*
@@ -1062,7 +1132,9 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 		}
 
 		/*
-		 * The first element is the DDL statement itself.
+		 * The first element is the DDL statement itself. A batch of
+		 * statements captured by ddlCaptureBatch() has the remaining ones
+		 * following the node and sequence lists.
 		 */
 		ddl_script = DatumGetCString(DirectFunctionCall1(
 													   textout, cmdargs[0]));
@@ -1070,7 +1142,7 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 		/*
 		 * If there is an optional node ID list, check that we are in it.
 		 */
-		if (nodeargsn > 0)
+		if (nodeargsn > 0 && !archive)
 		{
 			localNodeFound = false;
 			for (i = 0; i < nodeargsn; i++)
@@ -1102,18 +1174,23 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 			argtypes[1] = INT4OID;
 			argtypes[2] = INT8OID;
 
-			snprintf(query, 1023, "select \"%s\".sequenceSetValue($1," \
-					 "$2,NULL,$3,true); ", tg->tg_trigger->tgargs[0]);
-			plan = SPI_prepare(query, 3, argtypes);
-			if (plan == NULL)
+			if (!archive)
 			{
+				snprintf(query, 1023, "select \"%s\".sequenceSetValue($1," \
+						 "$2,NULL,$3,true); ", tg->tg_trigger->tgargs[0]);
+				plan = SPI_prepare(query, 3, argtypes);
+				if (plan == NULL)
+				{
 
-				elog(ERROR, "could not prepare plan to call sequenceSetValue");
+					elog(ERROR, "could not prepare plan to call sequenceSetValue");
+				}
 			}
 			/**
 			 * before we execute the DDL we need to update the sequences.
+			 * A log shipping target has no sequence IDs, the archive
+			 * sets its sequences by name.
 			 */
-			if (seqargsn > 0)
+			if (seqargsn > 0 && !archive)
 			{
 
 				for (i = 0; (i + 2) < seqargsn; i = i + 3)
@@ -1156,6 +1233,18 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 				elog(ERROR, "SPI_exec() failed for DDL statement '%s'",
 					 ddl_script);
 			}
+			for (i = 3; i < cmdargsn; i++)
+			{
+				if (cmdargsnulls[i])
+					continue;
+				ddl_script = DatumGetCString(DirectFunctionCall1(
+													   textout, cmdargs[i]));
+				if (SPI_exec(ddl_script, 0) < 0)
+				{
+					elog(ERROR, "SPI_exec() failed for DDL statement '%s'",
+						 ddl_script);
+				}
+			}
 
 			sprintf(query, "set session_replication_role to replica;");
 			if (SPI_exec(query, 0) < 0)
@@ -1165,15 +1254,21 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 			}
 
 			/*
-			 * Set the currentXid to invalid to flush the apply query cache.
+			 * The relcache callback has marked the cached queries of all
+			 * relations touched by the DDL stale. They are prepared again
+			 * on their next use, the rest of the apply cache stays valid.
 			 */
-			cs->currentXid = InvalidTransactionId;
 		}
 
 		/*
 		 * Build the parameters for the insert into sl_log_script and execute
-		 * the query.
+		 * the query. A log shipping target has no sl_log_script.
 		 */
+		if (archive)
+		{
+			SPI_finish();
+			return PointerGetDatum(NULL);
+		}
 		script_insert_args[0] = SPI_getbinval(new_row, tupdesc,
 								SPI_fnumber(tupdesc, "log_origin"), &isnull);
 		script_insert_args[1] = SPI_getbinval(new_row, tupdesc,
@@ -1204,6 +1299,15 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 
 		apply_num_script++;
 
+		/*
+		 * A log shipping target has no ddlScript_complete_int().
+		 */
+		if (archive)
+		{
+			SPI_finish();
+			return PointerGetDatum(NULL);
+		}
+
 		/*
 		 * Turn the log_cmdargs into a plain array of Text Datums.
 		 */
@@ -1253,11 +1357,10 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 					 query);
 			}
 
-
 			/*
-			 * Set the currentXid to invalid to flush the apply query cache.
+			 * Relations whose triggers were reconfigured are handled by
+			 * the relcache callback like above.
 			 */
-			cs->currentXid = InvalidTransactionId;
 		}
 
 		/*
@@ -1354,11 +1457,49 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 	cacheKey = pstrdup(applyQuery);
 	MemoryContextSwitchTo(oldContext);
 
+	/*
+	 * Throw away the queries of relations invalidated since their prepare.
+	 */
+	if (applyCacheStale)
+		applyCacheSweep();
+
 /*	elog(NOTICE, "looking for key=%s", cacheKey); */
 	cacheEnt = hash_search(applyCacheHash, &cacheKey, HASH_ENTER, &found);
+	if (found && cacheEnt->plan == NULL)
+	{
+		/*
+		 * An error in an earlier transaction interrupted preparing this
+		 * query. The entry keeps its own key, prepare it again. The miss
+		 * path below still uses cacheKey, so point it at that key.
+		 */
+		pfree(cacheKey);
+		cacheKey = cacheEnt->queryKey;
+		if (cacheEnt->finfo_input != NULL)
+			pfree(cacheEnt->finfo_input);
+		if (cacheEnt->typioparam != NULL)
+			pfree(cacheEnt->typioparam);
+		if (cacheEnt->typmod != NULL)
+			pfree(cacheEnt->typmod);
+#ifdef APPLY_CACHE_VERIFY
+		if (cacheEnt->verifyKey != NULL)
+			pfree(cacheEnt->verifyKey);
+#endif
+		found = false;
+	}
+	else if (!found)
+	{
+		cacheEnt->plan = NULL;
+		cacheEnt->finfo_input = NULL;
+		cacheEnt->typioparam = NULL;
+		cacheEnt->typmod = NULL;
+#ifdef APPLY_CACHE_VERIFY
+		cacheEnt->verifyKey = NULL;
+#endif
+	}
 	if (found)
 	{
 		apply_num_hit++;
+		cacheEnt->stats->num_hit++;
 
 		/* elog(NOTICE, "cache entry for %s found", cacheKey); */
 
@@ -1417,9 +1558,18 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 	}
 	else
 	{
-		Datum		query_args[2];
-
 		apply_num_prepare++;
+		cacheEnt->stats = hash_search(applyTableStatsHash, &tableid,
+									  HASH_ENTER, &found);
+		if (!found)
+		{
+			cacheEnt->stats->num_prepare = 0;
+			cacheEnt->stats->num_hit = 0;
+			cacheEnt->stats->num_evict = 0;
+			cacheEnt->stats->num_inval = 0;
+		}
+		cacheEnt->stats->num_prepare++;
+		cacheEnt->forwardXid = InvalidTransactionId;
 
 		/* elog(NOTICE, "cache entry for %s NOT found", cacheKey); */
 
@@ -1464,6 +1614,8 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 			elog(ERROR, "Slony-I: cannot find table %s.%s in logApply()",
 				 slon_quote_identifier(nspname),
 				 slon_quote_identifier(relname));
+		cacheEnt->relid = RelationGetRelid(target_rel);
+		cacheEnt->stale = false;
 
 		/*
 		 * Create the saved SPI plan for this query
@@ -1789,59 +1941,40 @@ versionFunc(logApply) (PG_FUNCTION_ARGS)
 		 */
 		if (applyCacheUsed > applyCacheSize)
 		{
-			ApplyCacheEntry *evict = applyCacheHead;
-
 			apply_num_evict++;
-
-			SPI_freeplan(evict->plan);
-			oldContext = MemoryContextSwitchTo(applyCacheContext);
-			pfree(evict->finfo_input);
-			pfree(evict->typioparam);
-			pfree(evict->typmod);
-			MemoryContextSwitchTo(oldContext);
-			evict->finfo_input = NULL;
-			evict->typioparam = NULL;
-			evict->typmod = NULL;
-			evict->plan = NULL;
-#ifdef APPLY_CACHE_VERIFY
-			evict->evicted = 1;
-#endif
-
-			if (evict->prev == NULL)
-				applyCacheHead = evict->next;
-			else
-				evict->prev->next = evict->next;
-			if (evict->next == NULL)
-				applyCacheTail = evict->prev;
-			else
-				evict->next->prev = evict->prev;
-
-			hash_search(applyCacheHash, &(evict->queryKey), HASH_REMOVE, &found);
-			if (!found)
-				elog(ERROR, "Slony-I: cached queries hash entry not found "
-					 "on evict");
-
-			applyCacheUsed--;
+			applyCacheHead->stats->num_evict++;
+			applyCacheEvict(applyCacheHead);
 		}
+	}
 
-		/*
-		 * We also need to determine if this table belongs to a set, that we
-		 * are a forwarder of.
-		 */
-		query_args[0] = SPI_getbinval(new_row, tupdesc,
-							   SPI_fnumber(tupdesc, "log_tableid"), &isnull);
-		query_args[1] = Int32GetDatum(cs->localNodeId);
+	/*
+	 * We also need to determine if this table belongs to a set, that we are
+	 * a forwarder of. Since the plan outlives the transaction, this is looked
+	 * up again once per transaction. Archive rows are never kept.
+	 */
+	if (!TransactionIdEquals(cacheEnt->forwardXid, newXid))
+	{
+		if (archive)
+			cacheEnt->forward = false;
+		else
+		{
+			Datum		query_args[2];
 
-		if (SPI_execp(cs->plan_table_info, query_args, NULL, 0) < 0)
-			elog(ERROR, "SPI_execp() failed for table forward lookup");
+			query_args[0] = Int32GetDatum(tableid);
+			query_args[1] = Int32GetDatum(cs->localNodeId);
 
-		if (SPI_processed != 1)
-			elog(ERROR, "forwarding lookup for table %d failed",
-				 DatumGetInt32(query_args[1]));
+			if (SPI_execp(cs->plan_table_info, query_args, NULL, 0) < 0)
+				elog(ERROR, "SPI_execp() failed for table forward lookup");
 
-		cacheEnt->forward = DatumGetBool(
+			if (SPI_processed != 1)
+				elog(ERROR, "forwarding lookup for table %d failed",
+					 tableid);
+
+			cacheEnt->forward = DatumGetBool(
 				  SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
 				SPI_fnumber(SPI_tuptable->tupdesc, "sub_forward"), &isnull));
+		}
+		cacheEnt->forwardXid = newXid;
 	}
 
 	/*
@@ -1982,6 +2115,8 @@ versionFunc(logApplySaveStats) (PG_FUNCTION_ARGS)
 	char	   *nulls = "           ";
 	int32		rc = 0;
 	int			spi_rc;
+	HASH_SEQ_STATUS hseq;
+	ApplyTableStats *tstats;
 
 	if (!superuser())
 		elog(ERROR, "Slony-I: insufficient privilege logApplySetCacheSize");
@@ -2036,6 +2171,42 @@ versionFunc(logApplySaveStats) (PG_FUNCTION_ARGS)
 			rc = 1;
 	}
 
+	/*
+	 * Add the apply cache counters of the individual tables to
+	 * sl_apply_table_stats.
+	 */
+	if (applyTableStatsHash != NULL)
+	{
+		hash_seq_init(&hseq, applyTableStatsHash);
+		while ((tstats = (ApplyTableStats *) hash_seq_search(&hseq)) != NULL)
+		{
+			if (tstats->num_prepare == 0 && tstats->num_hit == 0 &&
+				tstats->num_evict == 0 && tstats->num_inval == 0)
+				continue;
+
+			params[1] = Int32GetDatum(tstats->tab_id);
+			params[2] = Int64GetDatum(tstats->num_prepare);
+			params[3] = Int64GetDatum(tstats->num_hit);
+			params[4] = Int64GetDatum(tstats->num_evict);
+			params[5] = Int64GetDatum(tstats->num_inval);
+
+			if ((spi_rc = SPI_execp(cs->plan_apply_table_stats_update,
+									params, nulls, 0)) < 0)
+				elog(ERROR, "Slony-I: SPI_execp() to update apply table "
+					 "stats failed - rc=%d", spi_rc);
+			if (SPI_processed == 0 &&
+				(spi_rc = SPI_execp(cs->plan_apply_table_stats_insert,
+									params, nulls, 0)) < 0)
+				elog(ERROR, "Slony-I: SPI_execp() to insert apply table "
+					 "stats failed - rc=%d", spi_rc);
+
+			tstats->num_prepare = 0;
+			tstats->num_hit = 0;
+			tstats->num_evict = 0;
+			tstats->num_inval = 0;
+		}
+	}
+
 	/*
 	 * Reset statistic counters.
 	 */
@@ -2075,6 +2246,107 @@ applyCache_cmp(const void *kp1, const void *kp2, Size ksize)
 }
 
 
+/*
+ * Relcache invalidation callback. Marks the cached queries of the
+ * relation, or all of them on a cache reset, so that they are thrown away
+ * before the next lookup. This runs while invalidation messages are
+ * processed, so it must not touch the catalog or free the plans itself.
+ */
+static void
+applyCache_relcache_cb(Datum arg, Oid relid)
+{
+	ApplyCacheEntry *cacheEnt;
+
+	for (cacheEnt = applyCacheHead; cacheEnt; cacheEnt = cacheEnt->next)
+	{
+		if (relid == InvalidOid || cacheEnt->relid == relid)
+		{
+			cacheEnt->stale = true;
+			applyCacheStale = true;
+		}
+	}
+}
+
+
+/*
+ * Remove one entry from the apply cache and free its plan.
+ */
+static void
+applyCacheEvict(ApplyCacheEntry * evict)
+{
+	MemoryContext oldContext;
+	char	   *queryKey = evict->queryKey;
+	bool		found;
+
+	SPI_freeplan(evict->plan);
+	oldContext = MemoryContextSwitchTo(applyCacheContext);
+	pfree(evict->finfo_input);
+	pfree(evict->typioparam);
+	pfree(evict->typmod);
+	MemoryContextSwitchTo(oldContext);
+	evict->finfo_input = NULL;
+	evict->typioparam = NULL;
+	evict->typmod = NULL;
+	evict->plan = NULL;
+#ifdef APPLY_CACHE_VERIFY
+	evict->evicted = 1;
+	pfree(evict->verifyKey);
+	evict->verifyKey = NULL;
+#endif
+
+	if (evict->prev == NULL)
+		applyCacheHead = evict->next;
+	else
+		evict->prev->next = evict->next;
+	if (evict->next == NULL)
+		applyCacheTail = evict->prev;
+	else
+		evict->next->prev = evict->prev;
+
+	hash_search(applyCacheHash, &queryKey, HASH_REMOVE, &found);
+	if (!found)
+		elog(ERROR, "Slony-I: cached queries hash entry not found "
+			 "on evict");
+	pfree(queryKey);
+
+	applyCacheUsed--;
+}
+
+
+/*
+ * Evict all entries marked stale by applyCache_relcache_cb().
+ */
+static void
+applyCacheSweep(void)
+{
+	ApplyCacheEntry *cacheEnt;
+	ApplyCacheEntry *next;
+
+	for (cacheEnt = applyCacheHead; cacheEnt; cacheEnt = next)
+	{
+		next = cacheEnt->next;
+		if (cacheEnt->stale)
+		{
+			cacheEnt->stats->num_inval++;
+			applyCacheEvict(cacheEnt);
+		}
+	}
+	applyCacheStale = false;
+}
+
+
+/*
+ * Evict all entries of the apply cache.
+ */
+static void
+applyCacheFlush(void)
+{
+	while (applyCacheHead != NULL)
+		applyCacheEvict(applyCacheHead);
+	applyCacheStale = false;
+}
+
+
 static void
 applyQueryReset(void)
 {
@@ -2136,6 +2408,67 @@ versionFunc(lockedSet) (PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * waitXmin(xmax)
+ *
+ *	Wait until all transactions that were in progress below the txid
+ *	xmax have ended, i.e. until the xmin of a new snapshot is >= xmax.
+ *	The backend sleeps on the transaction locks and wakes up the moment
+ *	the last one commits or aborts. Returns the number of transactions
+ *	waited for.
+ */
+Datum
+versionFunc(waitXmin) (PG_FUNCTION_ARGS)
+{
+	int64		xmax = PG_GETARG_INT64(0);
+	int64	   *xids;
+	int			nxids;
+	int			rc;
+	int			i;
+
+	if ((rc = SPI_connect()) < 0)
+		elog(ERROR, "Slony-I: SPI_connect() failed in waitXmin()");
+
+	if (SPI_exec("select pg_catalog.txid_snapshot_xip("
+				 "pg_catalog.txid_current_snapshot()); ", 0) != SPI_OK_SELECT)
+		elog(ERROR, "Slony-I: cannot read the current snapshot in waitXmin()");
+
+	/*
+	 * The list must survive SPI_finish(), so allocate it in the caller's
+	 * memory context.
+	 */
+	xids = (int64 *) SPI_palloc(sizeof(int64) * (SPI_processed + 1));
+	nxids = 0;
+	for (i = 0; i < (int) SPI_processed; i++)
+	{
+		bool		isnull;
+		int64		xid;
+
+		xid = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[i],
+										  SPI_tuptable->tupdesc, 1, &isnull));
+		if (!isnull && xid < xmax)
+			xids[nxids++] = xid;
+	}
+	SPI_finish();
+
+	/*
+	 * A txid is the epoch shifted left by 32 bits plus the xid.
+	 */
+	for (i = 0; i < nxids; i++)
+	{
+#if PG_VERSION_NUM >= 90400
+		XactLockTableWait((TransactionId) (xids[i] & 0xFFFFFFFF),
+						  NULL, NULL, XLTW_None);
+#else
+		XactLockTableWait((TransactionId) (xids[i] & 0xFFFFFFFF));
+#endif
+	}
+	pfree(xids);
+
+	PG_RETURN_INT32(nxids);
+}
+
+
 Datum
 versionFunc(killBackend) (PG_FUNCTION_ARGS)
 {
@@ -2659,6 +2992,45 @@ getClusterStatus(Name cluster_name, int need_plan_mask)
 		if (cs->plan_apply_stats_insert == NULL)
 			elog(ERROR, "Slony-I: SPI_prepare() failed");
 
+		/*
+		 * The plans to update or insert the per table apply cache stats
+		 */
+		sprintf(query,
+				"update %s.sl_apply_table_stats set "
+				" ats_cache_prepare = ats_cache_prepare + $3, "
+				" ats_cache_hit = ats_cache_hit + $4, "
+				" ats_cache_evict = ats_cache_evict + $5, "
+				" ats_cache_inval = ats_cache_inval + $6, "
+				" ats_apply_last = \"pg_catalog\".timeofday()::timestamptz "
+				" where ats_origin = $1 and ats_tab_id = $2;",
+				slon_quote_identifier(NameStr(*cluster_name)));
+
+		plan_types[0] = INT4OID;
+		plan_types[1] = INT4OID;
+		plan_types[2] = INT8OID;
+		plan_types[3] = INT8OID;
+		plan_types[4] = INT8OID;
+		plan_types[5] = INT8OID;
+
+		cs->plan_apply_table_stats_update = SPI_saveplan(
+										  SPI_prepare(query, 6, plan_types));
+		if (cs->plan_apply_table_stats_update == NULL)
+			elog(ERROR, "Slony-I: SPI_prepare() failed");
+
+		sprintf(query,
+				"insert into %s.sl_apply_table_stats ("
+				" ats_origin, ats_tab_id, ats_cache_prepare, ats_cache_hit, "
+				" ats_cache_evict, ats_cache_inval, ats_apply_last) "
+				"values "
+				"($1, $2, $3, $4, $5, $6, "
+				"\"pg_catalog\".timeofday()::timestamptz);",
+				slon_quote_identifier(NameStr(*cluster_name)));
+
+		cs->plan_apply_table_stats_insert = SPI_saveplan(
+										  SPI_prepare(query, 6, plan_types));
+		if (cs->plan_apply_table_stats_insert == NULL)
+			elog(ERROR, "Slony-I: SPI_prepare() failed");
+
 		cs->have_plan |= PLAN_APPLY_QUERIES;
 	}
 
@@ -122,13 +122,14 @@ Create an sl_event entry';
 -- FUNCTION denyAccess ()
 --
 --	Trigger function to prevent modifications to a table on
---	a subscriber.
+--	a subscriber. It only looks at session_replication_role, so it
+--	is not security definer, which would cost a GUC save/restore on
+--	every row.
 -- ----------------------------------------------------------------------
 create or replace function @NAMESPACE@.denyAccess ()
 	returns trigger
 	as '$libdir/slony1_funcs.@MODULEVERSION@', '_Slony_I_@FUNCVERSION@_denyAccess'
-	language C
-	security definer;
+	language C;
 
 comment on function @NAMESPACE@.denyAccess () is 
   'Trigger function to prevent modifications to a table on a subscriber';
@@ -150,6 +151,20 @@ create or replace function @NAMESPACE@.lockedSet ()
 comment on function @NAMESPACE@.lockedSet () is 
   'Trigger function to prevent modifications to a table before and after a moveSet()';
 
+-- ----------------------------------------------------------------------
+-- FUNCTION waitXmin (xmax)
+--
+--	Wait until no transaction below the txid xmax is in progress any
+--	more. Used by LOCK SET after lockSet().
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.waitXmin (p_xmax int8)
+	returns int4
+	as '$libdir/slony1_funcs.@MODULEVERSION@', '_Slony_I_@FUNCVERSION@_waitXmin'
+	language C;
+
+comment on function @NAMESPACE@.waitXmin (p_xmax int8) is 
+  'Wait until all transactions below the given txid have ended, blocking on their locks instead of polling';
+
 -- ----------------------------------------------------------------------
 -- FUNCTION getLocalNodeId (name)
 --
@@ -209,8 +224,8 @@ returns int4
 -- ----------------------------------------------------------------------
 -- FUNCTION logApplySaveStats ()
 --
---	A function used by the remote worker to update sl_apply_stats after
---	performing a SYNC.
+--	A function used by the remote worker to update sl_apply_stats and
+--	sl_apply_table_stats after performing a SYNC.
 -- ----------------------------------------------------------------------
 create or replace function @NAMESPACE@.logApplySaveStats (p_cluster name, p_origin int4, p_duration interval) 
 returns int4
@@ -2949,6 +2964,75 @@ This function processes the SET_ADD_TABLE event on remote nodes,
 adding a table to replication if the remote node is subscribing to its
 replication set.';
 
+-- ----------------------------------------------------------------------
+-- FUNCTION setAddTables (set_id, tab_ids, tab_fqnames, tab_idxnames,
+--					tab_comments)
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.setAddTables(p_set_id int4, p_tab_ids int4[], p_fqnames text[], p_tab_idxnames name[], p_tab_comments text[])
+returns bigint
+as $$
+declare
+	v_set_origin		int4;
+	v_idx				integer;
+begin
+	-- ----
+	-- Grab the central configuration lock
+	-- ----
+	lock table @NAMESPACE@.sl_config_lock;
+
+	-- ----
+	-- Check that we are the origin of the set
+	-- ----
+	select set_origin into v_set_origin
+			from @NAMESPACE@.sl_set
+			where set_id = p_set_id;
+	if not found then
+		raise exception 'Slony-I: setAddTables(): set % not found', p_set_id;
+	end if;
+	if v_set_origin != @NAMESPACE@.getLocalNodeId('_@CLUSTERNAME@') then
+		raise exception 'Slony-I: setAddTables(): set % has remote origin', p_set_id;
+	end if;
+
+	if exists (select true from @NAMESPACE@.sl_subscribe
+			where sub_set = p_set_id)
+	then
+		raise exception 'Slony-I: cannot add table to currently subscribed set % - must attach to an unsubscribed set',
+				p_set_id;
+	end if;
+
+	if array_upper(p_fqnames, 1) is distinct from array_upper(p_tab_ids, 1) or
+		array_upper(p_tab_idxnames, 1) is distinct from array_upper(p_tab_ids, 1) or
+		array_upper(p_tab_comments, 1) is distinct from array_upper(p_tab_ids, 1)
+	then
+		raise exception 'Slony-I: setAddTables(): argument arrays differ in length';
+	end if;
+
+	-- ----
+	-- Add all the tables to the set and generate a single
+	-- SET_ADD_TABLES event for them
+	-- ----
+	v_idx := 1;
+	LOOP
+		EXIT WHEN v_idx > coalesce(array_upper(p_tab_ids, 1), 0);
+		perform @NAMESPACE@.setAddTable_int(p_set_id, p_tab_ids[v_idx],
+				p_fqnames[v_idx], p_tab_idxnames[v_idx],
+				p_tab_comments[v_idx]);
+		v_idx := v_idx + 1;
+	END LOOP;
+	return  @NAMESPACE@.createEvent('_@CLUSTERNAME@', 'SET_ADD_TABLES',
+			p_set_id::text, array_to_string(p_tab_ids, ','),
+			p_fqnames::text, p_tab_idxnames::text, p_tab_comments::text);
+end;
+$$ language plpgsql;
+comment on function @NAMESPACE@.setAddTables(p_set_id int4, p_tab_ids int4[], p_fqnames text[], p_tab_idxnames name[], p_tab_comments text[]) is
+'setAddTables (set_id, tab_ids, tab_fqnames, tab_idxnames, tab_comments)
+
+Add the tables tab_fqnames to replication set on origin node, like
+setAddTable() does for each of them, but generate only one
+SET_ADD_TABLES event for all of them.
+
+Note that the table ids, tab_ids, must be unique ACROSS ALL SETS.';
+
 -- ----------------------------------------------------------------------
 -- FUNCTION setDropTable (tab_id)
 -- ----------------------------------------------------------------------
@@ -3226,6 +3310,70 @@ comment on function @NAMESPACE@.setAddSequence_int(p_set_id int4, p_seq_id int4,
 This processes the SET_ADD_SEQUENCE event.  On remote nodes that
 subscribe to set_id, add the sequence to the replication set.';
 
+-- ----------------------------------------------------------------------
+-- FUNCTION setAddSequences (set_id, seq_ids, seq_fqnames, seq_comments)
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.setAddSequences (p_set_id int4, p_seq_ids int4[], p_fqnames text[], p_seq_comments text[])
+returns bigint
+as $$
+declare
+	v_set_origin		int4;
+	v_idx				integer;
+begin
+	-- ----
+	-- Grab the central configuration lock
+	-- ----
+	lock table @NAMESPACE@.sl_config_lock;
+
+	-- ----
+	-- Check that we are the origin of the set
+	-- ----
+	select set_origin into v_set_origin
+			from @NAMESPACE@.sl_set
+			where set_id = p_set_id;
+	if not found then
+		raise exception 'Slony-I: setAddSequences(): set % not found', p_set_id;
+	end if;
+	if v_set_origin != @NAMESPACE@.getLocalNodeId('_@CLUSTERNAME@') then
+		raise exception 'Slony-I: setAddSequences(): set % has remote origin - submit to origin node', p_set_id;
+	end if;
+
+	if exists (select true from @NAMESPACE@.sl_subscribe
+			where sub_set = p_set_id)
+	then
+		raise exception 'Slony-I: cannot add sequence to currently subscribed set %',
+				p_set_id;
+	end if;
+
+	if array_upper(p_fqnames, 1) is distinct from array_upper(p_seq_ids, 1) or
+		array_upper(p_seq_comments, 1) is distinct from array_upper(p_seq_ids, 1)
+	then
+		raise exception 'Slony-I: setAddSequences(): argument arrays differ in length';
+	end if;
+
+	-- ----
+	-- Add all the sequences to the set and generate a single
+	-- SET_ADD_SEQUENCES event for them
+	-- ----
+	v_idx := 1;
+	LOOP
+		EXIT WHEN v_idx > coalesce(array_upper(p_seq_ids, 1), 0);
+		perform @NAMESPACE@.setAddSequence_int(p_set_id, p_seq_ids[v_idx],
+				p_fqnames[v_idx], p_seq_comments[v_idx]);
+		v_idx := v_idx + 1;
+	END LOOP;
+	return  @NAMESPACE@.createEvent('_@CLUSTERNAME@', 'SET_ADD_SEQUENCES',
+						p_set_id::text, array_to_string(p_seq_ids, ','),
+						p_fqnames::text, p_seq_comments::text);
+end;
+$$ language plpgsql;
+comment on function @NAMESPACE@.setAddSequences (p_set_id int4, p_seq_ids int4[], p_fqnames text[], p_seq_comments text[]) is
+'setAddSequences (set_id, seq_ids, seq_fqnames, seq_comments)
+
+On the origin node for set set_id, add the sequences seq_fqnames to the
+replication set like setAddSequence() does for each of them, but raise
+only one SET_ADD_SEQUENCES event for all of them.';
+
 -- ----------------------------------------------------------------------
 -- FUNCTION setDropSequence (seq_id)
 -- ----------------------------------------------------------------------
@@ -3645,6 +3793,22 @@ Set sequence seq_id to have new value last_value.
 create or replace function @NAMESPACE@.ddlCapture (p_statement text, p_nodes text)
 returns bigint
 as $$
+begin
+	return @NAMESPACE@.ddlCaptureBatch(array[p_statement], p_nodes);
+end;
+$$ language plpgsql;
+
+comment on function @NAMESPACE@.ddlCapture (p_statement text, p_nodes text) is
+'Capture an SQL statement (usually DDL) that is to be literally replayed on subscribers';
+
+-- ----------------------------------------------------------------------
+-- FUNCTION ddlCaptureBatch (statements, nodes)
+--
+--	Capture a series of DDL statements into one sl_log_script row
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.ddlCaptureBatch (p_statements text[], p_nodes text)
+returns bigint
+as $$
 declare
 	c_local_node	integer;
 	c_found_origin	boolean;
@@ -3652,10 +3816,15 @@ declare
 	c_cmdargs		text[];
 	c_nodeargs      text;
 	c_delim         text;
+	v_idx			int4;
 begin
+	if p_statements is null or array_upper(p_statements, 1) is null then
+		return NULL;
+	end if;
 	c_local_node := @NAMESPACE@.getLocalNodeId('_@CLUSTERNAME@');
 
-	c_cmdargs = array_append('{}'::text[], p_statement);
+	c_cmdargs = array_append('{}'::text[],
+				p_statements[array_lower(p_statements, 1)]);
 	c_nodeargs = '';
 	if p_nodes is not null then
 		c_found_origin := 'f';
@@ -3667,7 +3836,7 @@ begin
 					(select 1 from @NAMESPACE@.sl_node 
 					where no_id = (c_node::integer)) then
 				raise exception 'ddlcapture(%,%) - node % does not exist!', 
-					p_statement, p_nodes, c_node;
+					c_cmdargs[1], p_nodes, c_node;
 		   end if;
 
 		   if c_local_node = (c_node::integer) then
@@ -3683,7 +3852,7 @@ begin
 		if not c_found_origin then
 			raise exception 
 				'ddlcapture(%,%) - origin node % not included in ONLY ON list!',
-				p_statement, p_nodes, c_local_node;
+				c_cmdargs[1], p_nodes, c_local_node;
        end if;
     end if;
 	c_cmdargs = array_append(c_cmdargs,c_nodeargs);
@@ -3698,18 +3867,28 @@ begin
            	   seq_last_value from @NAMESPACE@.sl_seqlastvalue
            	   where seq_origin = c_local_node) as FOO
 			where NOT @NAMESPACE@.seqtrack(seq_id,seq_last_value) is NULL));
+
+	-- Statements after the first one follow the node and sequence lists
+	for v_idx in array_lower(p_statements, 1) + 1 .. array_upper(p_statements, 1) loop
+		c_cmdargs = array_append(c_cmdargs, p_statements[v_idx]);
+	end loop;
 	insert into @NAMESPACE@.sl_log_script
 			(log_origin, log_txid, log_actionseq, log_cmdtype, log_cmdargs)
 		values 
 			(c_local_node, pg_catalog.txid_current(), 
 			nextval('@NAMESPACE@.sl_action_seq'), 'S', c_cmdargs);
-	execute p_statement;
+	for v_idx in array_lower(p_statements, 1) .. array_upper(p_statements, 1) loop
+		execute p_statements[v_idx];
+	end loop;
 	return currval('@NAMESPACE@.sl_action_seq');
 end;
 $$ language plpgsql;
 
-comment on function @NAMESPACE@.ddlCapture (p_statement text, p_nodes text) is
-'Capture an SQL statement (usually DDL) that is to be literally replayed on subscribers';
+comment on function @NAMESPACE@.ddlCaptureBatch (p_statements text[], p_nodes text) is
+'Capture and execute a series of SQL statements, one after the other.
+They are logged as a single sl_log_script row, which subscribers replay
+in one go.  This lets slonik submit many statements of an EXECUTE
+SCRIPT in one round trip.';
 
 
 -- ----------------------------------------------------------------------
@@ -4772,7 +4951,9 @@ begin
 	loop
 		delete from @NAMESPACE@.sl_seqlog where seql_origin = v_origin and seql_ev_seqno < v_seqno;
 		delete from @NAMESPACE@.sl_log_script where log_origin = v_origin and log_txid < v_xmin;
+		delete from @NAMESPACE@.sl_log_fetch where lf_origin = v_origin and lf_seqno < v_seqno;
     end loop;
+	perform @NAMESPACE@.logFetchSwitch();
 	
 	v_rc := @NAMESPACE@.logswitch_finish();
 	if v_rc = 0 then   -- no switch in progress
@@ -5485,6 +5666,431 @@ return values:
 ';
 
 
+-- ----------------------------------------------------------------------
+-- FUNCTION logSelect (origin, tab_ids, min_txid, max_txid, snapshot,
+--						last_snapshot, actionseq_qual)
+--
+--	Called by the remote worker of a subscriber on its data provider
+--	to select the log rows of one set for a SYNC.
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.logSelect(p_origin int4, p_tab_ids int4[], p_min_txid bigint, p_max_txid bigint, p_snapshot "pg_catalog".txid_snapshot, p_last_snapshot "pg_catalog".txid_snapshot, p_actionseq_qual text)
+returns setof @NAMESPACE@.sl_log_1
+as $$
+declare
+	v_log_status		int4;
+	v_log_no			int4;
+	v_query				text;
+	v_row				record;
+begin
+	-- ----
+	-- sl_log_1 is in use when log_status is 0 and sl_log_2 when it
+	-- is 1. During a log switch (2 or 3) both are.
+	-- ----
+	select last_value into v_log_status from @NAMESPACE@.sl_log_status;
+
+	if p_actionseq_qual is null then
+		-- ----
+		-- The rows of transactions that started after the last
+		-- snapshot and are visible in this one, plus the rows of those
+		-- in progress at the last snapshot that committed since.
+		-- ----
+		if v_log_status <> 1 then
+			return query
+				select log_origin, log_txid, log_tableid, log_actionseq,
+						log_tablenspname, log_tablerelname, log_cmdtype,
+						log_cmdupdncols, log_cmdargs
+					from @NAMESPACE@.sl_log_1
+					where log_origin = p_origin
+						and log_tableid = any (p_tab_ids)
+						and log_txid >= p_min_txid
+						and log_txid < p_max_txid
+						and "pg_catalog".txid_visible_in_snapshot(log_txid, p_snapshot)
+				union all
+				select log_origin, log_txid, log_tableid, log_actionseq,
+						log_tablenspname, log_tablerelname, log_cmdtype,
+						log_cmdupdncols, log_cmdargs
+					from @NAMESPACE@.sl_log_1
+					where log_origin = p_origin
+						and log_tableid = any (p_tab_ids)
+						and log_txid in (
+							select * from "pg_catalog".txid_snapshot_xip(p_last_snapshot)
+							except
+							select * from "pg_catalog".txid_snapshot_xip(p_snapshot));
+		end if;
+		if v_log_status <> 0 then
+			return query
+				select log_origin, log_txid, log_tableid, log_actionseq,
+						log_tablenspname, log_tablerelname, log_cmdtype,
+						log_cmdupdncols, log_cmdargs
+					from @NAMESPACE@.sl_log_2
+					where log_origin = p_origin
+						and log_tableid = any (p_tab_ids)
+						and log_txid >= p_min_txid
+						and log_txid < p_max_txid
+						and "pg_catalog".txid_visible_in_snapshot(log_txid, p_snapshot)
+				union all
+				select log_origin, log_txid, log_tableid, log_actionseq,
+						log_tablenspname, log_tablerelname, log_cmdtype,
+						log_cmdupdncols, log_cmdargs
+					from @NAMESPACE@.sl_log_2
+					where log_origin = p_origin
+						and log_tableid = any (p_tab_ids)
+						and log_txid in (
+							select * from "pg_catalog".txid_snapshot_xip(p_last_snapshot)
+							except
+							select * from "pg_catalog".txid_snapshot_xip(p_snapshot));
+		end if;
+		return;
+	end if;
+
+	-- ----
+	-- The first SYNC after a subscription must skip the actions that
+	-- were already copied. That qualification is only known as query
+	-- text, so these queries are planned every time.
+	-- ----
+	for v_log_no in 1..2 loop
+		if (v_log_no = 1 and v_log_status <> 1) or
+			(v_log_no = 2 and v_log_status <> 0)
+		then
+			v_query := 'select log_origin, log_txid, log_tableid, ' ||
+				'log_actionseq, log_tablenspname, log_tablerelname, ' ||
+				'log_cmdtype, log_cmdupdncols, log_cmdargs ' ||
+				'from @NAMESPACE@.sl_log_' || v_log_no::text ||
+				' where log_origin = ' || p_origin::text ||
+				' and log_tableid = any (' ||
+				pg_catalog.quote_literal(p_tab_ids::text) || '::int4[])';
+			v_query := v_query ||
+				' and log_txid >= ' || p_min_txid::text ||
+				' and log_txid < ' || p_max_txid::text ||
+				' and "pg_catalog".txid_visible_in_snapshot(log_txid, ' ||
+				pg_catalog.quote_literal(p_snapshot::text) || ')' ||
+				' and (' || p_actionseq_qual || ')';
+			for v_row in execute v_query loop
+				return next v_row;
+			end loop;
+
+			v_query := 'select log_origin, log_txid, log_tableid, ' ||
+				'log_actionseq, log_tablenspname, log_tablerelname, ' ||
+				'log_cmdtype, log_cmdupdncols, log_cmdargs ' ||
+				'from @NAMESPACE@.sl_log_' || v_log_no::text ||
+				' where log_origin = ' || p_origin::text ||
+				' and log_tableid = any (' ||
+				pg_catalog.quote_literal(p_tab_ids::text) || '::int4[])';
+			v_query := v_query ||
+				' and log_txid in (select * from ' ||
+				'"pg_catalog".txid_snapshot_xip(' ||
+				pg_catalog.quote_literal(p_last_snapshot::text) || ') ' ||
+				'except select * from "pg_catalog".txid_snapshot_xip(' ||
+				pg_catalog.quote_literal(p_snapshot::text) || '))' ||
+				' and (' || p_actionseq_qual || ')';
+			for v_row in execute v_query loop
+				return next v_row;
+			end loop;
+		end if;
+	end loop;
+	return;
+end;
+$$ language plpgsql;
+comment on function @NAMESPACE@.logSelect(p_origin int4, p_tab_ids int4[], p_min_txid bigint, p_max_txid bigint, p_snapshot "pg_catalog".txid_snapshot, p_last_snapshot "pg_catalog".txid_snapshot, p_actionseq_qual text) is
+'logSelect (origin, tab_ids, min_txid, max_txid, snapshot, last_snapshot, actionseq_qual)
+
+Returns the log rows of origin for the tables tab_ids that a SYNC with
+the given snapshot covers since last_snapshot, whose xmax is min_txid.
+The log tables to read are chosen by sl_log_status. actionseq_qual is
+an additional qualification on log_actionseq, or NULL. Without it the
+queries are planned only once per session.';
+
+-- ----------------------------------------------------------------------
+-- FUNCTION setup_log_fetch_tables ()
+--
+--	Run as part of loading slony1_funcs.sql. Creates the tables that
+--	hold the log slices shared by subscribers using sync_shared_fetch.
+--	They are unlogged where the server supports it, since a slice can
+--	always be materialized again from sl_log_1/sl_log_2.
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.setup_log_fetch_tables () returns integer as $$
+declare
+	v_create		text;
+	v_log_no		int4;
+begin
+	if exists (select 1 from "pg_catalog".pg_class c, "pg_catalog".pg_namespace n
+			where n.nspname = '_@CLUSTERNAME@' and c.relnamespace = n.oid
+			and c.relname = 'sl_log_fetch') then
+		return 0;
+	end if;
+
+	if "pg_catalog".current_setting('server_version_num')::int4 >= 90100 then
+		v_create := 'create unlogged table ';
+	else
+		v_create := 'create table ';
+	end if;
+
+	execute v_create || '@NAMESPACE@.sl_log_fetch (
+			lf_origin			int4,
+			lf_seqno			int8,
+			lf_table			int4,
+			lf_tables			int4[],
+			lf_timestamp		timestamptz,
+
+			CONSTRAINT "sl_log_fetch-pkey"
+				PRIMARY KEY (lf_origin, lf_seqno)
+		) WITHOUT OIDS;';
+	for v_log_no in 1..2 loop
+		execute v_create || '@NAMESPACE@.sl_log_fetch_' || v_log_no::text || ' (
+				lf_seqno			int8,
+				log_origin			int4,
+				log_txid			bigint,
+				log_tableid			int4,
+				log_actionseq		int8,
+				log_tablenspname	text,
+				log_tablerelname	text,
+				log_cmdtype			"char",
+				log_cmdupdncols		int4,
+				log_cmdargs			text[]
+			) WITHOUT OIDS;';
+		execute 'create index sl_log_fetch_' || v_log_no::text ||
+				'_idx1 on @NAMESPACE@.sl_log_fetch_' || v_log_no::text ||
+				' (log_origin, lf_seqno);';
+	end loop;
+	execute 'create sequence @NAMESPACE@.sl_log_fetch_status minvalue 1 maxvalue 2;';
+
+	execute 'comment on table @NAMESPACE@.sl_log_fetch is ''One row per log slice materialized in sl_log_fetch_1 or sl_log_fetch_2 for subscribers using sync_shared_fetch'';';
+	execute 'comment on column @NAMESPACE@.sl_log_fetch.lf_seqno is ''The SYNC event of lf_origin whose log rows the slice holds'';';
+	execute 'comment on column @NAMESPACE@.sl_log_fetch.lf_table is ''The table (1 or 2) that holds the slice, sl_log_fetch_1 or sl_log_fetch_2'';';
+	execute 'comment on column @NAMESPACE@.sl_log_fetch.lf_tables is ''The IDs of the tables whose log rows the slice holds'';';
+	execute 'comment on sequence @NAMESPACE@.sl_log_fetch_status is ''The sl_log_fetch table (1 or 2) new slices go into. logFetchSwitch() truncates the other one once it holds no slice anymore.'';';
+	return 1;
+end
+$$ language plpgsql;
+
+comment on function @NAMESPACE@.setup_log_fetch_tables () is 
+'Function to be run as part of loading slony1_funcs.sql that creates sl_log_fetch, sl_log_fetch_1, sl_log_fetch_2 and sl_log_fetch_status if they are missing';
+
+select @NAMESPACE@.setup_log_fetch_tables();
+
+drop function @NAMESPACE@.setup_log_fetch_tables ();
+
+-- ----------------------------------------------------------------------
+-- FUNCTION logFetchPrepare (origin, receiver, first_seqno,
+--						first_snapshot, last_seqno)
+--
+--	Called outside of a transaction by the remote worker of a
+--	subscriber using sync_shared_fetch. Materializes the log rows of
+--	every SYNC of origin after first_seqno up to last_seqno that no
+--	other subscriber materialized yet, one slice per SYNC. Returns the
+--	number of slices, or 0 if the subscriber must use logSelect().
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.logFetchPrepare(p_origin int4, p_receiver int4, p_first_seqno int8, p_first_snapshot "pg_catalog".txid_snapshot, p_last_seqno int8)
+returns int4
+as $$
+declare
+	v_local_node_id		int4;
+	v_readers			int4;
+	v_tables			int4[];
+	v_need				int4[];
+	v_lf_tables			int4[];
+	v_fetch_no			int4;
+	v_log_status		int4;
+	v_log_no			int4;
+	v_prev_snapshot		"pg_catalog".txid_snapshot;
+	v_created			boolean;
+	v_usable			boolean;
+	v_slices			int4;
+	v_query				text;
+	v_ev				record;
+begin
+	v_local_node_id := @NAMESPACE@.getLocalNodeId('_@CLUSTERNAME@');
+
+	-- ----
+	-- A slice only pays off if more than one subscriber reads it.
+	-- ----
+	select count(distinct sub_receiver) into v_readers
+			from @NAMESPACE@.sl_subscribe, @NAMESPACE@.sl_set
+			where set_id = sub_set and set_origin = p_origin
+				and sub_provider = v_local_node_id and sub_active;
+	if v_readers < 2 then
+		return 0;
+	end if;
+
+	-- ----
+	-- The slices chain the snapshots of consecutive SYNC events, so
+	-- the receiver must be synced to exactly the first one of them.
+	-- ----
+	select ev_snapshot into v_prev_snapshot from @NAMESPACE@.sl_event
+			where ev_origin = p_origin and ev_seqno = p_first_seqno
+				and ev_type = 'SYNC';
+	if not found or v_prev_snapshot::text <> p_first_snapshot::text then
+		return 0;
+	end if;
+	if not exists (select 1 from @NAMESPACE@.sl_event
+			where ev_origin = p_origin and ev_seqno = p_last_seqno
+				and ev_type = 'SYNC') then
+		return 0;
+	end if;
+
+	-- ----
+	-- New slices hold the tables of all sets of origin that this node
+	-- provides, the receiver needs those of its own sets.
+	-- ----
+	v_tables := array(select distinct tab_id
+			from @NAMESPACE@.sl_table, @NAMESPACE@.sl_set,
+				@NAMESPACE@.sl_subscribe
+			where tab_set = set_id and set_origin = p_origin
+				and sub_set = set_id and sub_provider = v_local_node_id
+			order by tab_id);
+	v_need := array(select tab_id
+			from @NAMESPACE@.sl_table, @NAMESPACE@.sl_set,
+				@NAMESPACE@.sl_subscribe
+			where tab_set = set_id and set_origin = p_origin
+				and sub_set = set_id and sub_provider = v_local_node_id
+				and sub_receiver = p_receiver
+			order by tab_id);
+
+	-- ----
+	-- Lock the table new slices go into before claiming any, so that
+	-- logFetchSwitch() cannot truncate it under us.
+	-- ----
+	select last_value into v_fetch_no from @NAMESPACE@.sl_log_fetch_status;
+	execute 'lock table @NAMESPACE@.sl_log_fetch_' || v_fetch_no::text ||
+			' in row exclusive mode;';
+	select last_value into v_log_status from @NAMESPACE@.sl_log_status;
+
+	v_usable := true;
+	v_slices := 0;
+	for v_ev in select ev_seqno, ev_snapshot from @NAMESPACE@.sl_event
+			where ev_origin = p_origin and ev_seqno > p_first_seqno
+				and ev_seqno <= p_last_seqno and ev_type = 'SYNC'
+			order by ev_seqno
+	loop
+		v_created := false;
+		select lf_tables into v_lf_tables from @NAMESPACE@.sl_log_fetch
+				where lf_origin = p_origin and lf_seqno = v_ev.ev_seqno;
+		if not found then
+			-- ----
+			-- Claim the slice. A concurrent claim of the same slice
+			-- waits here until the other subscriber's materialization
+			-- is committed, and then uses that.
+			-- ----
+			begin
+				insert into @NAMESPACE@.sl_log_fetch
+						(lf_origin, lf_seqno, lf_table, lf_tables, lf_timestamp)
+						values (p_origin, v_ev.ev_seqno, v_fetch_no, v_tables,
+						CURRENT_TIMESTAMP);
+				v_lf_tables := v_tables;
+				v_created := true;
+			exception when unique_violation then
+				select lf_tables into v_lf_tables from @NAMESPACE@.sl_log_fetch
+						where lf_origin = p_origin and lf_seqno = v_ev.ev_seqno;
+			end;
+		end if;
+
+		if v_created then
+			for v_log_no in 1..2 loop
+				if (v_log_no = 1 and v_log_status <> 1) or
+					(v_log_no = 2 and v_log_status <> 0)
+				then
+					v_query := 'insert into @NAMESPACE@.sl_log_fetch_' ||
+						v_fetch_no::text ||
+						' select ' || v_ev.ev_seqno::text || ', log_origin, ' ||
+						'log_txid, log_tableid, log_actionseq, ' ||
+						'log_tablenspname, log_tablerelname, log_cmdtype, ' ||
+						'log_cmdupdncols, log_cmdargs ' ||
+						'from @NAMESPACE@.sl_log_' || v_log_no::text ||
+						' where log_origin = ' || p_origin::text ||
+						' and log_tableid = any (' ||
+						pg_catalog.quote_literal(v_tables::text) || '::int4[])';
+					execute v_query ||
+						' and log_txid >= ' ||
+						"pg_catalog".txid_snapshot_xmax(v_prev_snapshot)::text ||
+						' and log_txid < ' ||
+						"pg_catalog".txid_snapshot_xmax(v_ev.ev_snapshot)::text ||
+						' and "pg_catalog".txid_visible_in_snapshot(log_txid, ' ||
+						pg_catalog.quote_literal(v_ev.ev_snapshot::text) || ')';
+					execute v_query ||
+						' and log_txid in (select * from ' ||
+						'"pg_catalog".txid_snapshot_xip(' ||
+						pg_catalog.quote_literal(v_prev_snapshot::text) || ') ' ||
+						'except select * from "pg_catalog".txid_snapshot_xip(' ||
+						pg_catalog.quote_literal(v_ev.ev_snapshot::text) || '))';
+				end if;
+			end loop;
+		elsif not (v_need <@ v_lf_tables) then
+			-- ----
+			-- The slice was made before the receiver subscribed to
+			-- some of its sets here.
+			-- ----
+			v_usable := false;
+		end if;
+
+		v_prev_snapshot := v_ev.ev_snapshot;
+		v_slices := v_slices + 1;
+	end loop;
+
+	if not v_usable then
+		return 0;
+	end if;
+	return v_slices;
+end;
+$$ language plpgsql;
+comment on function @NAMESPACE@.logFetchPrepare(p_origin int4, p_receiver int4, p_first_seqno int8, p_first_snapshot "pg_catalog".txid_snapshot, p_last_seqno int8) is
+'logFetchPrepare (origin, receiver, first_seqno, first_snapshot, last_seqno)
+
+Materializes the log rows of origin for every SYNC event after
+first_seqno up to last_seqno into sl_log_fetch_1 or sl_log_fetch_2,
+one slice per SYNC and only for the tables of the sets this node
+provides, unless that slice exists already. Subscribers that group the
+SYNCs differently still share the slices, so sl_log_1/sl_log_2 are
+read only once. Returns the number of slices the receiver can read
+between first_seqno and last_seqno, or 0 if fewer than two subscribers
+read from this node or the receiver must use logSelect() otherwise.';
+
+-- ----------------------------------------------------------------------
+-- FUNCTION logFetchSwitch ()
+--
+--	Called by cleanupEvent(). Truncates the sl_log_fetch table that
+--	new slices do not go into once it holds no slice anymore, and
+--	makes it the one new slices go into.
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.logFetchSwitch()
+returns int4
+as $$
+declare
+	v_current			int4;
+	v_other				int4;
+begin
+	select last_value into v_current from @NAMESPACE@.sl_log_fetch_status;
+	v_other := 3 - v_current;
+
+	-- ----
+	-- A logFetchPrepare() that still writes to the other table holds
+	-- a lock on it. Try again at the next cleanup.
+	-- ----
+	begin
+		execute 'lock table @NAMESPACE@.sl_log_fetch_' || v_other::text ||
+				' in access exclusive mode nowait;';
+	exception when lock_not_available then
+		return 0;
+	end;
+
+	if exists (select 1 from @NAMESPACE@.sl_log_fetch
+			where lf_table = v_other) then
+		return 0;
+	end if;
+
+	execute 'truncate @NAMESPACE@.sl_log_fetch_' || v_other::text || ';';
+	perform "pg_catalog".setval('@NAMESPACE@.sl_log_fetch_status', v_other);
+	return 1;
+end;
+$$ language plpgsql;
+comment on function @NAMESPACE@.logFetchSwitch() is
+'logFetchSwitch()
+
+Called by cleanupEvent() after removing the sl_log_fetch rows of
+confirmed SYNCs. Truncates the sl_log_fetch table new slices do not
+go into once no slice is left in it and switches new slices to it.
+Returns 1 if it switched, 0 otherwise.';
+
+
 -- ----------------------------------------------------------------------
 -- FUNCTION addPartialLogIndices ()
 -- Add partial indices to sl_log_? tables that aren't currently in use
@@ -5692,6 +6298,54 @@ create table @NAMESPACE@.sl_components (
 			) WITHOUT OIDS;';
 		execute v_query;
 	end if;
+
+	if not exists (select 1 from information_schema.tables t 
+			where table_schema = '_@CLUSTERNAME@' 
+			and table_name = 'sl_apply_table_stats') then
+		v_query := '
+			create table @NAMESPACE@.sl_apply_table_stats (
+				ats_origin			int4,
+				ats_tab_id			int4,
+				ats_cache_prepare	int8,
+				ats_cache_hit		int8,
+				ats_cache_evict		int8,
+				ats_cache_inval		int8,
+				ats_apply_last		timestamptz
+			) WITHOUT OIDS;
+			create index sl_apply_table_stats_idx1 on @NAMESPACE@.sl_apply_table_stats
+				(ats_origin, ats_tab_id);';
+		execute v_query;
+	end if;
+
+	if not exists (select 1 from information_schema.tables t 
+			where table_schema = '_@CLUSTERNAME@' 
+			and table_name = 'sl_sync_metrics') then
+		v_query := '
+			create table @NAMESPACE@.sl_sync_metrics (
+				sm_slot				int4,
+				sm_origin			int4,
+				sm_seqno			int8,
+				sm_group_size		int4,
+				sm_log_rows			int8,
+				sm_copy_bytes		int8,
+				sm_prov_query		interval,
+				sm_first_row		interval,
+				sm_copy				interval,
+				sm_apply			interval,
+				sm_confirm			interval,
+				sm_commit			interval,
+				sm_total			interval,
+				sm_timestamp		timestamptz,
+
+				CONSTRAINT "sl_sync_metrics-pkey"
+					PRIMARY KEY (sm_slot)
+			) WITHOUT OIDS;
+			create index sl_sync_metrics_idx1 on @NAMESPACE@.sl_sync_metrics
+				(sm_origin, sm_total);
+			create sequence @NAMESPACE@.sl_sync_metrics_seq;';
+		execute v_query;
+	end if;
+
 	
 	--
 	-- On the upgrade to 2.2, we change the layout of sl_log_N by
@@ -5784,7 +6438,7 @@ create table @NAMESPACE@.sl_components (
 		comment on column @NAMESPACE@.sl_log_script.log_txid is 'Transaction ID on the origin node';
 		comment on column @NAMESPACE@.sl_log_script.log_actionseq is 'The sequence number in which actions will be applied on replicas';
 		comment on column @NAMESPACE@.sl_log_2.log_cmdtype is 'Replication action to take. S = Script statement, s = Script complete';
-		comment on column @NAMESPACE@.sl_log_script.log_cmdargs is 'The DDL statement, optionally followed by selected nodes to execute it on.';
+		comment on column @NAMESPACE@.sl_log_script.log_cmdargs is 'The DDL statement, followed by the selected nodes to execute it on, the sequence values to set before and any further statements of the same batch.';
 
 		--
 		-- Put the log apply triggers back onto sl_log_1/2
@@ -5865,6 +6519,86 @@ create table @NAMESPACE@.sl_components (
 	   alter table @NAMESPACE@.sl_node add column no_failed bool;
 	   update @NAMESPACE@.sl_node set no_failed=false;
 	end if;
+	if not exists (select 1 from information_schema.views where table_schema='_@CLUSTERNAME@' and table_name='sl_sync_metrics_summary') then
+	   create view @NAMESPACE@.sl_sync_metrics_summary as
+		select sm_origin,
+				count(*) as sm_num_groups,
+				sum(sm_group_size) as sm_num_syncs,
+				avg(sm_group_size) as sm_avg_group_size,
+				sum(sm_log_rows) as sm_log_rows,
+				sum(sm_copy_bytes) as sm_copy_bytes,
+				avg(sm_prov_query) as sm_avg_prov_query,
+				avg(sm_first_row) as sm_avg_first_row,
+				avg(sm_copy) as sm_avg_copy,
+				avg(sm_apply) as sm_avg_apply,
+				avg(sm_confirm) as sm_avg_confirm,
+				avg(sm_commit) as sm_avg_commit,
+				avg(sm_total) as sm_avg_total,
+				max(sm_total) as sm_max_total,
+				sum(sm_log_rows) / greatest(extract(epoch from sum(sm_total)), 0.001)
+					as sm_rows_per_sec,
+				sum(sm_copy_bytes) / greatest(extract(epoch from sum(sm_total)), 0.001)
+					as sm_bytes_per_sec,
+				min(sm_timestamp) as sm_first,
+				max(sm_timestamp) as sm_last
+			from @NAMESPACE@.sl_sync_metrics
+			group by sm_origin;
+	end if;
+	if not exists (select 1 from information_schema.views where table_schema='_@CLUSTERNAME@' and table_name='sl_sync_metrics_percentiles') then
+	   create view @NAMESPACE@.sl_sync_metrics_percentiles as
+		select O.sm_origin, O.sm_num_groups,
+				(select M.sm_total from @NAMESPACE@.sl_sync_metrics M
+					where M.sm_origin = O.sm_origin order by M.sm_total
+					offset floor(0.50 * (O.sm_num_groups - 1))::int8 limit 1)
+					as sm_total_p50,
+				(select M.sm_total from @NAMESPACE@.sl_sync_metrics M
+					where M.sm_origin = O.sm_origin order by M.sm_total
+					offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+					as sm_total_p90,
+				(select M.sm_total from @NAMESPACE@.sl_sync_metrics M
+					where M.sm_origin = O.sm_origin order by M.sm_total
+					offset floor(0.99 * (O.sm_num_groups - 1))::int8 limit 1)
+					as sm_total_p99,
+				(select M.sm_first_row from @NAMESPACE@.sl_sync_metrics M
+					where M.sm_origin = O.sm_origin order by M.sm_first_row
+					offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+					as sm_first_row_p90,
+				(select M.sm_copy from @NAMESPACE@.sl_sync_metrics M
+					where M.sm_origin = O.sm_origin order by M.sm_copy
+					offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+					as sm_copy_p90,
+				(select M.sm_commit from @NAMESPACE@.sl_sync_metrics M
+					where M.sm_origin = O.sm_origin order by M.sm_commit
+					offset floor(0.90 * (O.sm_num_groups - 1))::int8 limit 1)
+					as sm_commit_p90,
+				O.sm_max_total
+			from (select sm_origin, count(*) as sm_num_groups,
+						max(sm_total) as sm_max_total
+					from @NAMESPACE@.sl_sync_metrics
+					group by sm_origin) O;
+	end if;
+	if not exists (select 1 from information_schema.views where table_schema='_@CLUSTERNAME@' and table_name='sl_failover_readiness') then
+	   create view @NAMESPACE@.sl_failover_readiness as
+		select T.set_origin as fr_origin,
+				T.backup_id as fr_candidate,
+				T.fr_num_sets,
+				C.fr_confirmed_seqno,
+				C.fr_confirmed_time,
+				E.fr_origin_seqno - C.fr_confirmed_seqno as fr_lag_events
+			from (select set_origin, backup_id, count(*) as fr_num_sets
+					from @NAMESPACE@.sl_failover_targets
+					group by set_origin, backup_id) T
+			left join (select con_origin, con_received,
+						max(con_seqno) as fr_confirmed_seqno,
+						max(con_timestamp) as fr_confirmed_time
+					from @NAMESPACE@.sl_confirm
+					group by con_origin, con_received) C
+				on (C.con_origin = T.set_origin and C.con_received = T.backup_id)
+			left join (select ev_origin, max(ev_seqno) as fr_origin_seqno
+					from @NAMESPACE@.sl_event
+					group by ev_origin) E
+				on (E.ev_origin = T.set_origin);
+	end if;
 	return p_old;
 end;
 $$ language plpgsql;
@@ -6190,6 +6924,16 @@ begin
 	if @NAMESPACE@.ShouldSlonyVacuumTable(prec.nspname, prec.relname) then
 		return next prec;
 	end if;
+	prec.nspname := '_@CLUSTERNAME@';
+	prec.relname := 'sl_sync_metrics';
+	if @NAMESPACE@.ShouldSlonyVacuumTable(prec.nspname, prec.relname) then
+		return next prec;
+	end if;
+	prec.nspname := '_@CLUSTERNAME@';
+	prec.relname := 'sl_log_fetch';
+	if @NAMESPACE@.ShouldSlonyVacuumTable(prec.nspname, prec.relname) then
+		return next prec;
+	end if;
 	prec.nspname := 'pg_catalog';
 	prec.relname := 'pg_listener';
 	if @NAMESPACE@.ShouldSlonyVacuumTable(prec.nspname, prec.relname) then
@@ -6515,6 +7259,65 @@ language plpgsql;
 comment on function @NAMESPACE@.component_state (i_actor text, i_pid integer, i_node integer, i_conn_pid integer, i_activity text, i_starttime timestamptz, i_event bigint, i_eventtype text) is
 'Store state of a Slony component.  Useful for monitoring';
 
+-- ----------------------------------------------------------------------
+-- FUNCTION logSyncMetrics ()
+--
+--	Called by the remote worker as the last statement of a SYNC group
+--	transaction. Stores the timing breakdown into the next slot of the
+--	sl_sync_metrics ring buffer.
+-- ----------------------------------------------------------------------
+create or replace function @NAMESPACE@.logSyncMetrics (p_origin int4,
+		p_seqno int8, p_group_size int4, p_log_rows int8, p_copy_bytes int8,
+		p_prov_query interval, p_first_row interval, p_copy interval,
+		p_apply interval, p_confirm interval, p_commit interval,
+		p_total interval, p_ring_size int4)
+returns int4 as $$
+declare
+	v_slot		int4;
+begin
+	if p_ring_size <= 0 then
+		return -1;
+	end if;
+	v_slot := nextval('@NAMESPACE@.sl_sync_metrics_seq') % p_ring_size;
+
+	update @NAMESPACE@.sl_sync_metrics set
+			sm_origin = p_origin, sm_seqno = p_seqno,
+			sm_group_size = p_group_size, sm_log_rows = p_log_rows,
+			sm_copy_bytes = p_copy_bytes, sm_prov_query = p_prov_query,
+			sm_first_row = p_first_row, sm_copy = p_copy,
+			sm_apply = p_apply, sm_confirm = p_confirm,
+			sm_commit = p_commit, sm_total = p_total,
+			sm_timestamp = "pg_catalog".clock_timestamp()
+		where sm_slot = v_slot;
+	if not found then
+		insert into @NAMESPACE@.sl_sync_metrics
+				(sm_slot, sm_origin, sm_seqno, sm_group_size, sm_log_rows,
+				sm_copy_bytes, sm_prov_query, sm_first_row, sm_copy,
+				sm_apply, sm_confirm, sm_commit, sm_total, sm_timestamp)
+			values
+				(v_slot, p_origin, p_seqno, p_group_size, p_log_rows,
+				p_copy_bytes, p_prov_query, p_first_row, p_copy,
+				p_apply, p_confirm, p_commit, p_total,
+				"pg_catalog".clock_timestamp());
+	end if;
+
+	-- ----
+	-- Once per lap, drop slots left over from a larger ring size
+	-- ----
+	if v_slot = 0 then
+		delete from @NAMESPACE@.sl_sync_metrics where sm_slot >= p_ring_size;
+	end if;
+	return v_slot;
+end;
+$$ language plpgsql;
+
+comment on function @NAMESPACE@.logSyncMetrics (p_origin int4,
+		p_seqno int8, p_group_size int4, p_log_rows int8, p_copy_bytes int8,
+		p_prov_query interval, p_first_row interval, p_copy interval,
+		p_apply interval, p_confirm interval, p_commit interval,
+		p_total interval, p_ring_size int4) is
+'Store the timing breakdown of one applied SYNC group in the sl_sync_metrics ring buffer of p_ring_size slots.';
+
 create or replace function @NAMESPACE@.recreate_log_trigger(p_fq_table_name text,
        p_tab_id oid, p_tab_attkind text) returns integer as $$
 begin
@@ -1,298 +1,399 @@
 /*	*/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include "scanner.h"
 
-int			STMTS[MAXSTATEMENTS];
+int		   *STMTS = NULL;
+static int	max_stmts = 0;
+
+/*
+ * First words of the statements that begin, end or otherwise control a
+ * transaction.
+ */
+static const char *xact_keywords[] = {
+	"abort",
+	"begin",
+	"commit",
+	"end",
+	"prepare",
+	"release",
+	"rollback",
+	"savepoint",
+	"start",
+	NULL
+};
+
+static int	scan_char(ScanState * ss, char cchar);
+static void scan_content(ScanState * ss, char cchar);
+static void scan_end_statement(ScanState * ss);
+
+
+/* ----------
+ * scan_init
+ *
+ *	Prepare a ScanState for the first piece of a script.
+ * ----------
+ */
+void
+scan_init(ScanState * ss)
+{
+	memset(ss, 0, sizeof(ScanState));
+	ss->state = Q_NORMAL_STATE;
+}
+
+
+/* ----------
+ * scan_statements
+ *
+ *	Scan the next len bytes of a script. Returns the offset in buf just
+ *	behind the first semicolon ending a statement, or -1 if buf ends
+ *	inside a statement. The caller continues with the rest of buf and
+ *	with following pieces of the script, there is no limit on the number
+ *	of statements or the size of the script.
+ * ----------
+ */
+int
+scan_statements(ScanState * ss, const char *buf, int len)
+{
+	int			cpos;
+
+	for (cpos = 0; cpos < len; cpos++)
+	{
+		if (scan_char(ss, buf[cpos]))
+			return cpos + 1;
+	}
+	return -1;
+}
+
+
+/* ----------
+ * scan_finish
+ *
+ *	Called at the end of the script to describe the text following the
+ *	last semicolon like a regular statement. Returns stmt_content.
+ * ----------
+ */
+int
+scan_finish(ScanState * ss)
+{
+	int			content;
+	int			xact_control;
+
+	scan_end_statement(ss);
+	content = ss->stmt_content;
+	xact_control = ss->stmt_xact_control;
+
+	scan_init(ss);
+	ss->stmt_content = content;
+	ss->stmt_xact_control = xact_control;
+
+	return content;
+}
+
+
+/* ----------
+ * scan_for_statements
+ *
+ *	Split a complete script into statements. The end positions of the
+ *	statements are returned in STMTS, the last one being the end of the
+ *	script. Returns the number of statements, or -1 if out of memory.
+ * ----------
+ */
 int
 scan_for_statements(const char *extended_statement)
 {
+	ScanState	ss;
 	int			cpos;
-	int			bquote;
-	int			bpos;
-	enum quote_states state;
-	char		cchar;
-	int			d1start,
-				d1end,
-				d2start,
-				d2end,
-				d1stemp;
+	int			len;
+	int			n;
 	int			statements;
-	int			nparens;
-	int			nbrokets;
-	int			nsquigb;
 
-	/* Initialize */
+	scan_init(&ss);
+	len = strlen(extended_statement);
 	cpos = 0;
 	statements = 0;
-	bquote = 0;
-	bpos = 0;					/* Location of last backquote */
-	d1start = 0;
-	d2start = 0;
-	d1end = 0;
-	state = Q_NORMAL_STATE;
-	nparens = 0;
-	nbrokets = 0;
-	nsquigb = 0;
-
-	while (state != Q_DONE)
+
+	for (;;)
 	{
-		cchar = extended_statement[cpos];
-		switch (cchar)
+		if (statements >= max_stmts)
 		{
-			case '\0':
-				STMTS[statements++] = cpos;
-				state = Q_DONE;
-				break;
+			int		   *newstmts;
 
-			case '(':
-				if (state == Q_NORMAL_STATE)
-				{
-					nparens++;
-					break;
-				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
+			newstmts = (int *) realloc(STMTS, sizeof(int) *
+									   (max_stmts == 0 ? 1024 : max_stmts * 2));
+			if (newstmts == NULL)
+				return -1;
+			STMTS = newstmts;
+			max_stmts = (max_stmts == 0) ? 1024 : max_stmts * 2;
+		}
 
-			case ')':
-				if (state == Q_NORMAL_STATE)
-				{
-					nparens--;
-					break;
-				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-			case '[':
-				if (state == Q_NORMAL_STATE)
-				{
-					nbrokets++;
-					break;
-				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-			case ']':
-				if (state == Q_NORMAL_STATE)
-				{
-					nbrokets--;
-					break;
-				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-			case '{':
-				if (state == Q_NORMAL_STATE)
-				{
-					nsquigb++;
-					break;
-				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
+		n = scan_statements(&ss, extended_statement + cpos, len - cpos);
+		if (n < 0)
+			break;
+		cpos += n;
+		STMTS[statements++] = cpos;
+	}
+	STMTS[statements++] = len;
 
-			case '}':
-				if (state == Q_NORMAL_STATE)
-				{
-					nsquigb--;
-					break;
-				}
+	return statements;
+}
 
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-			case '/':
-				if (state == Q_NORMAL_STATE)
-				{
-					state = Q_HOPE_TO_CCOMMENT;
-					break;
-				}
-				if (state == Q_HOPE_CEND)
-				{
-					state = Q_NORMAL_STATE;
-					break;
-				}
-				break;
-			case '*':
-				if (state == Q_HOPE_TO_CCOMMENT)
-				{
-					state = Q_CCOMMENT;
-					break;
-				}
-				if (state == Q_CCOMMENT)
-				{
-					state = Q_HOPE_CEND;
-					break;
-				}
 
-				break;
-			case '\\':
-				if ((state == Q_DOUBLE_QUOTING) || (state == Q_SINGLE_QUOTING))
+/* ----------
+ * scan_char
+ *
+ *	Advance the state machine by one character. Returns 1 if the
+ *	character is a semicolon ending a statement.
+ * ----------
+ */
+static int
+scan_char(ScanState * ss, char cchar)
+{
+	for (;;)
+	{
+		switch (ss->state)
+		{
+			case Q_NORMAL_STATE:
+				switch (cchar)
 				{
-					if (bquote == 0)
-					{
-						bquote = 1;
-						bpos = cpos;
+					case '(':
+						ss->nparens++;
 						break;
-					}
-				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case '$':
-				if (state == Q_NORMAL_STATE)
-				{
-					d1start = cpos;
-					state = Q_DOLLAR_BUILDING;
-					break;
-				}
-				if (state == Q_DOLLAR_BUILDING)
-				{
-					d1end = cpos;
-					state = Q_DOLLAR_QUOTING;
-					break;
-				}
-				if (state == Q_DOLLAR_QUOTING)
-				{
-					d2start = cpos;
-					state = Q_DOLLAR_UNBUILDING;
-					break;
-				}
-				if (state == Q_DOLLAR_UNBUILDING)
-				{
-					d2end = cpos;
-
-					/*
-					 * Compare strings - is this the delimiter the imperials
-					 * are looking for?
-					 */
-					if ((d1end - d1start) != (d2end - d2start))
-					{
-						/*
-						 * Lengths don't even match - these aren't the droids
-						 * we're looking for
-						 */
-						state = Q_DOLLAR_QUOTING;		/* Return to dollar
-														 * quoting mode */
+					case ')':
+						ss->nparens--;
+						break;
+					case '[':
+						ss->nbrokets++;
+						break;
+					case ']':
+						ss->nbrokets--;
+						break;
+					case '{':
+						ss->nsquigb++;
+						break;
+					case '}':
+						ss->nsquigb--;
 						break;
-					}
-					d1stemp = d1start;
-					while (d1stemp < d1end)
-					{
-						if (extended_statement[d1stemp] != extended_statement[d2start])
+					case '-':
+						ss->state = Q_HOPE_TO_DASH;
+						return 0;
+					case '/':
+						ss->state = Q_HOPE_TO_CCOMMENT;
+						return 0;
+					case '"':
+						ss->state = Q_DOUBLE_QUOTING;
+						ss->bquote = 0;
+						break;
+					case '\'':
+						ss->state = Q_SINGLE_QUOTING;
+						ss->bquote = 0;
+						break;
+					case '$':
+						ss->state = Q_DOLLAR_BUILDING;
+						ss->taglen = 0;
+						break;
+					case ';':
+						if ((ss->nparens == 0) && (ss->nbrokets == 0) &&
+							(ss->nsquigb == 0))
 						{
-							/* mismatch - these aren't the droids... */
-							state = Q_DOLLAR_QUOTING;
-							break;
+							scan_end_statement(ss);
+							return 1;
 						}
-						d1stemp++;		/* Step forward to the next character */
-						d2start++;
-					}
-					if ((d1stemp >= d1end) && (state == Q_DOLLAR_UNBUILDING))
-					{			/* No mismatches */
-						state = Q_NORMAL_STATE;
 						break;
-					}
 				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case '"':
-				if (state == Q_NORMAL_STATE)
+				scan_content(ss, cchar);
+				return 0;
+
+			case Q_HOPE_TO_DASH:
+				if (cchar == '-')
 				{
-					state = Q_DOUBLE_QUOTING;
-					break;
+					ss->state = Q_DASHING_STATE;
+					return 0;
 				}
-				if (state == Q_DOUBLE_QUOTING)
+				/* Just a minus, look at this character again */
+				ss->state = Q_NORMAL_STATE;
+				scan_content(ss, '-');
+				continue;
+
+			case Q_DASHING_STATE:
+				if (cchar == '\n' || cchar == '\r')
+					ss->state = Q_NORMAL_STATE;
+				return 0;
+
+			case Q_HOPE_TO_CCOMMENT:
+				if (cchar == '*')
 				{
-					/* But a backquote hides this! */
-					if ((bquote == 1) && (bpos == cpos - 1))
-					{
-						break;	/* Ignore the quote */
-					}
-					state = Q_NORMAL_STATE;
-					break;
+					ss->state = Q_CCOMMENT;
+					ss->ncomments = 1;
+					ss->bquote = 0;
+					return 0;
 				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case '\'':
-				if (state == Q_NORMAL_STATE)
+				/* Just a slash, look at this character again */
+				ss->state = Q_NORMAL_STATE;
+				scan_content(ss, '/');
+				continue;
+
+			case Q_CCOMMENT:
+				/* C-style comments nest, bquote remembers a slash here */
+				if (cchar == '*')
 				{
-					state = Q_SINGLE_QUOTING;
-					break;
+					if (ss->bquote)
+						ss->ncomments++;
+					else
+						ss->state = Q_HOPE_CEND;
 				}
-				if (state == Q_SINGLE_QUOTING)
+				ss->bquote = (cchar == '/');
+				return 0;
+
+			case Q_HOPE_CEND:
+				if (cchar == '/')
 				{
-					/* But a backquote hides this! */
-					if ((bquote == 1) && (bpos == cpos - 1))
-					{
-						break;	/* Ignore the quote */
-					}
-					state = Q_NORMAL_STATE;
-					break;
+					if (--ss->ncomments == 0)
+						ss->state = Q_NORMAL_STATE;
+					else
+						ss->state = Q_CCOMMENT;
 				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case '-':
-				if (state == Q_NORMAL_STATE && extended_statement[cpos + 1] == '-')
+				else if (cchar != '*')
+					ss->state = Q_CCOMMENT;
+				return 0;
+
+			case Q_DOUBLE_QUOTING:
+			case Q_SINGLE_QUOTING:
+				if (ss->bquote)
 				{
-					state = Q_HOPE_TO_DASH;
-					break;
+					/* A backslash hides whatever follows */
+					ss->bquote = 0;
+					return 0;
 				}
-				if (state == Q_HOPE_TO_DASH)
+				if (cchar == '\\')
+					ss->bquote = 1;
+				else if (cchar == (ss->state == Q_DOUBLE_QUOTING ? '"' : '\''))
+					ss->state = Q_NORMAL_STATE;
+				return 0;
+
+			case Q_DOLLAR_BUILDING:
+				if (cchar == '$')
 				{
-					state = Q_DASHING_STATE;
-					break;
+					ss->state = Q_DOLLAR_QUOTING;
+					return 0;
 				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case '\n':
-				if (state == Q_DASHING_STATE)
+				if ((isalpha((unsigned char) cchar) || cchar == '_' ||
+					 (unsigned char) cchar >= 0x80 ||
+					 (isdigit((unsigned char) cchar) && ss->taglen > 0)) &&
+					ss->taglen < SCAN_TAGLEN)
 				{
-					state = Q_NORMAL_STATE;
+					ss->tag[ss->taglen++] = cchar;
+					return 0;
 				}
-				if (state == Q_DOLLAR_BUILDING)
-					state = Q_NORMAL_STATE;
-				if (state == Q_DOLLAR_UNBUILDING)
-					state = Q_DOLLAR_QUOTING;
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case '\r':
-				if (state == Q_DASHING_STATE)
+
+				/*
+				 * Not a dollar quote after all, but something like a
+				 * positional parameter. Look at this character again.
+				 */
+				ss->state = Q_NORMAL_STATE;
+				continue;
+
+			case Q_DOLLAR_QUOTING:
+				if (cchar == '$')
 				{
-					state = Q_NORMAL_STATE;
+					ss->state = Q_DOLLAR_UNBUILDING;
+					ss->tagpos = 0;
 				}
-				if (state == Q_DOLLAR_BUILDING)
-					state = Q_NORMAL_STATE;
-				if (state == Q_DOLLAR_UNBUILDING)
-					state = Q_DOLLAR_QUOTING;
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case ' ':
-				if (state == Q_DOLLAR_BUILDING)
-					state = Q_NORMAL_STATE;
-				if (state == Q_DOLLAR_UNBUILDING)
-					state = Q_DOLLAR_QUOTING;
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			case ';':
-				if ((state == Q_NORMAL_STATE) && (nparens == 0) && (nbrokets == 0) && (nsquigb == 0))
+				return 0;
+
+			case Q_DOLLAR_UNBUILDING:
+				if (cchar == '$')
 				{
-					STMTS[statements++] = cpos + 1;
-					if (statements >= MAXSTATEMENTS)
-					{
-						return statements;
-					}
+					/*
+					 * Compare strings - is this the delimiter the imperials
+					 * are looking for? If not, this dollar may still open
+					 * the one that is.
+					 */
+					if (ss->tagpos == ss->taglen)
+						ss->state = Q_NORMAL_STATE;
+					else
+						ss->tagpos = 0;
+					return 0;
+				}
+				if (ss->tagpos < ss->taglen && ss->tag[ss->tagpos] == cchar)
+				{
+					ss->tagpos++;
+					return 0;
 				}
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
-			default:
-				if (state == Q_HOPE_CEND)
-					state = Q_CCOMMENT;
-				break;
+				/* These aren't the droids we're looking for */
+				ss->state = Q_DOLLAR_QUOTING;
+				return 0;
+
+			case Q_DONE:
+				return 0;
 		}
-		cpos++;
 	}
-	return statements;
+}
+
+
+/* ----------
+ * scan_content
+ *
+ *	Account for a character outside of comments in the leading keyword
+ *	of the current statement.
+ * ----------
+ */
+static void
+scan_content(ScanState * ss, char cchar)
+{
+	if (isspace((unsigned char) cchar))
+	{
+		if (ss->keywordlen > 0)
+			ss->keyword_done = 1;
+		return;
+	}
+	ss->has_content = 1;
+	if (ss->keyword_done)
+		return;
+
+	if (isalpha((unsigned char) cchar))
+	{
+		if (ss->keywordlen < SCAN_KEYWORDLEN)
+		{
+			ss->keyword[ss->keywordlen++] = tolower((unsigned char) cchar);
+			return;
+		}
+		ss->keywordlen = 0;		/* too long to be interesting */
+	}
+	else if (isdigit((unsigned char) cchar) || cchar == '_' ||
+			 cchar == '$' || (unsigned char) cchar >= 0x80)
+		ss->keywordlen = 0;		/* part of a longer identifier */
+	ss->keyword_done = 1;
+}
+
+
+/* ----------
+ * scan_end_statement
+ *
+ *	Describe the statement just ended in stmt_content and
+ *	stmt_xact_control and reset for the next one.
+ * ----------
+ */
+static void
+scan_end_statement(ScanState * ss)
+{
+	int			i;
+
+	ss->stmt_content = ss->has_content;
+	ss->stmt_xact_control = 0;
+	ss->keyword[ss->keywordlen] = '\0';
+	for (i = 0; xact_keywords[i] != NULL; i++)
+	{
+		if (strcmp(ss->keyword, xact_keywords[i]) == 0)
+		{
+			ss->stmt_xact_control = 1;
+			break;
+		}
+	}
+
+	ss->has_content = 0;
+	ss->keywordlen = 0;
+	ss->keyword_done = 0;
 }
@@ -1,5 +1,4 @@
 /*	*/
-#define MAXSTATEMENTS 1000
 enum quote_states
 {
 	Q_NORMAL_STATE,
@@ -21,4 +20,44 @@ enum quote_states
 	Q_DONE						/* NULL ends it all... */
 };
 
+/*
+ * Longest dollar quote tag and leading keyword remembered by the
+ * streaming scanner.
+ */
+#define SCAN_TAGLEN		64
+#define SCAN_KEYWORDLEN	16
+
+/*
+ * State of the streaming statement scanner. The input is handed to
+ * scan_statements() in arbitrary pieces, so everything that the scanner
+ * needs to know about the text already seen lives here.
+ */
+typedef struct
+{
+	enum quote_states state;
+	int			nparens;
+	int			nbrokets;
+	int			nsquigb;
+	int			ncomments;		/* nesting depth of C-style comments */
+	int			bquote;			/* last character was a backslash */
+
+	char		tag[SCAN_TAGLEN];	/* opening dollar quote tag */
+	int			taglen;
+	int			tagpos;			/* matched part of a closing tag */
+
+	char		keyword[SCAN_KEYWORDLEN + 1];	/* first word, lower case */
+	int			keywordlen;
+	int			keyword_done;
+	int			has_content;	/* more than white space and comments seen */
+
+	/* Describes the statement ended by the last scan_statements() */
+	int			stmt_content;
+	int			stmt_xact_control;	/* BEGIN, COMMIT, SAVEPOINT ... */
+} ScanState;
+
+extern void scan_init(ScanState * ss);
+extern int	scan_statements(ScanState * ss, const char *buf, int len);
+extern int	scan_finish(ScanState * ss);
+
+extern int *STMTS;
 extern int	scan_for_statements(const char *extended_statement);
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include "scanner.h"
 
 char		foo[65536];
-extern int	STMTS[1024];
-extern int	statements;
+
+static int	benchmark(int nstatements, int chunksize);
 
 int
 main(int argc, char *const argv[])
@@ -15,6 +17,14 @@ main(int argc, char *const argv[])
 				START;
 	int			nstatements = 0;
 
+	/*
+	 * test-scanner -b [statements [chunk size]] measures the throughput of
+	 * the scanner on a generated script instead.
+	 */
+	if (argc > 1 && strcmp(argv[1], "-b") == 0)
+		return benchmark((argc > 2) ? atoi(argv[2]) : 100000,
+						 (argc > 3) ? atoi(argv[3]) : 8192);
+
 	fread(foo, sizeof(char), 65536, stdin);
 	printf("Input: %s\n", foo);
 
@@ -33,3 +43,141 @@ main(int argc, char *const argv[])
 
 	return 0;
 }
+
+
+static double
+elapsed(struct timeval * tv_start)
+{
+	struct timeval tv_now;
+
+	gettimeofday(&tv_now, NULL);
+	return (double) (tv_now.tv_sec - tv_start->tv_sec) +
+		(double) (tv_now.tv_usec - tv_start->tv_usec) / 1000000.0;
+}
+
+
+/*
+ * Generate a script like the partition maintenance scripts fed to EXECUTE
+ * SCRIPT and split it once with scan_for_statements() and once by
+ * feeding it in chunks to the streaming scanner, counting the batches
+ * slonik would submit.
+ */
+static int
+benchmark(int nstatements, int chunksize)
+{
+	char	   *script;
+	size_t		size;
+	size_t		len;
+	int			i;
+	int			n;
+	int			cpos;
+	int			found;
+	int			batches;
+	int			in_batch;
+	double		secs;
+	ScanState	ss;
+	struct timeval tv_start;
+
+	if (nstatements <= 0 || chunksize <= 0)
+	{
+		fprintf(stderr, "usage: test-scanner -b [statements [chunk size]]\n");
+		return 1;
+	}
+
+	size = (size_t) nstatements * 256 + 1;
+	script = (char *) malloc(size);
+	if (script == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	len = 0;
+	for (i = 0; i < nstatements; i++)
+	{
+		switch (i % 8)
+		{
+			case 0:
+				len += sprintf(script + len, "begin;\n");
+				break;
+			case 1:
+				len += sprintf(script + len,
+							   "create table part_%d (like parent "
+							   "including defaults) inherits (parent);\n", i);
+				break;
+			case 2:
+				len += sprintf(script + len,
+							   "-- range check; quoted 'text'\n"
+							   "alter table part_%d add check "
+							   "(ts >= '2010-01-01' and ts < '2010-02-01');\n", i);
+				break;
+			case 3:
+				len += sprintf(script + len,
+							   "create function f_%d() returns int as $f$ "
+							   "begin return 1; end; $f$ language plpgsql;\n", i);
+				break;
+			case 4:
+				len += sprintf(script + len,
+							   "/* index; on \"ts\" */ create index "
+							   "part_%d_ts on part_%d (ts);\n", i, i);
+				break;
+			case 5:
+				len += sprintf(script + len,
+							   "insert into part_%d values (E'a\\';b', "
+							   "array[1,2]);\n", i);
+				break;
+			case 6:
+				len += sprintf(script + len,
+							   "comment on table part_%d is 'x;y';\n", i);
+				break;
+			case 7:
+				len += sprintf(script + len, "commit;\n");
+				break;
+		}
+	}
+
+	printf("script: %d statements, %lu bytes\n",
+		   nstatements, (unsigned long) len);
+
+	gettimeofday(&tv_start, NULL);
+	found = scan_for_statements(script);
+	secs = elapsed(&tv_start);
+	printf("scan_for_statements: %d statements in %.3f s, %.1f MB/s\n",
+		   found, secs, (secs > 0.0) ? (double) len / secs / 1048576.0 : 0.0);
+
+	gettimeofday(&tv_start, NULL);
+	scan_init(&ss);
+	found = 0;
+	batches = 0;
+	in_batch = 0;
+	for (cpos = 0; cpos < (int) len; cpos += n)
+	{
+		int			piece;
+
+		piece = ((int) len - cpos < chunksize) ? (int) len - cpos : chunksize;
+		n = scan_statements(&ss, script + cpos, piece);
+		if (n < 0)
+		{
+			n = piece;
+			continue;
+		}
+		found++;
+		if (ss.stmt_xact_control)
+		{
+			batches += in_batch + 1;
+			in_batch = 0;
+		}
+		else if (ss.stmt_content)
+			in_batch = 1;
+	}
+	if (scan_finish(&ss))
+		found++;
+	batches += in_batch;
+	secs = elapsed(&tv_start);
+	printf("scan_statements:     %d statements in %.3f s, %.1f MB/s, "
+		   "%d batches\n",
+		   found, secs, (secs > 0.0) ? (double) len / secs / 1048576.0 : 0.0,
+		   batches);
+
+	free(script);
+	return 0;
+}
@@ -53,6 +53,20 @@ static struct config_int ConfigureNamesInt[] =
 		-1,
 		4
 	},
+	{
+		{
+			(const char *) "log_queue_size",
+			gettext_noop("size of the log message queue in kB"),
+			gettext_noop("log messages are queued and written by a separate "
+						 "log writer thread; 0 writes every message "
+						 "synchronously from the logging thread"),
+			SLON_C_INT
+		},
+		&log_queue_size,
+		512,
+		0,
+		1048576
+	},
 	{
 		{
 			(const char *) "sync_interval",
@@ -89,6 +103,54 @@ static struct config_int ConfigureNamesInt[] =
 		0,
 		10000
 	},
+	{
+		{
+			(const char *) "sync_metrics_size",
+			gettext_noop("number of SYNC groups kept in sl_sync_metrics"),
+			gettext_noop("size of the ring buffer of per SYNC group timings; 0 disables recording"),
+			SLON_C_INT
+		},
+		&sync_metrics_size,
+		1000,
+		0,
+		1000000
+	},
+	{
+		{
+			(const char *) "archive_compression",
+			gettext_noop("zlib compression level for log archives"),
+			gettext_noop("0 writes plain .sql archives, 1 to 9 writes .sql.gz archives compressed at that level"),
+			SLON_C_INT
+		},
+		&archive_compression,
+		0,
+		0,
+		9
+	},
+	{
+		{
+			(const char *) "archive_rollover_size",
+			gettext_noop("size in kB after which a log archive is closed"),
+			gettext_noop("0 closes the archive after every SYNC group, otherwise further SYNC groups are appended until the file reaches this size"),
+			SLON_C_INT
+		},
+		&archive_rollover_size,
+		0,
+		0,
+		2097151
+	},
+	{
+		{
+			(const char *) "archive_rollover_interval",
+			gettext_noop("milliseconds after which a log archive is closed"),
+			gettext_noop("0 closes the archive after every SYNC group, otherwise further SYNC groups are appended until the file is this old"),
+			SLON_C_INT
+		},
+		&archive_rollover_interval,
+		0,
+		0,
+		86400000
+	},
 #ifdef HAVE_SYSLOG
 	{
 		{
@@ -214,6 +276,32 @@ static struct config_int ConfigureNamesInt[] =
 		10,
 		2000
 	},
+	{
+		{
+			(const char *) "remote_queue_maxsize",
+			gettext_noop("maximum number of events queued for a remote worker"),
+			gettext_noop("once a remote worker has this many events queued, "
+						 "the remote listeners stop selecting further events "
+						 "for its origin until the worker catches up"),
+			SLON_C_INT
+		},
+		&remote_queue_maxsize,
+		10000,
+		100,
+		1000000
+	},
+	{
+		{
+			(const char *) "metrics_port",
+			gettext_noop("TCP port on 127.0.0.1 to serve metrics on"),
+			gettext_noop("0 disables the TCP metrics endpoint"),
+			SLON_C_INT
+		},
+		&metrics_port,
+		0,
+		0,
+		65535
+	},
 	{{0}}
 };
 
@@ -239,6 +327,17 @@ static struct config_bool ConfigureNamesBool[] =
 		&logtimestamp,
 		true
 	},
+	{
+		{
+			(const char *) "log_queue_drop",
+			gettext_noop("Should log messages be dropped when the log queue is full?"),
+			gettext_noop("If false, a thread logging into a full queue waits "
+						 "for the log writer thread to make room"),
+			SLON_C_BOOL
+		},
+		&log_queue_drop,
+		false
+	},
 
 	{
 
@@ -262,6 +361,28 @@ static struct config_bool ConfigureNamesBool[] =
 		&monitor_threads,
 		true
 	},
+	{
+		{
+			(const char *) "archive_fsync",
+			gettext_noop("fsync log archives before publishing them"),
+			gettext_noop("fsync each log archive file and the archive directory once when the archive is closed"),
+			SLON_C_BOOL
+		},
+		&archive_fsync,
+		false
+	},
+	{
+		{
+			(const char *) "sync_shared_fetch",
+			gettext_noop("Share the log rows fetched for a SYNC with other subscribers"),
+			gettext_noop("Have the provider materialize the log rows of each "
+						 "SYNC once, for all subscribers of the origin that "
+						 "use this option"),
+			SLON_C_BOOL
+		},
+		&sync_shared_fetch,
+		false
+	},
 	{{0}}
 };
 
@@ -375,6 +496,16 @@ static struct config_string ConfigureNamesString[] =
 		&command_on_logarchive,
 		NULL
 	},
+	{
+		{
+			(const char *) "metrics_socket",
+			gettext_noop("Unix domain socket path to serve metrics on"),
+			NULL,
+			SLON_C_STRING
+		},
+		&metrics_socket,
+		NULL
+	},
 
 
 #ifdef HAVE_SYSLOG
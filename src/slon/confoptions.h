@@ -21,6 +21,12 @@ extern int	sync_interval_timeout;
 extern int	remote_listen_timeout;
 
 extern int	sync_group_maxsize;
+extern int	sync_metrics_size;
+extern int	archive_compression;
+extern int	archive_rollover_size;
+extern int	archive_rollover_interval;
+extern bool archive_fsync;
+extern bool sync_shared_fetch;
 extern int	desired_sync_time;
 
 extern int	quit_sync_provider;
@@ -31,6 +37,11 @@ extern int	keep_alive_interval;
 extern int	keep_alive_count;
 
 extern int	apply_cache_size;
+extern int	remote_queue_maxsize;
+extern int	metrics_port;
+extern char *metrics_socket;
+extern int	log_queue_size;
+extern bool log_queue_drop;
 
 /*
  * ----------
@@ -38,6 +38,39 @@ int			keep_alive_interval;
 static int	slon_appendquery_int(SlonDString * dsp, char *fmt, va_list ap);
 static int	db_get_version(PGconn *conn);
 
+
+/* ----------
+ * Per thread pool of dstring buffers
+ * ----------
+ */
+typedef struct SlonDStringPool_s SlonDStringPool;
+struct SlonDStringPool_s
+{
+	int			num_bufs;
+	char	   *bufs[SLON_DSTRING_POOL_SIZE];
+	size_t		sizes[SLON_DSTRING_POOL_SIZE];
+
+	int64		num_alloc;		/* buffers obtained from malloc() */
+	int64		num_realloc;	/* buffers grown by realloc() */
+	int64		num_reuse;		/* buffers taken from the pool */
+
+	SlonDStringPool *prev;
+	SlonDStringPool *next;
+};
+
+static pthread_key_t dstring_pool_key;
+static pthread_once_t dstring_pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t dstring_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static SlonDStringPool *dstring_pool_head = NULL;
+static SlonDStringPool *dstring_pool_tail = NULL;
+static int64 dstring_exited_alloc = 0;
+static int64 dstring_exited_realloc = 0;
+static int64 dstring_exited_reuse = 0;
+
+static void dstring_pool_init(void);
+static void dstring_pool_destroy(void *arg);
+static SlonDStringPool *dstring_pool_get(void);
+
 #if (PG_VERSION_MAJOR < 8)
 /* ----
  * This mutex is used to wrap around PQconnectdb. There's a problem that
@@ -330,6 +363,89 @@ slon_free_dummyconn(SlonConn * conn)
 }
 
 
+/* ----------
+ * db_send_query
+ *
+ * Send a query on a connection that belongs to the calling thread
+ * without waiting for it. The results are read with db_get_result().
+ * ----------
+ */
+int
+db_send_query(SlonConn * conn, const char *query)
+{
+	if (PQsendQuery(conn->dbconn, query) == 0)
+		return -1;
+	return 0;
+}
+
+
+/* ----------
+ * db_get_result
+ *
+ * Return the next result of a query sent with db_send_query(), or NULL
+ * when there are no more. Instead of sleeping inside libpq the thread
+ * waits for the socket in the scheduler, like the listeners do. Should
+ * the scheduler be shutting down, libpq is left to block as PQexec()
+ * would.
+ * ----------
+ */
+PGresult *
+db_get_result(SlonConn * conn)
+{
+	int			rc;
+
+	while (PQisBusy(conn->dbconn))
+	{
+		rc = sched_wait_conn(conn, SCHED_WAIT_SOCK_READ);
+		if (rc != SCHED_STATUS_OK && rc != SCHED_STATUS_CANCEL)
+			break;
+		if (PQconsumeInput(conn->dbconn) == 0)
+			break;
+	}
+	return PQgetResult(conn->dbconn);
+}
+
+
+/* ----------
+ * db_exec
+ *
+ * PQexec() on top of db_send_query() and db_get_result().
+ * ----------
+ */
+PGresult *
+db_exec(SlonConn * conn, const char *query)
+{
+	PGresult   *res;
+	PGresult   *last = NULL;
+
+	if (db_send_query(conn, query) < 0)
+		return PQmakeEmptyPGresult(conn->dbconn, PGRES_FATAL_ERROR);
+
+	while ((res = db_get_result(conn)) != NULL)
+	{
+		/*
+		 * Like PQexec() return the last result, unless an earlier one
+		 * reported the error.
+		 */
+		if (last != NULL)
+		{
+			if (PQresultStatus(last) == PGRES_FATAL_ERROR)
+			{
+				PQclear(res);
+				continue;
+			}
+			PQclear(last);
+		}
+		last = res;
+		if (PQresultStatus(res) == PGRES_COPY_IN ||
+			PQresultStatus(res) == PGRES_COPY_OUT)
+			break;
+	}
+
+	return last;
+}
+
+
 /* ----------
  * db_getLocalNodeId
  *
@@ -475,6 +591,215 @@ db_checkSchemaVersion(PGconn *conn)
 }
 
 
+/* ----------
+ * dstring_pool_init
+ *
+ * Create the thread specific data key for the dstring buffer pools.
+ * ----------
+ */
+static void
+dstring_pool_init(void)
+{
+	pthread_key_create(&dstring_pool_key, dstring_pool_destroy);
+}
+
+
+/* ----------
+ * dstring_pool_destroy
+ *
+ * Thread exit callback. Release the buffers kept by the thread and
+ * remember its counters in the totals.
+ * ----------
+ */
+static void
+dstring_pool_destroy(void *arg)
+{
+	SlonDStringPool *pool = (SlonDStringPool *) arg;
+	int			i;
+
+	for (i = 0; i < pool->num_bufs; i++)
+		free(pool->bufs[i]);
+
+	pthread_mutex_lock(&dstring_pool_lock);
+	dstring_exited_alloc += pool->num_alloc;
+	dstring_exited_realloc += pool->num_realloc;
+	dstring_exited_reuse += pool->num_reuse;
+	DLLIST_REMOVE(dstring_pool_head, dstring_pool_tail, pool);
+	pthread_mutex_unlock(&dstring_pool_lock);
+
+	free(pool);
+}
+
+
+/* ----------
+ * dstring_pool_get
+ *
+ * Return the calling thread's buffer pool, creating it on first use.
+ * ----------
+ */
+static SlonDStringPool *
+dstring_pool_get(void)
+{
+	SlonDStringPool *pool;
+
+	pthread_once(&dstring_pool_once, dstring_pool_init);
+	pool = (SlonDStringPool *) pthread_getspecific(dstring_pool_key);
+	if (pool != NULL)
+		return pool;
+
+	pool = (SlonDStringPool *) malloc(sizeof(SlonDStringPool));
+	if (pool == NULL)
+	{
+		slon_log(SLON_FATAL, "dstring_pool_get: malloc() - %s",
+				 strerror(errno));
+		slon_abort();
+	}
+	memset(pool, 0, sizeof(SlonDStringPool));
+	pthread_setspecific(dstring_pool_key, pool);
+
+	pthread_mutex_lock(&dstring_pool_lock);
+	DLLIST_ADD_TAIL(dstring_pool_head, dstring_pool_tail, pool);
+	pthread_mutex_unlock(&dstring_pool_lock);
+
+	return pool;
+}
+
+
+/* ----------
+ * slon_dstring_alloc
+ *
+ * Get the buffer for a new dstring. The most recently released buffer
+ * of this thread is reused if there is one, otherwise a new buffer of
+ * SLON_DSTRING_SIZE_INIT bytes is allocated.
+ * ----------
+ */
+char *
+slon_dstring_alloc(size_t *n_alloc)
+{
+	SlonDStringPool *pool = dstring_pool_get();
+	char	   *data;
+
+	if (pool->num_bufs > 0)
+	{
+		pool->num_bufs--;
+		pool->num_reuse++;
+		*n_alloc = pool->sizes[pool->num_bufs];
+		return pool->bufs[pool->num_bufs];
+	}
+
+	data = malloc(SLON_DSTRING_SIZE_INIT);
+	if (data == NULL)
+	{
+		slon_log(SLON_FATAL, "dstring_init: malloc() - %s",
+				 strerror(errno));
+		slon_abort();
+	}
+	pool->num_alloc++;
+	*n_alloc = SLON_DSTRING_SIZE_INIT;
+
+	return data;
+}
+
+
+/* ----------
+ * slon_dstring_release
+ *
+ * Give the buffer of a freed dstring back to the thread's pool. When the
+ * pool is full, the smallest buffer is dropped so the pool converges to
+ * the sizes the thread actually needs. Buffers larger than
+ * SLON_DSTRING_POOL_MAXBUF (copy_set can produce those) are not kept.
+ * ----------
+ */
+void
+slon_dstring_release(char *data, size_t n_alloc)
+{
+	SlonDStringPool *pool;
+	int			i;
+	int			smallest;
+
+	if (data == NULL)
+		return;
+	if (n_alloc > SLON_DSTRING_POOL_MAXBUF)
+	{
+		free(data);
+		return;
+	}
+
+	pool = dstring_pool_get();
+	if (pool->num_bufs < SLON_DSTRING_POOL_SIZE)
+	{
+		pool->bufs[pool->num_bufs] = data;
+		pool->sizes[pool->num_bufs] = n_alloc;
+		pool->num_bufs++;
+		return;
+	}
+
+	smallest = 0;
+	for (i = 1; i < pool->num_bufs; i++)
+	{
+		if (pool->sizes[i] < pool->sizes[smallest])
+			smallest = i;
+	}
+	if (pool->sizes[smallest] < n_alloc)
+	{
+		free(pool->bufs[smallest]);
+		pool->bufs[smallest] = data;
+		pool->sizes[smallest] = n_alloc;
+	}
+	else
+		free(data);
+}
+
+
+/* ----------
+ * slon_dstring_grow
+ *
+ * Enlarge a dstring so that it can hold more than n_need bytes.
+ * ----------
+ */
+void
+slon_dstring_grow(SlonDString * ds, size_t n_need)
+{
+	while (n_need >= ds->n_alloc)
+		ds->n_alloc *= SLON_DSTRING_SIZE_INC;
+	ds->data = realloc(ds->data, ds->n_alloc);
+	if (ds->data == NULL)
+	{
+		slon_log(SLON_FATAL, "dstring_nappend: realloc() - %s",
+				 strerror(errno));
+		slon_abort();
+	}
+	dstring_pool_get()->num_realloc++;
+}
+
+
+/* ----------
+ * slon_dstring_stats
+ *
+ * Sum up the dstring buffer counters of all threads. The per thread
+ * counters are read without locking, so the result is only a snapshot
+ * good enough for monitoring.
+ * ----------
+ */
+void
+slon_dstring_stats(int64 *num_alloc, int64 *num_realloc, int64 *num_reuse)
+{
+	SlonDStringPool *pool;
+
+	pthread_mutex_lock(&dstring_pool_lock);
+	*num_alloc = dstring_exited_alloc;
+	*num_realloc = dstring_exited_realloc;
+	*num_reuse = dstring_exited_reuse;
+	for (pool = dstring_pool_head; pool != NULL; pool = pool->next)
+	{
+		*num_alloc += pool->num_alloc;
+		*num_realloc += pool->num_realloc;
+		*num_reuse += pool->num_reuse;
+	}
+	pthread_mutex_unlock(&dstring_pool_lock);
+}
+
+
 /* ----------
  * slon_mkquery
  *
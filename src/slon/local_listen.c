@@ -436,10 +436,11 @@ localListenThread_main( /* @unused@ */ void *dummy)
 
 				rtcfg_dropSet(add_id);
 			}
-			else if (strcmp(ev_type, "SET_ADD_TABLE") == 0)
+			else if (strcmp(ev_type, "SET_ADD_TABLE") == 0 ||
+					 strcmp(ev_type, "SET_ADD_TABLES") == 0)
 			{
 				/*
-				 * SET_ADD_TABLE
+				 * SET_ADD_TABLE and SET_ADD_TABLES
 				 */
 
 				/*
@@ -448,10 +449,11 @@ localListenThread_main( /* @unused@ */ void *dummy)
 				 * the runtime configuration.
 				 */
 			}
-			else if (strcmp(ev_type, "SET_ADD_SEQUENCE") == 0)
+			else if (strcmp(ev_type, "SET_ADD_SEQUENCE") == 0 ||
+					 strcmp(ev_type, "SET_ADD_SEQUENCES") == 0)
 			{
 				/*
-				 * SET_ADD_SEQUENCE
+				 * SET_ADD_SEQUENCE and SET_ADD_SEQUENCES
 				 */
 
 				/*
@@ -0,0 +1,569 @@
+/*-------------------------------------------------------------------------
+ * metrics_thread.c
+ *
+ *	Implementation of the thread that serves the metrics endpoint.
+ *
+ *	The thread listens on a local TCP port and/or a Unix domain socket
+ *	and answers every request with the current in-memory counters in
+ *	the Prometheus text exposition format. Nothing in here talks to a
+ *	database.
+ *
+ *	Copyright (c) 2011, PostgreSQL Global Development Group
+ *-------------------------------------------------------------------------
+ */
+
+
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include "types.h"
+#include "slon.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* ----------
+ * Global variables
+ * ----------
+ */
+int			metrics_port;
+char	   *metrics_socket;
+
+#ifndef WIN32
+static int	metrics_listen_tcp(int port);
+static int	metrics_listen_unix(char *path);
+static void metrics_serve(int fd);
+static void metrics_build(SlonDString * ds);
+static void metrics_append(SlonDString * ds, const char *fmt,...);
+static time_t metrics_parse_timestamp(const char *ts);
+#endif
+
+
+/* ----------
+ * metricsThread_main
+ *
+ * Accept connections on the configured endpoints and answer each one
+ * with a metrics snapshot until the scheduler shuts down.
+ * ----------
+ */
+void *
+metricsThread_main(void *dummy)
+{
+#ifndef WIN32
+	int			tcp_fd = -1;
+	int			unix_fd = -1;
+	fd_set		rfds;
+	struct timeval tv;
+	int			maxfd;
+	int			rc;
+
+	slon_log(SLON_INFO, "metricsThread: thread starts\n");
+
+	if (metrics_port > 0)
+		tcp_fd = metrics_listen_tcp(metrics_port);
+	if (metrics_socket != NULL && metrics_socket[0] != '\0')
+		unix_fd = metrics_listen_unix(metrics_socket);
+	if (tcp_fd < 0 && unix_fd < 0)
+	{
+		slon_log(SLON_ERROR, "metricsThread: no endpoint to listen on "
+				 "- exit metrics thread\n");
+		pthread_exit(NULL);
+		return (void *) 0;
+	}
+
+	while (sched_get_status() == SCHED_STATUS_OK)
+	{
+		FD_ZERO(&rfds);
+		maxfd = -1;
+		if (tcp_fd >= 0)
+		{
+			FD_SET(tcp_fd, &rfds);
+			maxfd = tcp_fd;
+		}
+		if (unix_fd >= 0)
+		{
+			FD_SET(unix_fd, &rfds);
+			if (unix_fd > maxfd)
+				maxfd = unix_fd;
+		}
+
+		/*
+		 * Wake up once a second to notice a scheduler shutdown.
+		 */
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		rc = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			slon_log(SLON_ERROR, "metricsThread: select() - %s\n",
+					 strerror(errno));
+			break;
+		}
+		if (tcp_fd >= 0 && FD_ISSET(tcp_fd, &rfds))
+			metrics_serve(tcp_fd);
+		if (unix_fd >= 0 && FD_ISSET(unix_fd, &rfds))
+			metrics_serve(unix_fd);
+	}
+
+	if (tcp_fd >= 0)
+		close(tcp_fd);
+	if (unix_fd >= 0)
+	{
+		close(unix_fd);
+		unlink(metrics_socket);
+	}
+	slon_log(SLON_INFO, "metricsThread: thread done\n");
+#else
+	slon_log(SLON_WARN, "metricsThread: metrics endpoint is not "
+			 "supported on this platform\n");
+#endif
+	pthread_exit(NULL);
+	return (void *) 0;
+}
+
+
+#ifndef WIN32
+/* ----------
+ * metrics_listen_tcp
+ *
+ * Create the listening socket on the loopback interface.
+ * ----------
+ */
+static int
+metrics_listen_tcp(int port)
+{
+	int			fd;
+	int			on = 1;
+	struct sockaddr_in addr;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		slon_log(SLON_ERROR, "metricsThread: socket() - %s\n",
+				 strerror(errno));
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short) port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) & addr, sizeof(addr)) < 0 ||
+		listen(fd, 8) < 0)
+	{
+		slon_log(SLON_ERROR, "metricsThread: cannot listen on "
+				 "127.0.0.1:%d - %s\n", port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	slon_log(SLON_CONFIG, "metricsThread: listening on 127.0.0.1:%d\n",
+			 port);
+	return fd;
+}
+
+
+/* ----------
+ * metrics_listen_unix
+ *
+ * Create the listening Unix domain socket, replacing a stale one left
+ * behind by a previous slon.
+ * ----------
+ */
+static int
+metrics_listen_unix(char *path)
+{
+	int			fd;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		slon_log(SLON_ERROR, "metricsThread: socket path \"%s\" "
+				 "is too long\n", path);
+		return -1;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		slon_log(SLON_ERROR, "metricsThread: socket() - %s\n",
+				 strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) & addr, sizeof(addr)) < 0 ||
+		listen(fd, 8) < 0)
+	{
+		slon_log(SLON_ERROR, "metricsThread: cannot listen on "
+				 "\"%s\" - %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	slon_log(SLON_CONFIG, "metricsThread: listening on \"%s\"\n", path);
+	return fd;
+}
+
+
+/* ----------
+ * metrics_serve
+ *
+ * Accept one connection, swallow the request and answer it with a
+ * plain HTTP/1.0 response carrying the metrics. Scrapes are rare, so
+ * they are handled one at a time with short socket timeouts.
+ * ----------
+ */
+static void
+metrics_serve(int listen_fd)
+{
+	int			fd;
+	char		request[1024];
+	char		header[256];
+	struct timeval tv;
+	SlonDString body;
+	size_t		off;
+	ssize_t		n;
+
+	if ((fd = accept(listen_fd, NULL, NULL)) < 0)
+	{
+		if (errno != EINTR && errno != EAGAIN)
+			slon_log(SLON_WARN, "metricsThread: accept() - %s\n",
+					 strerror(errno));
+		return;
+	}
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char *) &tv, sizeof(tv));
+
+	/*
+	 * We answer every request the same way, so only wait for the end of
+	 * the request header (or a full buffer) before responding.
+	 */
+	off = 0;
+	while (off < sizeof(request) - 1)
+	{
+		n = recv(fd, request + off, sizeof(request) - 1 - off, 0);
+		if (n <= 0)
+			break;
+		off += n;
+		request[off] = '\0';
+		if (strstr(request, "\r\n\r\n") != NULL ||
+			strstr(request, "\n\n") != NULL)
+			break;
+	}
+
+	dstring_init(&body);
+	metrics_build(&body);
+
+	snprintf(header, sizeof(header),
+			 "HTTP/1.0 200 OK\r\n"
+			 "Content-Type: text/plain; version=0.0.4\r\n"
+			 "Content-Length: %d\r\n"
+			 "Connection: close\r\n\r\n",
+			 (int) body.n_used);
+
+	if (send(fd, header, strlen(header), MSG_NOSIGNAL) > 0)
+	{
+		off = 0;
+		while (off < body.n_used)
+		{
+			n = send(fd, dstring_data(&body) + off, body.n_used - off,
+					 MSG_NOSIGNAL);
+			if (n <= 0)
+				break;
+			off += n;
+		}
+	}
+
+	dstring_free(&body);
+	close(fd);
+}
+
+
+/* ----------
+ * metrics_build
+ *
+ * Render all metrics into ds. Only in-memory state is used: the runtime
+ * configuration's node list, the remote worker counters kept in each
+ * SlonNode, the scheduler wait queue and the dstring pool counters.
+ * ----------
+ */
+static void
+metrics_build(SlonDString * ds)
+{
+	SlonNode   *node;
+	time_t		now;
+	time_t		evtime;
+	int			num_sock;
+	int			num_sleep;
+	int64		ds_alloc;
+	int64		ds_realloc;
+	int64		ds_reuse;
+	SlonDString events,
+				queue,
+				lag,
+				lag_sec,
+				counters;
+
+	now = time(NULL);
+
+	metrics_append(ds,
+				   "# HELP slon_info Cluster and local node served by this slon\n"
+				   "# TYPE slon_info gauge\n"
+				   "slon_info{cluster=\"%s\",node=\"%d\"} 1\n",
+				   rtcfg_cluster_name, rtcfg_nodeid);
+
+	/*
+	 * Per origin values. Collect them into separate strings so that each
+	 * metric family comes out as one block.
+	 */
+	dstring_init(&events);
+	dstring_init(&queue);
+	dstring_init(&lag);
+	dstring_init(&lag_sec);
+	dstring_init(&counters);
+
+	rtcfg_lock();
+	for (node = rtcfg_node_list_head; node; node = node->next)
+	{
+		int64		last_event;
+		int64		last_seqno;
+		int			message_events;
+		int			message_pool_size;
+		SlonNodeStats stat;
+
+		if (node->no_id == rtcfg_nodeid ||
+			node->worker_status == SLON_TSTAT_NONE)
+			continue;
+
+		pthread_mutex_lock(&(node->message_lock));
+		last_event = node->last_event;
+		message_events = node->message_events;
+		message_pool_size = node->message_pool_size;
+		stat = node->stats;
+		pthread_mutex_unlock(&(node->message_lock));
+		last_seqno = stat.last_seqno;
+
+		metrics_append(&events,
+					   "slon_node_last_event_received{origin=\"%d\"} "
+					   INT64_FORMAT "\n"
+					   "slon_node_last_event_processed{origin=\"%d\"} "
+					   INT64_FORMAT "\n",
+					   node->no_id, last_event,
+					   node->no_id, last_seqno);
+		metrics_append(&queue,
+					   "slon_worker_queue_events{origin=\"%d\"} %d\n"
+					   "slon_worker_event_pool_buffers{origin=\"%d\"} %d\n",
+					   node->no_id, message_events,
+					   node->no_id, message_pool_size);
+		if (last_seqno > 0 && last_event >= last_seqno)
+			metrics_append(&lag,
+						   "slon_node_event_lag_events{origin=\"%d\"} "
+						   INT64_FORMAT "\n",
+						   node->no_id, last_event - last_seqno);
+		evtime = metrics_parse_timestamp(stat.last_timestamp);
+		if (evtime > 0)
+			metrics_append(&lag_sec,
+						   "slon_node_event_lag_seconds{origin=\"%d\"} %d\n",
+						   node->no_id,
+						   (int) ((now > evtime) ? now - evtime : 0));
+		metrics_append(&counters,
+					   "slon_events_processed_total{origin=\"%d\"} "
+					   INT64_FORMAT "\n"
+					   "slon_sync_events_total{origin=\"%d\"} "
+					   INT64_FORMAT "\n"
+					   "slon_sync_groups_total{origin=\"%d\"} "
+					   INT64_FORMAT "\n"
+					   "slon_sync_log_rows_total{origin=\"%d\"} "
+					   INT64_FORMAT "\n"
+					   "slon_sync_copy_bytes_total{origin=\"%d\"} "
+					   INT64_FORMAT "\n"
+					   "slon_sync_seconds_total{origin=\"%d\"} %.3f\n"
+					   "slon_sync_copy_seconds_total{origin=\"%d\"} %.3f\n",
+					   node->no_id, stat.events,
+					   node->no_id, stat.syncs,
+					   node->no_id, stat.sync_groups,
+					   node->no_id, stat.log_rows,
+					   node->no_id, stat.copy_bytes,
+					   node->no_id, stat.sync_time,
+					   node->no_id, stat.copy_time);
+	}
+	rtcfg_unlock();
+
+	metrics_append(ds,
+				   "# HELP slon_node_last_event_received Highest event sequence number received per origin\n"
+				   "# TYPE slon_node_last_event_received gauge\n"
+				   "# HELP slon_node_last_event_processed Event sequence number last processed by the remote worker\n"
+				   "# TYPE slon_node_last_event_processed gauge\n"
+				   "%s"
+				   "# HELP slon_node_event_lag_events Events received but not yet processed\n"
+				   "# TYPE slon_node_event_lag_events gauge\n"
+				   "%s"
+				   "# HELP slon_node_event_lag_seconds Age of the last processed event according to its origin timestamp\n"
+				   "# TYPE slon_node_event_lag_seconds gauge\n"
+				   "%s"
+				   "# HELP slon_worker_queue_events Events queued for the remote worker\n"
+				   "# TYPE slon_worker_queue_events gauge\n"
+				   "# HELP slon_worker_event_pool_buffers Recycled event buffers held by the remote worker\n"
+				   "# TYPE slon_worker_event_pool_buffers gauge\n"
+				   "%s",
+				   dstring_data(&events), dstring_data(&lag),
+				   dstring_data(&lag_sec), dstring_data(&queue));
+	metrics_append(ds,
+				   "# HELP slon_events_processed_total Events processed by the remote worker\n"
+				   "# TYPE slon_events_processed_total counter\n"
+				   "# HELP slon_sync_events_total SYNC events applied\n"
+				   "# TYPE slon_sync_events_total counter\n"
+				   "# HELP slon_sync_groups_total SYNC groups applied\n"
+				   "# TYPE slon_sync_groups_total counter\n"
+				   "# HELP slon_sync_log_rows_total Log rows copied from providers\n"
+				   "# TYPE slon_sync_log_rows_total counter\n"
+				   "# HELP slon_sync_copy_bytes_total Bytes of log data copied from providers\n"
+				   "# TYPE slon_sync_copy_bytes_total counter\n"
+				   "# HELP slon_sync_seconds_total Time spent applying SYNC groups\n"
+				   "# TYPE slon_sync_seconds_total counter\n"
+				   "# HELP slon_sync_copy_seconds_total Time spent selecting and copying log rows\n"
+				   "# TYPE slon_sync_copy_seconds_total counter\n"
+				   "%s",
+				   dstring_data(&counters));
+
+	dstring_free(&events);
+	dstring_free(&queue);
+	dstring_free(&lag);
+	dstring_free(&lag_sec);
+	dstring_free(&counters);
+
+	sched_get_waitqueue(&num_sock, &num_sleep);
+	metrics_append(ds,
+				   "# HELP slon_scheduler_waitqueue Threads waiting in the scheduler\n"
+				   "# TYPE slon_scheduler_waitqueue gauge\n"
+				   "slon_scheduler_waitqueue{wait=\"socket\"} %d\n"
+				   "slon_scheduler_waitqueue{wait=\"sleep\"} %d\n",
+				   num_sock, num_sleep);
+
+	slon_dstring_stats(&ds_alloc, &ds_realloc, &ds_reuse);
+	metrics_append(ds,
+				   "# HELP slon_dstring_buffers_total Query buffer allocations\n"
+				   "# TYPE slon_dstring_buffers_total counter\n"
+				   "slon_dstring_buffers_total{op=\"malloc\"} " INT64_FORMAT "\n"
+				   "slon_dstring_buffers_total{op=\"realloc\"} " INT64_FORMAT "\n"
+				   "slon_dstring_buffers_total{op=\"reuse\"} " INT64_FORMAT "\n",
+				   ds_alloc, ds_realloc, ds_reuse);
+}
+
+
+/* ----------
+ * metrics_append
+ *
+ * printf style append to a dstring.
+ * ----------
+ */
+static void
+metrics_append(SlonDString * ds, const char *fmt,...)
+{
+	va_list		ap;
+	char		buf[1024];
+	char	   *big;
+	int			len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len < sizeof(buf))
+	{
+		dstring_append(ds, buf);
+		dstring_terminate(ds);
+		return;
+	}
+
+	big = malloc(len + 1);
+	if (big == NULL)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(big, len + 1, fmt, ap);
+	va_end(ap);
+	dstring_append(ds, big);
+	dstring_terminate(ds);
+	free(big);
+}
+
+
+/* ----------
+ * metrics_parse_timestamp
+ *
+ * Convert an ISO timestamptz as delivered by the server
+ * ("YYYY-MM-DD HH:MM:SS[.frac]+HH[:MM]") into a time_t. Returns 0 if the
+ * string cannot be parsed.
+ * ----------
+ */
+static time_t
+metrics_parse_timestamp(const char *ts)
+{
+	int			y,
+				m,
+				d,
+				hh,
+				mi,
+				ss;
+	int			tzh = 0,
+				tzm = 0;
+	int			sign = 1;
+	int64		days;
+	const char *cp;
+
+	if (ts == NULL || sscanf(ts, "%d-%d-%d %d:%d:%d",
+							 &y, &m, &d, &hh, &mi, &ss) != 6)
+		return 0;
+
+	/*
+	 * Skip fractional seconds and find the zone offset.
+	 */
+	cp = strchr(ts, ':');
+	if (cp != NULL)
+		cp = strchr(cp + 1, ':');
+	if (cp == NULL)
+		return 0;
+	for (cp++; *cp != '\0' && *cp != '+' && *cp != '-'; cp++)
+		;
+	if (*cp == '-')
+		sign = -1;
+	if (*cp != '\0')
+	{
+		if (sscanf(cp + 1, "%d:%d", &tzh, &tzm) < 1)
+			return 0;
+	}
+
+	/*
+	 * Days since 1970-01-01 of the proleptic Gregorian calendar.
+	 */
+	y -= (m <= 2);
+	days = (int64) 365 * y + y / 4 - y / 100 + y / 400 +
+		(153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1 - 719468;
+
+	return (time_t) (days * 86400 + hh * 3600 + mi * 60 + ss -
+					 sign * (tzh * 3600 + tzm * 60));
+}
+#endif   /* !WIN32 */
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
@@ -64,6 +65,76 @@ static void write_syslog(int level, const char *line);
 #endif   /* HAVE_SYSLOG */
 
 
+/* ----------
+ * Asynchronous logging
+ *
+ * Once slon_log_start() has been called, slon_log() formats messages into a
+ * buffer of the calling thread and appends them to an in-memory queue. A
+ * dedicated writer thread takes them from there and does the actual
+ * stdout/syslog output, so that a thread logging at DEBUG levels does not
+ * wait for the terminal, a pipe or syslog.
+ *
+ * FATAL and ERROR messages, messages that don't fit into the queue and
+ * everything logged while the writer is not running are written
+ * synchronously, after any queued messages, so nothing is lost when a
+ * thread subsequently calls slon_abort() or slon_retry().
+ * ----------
+ */
+int			log_queue_size;		/* queue size in kB, 0 = synchronous */
+bool		log_queue_drop;		/* drop messages when the queue is full */
+
+typedef struct
+{
+	int			level;			/* -1 marks the unused end of the ring */
+	int			len;			/* message length without terminator */
+	char		data[1];
+}	LogQueueEntry;
+
+#define LOGQ_ALIGN(_n)		(((_n) + 7) & ~((size_t) 7))
+#define LOGQ_ENTRY_SIZE(_len) \
+	LOGQ_ALIGN(offsetof(LogQueueEntry, data) + (_len) + 1)
+
+static char *logq_buf = NULL;
+static size_t logq_size = 0;
+static size_t logq_head = 0;
+static size_t logq_tail = 0;
+static size_t logq_used = 0;
+static int64 logq_dropped = 0;
+static bool logq_running = false;
+static bool logq_stop = false;
+static pthread_t logq_writer;
+static pthread_mutex_t logq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logq_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t logq_space_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Per thread formatting buffer, including the last timestamp so that
+ * strftime() runs at most once per second and thread.
+ */
+typedef struct
+{
+	char	   *buf;
+	size_t		size;
+	time_t		stamp_time;
+	char		time_buf[128];
+}	SlonLogBuf;
+
+static pthread_key_t logbuf_key;
+static pthread_once_t logbuf_once = PTHREAD_ONCE_INIT;
+
+/* Output buffer of the writer, protected by log_mutex */
+static char *logw_buf = NULL;
+static size_t logw_size = 0;
+
+static void logbuf_init(void);
+static void logbuf_destroy(void *arg);
+static SlonLogBuf *logbuf_get(void);
+static const char *log_level_name(int level);
+static void log_emit(int level, const char *line);
+static void log_write_queued(void);
+static void *log_writer_main(void *dummy);
+
+
 /* ----------
  * slon_log
  * ----------
@@ -72,95 +143,28 @@ void
 slon_log(Slon_Log_Level level, char *fmt,...)
 {
 	va_list		ap;
-	static char *outbuf = NULL;
-	static int	outsize = -1;
-	int			off;
-	int			len;
-	char	   *level_c = NULL;
-
-	char		time_buf[128];	/* Buffer to hold timestamp */
-	char		ps_buf[20];		/* Buffer to hold PID */
-	time_t		stamp_time = time(NULL);
 	va_list		apcopy;
+	SlonLogBuf *lb;
+	size_t		off;
+	size_t		len;
+	size_t		esz;
+	size_t		waste;
+	int			n;
+	time_t		stamp_time;
+	LogQueueEntry *entry;
+	char		ps_buf[20];		/* Buffer to hold PID */
 
-#ifdef HAVE_SYSLOG
-	int			syslog_level = LOG_ERR;
-#endif
+	/*
+	 * Check the level first, messages we don't want are never formatted.
+	 */
 	if (level > slon_log_level)
 		return;
-	switch (level)
-	{
-		case SLON_DEBUG4:
-			level_c = "DEBUG4";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_DEBUG;
-#endif
-			break;
-		case SLON_DEBUG3:
-			level_c = "DEBUG3";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_DEBUG;
-#endif
-			break;
-		case SLON_DEBUG2:
-			level_c = "DEBUG2";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_DEBUG;
-#endif
-			break;
-		case SLON_DEBUG1:
-			level_c = "DEBUG1";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_DEBUG;
-#endif
-			break;
-		case SLON_INFO:
-			level_c = "INFO";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_INFO;
-#endif
-			break;
-		case SLON_CONFIG:
-			level_c = "CONFIG";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_WARNING;
-#endif
-			break;
-		case SLON_WARN:
-			level_c = "WARN";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_WARNING;
-#endif
-			break;
-		case SLON_ERROR:
-			level_c = "ERROR";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_ERR;
-#endif
-			break;
-		case SLON_FATAL:
-			level_c = "FATAL";
-#ifdef HAVE_SYSLOG
-			syslog_level = LOG_ERR;
-#endif
-			break;
-	}
-
-	va_start(ap, fmt);
 
-	pthread_mutex_lock(&log_mutex);
-	if (outbuf == NULL)
+	if ((lb = logbuf_get()) == NULL)
 	{
-		outsize = 8192;
-		outbuf = malloc((size_t) outsize);
-		if (outbuf == NULL)
-		{
-			perror("slon_log: malloc()");
-			pthread_mutex_unlock(&log_mutex);
-			slon_retry();
-		}
+		perror("slon_log: malloc()");
+		return;
 	}
-	outbuf[0] = (char) 0;
 
 	if (logtimestamp == true && (Use_syslog != 1)
 #ifdef WIN32
@@ -168,69 +172,427 @@ slon_log(Slon_Log_Level level, char *fmt,...)
 #endif
 		)
 	{
-		len = (int) strftime(time_buf, sizeof(time_buf), log_timestamp_format, localtime(&stamp_time));
-		if (len == 0 && time_buf[0] != '\0')
+		stamp_time = time(NULL);
+		if (stamp_time != lb->stamp_time)
 		{
-			perror("slon_log: problem with strftime()");
-			slon_retry();
+			struct tm	tmbuf;
+
+#ifndef WIN32
+			localtime_r(&stamp_time, &tmbuf);
+#else
+			tmbuf = *localtime(&stamp_time);
+#endif
+			if (strftime(lb->time_buf, sizeof(lb->time_buf),
+						 log_timestamp_format, &tmbuf) == 0)
+				lb->time_buf[0] = '\0';
+			lb->stamp_time = stamp_time;
 		}
 	}
 	else
 	{
-		time_buf[0] = (char) 0;
+		lb->time_buf[0] = '\0';
+		lb->stamp_time = 0;
 	}
 
 	if (logpid == true)
-	{
 		sprintf(ps_buf, "[%d] ", slon_pid);
-	}
 	else
-	{
 		ps_buf[0] = (char) 0;
-	}
 
-	sprintf(outbuf, "%s%s%-6.6s ", time_buf, ps_buf, level_c);
+	off = (size_t) snprintf(lb->buf, lb->size, "%s%s%-6.6s ",
+							lb->time_buf, ps_buf, log_level_name(level));
 
-	off = (int) strlen(outbuf);
-	va_copy(apcopy, ap);
-	while (vsnprintf(&outbuf[off], (size_t) (outsize - off), fmt, apcopy) >= outsize - off - 1)
+	va_start(ap, fmt);
+	while (true)
 	{
-		outsize *= 2;
-		outbuf = realloc(outbuf, (size_t) outsize);
-		if (outbuf == NULL)
+		va_copy(apcopy, ap);
+		n = vsnprintf(&lb->buf[off], lb->size - off, fmt, apcopy);
+		va_end(apcopy);
+		if (n >= 0 && (size_t) n < lb->size - off)
+			break;
+
+		lb->size *= 2;
+		lb->buf = realloc(lb->buf, lb->size);
+		if (lb->buf == NULL)
 		{
 			perror("slon_log: realloc()");
-			slon_retry();
+			lb->size = 0;
+			va_end(ap);
+			return;
 		}
-		va_end(apcopy);
-		va_copy(apcopy, ap);
 	}
+	va_end(ap);
+	len = off + (size_t) n;
+
+	/*
+	 * Write synchronously if there is no writer thread, if the message is
+	 * serious or if it is too large to be sure to fit into the queue once
+	 * the writer has caught up.
+	 */
+	esz = LOGQ_ENTRY_SIZE(len);
+	if (!logq_running || level <= SLON_ERROR || esz > logq_size / 2)
+	{
+		pthread_mutex_lock(&log_mutex);
+		log_write_queued();
+		log_emit(level, lb->buf);
+		(void) fflush(stdout);
+		pthread_mutex_unlock(&log_mutex);
+		return;
+	}
+
+	/*
+	 * Wait for (or give up on) enough space in the queue. An entry never
+	 * wraps around, so if it does not fit into the rest of the ring we also
+	 * need the space up to the end of it. An empty queue starts over at the
+	 * beginning of the buffer.
+	 */
+	pthread_mutex_lock(&logq_lock);
+	while (true)
+	{
+		if (logq_used == 0)
+			logq_head = logq_tail = 0;
+		waste = (logq_head + esz > logq_size) ? logq_size - logq_head : 0;
+		if (logq_used + waste + esz <= logq_size)
+			break;
+		if (log_queue_drop)
+		{
+			logq_dropped++;
+			pthread_mutex_unlock(&logq_lock);
+			return;
+		}
+		pthread_cond_wait(&logq_space_cond, &logq_lock);
+	}
+	if (waste > 0)
+	{
+		((LogQueueEntry *) (logq_buf + logq_head))->level = -1;
+		logq_used += waste;
+		logq_head = 0;
+	}
+	entry = (LogQueueEntry *) (logq_buf + logq_head);
+	entry->level = (int) level;
+	entry->len = (int) len;
+	memcpy(entry->data, lb->buf, len + 1);
+	logq_head += esz;
+	if (logq_head == logq_size)
+		logq_head = 0;
+	logq_used += esz;
+	pthread_cond_signal(&logq_cond);
+	pthread_mutex_unlock(&logq_lock);
+}
+
+
+/* ----------
+ * slon_log_start
+ *
+ * Create the log queue and start the writer thread. Called by the slon
+ * worker process before it starts its other threads.
+ * ----------
+ */
+void
+slon_log_start(void)
+{
+	if (log_queue_size <= 0 || logq_running)
+		return;
+
+	logq_size = LOGQ_ALIGN((size_t) log_queue_size * 1024);
+	logq_buf = malloc(logq_size);
+	if (logq_buf == NULL)
+	{
+		slon_log(SLON_WARN, "slon_log_start: malloc() - %s - "
+				 "using synchronous logging\n", strerror(errno));
+		return;
+	}
+	logq_head = logq_tail = logq_used = 0;
+	logq_stop = false;
+
+	if (pthread_create(&logq_writer, NULL, log_writer_main, NULL) != 0)
+	{
+		slon_log(SLON_WARN, "slon_log_start: cannot create log writer "
+				 "thread - %s - using synchronous logging\n",
+				 strerror(errno));
+		free(logq_buf);
+		logq_buf = NULL;
+		return;
+	}
+	logq_running = true;
+	atexit(slon_log_flush);
+}
+
+
+/* ----------
+ * slon_log_stop
+ *
+ * Write out all queued messages and terminate the writer thread.
+ * ----------
+ */
+void
+slon_log_stop(void)
+{
+	if (!logq_running)
+		return;
+
+	pthread_mutex_lock(&logq_lock);
+	logq_stop = true;
+	pthread_cond_signal(&logq_cond);
+	pthread_mutex_unlock(&logq_lock);
+	pthread_join(logq_writer, NULL);
+
+	logq_running = false;
+	slon_log_flush();
+}
+
+
+/* ----------
+ * slon_log_flush
+ *
+ * Write out all currently queued messages from the calling thread. Used
+ * before the worker process gets terminated by the watchdog.
+ * ----------
+ */
+void
+slon_log_flush(void)
+{
+	if (logq_buf == NULL)
+		return;
+
+	pthread_mutex_lock(&log_mutex);
+	log_write_queued();
+	(void) fflush(stdout);
+	pthread_mutex_unlock(&log_mutex);
+}
+
+
+/* ----------
+ * log_writer_main
+ *
+ * The log writer thread.
+ * ----------
+ */
+static void *
+log_writer_main(void *dummy)
+{
+	while (true)
+	{
+		pthread_mutex_lock(&logq_lock);
+		while (logq_used == 0 && !logq_stop)
+			pthread_cond_wait(&logq_cond, &logq_lock);
+		if (logq_used == 0 && logq_stop)
+		{
+			pthread_mutex_unlock(&logq_lock);
+			break;
+		}
+		pthread_mutex_unlock(&logq_lock);
+
+		pthread_mutex_lock(&log_mutex);
+		log_write_queued();
+		(void) fflush(stdout);
+		pthread_mutex_unlock(&log_mutex);
+	}
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
+
+/* ----------
+ * log_write_queued
+ *
+ * Take all messages out of the queue and write them. Each message is
+ * copied out so the queue lock is not held during the output. The
+ * caller must hold log_mutex, which keeps the messages in order.
+ * ----------
+ */
+static void
+log_write_queued(void)
+{
+	LogQueueEntry *entry;
+	int			level;
+	size_t		need;
+	bool		copied;
+	int64		dropped;
+	char		buf[128];
+
+	if (logq_buf == NULL)
+		return;
+
+	while (true)
+	{
+		pthread_mutex_lock(&logq_lock);
+		if (logq_used == 0)
+		{
+			dropped = logq_dropped;
+			logq_dropped = 0;
+			pthread_mutex_unlock(&logq_lock);
+			break;
+		}
+		entry = (LogQueueEntry *) (logq_buf + logq_tail);
+		if (entry->level == -1)
+		{
+			logq_used -= logq_size - logq_tail;
+			logq_tail = 0;
+			if (logq_used == 0)
+				logq_head = 0;
+			pthread_mutex_unlock(&logq_lock);
+			continue;
+		}
+		level = entry->level;
+		need = (size_t) entry->len + 1;
+		if (logw_size < need)
+		{
+			char	   *nbuf = realloc(logw_buf, need);
+
+			if (nbuf != NULL)
+			{
+				logw_buf = nbuf;
+				logw_size = need;
+			}
+		}
+		copied = (logw_size >= need);
+		if (copied)
+			memcpy(logw_buf, entry->data, need);
+		else
+		{
+			/* Out of memory, write it while holding the queue lock */
+			log_emit(level, entry->data);
+		}
+		logq_tail += LOGQ_ENTRY_SIZE(entry->len);
+		if (logq_tail == logq_size)
+			logq_tail = 0;
+		logq_used -= LOGQ_ENTRY_SIZE(entry->len);
+		if (logq_used == 0)
+			logq_head = logq_tail = 0;
+		pthread_cond_broadcast(&logq_space_cond);
+		pthread_mutex_unlock(&logq_lock);
+
+		if (copied)
+			log_emit(level, logw_buf);
+	}
+
+	if (dropped > 0)
+	{
+		snprintf(buf, sizeof(buf), "%-6.6s slon_log: " INT64_FORMAT
+				 " messages dropped - log queue full\n",
+				 log_level_name(SLON_WARN), dropped);
+		log_emit(SLON_WARN, buf);
+	}
+}
 
-	va_end(apcopy);
 
+/* ----------
+ * log_emit
+ *
+ * Send one formatted message to syslog, the event log and/or stdout.
+ * ----------
+ */
+static void
+log_emit(int level, const char *line)
+{
 #ifdef HAVE_SYSLOG
+	int			syslog_level;
+
 	if (Use_syslog >= 1)
 	{
-		write_syslog(syslog_level, outbuf);
+		if (level >= SLON_DEBUG1)
+			syslog_level = LOG_DEBUG;
+		else if (level == SLON_INFO)
+			syslog_level = LOG_INFO;
+		else if (level >= SLON_WARN)
+			syslog_level = LOG_WARNING;
+		else
+			syslog_level = LOG_ERR;
+		write_syslog(syslog_level, line);
 	}
 #endif
 #ifdef WIN32
 	if (win32_isservice)
-		win32_eventlog(level, outbuf);
+		win32_eventlog(level, (char *) line);
 #endif
 #ifdef HAVE_SYSLOG
 	if (Use_syslog != 2)
-	{
-		(void) fwrite(outbuf, strlen(outbuf), 1, stdout);
-		(void) fflush(stdout);
-	}
+		(void) fwrite(line, strlen(line), 1, stdout);
 #else
-	(void) fwrite(outbuf, strlen(outbuf), 1, stdout);
-	(void) fflush(stdout);
+	(void) fwrite(line, strlen(line), 1, stdout);
 #endif
-	pthread_mutex_unlock(&log_mutex);
+}
 
-	va_end(ap);
+
+/* ----------
+ * log_level_name
+ * ----------
+ */
+static const char *
+log_level_name(int level)
+{
+	switch (level)
+	{
+		case SLON_DEBUG4:
+			return "DEBUG4";
+		case SLON_DEBUG3:
+			return "DEBUG3";
+		case SLON_DEBUG2:
+			return "DEBUG2";
+		case SLON_DEBUG1:
+			return "DEBUG1";
+		case SLON_INFO:
+			return "INFO";
+		case SLON_CONFIG:
+			return "CONFIG";
+		case SLON_WARN:
+			return "WARN";
+		case SLON_ERROR:
+			return "ERROR";
+		case SLON_FATAL:
+			return "FATAL";
+	}
+	return "";
+}
+
+
+/* ----------
+ * logbuf_get
+ *
+ * Return the calling thread's formatting buffer.
+ * ----------
+ */
+static void
+logbuf_init(void)
+{
+	pthread_key_create(&logbuf_key, logbuf_destroy);
+}
+
+static void
+logbuf_destroy(void *arg)
+{
+	SlonLogBuf *lb = (SlonLogBuf *) arg;
+
+	free(lb->buf);
+	free(lb);
+}
+
+static SlonLogBuf *
+logbuf_get(void)
+{
+	SlonLogBuf *lb;
+
+	pthread_once(&logbuf_once, logbuf_init);
+	lb = (SlonLogBuf *) pthread_getspecific(logbuf_key);
+	if (lb != NULL && lb->buf != NULL)
+		return lb;
+
+	if (lb == NULL)
+	{
+		lb = (SlonLogBuf *) malloc(sizeof(SlonLogBuf));
+		if (lb == NULL)
+			return NULL;
+		memset(lb, 0, sizeof(SlonLogBuf));
+		pthread_setspecific(logbuf_key, lb);
+	}
+	lb->size = 8192;
+	lb->buf = malloc(lb->size);
+	if (lb->buf == NULL)
+		return NULL;
+
+	return lb;
 }
 
 
@@ -19,6 +19,9 @@ typedef enum
 }	Slon_Log_Level;
 
 extern void slon_log(Slon_Log_Level level, char *fmt,...);
+extern void slon_log_start(void);
+extern void slon_log_stop(void);
+extern void slon_log_flush(void);
 
 extern int	slon_scanint64(char *str, int64 *result);
 #endif
@@ -63,6 +63,11 @@ monitorThread_main(void *dummy)
 	PGresult   *res;
 	SlonState	state;
 	ScheduleStatus rc;
+	int64		ds_alloc,
+				ds_realloc,
+				ds_reuse;
+	int64		ds_last = -1;
+	char		ds_activity[256];
 
 	slon_log(SLON_INFO,
 			 "monitorThread: thread starts\n");
@@ -125,6 +130,22 @@ monitorThread_main(void *dummy)
 		{
 			int			qlen;
 
+			/*
+			 * Report the dstring buffer allocation counters as a component
+			 * of their own whenever they changed.
+			 */
+			slon_dstring_stats(&ds_alloc, &ds_realloc, &ds_reuse);
+			if (ds_alloc + ds_realloc + ds_reuse != ds_last)
+			{
+				ds_last = ds_alloc + ds_realloc + ds_reuse;
+				snprintf(ds_activity, sizeof(ds_activity),
+						 "dstring buffers: " INT64_FORMAT " malloc, "
+						 INT64_FORMAT " realloc, " INT64_FORMAT " reused",
+						 ds_alloc, ds_realloc, ds_reuse);
+				monitor_state("dstring_pool", 0, 0, ds_activity,
+							  ds_alloc, "n/a");
+			}
+
 			pthread_mutex_lock(&stack_lock);	/* lock access to stack size */
 			qlen = stack_size;
 			pthread_mutex_unlock(&stack_lock);
@@ -220,13 +241,13 @@ monitorThread_main(void *dummy)
 			}
 		}
 		monitor_state("local_monitor", 0, (pid_t) conn->conn_pid, "just running", 0, "n/a");
+
+		dstring_free(&beginquery);
+		dstring_free(&commitquery);
+		slon_disconnectdb(conn);
 	}
 	slon_log(SLON_CONFIG, "monitorThread: exit main loop\n");
 
-	dstring_free(&beginquery);
-	dstring_free(&commitquery);
-	slon_disconnectdb(conn);
-
 	slon_log(SLON_INFO, "monitorThread: thread done\n");
 	monitor_threads = false;
 	pthread_exit(NULL);
@@ -636,6 +636,7 @@ remoteListen_receive_events(SlonNode * node, SlonConn * conn,
 	PGresult   *res;
 	int			ntuples;
 	int			tupno;
+	int			num_origins = 0;
 	time_t		timeout;
 	time_t		now;
 
@@ -685,6 +686,22 @@ remoteListen_receive_events(SlonNode * node, SlonConn * conn,
 			dstring_free(&query);
 			return -1;
 		}
+
+		/*
+		 * If the worker for this origin still has a full queue, don't
+		 * select more events for it now. We pick them up again once the
+		 * worker has made room.
+		 */
+		if (remoteWorker_queue_full(origin))
+		{
+			slon_log(SLON_DEBUG2,
+					 "remoteListenThread_%d: queue for origin %d is full "
+					 "- deferring event selection\n",
+					 node->no_id, listat->li_origin);
+			listat = listat->next;
+			continue;
+		}
+
 		sprintf(seqno_buf, INT64_FORMAT, origin->last_event);
 		slon_appendquery(&query,
 						 " %s (e.ev_origin = '%d' and e.ev_seqno > '%s')",
@@ -692,10 +709,25 @@ remoteListen_receive_events(SlonNode * node, SlonConn * conn,
 
 		where_or_or = "or";
 		listat = listat->next;
+		num_origins++;
 	}
 	if (lag_interval)
 	{
 		slon_appendquery(&query, ")");
+		dstring_free(&q2);
+	}
+
+	/*
+	 * All the workers we feed are backed up. Check again after the normal
+	 * sync interval.
+	 */
+	if (num_origins == 0)
+	{
+		rtcfg_unlock();
+		dstring_free(&query);
+		poll_sleep = sync_interval;
+		monitor_state("remote listener", node->no_id, conn->conn_pid, "thread main loop", 0, "n/a");
+		return 0;
 	}
 
 	/*
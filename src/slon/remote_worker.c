@@ -19,6 +19,9 @@
 #include <errno.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 #ifndef WIN32
 #include <unistd.h>
 #include <sys/time.h>
@@ -27,10 +30,18 @@
 
 #include "slon.h"
 #include "../parsestatements/scanner.h"
-extern int	STMTS[MAXSTATEMENTS];
 
 #define MAXGROUPSIZE 10000		/* What is the largest number of SYNCs we'd
 								 * want to group together??? */
+#define MAXEVENTBATCH 1000		/* Configuration events applied in one local
+								 * transaction */
+
+#define SLON_EVENT_BUFSIZE_MIN	1024	/* Smallest event message buffer */
+
+#define ARCHIVE_INDEX_NAME	"slony1_archive_index"	/* in archive_dir */
+#define ARCHIVE_GZ_BLOCK_SIZE	(1024 * 1024)	/* input bytes between full
+												 * flushes of a compressed
+												 * archive */
 
 
 /* ----------
@@ -59,6 +70,7 @@ struct SlonWorkMsg_event_s
 	SlonWorkMsg_event *prev;
 	SlonWorkMsg_event *next;
 
+	int			msg_alloc;		/* allocated size of this buffer */
 	int			event_provider;
 
 	int			ev_origin;
@@ -165,6 +177,19 @@ struct PerfMon_s
 	int			num_truncates;
 };
 
+typedef struct SyncMetrics_s SyncMetrics;	/* Timing breakdown of one SYNC
+											 * group, see sl_sync_metrics */
+struct SyncMetrics_s
+{
+	double		prov_query_t;	/* Control queries against the provider(s) */
+	double		first_row_t;	/* Log selection until the first row */
+	double		copy_t;			/* Streaming the log rows after that */
+	double		apply_t;		/* Queries against the local node */
+	double		total_t;		/* All of sync_event() */
+	int64		log_rows;		/* Number of sl_log rows copied */
+	int64		copy_bytes;		/* Number of bytes of log data copied */
+};
+
 struct ProviderInfo_s
 {
 	int			no_id;
@@ -175,7 +200,6 @@ struct ProviderInfo_s
 	WorkerGroupData *wd;
 
 	SlonDString helper_query;
-	int			log_status;
 
 	ProviderSet *set_head;
 	ProviderSet *set_tail;
@@ -195,6 +219,9 @@ struct WorkerGroupData_s
 	ProviderInfo *provider_tail;
 
 	char		duration_buf[64];
+	SyncMetrics metrics;
+	double		commit_t;		/* Final round trip of the previous SYNC
+								 * group, see sl_sync_metrics */
 };
 
 
@@ -218,6 +245,25 @@ static pthread_mutex_t node_confirm_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int			sync_group_maxsize;
 int			explain_interval;
+int			remote_queue_maxsize;
+int			sync_metrics_size;
+int			archive_compression;
+int			archive_rollover_size;
+int			archive_rollover_interval;
+bool		archive_fsync;
+bool		sync_shared_fetch;
+#ifndef HAVE_LIBZ
+static bool archive_gz_warned = false;
+#endif
+
+/*
+ * The one log archive in progress, if any, and whether the archives of a
+ * previous slon process have been recovered.
+ */
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+static SlonNode *archive_open_node = NULL;
+static bool archive_recovered = false;
+
 time_t		explain_lastsec;
 int			explain_thistime;
 
@@ -245,13 +291,22 @@ static void monitor_provider_query(PerfMon * pm);
 static void monitor_subscriber_query(PerfMon * pm);
 static void monitor_subscriber_iud(PerfMon * pm);
 
+static SlonWorkMsg_event *remoteWorker_event_alloc(SlonNode * node, int len);
+static void remoteWorker_event_release(SlonNode * node,
+						   SlonWorkMsg_event * msg);
+
 static void adjust_provider_info(SlonNode * node,
 					 WorkerGroupData * wd, int cleanup, int event_provider);
-static int query_execute(SlonNode * node, PGconn *dbconn,
+static int query_execute(SlonNode * node, SlonConn * conn,
 			  SlonDString * dsp);
+static int query_finish(SlonNode * node, SlonConn * conn,
+			 SlonDString * dsp);
 static void query_append_event(SlonDString * dsp,
 				   SlonWorkMsg_event * event);
-static void store_confirm_forward(SlonNode * node, SlonConn * conn,
+static bool event_batchable(SlonWorkMsg_event * event);
+static int event_batch_commit(SlonNode * node, SlonConn * local_conn,
+				   SlonDString * event_batch, int *batch_events);
+static int store_confirm_forward(SlonNode * node, SlonDString * dsp,
 					  SlonWorkMsg_confirm * confirm);
 static int64 get_last_forwarded_confirm(int origin, int receiver);
 static int copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
@@ -262,12 +317,20 @@ static int	sync_helper(void *cdata, PGconn *local_dbconn);
 
 
 static int archive_open(SlonNode * node, char *seqbuf,
-			 PGconn *dbconn);
-static int	archive_close(SlonNode * node);
+			 PGconn *dbconn, bool is_sync);
+static int	archive_reopen(SlonNode * node, const char *how);
+static int	archive_stream_close(SlonNode * node);
+static int	archive_section_end(SlonNode * node);
+static int	archive_commit(SlonNode * node);
+static int	archive_publish(SlonNode * node, int64 last);
+static int	archive_sync_path(const char *path);
+static void archive_recover(SlonNode * node, int64 last);
+static int	archive_index_append(SlonNode * node, int num);
 static void archive_terminate(SlonNode * node);
 
 static int	archive_append_ds(SlonNode * node, SlonDString * ds);
 static int	archive_append_str(SlonNode * node, const char *s);
+static int	archive_write(SlonNode * node, const char *s, size_t len);
 static int	archive_append_data(SlonNode * node, const char *s, int len);
 
 
@@ -294,6 +357,7 @@ remoteWorkerThread_main(void *cdata)
 	SlonDString query1;
 	SlonDString query2;
 	SlonDString query3;
+	SlonDString event_batch;
 	SlonWorkMsg *msg;
 	SlonWorkMsg_event *event;
 	bool		check_config = true;
@@ -301,6 +365,8 @@ remoteWorkerThread_main(void *cdata)
 	char		seqbuf[64];
 	bool		event_ok;
 	bool		need_reloadListen = false;
+	int			batch_events = 0;
+	bool		event_batched;
 	char		conn_symname[32];
 
 	SlonSyncStatus sync_status = SYNC_INITIAL;
@@ -335,6 +401,7 @@ remoteWorkerThread_main(void *cdata)
 	dstring_init(&query1);
 	dstring_init(&query2);
 	dstring_init(&query3);
+	dstring_init(&event_batch);
 
 	/*
 	 * Connect to the local database
@@ -351,7 +418,7 @@ remoteWorkerThread_main(void *cdata)
 	 */
 	(void) slon_mkquery(&query1,
 						"set session_replication_role = replica; ");
-	if (query_execute(node, local_dbconn, &query1) < 0)
+	if (query_execute(node, local_conn, &query1) < 0)
 		slon_retry();
 
 	/*
@@ -360,7 +427,7 @@ remoteWorkerThread_main(void *cdata)
 	(void) slon_mkquery(&query1,
 						"select %s.logApplySetCacheSize(%d);",
 						rtcfg_namespace, apply_cache_size);
-	if (query_execute(node, local_dbconn, &query1) < 0)
+	if (query_execute(node, local_conn, &query1) < 0)
 		slon_retry();
 
 	/*
@@ -373,7 +440,12 @@ remoteWorkerThread_main(void *cdata)
 		 * scheduler and the status of our node.
 		 */
 		if (sched_get_status() != SCHED_STATUS_OK)
+		{
+			if (event_batch_commit(node, local_conn, &event_batch,
+								   &batch_events) < 0)
+				slon_retry();
 			break;
+		}
 
 		if (check_config)
 		{
@@ -420,10 +492,10 @@ remoteWorkerThread_main(void *cdata)
 										 ") as S; ",
 								  rtcfg_namespace, pset->set_id, node->no_id,
 										 rtcfg_namespace, node->no_id);
-							if (query_execute(node, local_dbconn, &query1) < 0)
+							if (query_execute(node, local_conn, &query1) < 0)
 								slon_retry();
 
-							res = PQexec(local_dbconn, dstring_data(&query1));
+							res = db_exec(local_conn, dstring_data(&query1));
 							if (PQresultStatus(res) != PGRES_TUPLES_OK)
 							{
 								slon_log(SLON_FATAL, "remoteWorkerThread_%d: \"%s\" %s",
@@ -472,8 +544,30 @@ remoteWorkerThread_main(void *cdata)
 		}
 		msg = node->message_head;
 		DLLIST_REMOVE(node->message_head, node->message_tail, msg);
+		if (msg->msg_type == WMSG_EVENT)
+			node->message_events--;
 		pthread_mutex_unlock(&(node->message_lock));
 
+		/*
+		 * A batch of events was started because the next message was
+		 * another batchable event, but confirmations and wakeups are put
+		 * in front of the queue. Commit the batch before anything else
+		 * uses the connection or decides to leave the loop.
+		 */
+		if (batch_events > 0 &&
+			(msg->msg_type != WMSG_EVENT ||
+			 !event_batchable((SlonWorkMsg_event *) msg)))
+		{
+			if (event_batch_commit(node, local_conn, &event_batch,
+								   &batch_events) < 0)
+				slon_retry();
+			if (need_reloadListen)
+			{
+				rtcfg_reloadListen(local_dbconn);
+				need_reloadListen = false;
+			}
+		}
+
 		/*
 		 * Process WAKEUP messages by simply setting the check_config flag.
 		 */
@@ -492,12 +586,34 @@ remoteWorkerThread_main(void *cdata)
 		 */
 		if (msg->msg_type == WMSG_CONFIRM)
 		{
-			store_confirm_forward(node, local_conn,
-								  (SlonWorkMsg_confirm *) msg);
+			int			nconfirms = 0;
+
+			/*
+			 * Confirmations arrive in bursts, one per node that confirms.
+			 * Forward all that are queued right now in one round trip.
+			 */
+			dstring_reset(&query1);
+			for (;;)
+			{
+				nconfirms += store_confirm_forward(node, &query1,
+											(SlonWorkMsg_confirm *) msg);
 #ifdef SLON_MEMDEBUG
-			memset(msg, 55, sizeof(SlonWorkMsg_confirm));
+				memset(msg, 55, sizeof(SlonWorkMsg_confirm));
 #endif
-			free(msg);
+				free(msg);
+
+				pthread_mutex_lock(&(node->message_lock));
+				msg = node->message_head;
+				if (msg == NULL || msg->msg_type != WMSG_CONFIRM)
+				{
+					pthread_mutex_unlock(&(node->message_lock));
+					break;
+				}
+				DLLIST_REMOVE(node->message_head, node->message_tail, msg);
+				pthread_mutex_unlock(&(node->message_lock));
+			}
+			if (nconfirms > 0)
+				(void) query_execute(node, local_conn, &query1);
 			continue;
 		}
 
@@ -541,6 +657,8 @@ remoteWorkerThread_main(void *cdata)
 			int			seconds;
 			ScheduleStatus rc;
 			int			i;
+			struct timeval tv_commit_start;
+			struct timeval tv_commit_end;
 
 			/*
 			 * SYNC event
@@ -586,7 +704,7 @@ remoteWorkerThread_main(void *cdata)
 						{
 							slon_log(SLON_FATAL, "ABORT at sync %d per command line request%n", quit_sync_finalsync);
 							slon_mkquery(&query2, "rollback transaction; ");
-							query_execute(node, local_dbconn, &query2);
+							query_execute(node, local_conn, &query2);
 							dstring_reset(&query2);
 							slon_retry();
 						}
@@ -608,6 +726,7 @@ remoteWorkerThread_main(void *cdata)
 					event = (SlonWorkMsg_event *) (node->message_head);
 					sync_group[sync_group_size++] = event;
 					DLLIST_REMOVE(node->message_head, node->message_tail, msg);
+					node->message_events--;
 				}
 				sg_last_grouping = sync_group_size;
 				pthread_mutex_unlock(&(node->message_lock));
@@ -618,7 +737,7 @@ remoteWorkerThread_main(void *cdata)
 				 * Execute the forwarding stuff, but do not commit the
 				 * transaction yet.
 				 */
-				if (query_execute(node, local_dbconn, &query1) < 0)
+				if (query_execute(node, local_conn, &query1) < 0)
 					slon_retry();
 
 				/*
@@ -642,7 +761,7 @@ remoteWorkerThread_main(void *cdata)
 				slon_log(SLON_DEBUG2, "remoteWorkerThread_%d: rollback SYNC"
 						 " transaction\n", node->no_id);
 				(void) slon_mkquery(&query2, "rollback transaction");
-				if (query_execute(node, local_dbconn, &query2) < 0)
+				if (query_execute(node, local_conn, &query2) < 0)
 					slon_retry();
 
 				if ((rc = sched_msleep(node, seconds * 1000)) != SCHED_STATUS_OK)
@@ -663,7 +782,7 @@ remoteWorkerThread_main(void *cdata)
 						 " transaction\n", node->no_id);
 				query_append_event(&query1, sync_group[i]);
 				if (i < (sync_group_size - 1))
-					free(sync_group[i]);
+					remoteWorker_event_release(node, sync_group[i]);
 				sg_last_grouping++;
 			}
 
@@ -676,13 +795,61 @@ remoteWorkerThread_main(void *cdata)
 			}
 			strcpy(wd->duration_buf, "0 s");
 
+			if (sync_metrics_size > 0)
+			{
+				/*
+				 * Record the timing breakdown in the SYNC transaction
+				 * itself. The server measures the forwarding of the
+				 * events and confirmations, the final round trip can
+				 * only be recorded with the next SYNC group.
+				 */
+				char		timing_buf[512];
+
+				snprintf(timing_buf, sizeof(timing_buf),
+						 "'%.6f s', '%.6f s', '%.6f s', '%.6f s', "
+						 "\"pg_catalog\".clock_timestamp() - "
+						 "\"pg_catalog\".statement_timestamp(), "
+						 "'%.6f s', '%.6f s'::interval + "
+						 "(\"pg_catalog\".clock_timestamp() - "
+						 "\"pg_catalog\".statement_timestamp())",
+						 wd->metrics.prov_query_t,
+						 wd->metrics.first_row_t,
+						 wd->metrics.copy_t,
+						 wd->metrics.apply_t,
+						 wd->commit_t,
+						 wd->metrics.total_t);
+				slon_appendquery(&query1,
+								 "select %s.logSyncMetrics(%d, '%L', %d, "
+								 "'%L', '%L', %s, %d); ",
+								 rtcfg_namespace, node->no_id,
+								 event->ev_seqno, sync_group_size,
+								 wd->metrics.log_rows,
+								 wd->metrics.copy_bytes,
+								 timing_buf, sync_metrics_size);
+			}
+			slon_appendquery(&query1, "commit transaction;");
+
 			slon_log(SLON_DEBUG2, "remoteWorkerThread_%d: committing SYNC"
 					 " transaction\n", node->no_id);
-			slon_appendquery(&query1, "commit transaction;");
+			gettimeofday(&tv_commit_start, NULL);
+			if (query_execute(node, local_conn, &query1) < 0)
+				slon_retry();
+			gettimeofday(&tv_commit_end, NULL);
+			wd->commit_t = TIMEVAL_DIFF(&tv_commit_start, &tv_commit_end);
 
-			if (query_execute(node, local_dbconn, &query1) < 0)
+			if (archive_commit(node) < 0)
 				slon_retry();
 
+			pthread_mutex_lock(&(node->message_lock));
+			node->stats.syncs += sync_group_size;
+			node->stats.sync_groups++;
+			node->stats.log_rows += wd->metrics.log_rows;
+			node->stats.copy_bytes += wd->metrics.copy_bytes;
+			node->stats.sync_time += wd->metrics.total_t;
+			node->stats.copy_time += wd->metrics.first_row_t +
+				wd->metrics.copy_t;
+			pthread_mutex_unlock(&(node->message_lock));
+
 			/*
 			 * Remember the sync snapshot in the in memory node structure
 			 */
@@ -692,9 +859,11 @@ remoteWorkerThread_main(void *cdata)
 		{
 
 			/**
-			 * open the transaction.
+			 * open the transaction, unless it is still open for a batch
+			 * of events (see below).
 			 */
-			if (query_execute(node, local_dbconn, &query1) < 0)
+			if (batch_events == 0 &&
+				query_execute(node, local_conn, &query1) < 0)
 				slon_retry();
 			dstring_reset(&query1);
 
@@ -707,7 +876,7 @@ remoteWorkerThread_main(void *cdata)
 			{
 				char		buf[256];
 
-				if (archive_open(node, seqbuf, local_dbconn) < 0)
+				if (archive_open(node, seqbuf, local_dbconn, false) < 0)
 					slon_retry();
 				sprintf(buf, "-- %s", event->ev_type);
 				if (archive_append_str(node, buf) < 0)
@@ -783,17 +952,17 @@ remoteWorkerThread_main(void *cdata)
 								 node->no_id);
 					
 						slon_appendquery(&query1, "commit transaction; ");
-						if (query_execute(node, local_dbconn, &query1) < 0)
+						if (query_execute(node, local_conn, &query1) < 0)
 						slon_retry();
 
 						(void) slon_mkquery(&query1, "select %s.uninstallNode(); ",
 											rtcfg_namespace);
-						if (query_execute(node, local_dbconn, &query1) < 0)
+						if (query_execute(node, local_conn, &query1) < 0)
 							slon_retry();
 						
 						(void) slon_mkquery(&query1, "drop schema %s cascade; ",
 											rtcfg_namespace);
-						query_execute(node, local_dbconn, &query1);
+						query_execute(node, local_conn, &query1);
 						
 						slon_retry();
 					}
@@ -828,7 +997,7 @@ remoteWorkerThread_main(void *cdata)
 								 "from %s.sl_confirm "
 								 "  where con_origin = %d  and con_received"
 								 "= %d", rtcfg_namespace, node->no_id, no_id);
-				res = PQexec(local_dbconn, dstring_data(&query1));
+				res = db_exec(local_conn, dstring_data(&query1));
 				if (PQresultStatus(res) != PGRES_TUPLES_OK)
 				{
 					slon_log(SLON_ERROR, "remoteWorkerThread_%d error querying "
@@ -957,7 +1126,8 @@ remoteWorkerThread_main(void *cdata)
 								 set_id, add_id);
 
 			}
-			else if (strcmp(event->ev_type, "SET_ADD_TABLE") == 0)
+			else if (strcmp(event->ev_type, "SET_ADD_TABLE") == 0 ||
+					 strcmp(event->ev_type, "SET_ADD_TABLES") == 0)
 			{
 				/*
 				 * Nothing to do ATM ... we don't support adding tables to
@@ -965,7 +1135,8 @@ remoteWorkerThread_main(void *cdata)
 				 * in the runtime configuration.
 				 */
 			}
-			else if (strcmp(event->ev_type, "SET_ADD_SEQUENCE") == 0)
+			else if (strcmp(event->ev_type, "SET_ADD_SEQUENCE") == 0 ||
+					 strcmp(event->ev_type, "SET_ADD_SEQUENCES") == 0)
 			{
 				/*
 				 * Nothing to do ATM ... we don't support adding sequences to
@@ -1065,7 +1236,7 @@ remoteWorkerThread_main(void *cdata)
 										rtcfg_namespace,
 					 old_origin, wait_seqno, set_id, old_origin, new_origin);
 
-					res = PQexec(local_dbconn, dstring_data(&query2));
+					res = db_exec(local_conn, dstring_data(&query2));
 					while (PQntuples(res) == 0)
 					{
 						PQclear(res);
@@ -1074,7 +1245,7 @@ remoteWorkerThread_main(void *cdata)
 
 						/* Rollback the transaction for now */
 						(void) slon_mkquery(&query3, "rollback transaction");
-						if (query_execute(node, local_dbconn, &query3) < 0)
+						if (query_execute(node, local_conn, &query3) < 0)
 							slon_retry();
 
 						/* Sleep */
@@ -1089,11 +1260,11 @@ remoteWorkerThread_main(void *cdata)
 							"lock table %s.sl_event_lock,%s.sl_config_lock;",
 										 rtcfg_namespace,
 										 rtcfg_namespace);
-						if (query_execute(node, local_dbconn, &query3) < 0)
+						if (query_execute(node, local_conn, &query3) < 0)
 							slon_retry();
 
 						/* See if we have the missing event now */
-						res = PQexec(local_dbconn, dstring_data(&query2));
+						res = db_exec(local_conn, dstring_data(&query2));
 					}
 					PQclear(res);
 					slon_log(SLON_DEBUG1, "ACCEPT_SET - MOVE_SET exists - adjusting setsync status\n");
@@ -1124,9 +1295,10 @@ remoteWorkerThread_main(void *cdata)
 					query_append_event(&query1, event);
 					slon_appendquery(&query1, "commit transaction;");
 
-					query_execute(node, local_dbconn, &query1);
+					archive_section_end(node);
+					if (query_execute(node, local_conn, &query1) == 0)
+						archive_commit(node);
 					slon_log(SLON_DEBUG1, "ACCEPT_SET - done\n");
-					archive_close(node);
 					slon_retry();
 
 					need_reloadListen = true;
@@ -1159,14 +1331,14 @@ remoteWorkerThread_main(void *cdata)
 								 rtcfg_namespace,
 								 rtcfg_namespace,
 								 set_id, old_origin, new_origin, seqbuf);
-				if (query_execute(node, local_dbconn, &query1) < 0)
+				if (query_execute(node, local_conn, &query1) < 0)
 					slon_retry();
 
 				(void) slon_mkquery(&query1,
 								  "select sub_provider from %s.sl_subscribe "
 							   "	where sub_receiver = %d and sub_set = %d",
 									rtcfg_namespace, rtcfg_nodeid, set_id);
-				res = PQexec(local_dbconn, dstring_data(&query1));
+				res = db_exec(local_conn, dstring_data(&query1));
 				if (PQresultStatus(res) != PGRES_TUPLES_OK)
 				{
 					slon_log(SLON_FATAL, "remoteWorkerThread_%d: \"%s\" %s",
@@ -1212,7 +1384,7 @@ remoteWorkerThread_main(void *cdata)
 							 ,rtcfg_namespace,
 							 failed_node, node->no_id,failed_node_list);
 
-				res = PQexec(local_dbconn, dstring_data(&query2));
+				res = db_exec(local_conn, dstring_data(&query2));
 				if (PQresultStatus(res) != PGRES_TUPLES_OK)
 				{
 					slon_log(SLON_FATAL, "remoteWorkerThread_%d: \"%s\" %s",
@@ -1222,7 +1394,7 @@ remoteWorkerThread_main(void *cdata)
 					slon_retry();
 				}
 				slon_mkquery(&query2, "commit transaction;start transaction");
-				res = PQexec(local_dbconn, dstring_data(&query2));
+				res = db_exec(local_conn, dstring_data(&query2));
 				if (PQresultStatus(res) != PGRES_COMMAND_OK)
 				{
 					slon_log(SLON_FATAL, "remoteWorkerThread_%d: \"%s\" %s",
@@ -1238,7 +1410,7 @@ remoteWorkerThread_main(void *cdata)
 							 "       ev_seqno>=%s"
 							 ,rtcfg_namespace, failed_node,
 							 seq_no_c);
-				res = PQexec(local_dbconn, dstring_data(&query2));
+				res = db_exec(local_conn, dstring_data(&query2));
 				while (PQntuples(res) == 0)
 				{
 					slon_log(SLON_INFO, "remoteWorkerThread_%d FAILOVER_NODE waiting for event %d,%s\n"
@@ -1246,7 +1418,7 @@ remoteWorkerThread_main(void *cdata)
 							 failed_node, seq_no_c);
 					PQclear(res);
 					(void) slon_mkquery(&query3, "rollback transaction");
-					if (query_execute(node, local_dbconn, &query3) < 0)
+					if (query_execute(node, local_conn, &query3) < 0)
 						slon_retry();
 
 					/* Sleep */
@@ -1261,11 +1433,11 @@ remoteWorkerThread_main(void *cdata)
 							"lock table %s.sl_event_lock,%s.sl_config_lock;",
 									 rtcfg_namespace,
 									 rtcfg_namespace);
-					if (query_execute(node, local_dbconn, &query3) < 0)
+					if (query_execute(node, local_conn, &query3) < 0)
 						slon_retry();
 
 					/* See if we have the missing event now */
-					res = PQexec(local_dbconn, dstring_data(&query2));
+					res = db_exec(local_conn, dstring_data(&query2));
 
 				}
 				PQclear(res);
@@ -1351,7 +1523,7 @@ remoteWorkerThread_main(void *cdata)
 								 * we want other threads to be
 								 * able to continue during the sleep.
 								 */
-								if (query_execute(node, local_dbconn, &query2) < 0)
+								if (query_execute(node, local_conn, &query2) < 0)
 									slon_retry();
 								sched_rc = sched_msleep(node, 5000);
 								if (sched_rc != SCHED_STATUS_OK)
@@ -1369,7 +1541,7 @@ remoteWorkerThread_main(void *cdata)
 											"lock table %s.sl_config_lock; ",
 												 rtcfg_namespace);
 
-								if (query_execute(node, local_dbconn, &query1) < 0)
+								if (query_execute(node, local_conn, &query1) < 0)
 									slon_retry();
 
 								continue;
@@ -1391,7 +1563,7 @@ remoteWorkerThread_main(void *cdata)
 											 "lock table %s.sl_config_lock; ",
 											 rtcfg_namespace);
 
-							if (query_execute(node, local_dbconn, &query1) < 0)
+							if (query_execute(node, local_conn, &query1) < 0)
 								slon_retry();
 						}
 
@@ -1424,7 +1596,7 @@ remoteWorkerThread_main(void *cdata)
 								 node->no_id, sub_set, copy_set_retries,
 								 sleeptime);
 
-						if (query_execute(node, local_dbconn, &query2) < 0)
+						if (query_execute(node, local_conn, &query2) < 0)
 							slon_retry();
 						sched_rc = sched_msleep(node, sleeptime * 1000);
 						if (sched_rc != SCHED_STATUS_OK)
@@ -1492,36 +1664,83 @@ remoteWorkerThread_main(void *cdata)
 			}
 
 			/*
-			 * All simple configuration events fall through here. Commit the
-			 * transaction.
+			 * All simple configuration events fall through here. If the
+			 * next message in the queue is another event that can share the
+			 * transaction, only remember the queries. A storm of thousands
+			 * of configuration events is then applied with one round trip and
+			 * commit per MAXEVENTBATCH events. Log shipping writes an
+			 * archive per event and does not batch.
 			 */
-			if (event_ok)
+			event_batched = false;
+			if (event_ok && !archive_dir &&
+				batch_events < MAXEVENTBATCH - 1 && event_batchable(event))
 			{
-				query_append_event(&query1, event);
-				slon_appendquery(&query1, "commit transaction;");
-				if (archive_close(node) < 0)
-					slon_retry();
-			}
-			else
-			{
-				(void) slon_mkquery(&query1, "rollback transaction;");
-				archive_terminate(node);
+				pthread_mutex_lock(&(node->message_lock));
+				if (node->message_head != NULL &&
+					node->message_head->msg_type == WMSG_EVENT &&
+				event_batchable((SlonWorkMsg_event *) node->message_head))
+				{
+					query_append_event(&query1, event);
+					dstring_append(&event_batch, dstring_data(&query1));
+					dstring_terminate(&event_batch);
+					dstring_reset(&query1);
+					batch_events++;
+					event_batched = true;
+				}
+				pthread_mutex_unlock(&(node->message_lock));
 			}
 			monitor_state(conn_symname, node->no_id, local_conn->conn_pid, "thread main loop", event->ev_seqno, event->ev_type);
-			if (query_execute(node, local_dbconn, &query1) < 0)
-				slon_retry();
 
-			if (need_reloadListen)
+			/*
+			 * Otherwise commit the transaction.
+			 */
+			if (!event_batched)
 			{
-				rtcfg_reloadListen(local_dbconn);
-				need_reloadListen = false;
+				if (event_ok)
+				{
+					query_append_event(&query1, event);
+					slon_appendquery(&query1, "commit transaction;");
+					if (archive_section_end(node) < 0)
+						slon_retry();
+				}
+				else
+				{
+					(void) slon_mkquery(&query1, "rollback transaction;");
+					archive_terminate(node);
+				}
+				if (batch_events > 0)
+				{
+					slon_log(SLON_DEBUG2, "remoteWorkerThread_%d: "
+							 "committing %d events in one transaction\n",
+							 node->no_id, batch_events + 1);
+					dstring_append(&event_batch, dstring_data(&query1));
+					dstring_terminate(&event_batch);
+					if (query_execute(node, local_conn, &event_batch) < 0)
+						slon_retry();
+					dstring_reset(&event_batch);
+					batch_events = 0;
+				}
+				else if (query_execute(node, local_conn, &query1) < 0)
+					slon_retry();
+				if (event_ok && archive_commit(node) < 0)
+					slon_retry();
+
+				if (need_reloadListen)
+				{
+					rtcfg_reloadListen(local_dbconn);
+					need_reloadListen = false;
+				}
 			}
 		}
 
-#ifdef SLON_MEMDEBUG
-		memset(msg, 55, sizeof(SlonWorkMsg_event));
-#endif
-		free(msg);
+		pthread_mutex_lock(&(node->message_lock));
+		node->stats.events++;
+		node->stats.last_seqno = event->ev_seqno;
+		strncpy(node->stats.last_timestamp, event->ev_timestamp_c,
+				sizeof(node->stats.last_timestamp) - 1);
+		pthread_mutex_unlock(&(node->message_lock));
+
+		remoteWorker_event_release(node, (SlonWorkMsg_event *) msg);
 	}
 
 	/*
@@ -1529,11 +1748,13 @@ remoteWorkerThread_main(void *cdata)
 	 * free memory
 	 */
 	adjust_provider_info(node, wd, true, -1);
+	archive_terminate(node);
 
 	slon_disconnectdb(local_conn);
 	dstring_free(&query1);
 	dstring_free(&query2);
 	dstring_free(&query3);
+	dstring_free(&event_batch);
 #ifdef SLON_MEMDEBUG
 	local_conn = NULL;
 	memset(wd, 66, sizeof(WorkerGroupData));
@@ -1919,13 +2140,7 @@ remoteWorker_event(int event_provider,
 		+ ((ev_data7 == NULL) ? 0 : (len_data7 = strlen(ev_data7) + 1))
 		+ ((ev_data8 == NULL) ? 0 : (len_data8 = strlen(ev_data8) + 1));
 
-	msg = (SlonWorkMsg_event *) malloc(len);
-	if (msg == NULL)
-	{
-		perror("remoteWorker_event: malloc()");
-		slon_retry();
-	}
-	memset(msg, 0, sizeof(SlonWorkMsg_event));
+	msg = remoteWorker_event_alloc(node, len);
 
 	/*
 	 * Copy all data into the message.
@@ -2005,11 +2220,130 @@ remoteWorker_event(int event_provider,
 	 */
 	DLLIST_ADD_TAIL(node->message_head, node->message_tail,
 					(SlonWorkMsg *) msg);
+	node->message_events++;
 	pthread_cond_signal(&(node->message_cond));
 	pthread_mutex_unlock(&(node->message_lock));
 }
 
 
+/* ----------
+ * remoteWorker_event_alloc
+ *
+ * Get a buffer for an event message of at least len bytes. Buffers
+ * are taken from the node's pool of recycled messages if possible,
+ * so that a steady stream of events does not cause a malloc()/free()
+ * pair per event. Buffer sizes are rounded up to a power of two, which
+ * lets a pooled buffer usually fit the next event as well.
+ *
+ * The caller must hold the node's message_lock.
+ * ----------
+ */
+static SlonWorkMsg_event *
+remoteWorker_event_alloc(SlonNode * node, int len)
+{
+	SlonWorkMsg_event *msg;
+	int			alloc = SLON_EVENT_BUFSIZE_MIN;
+
+	while (alloc < len)
+		alloc *= 2;
+
+	msg = (SlonWorkMsg_event *) node->message_pool;
+	if (msg != NULL)
+	{
+		node->message_pool = (SlonWorkMsg *) msg->next;
+		node->message_pool_size--;
+
+		/*
+		 * A pooled buffer that is too small for this event is replaced
+		 * by a larger one, so the pool grows towards the high-water
+		 * mark of the event sizes.
+		 */
+		if (msg->msg_alloc < len)
+		{
+			free(msg);
+			msg = NULL;
+		}
+		else
+			alloc = msg->msg_alloc;
+	}
+	if (msg == NULL)
+	{
+		msg = (SlonWorkMsg_event *) malloc(alloc);
+		if (msg == NULL)
+		{
+			perror("remoteWorker_event: malloc()");
+			slon_retry();
+		}
+	}
+	memset(msg, 0, sizeof(SlonWorkMsg_event));
+	msg->msg_alloc = alloc;
+
+	return msg;
+}
+
+
+/* ----------
+ * remoteWorker_event_release
+ *
+ * Return a processed event message to the node's buffer pool. The pool
+ * keeps about as many buffers as the remote listener selects in one
+ * round, anything beyond that is given back to the system.
+ * ----------
+ */
+static void
+remoteWorker_event_release(SlonNode * node, SlonWorkMsg_event * msg)
+{
+	int			alloc = msg->msg_alloc;
+	int			pool_max;
+
+#ifdef SLON_MEMDEBUG
+	memset(msg, 55, sizeof(SlonWorkMsg_event));
+#endif
+
+	pool_max = (sync_group_maxsize > 0) ? sync_group_maxsize * 2 : 100;
+
+	pthread_mutex_lock(&(node->message_lock));
+	if (node->message_pool_size < pool_max)
+	{
+		msg->msg_type = WMSG_EVENT;
+		msg->msg_alloc = alloc;
+		msg->prev = NULL;
+		msg->next = (SlonWorkMsg_event *) node->message_pool;
+		node->message_pool = (SlonWorkMsg *) msg;
+		node->message_pool_size++;
+		pthread_mutex_unlock(&(node->message_lock));
+		return;
+	}
+	pthread_mutex_unlock(&(node->message_lock));
+
+	free(msg);
+}
+
+
+/* ----------
+ * remoteWorker_queue_full
+ *
+ * Used by the remote listener threads to check whether the worker for
+ * an event origin has reached remote_queue_maxsize queued events. The
+ * listeners then stop selecting events for that origin until the worker
+ * has caught up, instead of piling up memory in the message queue.
+ *
+ * Called with the runtime configuration locked.
+ * ----------
+ */
+bool
+remoteWorker_queue_full(SlonNode * node)
+{
+	bool		full;
+
+	pthread_mutex_lock(&(node->message_lock));
+	full = (node->message_events >= remote_queue_maxsize);
+	pthread_mutex_unlock(&(node->message_lock));
+
+	return full;
+}
+
+
 /* ----------
  * remoteWorker_wakeup
  *
@@ -2180,27 +2514,53 @@ remoteWorker_confirm(int no_id,
  * ----------
  */
 static int
-query_execute(SlonNode * node, PGconn *dbconn, SlonDString * dsp)
+query_execute(SlonNode * node, SlonConn * conn, SlonDString * dsp)
+{
+	if (db_send_query(conn, dstring_data(dsp)) < 0)
+	{
+		slon_log(SLON_ERROR,
+				 "remoteWorkerThread_%d: \"%s\" %s",
+				 node->no_id, dstring_data(dsp),
+				 PQerrorMessage(conn->dbconn));
+		return -1;
+	}
+	return query_finish(node, conn, dsp);
+}
 
+
+/* ----------
+ * query_finish
+ *
+ * Collect the results of a query string sent with db_send_query(),
+ * which may contain any number of statements that do not return a
+ * result set. The caller can do other work between the two.
+ * ----------
+ */
+static int
+query_finish(SlonNode * node, SlonConn * conn, SlonDString * dsp)
 {
 	PGresult   *res;
 	int			rc;
+	int			failed = false;
 
-	res = PQexec(dbconn, dstring_data(dsp));
-	rc = PQresultStatus(res);
-	if (rc != PGRES_COMMAND_OK && rc != PGRES_TUPLES_OK &&
-		rc != PGRES_EMPTY_QUERY)
+	while ((res = db_get_result(conn)) != NULL)
 	{
-		slon_log(SLON_ERROR,
-				 "remoteWorkerThread_%d: \"%s\" %s %s",
-				 node->no_id, dstring_data(dsp),
-				 PQresStatus(rc),
-				 PQresultErrorMessage(res));
+		rc = PQresultStatus(res);
+		if (rc != PGRES_COMMAND_OK && rc != PGRES_TUPLES_OK &&
+			rc != PGRES_EMPTY_QUERY && !failed)
+		{
+			slon_log(SLON_ERROR,
+					 "remoteWorkerThread_%d: \"%s\" %s %s",
+					 node->no_id, dstring_data(dsp),
+					 PQresStatus(rc),
+					 PQresultErrorMessage(res));
+			failed = true;
+		}
 		PQclear(res);
-		return -1;
+		if (rc == PGRES_COPY_IN || rc == PGRES_COPY_OUT)
+			break;
 	}
-	PQclear(res);
-	return 0;
+	return (failed) ? -1 : 0;
 }
 
 
@@ -2269,18 +2629,83 @@ query_append_event(SlonDString * dsp, SlonWorkMsg_event * event)
 }
 
 
+/* ----------
+ * event_batchable
+ *
+ * Configuration events that only call their stored procedure and
+ * change nothing that another thread would look up in the database
+ * before our commit. Consecutive ones share a local transaction.
+ * ----------
+ */
+static bool
+event_batchable(SlonWorkMsg_event * event)
+{
+	static const char *batch_types[] = {
+		"STORE_PATH",
+		"DROP_PATH",
+		"STORE_LISTEN",
+		"DROP_LISTEN",
+		"STORE_SET",
+		"SET_ADD_TABLE",
+		"SET_ADD_TABLES",
+		"SET_ADD_SEQUENCE",
+		"SET_ADD_SEQUENCES",
+		"SET_DROP_TABLE",
+		"SET_DROP_SEQUENCE",
+		"SET_MOVE_TABLE",
+		"SET_MOVE_SEQUENCE",
+		NULL
+	};
+	int			i;
+
+	for (i = 0; batch_types[i] != NULL; i++)
+	{
+		if (strcmp(event->ev_type, batch_types[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+
+/* ----------
+ * event_batch_commit
+ *
+ * Commit the events collected in event_batch, if there are any.
+ * ----------
+ */
+static int
+event_batch_commit(SlonNode * node, SlonConn * local_conn,
+				   SlonDString * event_batch, int *batch_events)
+{
+	if (*batch_events == 0)
+		return 0;
+
+	slon_log(SLON_DEBUG2, "remoteWorkerThread_%d: "
+			 "committing %d events in one transaction\n",
+			 node->no_id, *batch_events);
+	dstring_append(event_batch, "commit transaction;");
+	dstring_terminate(event_batch);
+	if (query_execute(node, local_conn, event_batch) < 0)
+		return -1;
+	dstring_reset(event_batch);
+	*batch_events = 0;
+
+	return 0;
+}
+
+
 /* ----------
  * store_confirm_forward
  *
- * Call the forwardConfirm() stored procedure.
+ * Add a call to the forwardConfirm() stored procedure to a dstring,
+ * unless the confirmation is already known. Returns 1 if a call was
+ * added.
  * ----------
  */
-static void
-store_confirm_forward(SlonNode * node, SlonConn * conn,
+static int
+store_confirm_forward(SlonNode * node, SlonDString * dsp,
 					  SlonWorkMsg_confirm * confirm)
 {
-	SlonDString query;
-	PGresult   *res;
 	char		seqbuf[64];
 	struct node_confirm_status *cstat;
 	int			cstat_found = false;
@@ -2304,7 +2729,7 @@ store_confirm_forward(SlonNode * node, SlonConn * conn,
 				 * Confirm status is newer or equal, ignore message.
 				 */
 				pthread_mutex_unlock(&node_confirm_lock);
-				return;
+				return 0;
 			}
 
 			/*
@@ -2334,33 +2759,18 @@ store_confirm_forward(SlonNode * node, SlonConn * conn,
 	 * Call the stored procedure to forward this status through the table
 	 * sl_confirm.
 	 */
-	dstring_init(&query);
 	sprintf(seqbuf, INT64_FORMAT, confirm->con_seqno);
 
 	slon_log(SLON_DEBUG2,
 			 "remoteWorkerThread_%d: forward confirm %d,%s received by %d\n",
 			 node->no_id, confirm->con_origin, seqbuf, confirm->con_received);
 
-	(void) slon_mkquery(&query,
-						"select %s.forwardConfirm(%d, %d, '%s', '%q'); ",
-						rtcfg_namespace,
-						confirm->con_origin, confirm->con_received,
-						seqbuf, confirm->con_timestamp_c);
-
-	res = PQexec(conn->dbconn, dstring_data(&query));
-	if (PQresultStatus(res) != PGRES_TUPLES_OK)
-	{
-		slon_log(SLON_ERROR,
-				 "remoteWorkerThread_%d: \"%s\" %s",
-				 node->no_id, dstring_data(&query),
-				 PQresultErrorMessage(res));
-		PQclear(res);
-		dstring_free(&query);
-		return;
-	}
-	PQclear(res);
-	dstring_free(&query);
-	return;
+	slon_appendquery(dsp,
+					 "select %s.forwardConfirm(%d, %d, '%s', '%q'); ",
+					 rtcfg_namespace,
+					 confirm->con_origin, confirm->con_received,
+					 seqbuf, confirm->con_timestamp_c);
+	return 1;
 }
 
 
@@ -2562,7 +2972,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 	(void) slon_mkquery(&query1,
 						"select %s.registerNodeConnection(%d); ",
 						rtcfg_namespace, rtcfg_nodeid);
-	if (query_execute(node, pro_dbconn, &query1) < 0)
+	if (query_execute(node, pro_conn, &query1) < 0)
 	{
 		slon_disconnectdb(pro_conn);
 		dstring_free(&query1);
@@ -2594,7 +3004,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 							"select \"pg_catalog\".txid_snapshot_xmin(\"pg_catalog\".txid_current_snapshot()) <= '%s'; ",
 							provider_version >= 90100 ? "deferrable" : ""
 							,event->ev_maxtxid_c);
-		res1 = PQexec(pro_dbconn, dstring_data(&query1));
+		res1 = db_exec(pro_conn, dstring_data(&query1));
 		if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -2635,7 +3045,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 							"start transaction; "
 			   "set transaction isolation level serializable read only %s; ",
 							provider_version >= 90100 ? "deferrable" : "");
-		if (query_execute(node, pro_dbconn, &query1) < 0)
+		if (query_execute(node, pro_conn, &query1) < 0)
 		{
 			slon_disconnectdb(pro_conn);
 			dstring_free(&query1);
@@ -2678,7 +3088,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 						rtcfg_namespace,
 						rtcfg_namespace,
 						set_id);
-	res1 = PQexec(pro_dbconn, dstring_data(&query1));
+	res1 = db_exec(pro_conn, dstring_data(&query1));
 	if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -2710,7 +3120,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 
 		(void) slon_mkquery(&query3, "select * from %s limit 0;",
 							tab_fqname);
-		res2 = PQexec(loc_dbconn, dstring_data(&query3));
+		res2 = db_exec(local_conn, dstring_data(&query3));
 		if (PQresultStatus(res2) != PGRES_TUPLES_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: Could not find table %s "
@@ -2733,7 +3143,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 		 */
 
 		(void) slon_mkquery(&query3, "lock table %s;\n", tab_fqname);
-		res2 = PQexec(loc_dbconn, dstring_data(&query3));
+		res2 = db_exec(local_conn, dstring_data(&query3));
 		if (PQresultStatus(res2) != PGRES_COMMAND_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: Could not lock table %s "
@@ -2772,7 +3182,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 						rtcfg_namespace,
 						rtcfg_namespace,
 						set_id);
-	res1 = PQexec(pro_dbconn, dstring_data(&query1));
+	res1 = db_exec(pro_conn, dstring_data(&query1));
 	if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -2806,7 +3216,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 							rtcfg_namespace,
 							set_id, seq_id,
 							seq_fqname, seq_comment);
-		if (query_execute(node, loc_dbconn, &query1) < 0)
+		if (query_execute(node, local_conn, &query1) < 0)
 		{
 			PQclear(res1);
 			slon_disconnectdb(pro_conn);
@@ -2841,7 +3251,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 						rtcfg_namespace,
 						rtcfg_namespace,
 						set_id);
-	res1 = PQexec(pro_dbconn, dstring_data(&query1));
+	res1 = db_exec(pro_conn, dstring_data(&query1));
 	if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -2886,7 +3296,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 							rtcfg_namespace,
 							rtcfg_namespace,
 					   set_id, tab_id, tab_fqname, tab_idxname, tab_comment);
-		if (query_execute(node, loc_dbconn, &query1) < 0)
+		if (query_execute(node, local_conn, &query1) < 0)
 		{
 			PQclear(res1);
 			slon_disconnectdb(pro_conn);
@@ -2917,7 +3327,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 			(void) slon_mkquery(&query2, "select %s.copyFields(%d);",
 								rtcfg_namespace, tab_id);
 
-			res3 = PQexec(pro_dbconn, dstring_data(&query2));
+			res3 = db_exec(pro_conn, dstring_data(&query2));
 
 			if (PQresultStatus(res3) != PGRES_TUPLES_OK)
 			{
@@ -2943,7 +3353,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 								tab_id, tab_fqname,
 								PQgetvalue(res3, 0, 0)
 				);
-			res2 = PQexec(loc_dbconn, dstring_data(&query1));
+			res2 = db_exec(local_conn, dstring_data(&query1));
 			if (PQresultStatus(res2) != PGRES_COPY_IN)
 			{
 				slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s %s\n",
@@ -2990,7 +3400,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 			(void) slon_mkquery(&query1,
 			   "copy %s %s to stdout; ", tab_fqname, PQgetvalue(res3, 0, 0));
 			PQclear(res3);
-			res3 = PQexec(pro_dbconn, dstring_data(&query1));
+			res3 = db_exec(pro_conn, dstring_data(&query1));
 			if (PQresultStatus(res3) != PGRES_COPY_OUT)
 			{
 				slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s %s\n",
@@ -3184,7 +3594,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 								"analyze %s; ",
 								rtcfg_namespace, tab_id,
 								tab_fqname);
-			if (query_execute(node, loc_dbconn, &query1) < 0)
+			if (query_execute(node, local_conn, &query1) < 0)
 			{
 				PQclear(res1);
 				slon_disconnectdb(pro_conn);
@@ -3237,7 +3647,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 						rtcfg_namespace,
 						rtcfg_namespace,
 						set_id, seqbuf);
-	res1 = PQexec(pro_dbconn, dstring_data(&query1));
+	res1 = db_exec(pro_conn, dstring_data(&query1));
 	if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -3294,7 +3704,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 						 "		(%s, %d, '%s', '%s'); ",
 						 rtcfg_namespace,
 						 seql_seqid, node->no_id, seqbuf, seql_last_value);
-		if (query_execute(node, loc_dbconn, &query1) < 0)
+		if (query_execute(node, local_conn, &query1) < 0)
 		{
 			PQclear(res1);
 			slon_disconnectdb(pro_conn);
@@ -3338,7 +3748,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 							"from %s.sl_event "
 							"where ev_origin = %d and ev_type = 'SYNC'; ",
 							rtcfg_namespace, node->no_id);
-		res1 = PQexec(pro_dbconn, dstring_data(&query1));
+		res1 = db_exec(pro_conn, dstring_data(&query1));
 		if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -3402,7 +3812,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 								"where ev_origin = %d and ev_seqno = '%s'; ",
 					   rtcfg_namespace, node->no_id, PQgetvalue(res1, 0, 0));
 			PQclear(res1);
-			res1 = PQexec(pro_dbconn, dstring_data(&query1));
+			res1 = db_exec(pro_conn, dstring_data(&query1));
 			if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 			{
 				slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -3459,7 +3869,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 		 * query1 now contains the selection for the ssy_action_list selection
 		 * from both log tables. Fill the dstring.
 		 */
-		res2 = PQexec(pro_dbconn, dstring_data(&query1));
+		res2 = db_exec(pro_conn, dstring_data(&query1));
 		if (PQresultStatus(res2) != PGRES_TUPLES_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -3505,7 +3915,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 							"    ssy_action_list "
 							"from %s.sl_setsync where ssy_setid = %d; ",
 							rtcfg_namespace, set_id);
-		res1 = PQexec(pro_dbconn, dstring_data(&query1));
+		res1 = db_exec(pro_conn, dstring_data(&query1));
 		if (PQresultStatus(res1) != PGRES_TUPLES_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
@@ -3557,7 +3967,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 						set_id, node->no_id, ssy_seqno, ssy_snapshot,
 						dstring_data(&ssy_action_list));
 	dstring_free(&ssy_action_list);
-	if (query_execute(node, loc_dbconn, &query1) < 0)
+	if (query_execute(node, local_conn, &query1) < 0)
 	{
 		PQclear(res1);
 		slon_disconnectdb(pro_conn);
@@ -3581,7 +3991,7 @@ copy_set(SlonNode * node, SlonConn * local_conn, int set_id,
 	 * database connection.
 	 */
 	(void) slon_mkquery(&query1, "rollback transaction");
-	if (query_execute(node, pro_dbconn, &query1) < 0)
+	if (query_execute(node, pro_conn, &query1) < 0)
 	{
 		slon_disconnectdb(pro_conn);
 		dstring_free(&query1);
@@ -3638,6 +4048,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 
 	SlonDString query;
 	SlonDString lsquery;
+	SlonDString applyquery;
 	SlonDString *provider_query;
 	SlonDString actionseq_subquery;
 
@@ -3656,6 +4067,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 	dstring_init(&lsquery);
 
 	init_perfmon(&pm);
+	memset(&(wd->metrics), 0, sizeof(SyncMetrics));
 
 	/*
 	 * If this slon is running in log archiving mode, open a temporary file
@@ -3663,7 +4075,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 	 */
 	if (archive_dir)
 	{
-		rc = archive_open(node, seqbuf, local_dbconn);
+		rc = archive_open(node, seqbuf, local_dbconn, true);
 		if (rc < 0)
 		{
 			dstring_free(&query);
@@ -3736,7 +4148,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 								"select %s.registerNodeConnection(%d); ",
 								rtcfg_namespace, rtcfg_nodeid);
 			start_monitored_event(&pm);
-			if (query_execute(node, provider->conn->dbconn, &query) < 0)
+			if (query_execute(node, provider->conn, &query) < 0)
 			{
 				dstring_free(&query);
 				dstring_free(&lsquery);
@@ -3817,9 +4229,9 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 		int			ntuples2;
 		int			tupno2;
 		int			ntables_total = 0;
-		int			rc;
 		int			need_union;
-		int			sl_log_no;
+		char	   *fetch_seqno = NULL;
+		int			fetch_slices = 0;
 
 		/**
 		 * ONLY use the event_provider.
@@ -3847,54 +4259,12 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 							"COPY ( ");
 
 		/*
-		 * Get the current sl_log_status value for this provider
+		 * Add the DDL selection to the provider_query if this is the event
+		 * provider. In case we are subscribed to any set(s) from the origin,
+		 * this is implicitly the data provider because we only listen for
+		 * events on that node.
 		 */
-		(void) slon_mkquery(&query, "select last_value from %s.sl_log_status",
-							rtcfg_namespace);
-
-		start_monitored_event(&pm);
-		res1 = PQexec(provider->conn->dbconn, dstring_data(&query));
-		monitor_provider_query(&pm);
-
-		rc = PQresultStatus(res1);
-		if (rc != PGRES_TUPLES_OK)
-		{
-			slon_log(SLON_ERROR,
-					 "remoteWorkerThread_%d: \"%s\" %s %s\n",
-					 node->no_id, dstring_data(&query),
-					 PQresStatus(rc),
-					 PQresultErrorMessage(res1));
-			PQclear(res1);
-			dstring_free(&query);
-			dstring_free(&lsquery);
-			archive_terminate(node);
-			return 60;
-		}
-		if (PQntuples(res1) != 1)
-		{
-			slon_log(SLON_ERROR,
-					 "remoteWorkerThread_%d: \"%s\" %s returned %d tuples\n",
-					 node->no_id, dstring_data(&query),
-					 PQresStatus(rc), PQntuples(res1));
-			PQclear(res1);
-			dstring_free(&query);
-			dstring_free(&lsquery);
-			archive_terminate(node);
-			return 60;
-		}
-		provider->log_status = strtol(PQgetvalue(res1, 0, 0), NULL, 10);
-		PQclear(res1);
-		slon_log(SLON_DEBUG2,
-				 "remoteWorkerThread_%d_%d: current remote log_status = %d\n",
-				 node->no_id, provider->no_id, provider->log_status);
-
-		/*
-		 * Add the DDL selection to the provider_query if this is the event
-		 * provider. In case we are subscribed to any set(s) from the origin,
-		 * this is implicitly the data provider because we only listen for
-		 * events on that node.
-		 */
-		if (provider->no_id == event->event_provider)
+		if (provider->no_id == event->event_provider)
 		{
 			slon_appendquery(provider_query,
 							 "select log_origin, log_txid, "
@@ -3959,7 +4329,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 			slon_appendquery(&query, ") and SSY.ssy_origin=%d; ",node->no_id);
 
 			start_monitored_event(&pm);
-			res1 = PQexec(local_dbconn, dstring_data(&query));
+			res1 = db_exec(local_conn, dstring_data(&query));
 			monitor_subscriber_query(&pm);
 
 			slon_log(SLON_DEBUG1, "about to monitor_subscriber_query - pulling big actionid list for %d\n", provider->no_id);
@@ -4053,7 +4423,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 									sub_set);
 
 				start_monitored_event(&pm);
-				res2 = PQexec(local_dbconn, dstring_data(&query));
+				res2 = db_exec(local_conn, dstring_data(&query));
 				monitor_subscriber_query(&pm);
 
 				if (PQresultStatus(res2) != PGRES_TUPLES_OK)
@@ -4082,148 +4452,149 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 				ntables_total += ntuples2;
 
 				/*
-				 * ... and build up the log selection query
+				 * ... and build up the log selection query.
 				 */
-				for (sl_log_no = 1; sl_log_no <= 2; sl_log_no++)
+				if (need_union)
 				{
-					/*
-					 * We only need to query sl_log_1 when log_status is 0 or
-					 * during log switching (log_status 2 and 3).
-					 */
-					if (sl_log_no == 1 && provider->log_status == 1)
-						continue;
-
-					/*
-					 * Likewise we only query sl_log_2 when log_status is 1, 2
-					 * or 3.
-					 */
-					if (sl_log_no == 2 && provider->log_status == 0)
-						continue;
+					slon_appendquery(provider_query, " union all ");
+				}
+				need_union = 1;
 
-					if (need_union)
-					{
-						slon_appendquery(provider_query, " union all ");
-					}
-					need_union = 1;
+				actionlist_len = strlen(ssy_action_list);
+				slon_log(SLON_DEBUG2, "remoteWorkerThread_%d_%d: "
+						 "ssy_action_list length: %d\n",
+						 node->no_id, provider->no_id,
+						 actionlist_len);
+				slon_log(SLON_DEBUG4, "remoteWorkerThread_%d_%d: "
+						 "ssy_action_list value: %s\n",
+						 node->no_id, provider->no_id,
+						 ssy_action_list);
 
-					/*
-					 * First for the big chunk that does the index scan with
-					 * upper and lower bounds:
-					 *
-					 * select ... from sl_log_N where log_origin = X and
-					 * log_tableid in (<this set's tables>)
-					 */
-					slon_appendquery(provider_query,
-								 "select log_origin, log_txid, log_tableid, "
-									 "log_actionseq, log_tablenspname, "
-									 "log_tablerelname, log_cmdtype, "
-									 "log_cmdupdncols, log_cmdargs "
-									 "from %s.sl_log_%d "
-									 "where log_origin = %d "
-									 "and log_tableid in (",
-									 rtcfg_namespace, sl_log_no,
-									 node->no_id);
-					for (tupno2 = 0; tupno2 < ntuples2; tupno2++)
+				/*
+				 * Have the provider materialize the log rows of every
+				 * SYNC since this set's last one once for all subscribers
+				 * reading from it. Sets synced to the same SYNC share one
+				 * call:
+				 *
+				 * select logFetchPrepare(X, <receiver>, <ssy_seqno>,
+				 * '<last_snapshot>', <this_seqno>)
+				 */
+				if (sync_shared_fetch && actionlist_len == 0 &&
+					(fetch_seqno == NULL ||
+					 strcmp(fetch_seqno, PQgetvalue(res1, tupno1, 1)) != 0))
+				{
+					PGresult   *res3;
+
+					fetch_seqno = PQgetvalue(res1, tupno1, 1);
+					(void) slon_mkquery(&query,
+									"select %s.logFetchPrepare(%d, %d, "
+										"'%s', '%s', '%s'); ",
+										rtcfg_namespace, node->no_id,
+										rtcfg_nodeid, fetch_seqno,
+										ssy_snapshot, seqbuf);
+					start_monitored_event(&pm);
+					res3 = db_exec(provider->conn, dstring_data(&query));
+					monitor_provider_query(&pm);
+					if (PQresultStatus(res3) != PGRES_TUPLES_OK ||
+						PQntuples(res3) != 1)
 					{
-						if (tupno2 > 0)
-							dstring_addchar(provider_query, ',');
-						dstring_append(provider_query,
-									   PQgetvalue(res2, tupno2, 0));
+						slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
+								 node->no_id, dstring_data(&query),
+								 PQresultErrorMessage(res3));
+						PQclear(res3);
+						PQclear(res2);
+						PQclear(res1);
+						dstring_free(&query);
+						dstring_free(&lsquery);
+						archive_terminate(node);
+						return 60;
 					}
-					dstring_append(provider_query, ") ");
+					fetch_slices = strtol(PQgetvalue(res3, 0, 0), NULL, 10);
+					PQclear(res3);
+				}
 
-					/*
-					 * and log_txid >= '<maxxid_last_snapshot>' and log_txid <
-					 * '<maxxid_this_snapshot>' and
-					 * txit_visible_in_snapshot(log_txid, '<this_snapshot>')
-					 */
-					slon_appendquery(provider_query,
-									 "and log_txid >= '%s' "
-									 "and log_txid < '%s' "
-									 "and \"pg_catalog\".txid_visible_in_snapshot(log_txid, '%s') ",
-									 ssy_maxxid,
-									 event->ev_maxtxid_c,
-									 event->ev_snapshot_c);
+				/*
+				 * If it did, select this set's tables from those slices:
+				 *
+				 * select ... from sl_log_fetch_1 where log_origin = X and
+				 * lf_seqno > <ssy_seqno> and lf_seqno <= <this_seqno> and
+				 * log_tableid in (<this set's tables>) union all the same
+				 * from sl_log_fetch_2
+				 */
+				if (sync_shared_fetch && actionlist_len == 0 &&
+					fetch_slices > 0)
+				{
+					int			fetch_no;
 
-					/*
-					 * and (<actionseq_qual_on_first_sync>)
-					 */
-					actionlist_len = strlen(ssy_action_list);
-					slon_log(SLON_DEBUG2, "remoteWorkerThread_%d_%d: "
-							 "ssy_action_list length: %d\n",
-							 node->no_id, provider->no_id,
-							 actionlist_len);
-					slon_log(SLON_DEBUG4, "remoteWorkerThread_%d_%d: "
-							 "ssy_action_list value: %s\n",
-							 node->no_id, provider->no_id,
-							 ssy_action_list);
-					if (actionlist_len > 0)
+					for (fetch_no = 1; fetch_no <= 2; fetch_no++)
 					{
-						dstring_init(&actionseq_subquery);
-						compress_actionseq(ssy_action_list, &actionseq_subquery);
+						if (fetch_no > 1)
+							slon_appendquery(provider_query, " union all ");
 						slon_appendquery(provider_query,
-										 " and (%s)",
-										 dstring_data(&actionseq_subquery));
-						dstring_free(&actionseq_subquery);
+									 "select log_origin, log_txid, log_tableid, "
+										 "log_actionseq, log_tablenspname, "
+										 "log_tablerelname, log_cmdtype, "
+										 "log_cmdupdncols, log_cmdargs "
+										 "from %s.sl_log_fetch_%d "
+										 "where log_origin = %d "
+										 "and lf_seqno > '%s' "
+										 "and lf_seqno <= '%s' "
+										 "and log_tableid in (",
+										 rtcfg_namespace, fetch_no,
+										 node->no_id, fetch_seqno, seqbuf);
+						for (tupno2 = 0; tupno2 < ntuples2; tupno2++)
+						{
+							if (tupno2 > 0)
+								dstring_addchar(provider_query, ',');
+							dstring_append(provider_query,
+										   PQgetvalue(res2, tupno2, 0));
+						}
+						dstring_append(provider_query, ") ");
 					}
+					PQclear(res2);
+					continue;
+				}
 
-					/*
-					 * Now do it all over again to get the log rows from
-					 * in-progress transactions at snapshot one that have
-					 * committed by the time of snapshot two. again, we do:
-					 *
-					 * select ... from sl_log_N where log_origin = X and
-					 * log_tableid in (<this set's tables>)
-					 */
-
-					slon_appendquery(provider_query,
-									 "union all "
+				/*
+				 * Otherwise logSelect() on the provider picks the sl_log
+				 * table(s) to read from sl_log_status and keeps its query
+				 * plans for the session:
+				 *
+				 * select ... from logSelect(X, '{<this set's tables>}',
+				 * '<maxxid_last_snapshot>', '<maxxid_this_snapshot>',
+				 * '<this_snapshot>', '<last_snapshot>',
+				 * <actionseq_qual_on_first_sync>)
+				 */
+				slon_appendquery(provider_query,
 								 "select log_origin, log_txid, log_tableid, "
-									 "log_actionseq, log_tablenspname, "
-									 "log_tablerelname, log_cmdtype, "
-									 "log_cmdupdncols, log_cmdargs "
-									 "from %s.sl_log_%d "
-									 "where log_origin = %d "
-									 "and log_tableid in (",
-									 rtcfg_namespace, sl_log_no,
-									 node->no_id);
-					for (tupno2 = 0; tupno2 < ntuples2; tupno2++)
-					{
-						if (tupno2 > 0)
-							dstring_addchar(provider_query, ',');
-						dstring_append(provider_query,
-									   PQgetvalue(res2, tupno2, 0));
-					}
-					dstring_append(provider_query, ") ");
-
-					/*
-					 * and log_txid in (select
-					 * txid_snapshot_xip('<last_snapshot>')) and
-					 * txit_visible_in_snapshot(log_txid, '<this_snapshot>')
-					 */
-					slon_appendquery(provider_query,
-									 "and log_txid in (select * from "
-									 "\"pg_catalog\".txid_snapshot_xip('%s') "
-									 "except "
-									 "select * from "
-								  "\"pg_catalog\".txid_snapshot_xip('%s') )",
-									 ssy_snapshot,
-									 event->ev_snapshot_c);
-
-					/*
-					 * and (<actionseq_qual_on_first_sync>)
-					 */
-					actionlist_len = strlen(ssy_action_list);
-					if (actionlist_len > 0)
-					{
-						dstring_init(&actionseq_subquery);
-						compress_actionseq(ssy_action_list, &actionseq_subquery);
-						slon_appendquery(provider_query,
-										 " and (%s)",
-										 dstring_data(&actionseq_subquery));
-						dstring_free(&actionseq_subquery);
-					}
+								 "log_actionseq, log_tablenspname, "
+								 "log_tablerelname, log_cmdtype, "
+								 "log_cmdupdncols, log_cmdargs "
+								 "from %s.logSelect(%d, '{",
+								 rtcfg_namespace, node->no_id);
+				for (tupno2 = 0; tupno2 < ntuples2; tupno2++)
+				{
+					if (tupno2 > 0)
+						dstring_addchar(provider_query, ',');
+					dstring_append(provider_query,
+								   PQgetvalue(res2, tupno2, 0));
 				}
+				slon_appendquery(provider_query,
+								 "}', '%s', '%s', '%s', '%s', ",
+								 ssy_maxxid,
+								 event->ev_maxtxid_c,
+								 event->ev_snapshot_c,
+								 ssy_snapshot);
+				if (actionlist_len > 0)
+				{
+					dstring_init(&actionseq_subquery);
+					compress_actionseq(ssy_action_list, &actionseq_subquery);
+					slon_appendquery(provider_query, "'%q')",
+									 dstring_data(&actionseq_subquery));
+					dstring_free(&actionseq_subquery);
+				}
+				else
+					dstring_append(provider_query, "NULL)");
 				PQclear(res2);
 			}
 			PQclear(res1);
@@ -4262,7 +4633,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 	(void) slon_mkquery(&query, "select last_value from %s.sl_log_status",
 						rtcfg_namespace);
 	start_monitored_event(&pm);
-	res1 = PQexec(local_dbconn, dstring_data(&query));
+	res1 = db_exec(local_conn, dstring_data(&query));
 	monitor_subscriber_query(&pm);
 
 	if (PQresultStatus(res1) != PGRES_TUPLES_OK)
@@ -4345,8 +4716,11 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 	}
 
 	/*
-	 * Get all sequence updates
+	 * Get all sequence updates. The local calls to adjust the sequences
+	 * are collected in applyquery and sent together with the setsync
+	 * update below.
 	 */
+	dstring_init(&applyquery);
 	for (provider = wd->provider_head; provider; provider = provider->next)
 	{
 		int			ntuples1;
@@ -4381,7 +4755,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 				"  group by SL.seql_seqid,SQ.seq_nspname, SQ.seq_relname; ");
 
 		start_monitored_event(&pm);
-		res1 = PQexec(provider->conn->dbconn, dstring_data(&query));
+		res1 = db_exec(provider->conn, dstring_data(&query));
 		monitor_provider_query(&pm);
 
 		if (PQresultStatus(res1) != PGRES_TUPLES_OK)
@@ -4392,6 +4766,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 			PQclear(res1);
 			dstring_free(&query);
 			dstring_free(&lsquery);
+			dstring_free(&applyquery);
 			archive_terminate(node);
 			slon_disconnectdb(provider->conn);
 			provider->conn = NULL;
@@ -4405,20 +4780,10 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 			char	   *seq_nspname = PQgetvalue(res1, tupno1, 2);
 			char	   *seq_relname = PQgetvalue(res1, tupno1, 3);
 
-			(void) slon_mkquery(&query,
+			slon_appendquery(&applyquery,
 							 "select %s.sequenceSetValue(%s,%d,'%s','%s',false); ",
-								rtcfg_namespace,
+							 rtcfg_namespace,
 						   seql_seqid, node->no_id, seqbuf, seql_last_value);
-			start_monitored_event(&pm);
-			if (query_execute(node, local_dbconn, &query) < 0)
-			{
-				PQclear(res1);
-				dstring_free(&query);
-				dstring_free(&lsquery);
-				archive_terminate(node);
-				return 60;
-			}
-			monitor_subscriber_iud(&pm);
 
 			/*
 			 * Add the sequence number adjust call to the archive log.
@@ -4441,60 +4806,76 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 	 * Light's are still green ... update the setsync status of all the sets
 	 * we've just replicated ...
 	 */
-	(void) slon_mkquery(&query,
-						"update %s.sl_setsync set "
-						"    ssy_seqno = '%s', ssy_snapshot = '%s', "
-						"    ssy_action_list = '' "
-						"where ssy_origin=%d and  ssy_setid in (",
-						rtcfg_namespace,
-						seqbuf, event->ev_snapshot_c,node->no_id);
 	i = 0;
 	for (provider = wd->provider_head; provider; provider = provider->next)
 	{
 		for (pset = provider->set_head; pset; pset = pset->next)
 		{
-			slon_appendquery(&query, "%s%d", (i == 0) ? "" : ",",
+			if (i == 0)
+				slon_appendquery(&applyquery,
+								 "update %s.sl_setsync set "
+								 "    ssy_seqno = '%s', ssy_snapshot = '%s', "
+								 "    ssy_action_list = '' "
+								 "where ssy_origin=%d and  ssy_setid in (",
+								 rtcfg_namespace,
+								 seqbuf, event->ev_snapshot_c, node->no_id);
+			slon_appendquery(&applyquery, "%s%d", (i == 0) ? "" : ",",
 							 pset->set_id);
 			i++;
 		}
 	}
 
+	/*
+	 * ... if there could be any, that is.
+	 */
 	if (i > 0)
+		slon_appendquery(&applyquery, ") and ssy_seqno < '%s'; ", seqbuf);
+
+	/*
+	 * Send the sequence adjustments and the setsync update in one round
+	 * trip and finish the archive section while the database works on it.
+	 */
+	start_monitored_event(&pm);
+	if (dstring_data(&applyquery)[0] != '\0' &&
+		db_send_query(local_conn, dstring_data(&applyquery)) < 0)
 	{
-		/*
-		 * ... if there could be any, that is.
-		 */
-		slon_appendquery(&query, ") and ssy_seqno < '%s'; ", seqbuf);
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
+				 node->no_id, dstring_data(&applyquery),
+				 PQerrorMessage(local_dbconn));
+		dstring_free(&query);
+		dstring_free(&lsquery);
+		dstring_free(&applyquery);
+		archive_terminate(node);
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: SYNC aborted\n",
+				 node->no_id);
+		return 10;
+	}
 
-		start_monitored_event(&pm);
-		res1 = PQexec(local_dbconn, dstring_data(&query));
-		monitor_subscriber_query(&pm);
+	/*
+	 * End the SYNC group's section of the archive log. It is finished and
+	 * published by archive_commit() once the transaction has committed.
+	 */
+	if (archive_dir)
+	{
+		rc = archive_section_end(node);
+		if (rc < 0)
+			slon_retry();
+	}
 
-		if (PQresultStatus(res1) != PGRES_COMMAND_OK)
+	if (dstring_data(&applyquery)[0] != '\0')
+	{
+		rc = query_finish(node, local_conn, &applyquery);
+		monitor_subscriber_iud(&pm);
+		if (rc < 0)
 		{
-			slon_log(SLON_ERROR, "remoteWorkerThread_%d: \"%s\" %s",
-					 node->no_id, dstring_data(&query),
-					 PQresultErrorMessage(res1));
-			PQclear(res1);
 			dstring_free(&query);
 			dstring_free(&lsquery);
+			dstring_free(&applyquery);
 			archive_terminate(node);
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d: SYNC aborted\n",
 					 node->no_id);
 			return 10;
 		}
-		PQclear(res1);
-	}
-
-	/*
-	 * Add the final commit to the archive log, close it and rename the
-	 * temporary file to the real log chunk filename.
-	 */
-	if (archive_dir)
-	{
-		rc = archive_close(node);
-		if (rc < 0)
-			slon_retry();
 	}
 
 	/*
@@ -4502,6 +4883,7 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 	 */
 	dstring_free(&query);
 	dstring_free(&lsquery);
+	dstring_free(&applyquery);
 	gettimeofday(&tv_now, NULL);
 	slon_log(SLON_INFO, "remoteWorkerThread_%d: SYNC "
 			 INT64_FORMAT " done in %.3f seconds\n",
@@ -4509,6 +4891,10 @@ sync_event(SlonNode * node, SlonConn * local_conn,
 			 TIMEVAL_DIFF(&tv_start, &tv_now));
 	sprintf(wd->duration_buf, "%.3f s", TIMEVAL_DIFF(&tv_start, &tv_now));
 
+	wd->metrics.prov_query_t += pm.prov_query_t;
+	wd->metrics.apply_t += pm.subscr_query_t + pm.subscr_iud__t;
+	wd->metrics.total_t = TIMEVAL_DIFF(&tv_start, &tv_now);
+
 	slon_log(SLON_DEBUG1,
 		   "remoteWorkerThread_%d: SYNC " INT64_FORMAT " sync_event timing: "
 			 " pqexec (s/count)"
@@ -4539,9 +4925,9 @@ sync_helper(void *cdata, PGconn *local_conn)
 	SlonDString copy_in;
 	int			errors;
 	struct timeval tv_start;
+	struct timeval tv_first;
 	struct timeval tv_now;
 	int			first_fetch;
-	int			log_status;
 	int			rc;
 	int			rc2;
 	int			ntuples;
@@ -4574,53 +4960,13 @@ sync_helper(void *cdata, PGconn *local_conn)
 
 	start_monitored_event(&pm);
 
-	if (query_execute(node, dbconn, &query) < 0)
+	if (query_execute(node, provider->conn, &query) < 0)
 	{
 		errors++;
 		dstring_free(&query);
 		return errors;
 	}
 	monitor_subscriber_query(&pm);
-
-	/*
-	 * Get the current sl_log_status value
-	 */
-	(void) slon_mkquery(&query, "select last_value from %s.sl_log_status",
-						rtcfg_namespace);
-
-	start_monitored_event(&pm);
-	res2 = PQexec(dbconn, dstring_data(&query));
-	monitor_provider_query(&pm);
-
-	rc = PQresultStatus(res2);
-	if (rc != PGRES_TUPLES_OK)
-	{
-		slon_log(SLON_ERROR,
-				 "remoteWorkerThread_%d: \"%s\" %s %s\n",
-				 node->no_id, dstring_data(&query),
-				 PQresStatus(rc),
-				 PQresultErrorMessage(res2));
-		PQclear(res2);
-		errors++;
-		dstring_free(&query);
-		return errors;
-	}
-	if (PQntuples(res2) != 1)
-	{
-		slon_log(SLON_ERROR,
-				 "remoteWorkerThread_%d: \"%s\" %s returned %d tuples\n",
-				 node->no_id, dstring_data(&query),
-				 PQresStatus(rc), PQntuples(res2));
-		PQclear(res2);
-		errors++;
-		dstring_free(&query);
-		return errors;
-	}
-	log_status = strtol(PQgetvalue(res2, 0, 0), NULL, 10);
-	PQclear(res2);
-	slon_log(SLON_DEBUG2,
-			 "remoteWorkerThread_%d_%d: current remote log_status = %d\n",
-			 node->no_id, provider->no_id, log_status);
 	dstring_free(&query);
 
 	/*
@@ -4638,7 +4984,7 @@ sync_helper(void *cdata, PGconn *local_conn)
 		slon_mkquery(&explain_query, "explain %s",
 					 dstring_data(&(provider->helper_query)));
 
-		res = PQexec(dbconn, dstring_data(&explain_query));
+		res = db_exec(provider->conn, dstring_data(&explain_query));
 		if (PQresultStatus(res) != PGRES_TUPLES_OK)
 		{
 			slon_log(SLON_ERROR, "remoteWorkerThread_%d_%d: \"%s\" %s",
@@ -4684,7 +5030,7 @@ sync_helper(void *cdata, PGconn *local_conn)
 	 * execute the COPY to read the log data.
 	 */
 	start_monitored_event(&pm);
-	res = PQexec(dbconn, dstring_data(&provider->helper_query));
+	res = db_exec(provider->conn, dstring_data(&provider->helper_query));
 	if (PQresultStatus(res) != PGRES_COPY_OUT)
 	{
 		errors++;
@@ -4754,13 +5100,14 @@ sync_helper(void *cdata, PGconn *local_conn)
 			break;
 		}
 		tupno++;
+		wd->metrics.copy_bytes += rc;
 		if (first_fetch)
 		{
-			gettimeofday(&tv_now, NULL);
+			gettimeofday(&tv_first, NULL);
 			slon_log(SLON_DEBUG1,
 			  "remoteWorkerThread_%d_%d: %.3f seconds delay for first row\n",
 					 node->no_id, provider->no_id,
-					 TIMEVAL_DIFF(&tv_start, &tv_now));
+					 TIMEVAL_DIFF(&tv_start, &tv_first));
 
 			first_fetch = false;
 		}
@@ -4839,10 +5186,16 @@ sync_helper(void *cdata, PGconn *local_conn)
 	(void) slon_mkquery(&query, "rollback transaction; "
 						"set enable_seqscan = default; "
 						"set enable_indexscan = default; ");
-	if (query_execute(node, dbconn, &query) < 0)
+	if (query_execute(node, provider->conn, &query) < 0)
 		errors++;
 
 	gettimeofday(&tv_now, NULL);
+	if (first_fetch)
+		tv_first = tv_now;
+	wd->metrics.prov_query_t += pm.prov_query_t;
+	wd->metrics.first_row_t += TIMEVAL_DIFF(&tv_start, &tv_first);
+	wd->metrics.copy_t += TIMEVAL_DIFF(&tv_first, &tv_now);
+	wd->metrics.log_rows += tupno;
 	slon_log(SLON_DEBUG1,
 			 "remoteWorkerThread_%d_%d: %.3f seconds until close cursor\n",
 			 node->no_id, provider->no_id,
@@ -4881,9 +5234,28 @@ sync_helper(void *cdata, PGconn *local_conn)
  *
  * ========  Here Ends The Body of the Log Shipping Archive ========
  *
- * Finally, the log ends, notably with a COMMIT statement, generated
- * using close_log_archive(), which closes the file and renames it
- * from ".tmp" form to the final name.
+ * The end of the event's data is marked with archive_section_end()
+ * before the local transaction commits, and archive_commit() is
+ * called after it did. Only then the archive is finished with a
+ * COMMIT statement, closed and renamed from ".tmp" form to the final
+ * name by archive_publish(), so that no archive is ever published for
+ * a transaction that did not commit locally.
+ *
+ * With archive_rollover_size or archive_rollover_interval set, a SYNC
+ * archive is not published at its commit. The following SYNC groups of
+ * the same node are appended to it as further sections, each starting
+ * with its own archiveTracking_offline() call, until the file is big or
+ * old enough. The whole file is still applied in one transaction on the
+ * log shipping target.
+ *
+ * Since all workers draw their archive numbers from sl_archive_counter,
+ * at most one archive can be in progress at any time. Opening a new one
+ * publishes the one of another worker, which is safe because the row
+ * lock on the counter guarantees that its transaction has finished.
+ *
+ * The end offset of every section is recorded in a ".sections" file
+ * next to the temporary file. After a crash, archive_recover() uses it
+ * to publish the sections that were committed and drop the rest.
  * ----------
  */
 
@@ -4892,15 +5264,17 @@ sync_helper(void *cdata, PGconn *local_conn)
  * archive_open
  *
  * Stores the archive name in archive_name (as .sql name) and
- * archive_tmp (.tmp file)
+ * archive_tmp (.tmp file). For a SYNC with archive rollover enabled,
+ * a file left open by the previous SYNC group of this node is continued
+ * with a new section instead.
  * ----------
  */
 static int
-archive_open(SlonNode * node, char *seqbuf, PGconn *dbconn)
+archive_open(SlonNode * node, char *seqbuf, PGconn *dbconn, bool is_sync)
 {
 	SlonDString query;
 	PGresult   *res;
-	int			i;
+	int64		counter;
 	int			rc;
 
 	if (!archive_dir)
@@ -4922,14 +5296,6 @@ archive_open(SlonNode * node, char *seqbuf, PGconn *dbconn)
 		}
 	}
 
-	if (node->archive_fp != NULL)
-	{
-		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
-				 "archive_open() called - archive is already opened\n",
-				 node->no_id);
-		return -1;
-	}
-
 	dstring_init(&query);
 	slon_mkquery(&query,
 				 "update %s.sl_archive_counter "
@@ -4977,45 +5343,113 @@ archive_open(SlonNode * node, char *seqbuf, PGconn *dbconn)
 	strcpy(node->archive_timestamp, PQgetvalue(res, 0, 1));
 	PQclear(res);
 	dstring_free(&query);
+	counter = strtoll(node->archive_counter, NULL, 10);
+
+	/*
+	 * Every transaction that drew a lower counter value has finished now.
+	 * Those values are final, so archives left behind by a previous slon
+	 * and the archive of another worker can be published up to here.
+	 */
+	pthread_mutex_lock(&archive_lock);
+	if (!archive_recovered)
+	{
+		archive_recover(node, counter - 1);
+		archive_recovered = true;
+	}
+	if (archive_open_node != NULL &&
+		(archive_open_node != node || !is_sync || !node->archive_rollover))
+	{
+		if (archive_publish(archive_open_node, counter - 1) < 0)
+		{
+			pthread_mutex_unlock(&archive_lock);
+			return -1;
+		}
+	}
 
-	sprintf(node->archive_name, "%s/slony1_log_%d_", archive_dir,
-			rtcfg_nodeid);
-	for (i = strlen(node->archive_counter); i < 20; i++)
-		strcat(node->archive_name, "0");
-	strcat(node->archive_name, node->archive_counter);
-	strcat(node->archive_name, ".sql");
+	if (node->archive_active)
+	{
+		/*
+		 * Continue the archive of our previous SYNC group.
+		 */
+		pthread_mutex_unlock(&archive_lock);
+
+		dstring_init(&query);
+		slon_mkquery(&query,
+	 "\n------------------------------------------------------------------\n"
+					 "-- Node %d, Event %s\n"
+	   "------------------------------------------------------------------\n"
+					 "select %s.archiveTracking_offline('%s', '%s');\n",
+					 node->no_id, seqbuf, rtcfg_namespace,
+					 node->archive_counter, node->archive_timestamp);
+		rc = archive_write(node, dstring_data(&query),
+						   strlen(dstring_data(&query)));
+		dstring_free(&query);
+		if (rc < 0)
+		{
+			slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+					 "Cannot write to archive file %s - %s\n",
+					 node->no_id, node->archive_temp, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	snprintf(node->archive_name, SLON_MAX_PATH,
+			 "%s/slony1_log_%d_%020" INT64_MODIFIER "d.sql",
+			 archive_dir, rtcfg_nodeid, counter);
+	node->archive_gz_level = 0;
+#ifdef HAVE_LIBZ
+	if (archive_compression > 0)
+	{
+		strcat(node->archive_name, ".gz");
+		node->archive_gz_level = archive_compression;
+	}
+#else
+	if (archive_compression > 0 && !archive_gz_warned)
+	{
+		slon_log(SLON_WARN, "remoteWorkerThread_%d: "
+				 "archive_compression requested but slon was built "
+				 "without zlib - writing uncompressed archives\n",
+				 node->no_id);
+		archive_gz_warned = true;
+	}
+#endif
 	strcpy(node->archive_temp, node->archive_name);
 	strcat(node->archive_temp, ".tmp");
-	node->archive_fp = fopen(node->archive_temp, "w");
-	if (node->archive_fp == NULL)
+
+	node->archive_first = counter;
+	node->archive_sections = 0;
+	node->archive_committed = 0;
+	node->archive_opened = time(NULL);
+	node->archive_rollover = is_sync &&
+		(archive_rollover_size > 0 || archive_rollover_interval > 0);
+
+	if (archive_reopen(node, "w") < 0)
 	{
-		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
-				 "Cannot open archive file %s - %s\n",
-				 node->no_id, node->archive_temp, strerror(errno));
+		pthread_mutex_unlock(&archive_lock);
 		return -1;
 	}
-	rc = fprintf(node->archive_fp,
+	node->archive_active = true;
+	archive_open_node = node;
+	pthread_mutex_unlock(&archive_lock);
+
+	dstring_init(&query);
+	slon_mkquery(&query,
 	   "------------------------------------------------------------------\n"
 				 "-- Slony-I log shipping archive\n"
 				 "-- Node %d, Event %s\n"
 	   "------------------------------------------------------------------\n"
 				 "set session_replication_role to replica;\n"
-				 "start transaction;\n",
-				 node->no_id, seqbuf);
-	if (rc < 0)
-	{
-		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
-				 "Cannot write to archive file %s - %s\n",
-				 node->no_id, node->archive_temp, strerror(errno));
-		return -1;
-	}
-	rc = fprintf(node->archive_fp,
+				 "start transaction;\n"
 				 "select %s.archiveTracking_offline('%s', '%s');\n"
 				 "-- end of log archiving header\n"
 	   "------------------------------------------------------------------\n"
 				 "-- start of Slony-I data\n"
 	  "------------------------------------------------------------------\n",
+				 node->no_id, seqbuf,
 			rtcfg_namespace, node->archive_counter, node->archive_timestamp);
+	rc = archive_write(node, dstring_data(&query), strlen(dstring_data(&query)));
+	dstring_free(&query);
 	if (rc < 0)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
@@ -5027,19 +5461,99 @@ archive_open(SlonNode * node, char *seqbuf, PGconn *dbconn)
 	return 0;
 }
 
+
+/* ----------
+ * archive_reopen
+ *
+ *	Open the stream of the archive's temporary file with the given
+ *	fopen() mode. Every section of a compressed archive is a gzip
+ *	member of its own, so that the file can be cut at any section end.
+ * ----------
+ */
+static int
+archive_reopen(SlonNode * node, const char *how)
+{
+#ifdef HAVE_LIBZ
+	if (node->archive_gz_level > 0)
+	{
+		char		mode[16];
+
+		sprintf(mode, "%sb%d", how, node->archive_gz_level);
+		node->archive_gz = gzopen(node->archive_temp, mode);
+		node->archive_gz_pending = 0;
+		if (node->archive_gz == NULL)
+		{
+			slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+					 "Cannot open archive file %s - %s\n",
+					 node->no_id, node->archive_temp, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
+	node->archive_fp = fopen(node->archive_temp, how);
+	if (node->archive_fp == NULL)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot open archive file %s - %s\n",
+				 node->no_id, node->archive_temp, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
 /* ----------
- * archive_close
+ * archive_stream_close
+ *
+ *	Close the stream of the archive's temporary file, if open.
  * ----------
  */
 static int
-archive_close(SlonNode * node)
+archive_stream_close(SlonNode * node)
 {
 	int			rc = 0;
 
+#ifdef HAVE_LIBZ
+	if (node->archive_gz != NULL)
+	{
+		rc = (gzclose(node->archive_gz) == Z_OK) ? 0 : -1;
+		node->archive_gz = NULL;
+	}
+#endif
+	if (node->archive_fp != NULL)
+	{
+		if (fclose(node->archive_fp) != 0)
+			rc = -1;
+		node->archive_fp = NULL;
+	}
+
+	return rc;
+}
+
+
+/* ----------
+ * archive_section_end
+ *
+ *	Mark the end of the current event's data in the archive. Called
+ *	before the local transaction commits.
+ * ----------
+ */
+static int
+archive_section_end(SlonNode * node)
+{
+	char		path[SLON_MAX_PATH];
+	struct stat st;
+	off_t	   *offsets;
+	FILE	   *fp;
+	int			rc;
+
 	if (!archive_dir)
 		return 0;
 
-	if (node->archive_fp == NULL)
+	if (!node->archive_active)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot close archive file %s - not open\n",
@@ -5047,25 +5561,170 @@ archive_close(SlonNode * node)
 		return -1;
 	}
 
-	rc = fprintf(node->archive_fp,
+	if (node->archive_sections == node->archive_sections_max)
+	{
+		node->archive_sections_max = (node->archive_sections_max == 0) ?
+			16 : node->archive_sections_max * 2;
+		offsets = (off_t *) realloc(node->archive_offsets,
+							 sizeof(off_t) * node->archive_sections_max);
+		if (offsets == NULL)
+		{
+			slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+					 "Out of memory in archive_section_end()\n",
+					 node->no_id);
+			return -1;
+		}
+		node->archive_offsets = offsets;
+	}
+
+	/*
+	 * Bring the section to disk as far as the stdio or gzip buffers are
+	 * concerned and remember where it ends.
+	 */
+	if (node->archive_gz_level > 0)
+		rc = archive_stream_close(node);
+	else
+		rc = fflush(node->archive_fp);
+	if (rc != 0 || stat(node->archive_temp, &st) < 0)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot write to archive file %s - %s\n",
+				 node->no_id, node->archive_temp, strerror(errno));
+		return -1;
+	}
+	node->archive_offsets[node->archive_sections++] = st.st_size;
+
+	snprintf(path, sizeof(path), "%s.sections", node->archive_name);
+	if ((fp = fopen(path, "a")) == NULL)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot open archive section file %s - %s\n",
+				 node->no_id, path, strerror(errno));
+		return -1;
+	}
+	rc = fprintf(fp, "%s " INT64_FORMAT "\n", node->archive_counter,
+				 (int64) st.st_size);
+	if (fclose(fp) != 0 || rc < 0)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot write to archive section file %s - %s\n",
+				 node->no_id, path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* ----------
+ * archive_commit
+ *
+ *	Called after the local transaction of the current section has
+ *	committed. Publishes the archive unless it is to be continued by the
+ *	next SYNC group.
+ * ----------
+ */
+static int
+archive_commit(SlonNode * node)
+{
+	int			rc = 0;
+
+	if (!archive_dir)
+		return 0;
+
+	pthread_mutex_lock(&archive_lock);
+	if (node->archive_active)
+	{
+		node->archive_committed = node->archive_sections;
+		if (!node->archive_rollover || node->archive_sections == 0 ||
+			(archive_rollover_size > 0 &&
+			 node->archive_offsets[node->archive_sections - 1] >=
+			 (off_t) archive_rollover_size * 1024) ||
+			(archive_rollover_interval > 0 &&
+			 (int64) (time(NULL) - node->archive_opened) * 1000 >=
+			 archive_rollover_interval))
+			rc = archive_publish(node, node->archive_first +
+								 node->archive_committed - 1);
+	}
+	pthread_mutex_unlock(&archive_lock);
+
+	return rc;
+}
+
+
+/* ----------
+ * archive_publish
+ *
+ *	Finish the archive with the sections up to counter value last, close
+ *	it and rename it to its final name. The caller holds archive_lock.
+ *	An archive without such sections is removed.
+ * ----------
+ */
+static int
+archive_publish(SlonNode * node, int64 last)
+{
+	SlonDString trailer;
+	char		path[SLON_MAX_PATH];
+	int			num;
+	int			rc = 0;
+
+	if (!node->archive_active)
+		return 0;
+	node->archive_active = false;
+	if (archive_open_node == node)
+		archive_open_node = NULL;
+
+	num = node->archive_sections;
+	if (last - node->archive_first + 1 < num)
+		num = (int) (last - node->archive_first + 1);
+	if (num < 0)
+		num = 0;
+
+	(void) archive_stream_close(node);
+	snprintf(path, sizeof(path), "%s.sections", node->archive_name);
+	if (num == 0)
+	{
+		unlink(node->archive_temp);
+		unlink(path);
+		return 0;
+	}
+
+	/*
+	 * Cut off sections of transactions that did not commit and add the
+	 * trailer.
+	 */
+	if (truncate(node->archive_temp, node->archive_offsets[num - 1]) < 0)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot truncate archive file %s - %s\n",
+				 node->no_id, node->archive_temp, strerror(errno));
+		return -1;
+	}
+	if (archive_reopen(node, "a") < 0)
+		return -1;
+
+	dstring_init(&trailer);
+	slon_mkquery(&trailer,
 	 "\n------------------------------------------------------------------\n"
 				 "-- End Of Archive Log\n"
 	   "------------------------------------------------------------------\n"
 				 "commit;\n"
 				 "vacuum analyze %s.sl_archive_tracking;\n",
 				 rtcfg_namespace);
+	rc = archive_write(node, dstring_data(&trailer),
+					   strlen(dstring_data(&trailer)));
+	dstring_free(&trailer);
 	if (rc < 0)
 	{
-		archive_terminate(node);
+		(void) archive_stream_close(node);
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot write to archive file %s - %s\n",
 				 node->no_id, node->archive_temp, strerror(errno));
 		return -1;
 	}
 
-	rc = fclose(node->archive_fp);
-	node->archive_fp = NULL;
-	if (rc != 0)
+	if (archive_stream_close(node) != 0 ||
+		(archive_fsync && archive_sync_path(node->archive_temp) < 0))
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot close archive file %s - %s\n",
@@ -5073,6 +5732,14 @@ archive_close(SlonNode * node)
 		return -1;
 	}
 
+	/*
+	 * The index entries are written before the archive appears under its
+	 * final name. A reader that finds an entry without a file falls back
+	 * to scanning the directory.
+	 */
+	if (archive_index_append(node, num) < 0)
+		return -1;
+
 	rc = rename(node->archive_temp, node->archive_name);
 	if (rc != 0)
 	{
@@ -5082,6 +5749,14 @@ archive_close(SlonNode * node)
 				 strerror(errno));
 		return -1;
 	}
+	if (archive_fsync && archive_sync_path(archive_dir) < 0)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot fsync archive directory %s - %s\n",
+				 node->no_id, archive_dir, strerror(errno));
+		return -1;
+	}
+	unlink(path);
 
 	if (command_on_logarchive)
 	{
@@ -5096,18 +5771,198 @@ archive_close(SlonNode * node)
 	return 0;
 }
 
+
 /* ----------
- * archive_terminate
+ * archive_sync_path
+ *
+ *	fsync() a file or directory by name.
+ * ----------
+ */
+static int
+archive_sync_path(const char *path)
+{
+#ifndef WIN32
+	int			fd;
+	int			rc;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	rc = fsync(fd);
+	close(fd);
+	return rc;
+#else
+	return 0;
+#endif
+}
+
+
+/* ----------
+ * archive_recover
+ *
+ *	Publish the archives a previous slon process left behind in
+ *	archive_dir. Only the sections up to counter value last were
+ *	committed. The caller holds archive_lock.
  * ----------
  */
 static void
-archive_terminate(SlonNode * node)
+archive_recover(SlonNode * node, int64 last)
 {
-	if (node->archive_fp != NULL)
+	DIR		   *dirp;
+	struct dirent *dp;
+	SlonNode	tmp;
+	char		prefix[64];
+	char		name[SLON_MAX_PATH];
+	char		temp[SLON_MAX_PATH + 16];
+	char		line[256];
+	FILE	   *fp;
+	size_t		len;
+	int64		num;
+	int64		offset;
+
+	if ((dirp = opendir(archive_dir)) == NULL)
 	{
-		fclose(node->archive_fp);
-		node->archive_fp = NULL;
+		slon_log(SLON_WARN, "remoteWorkerThread_%d: "
+				 "Cannot open archive directory %s - %s\n",
+				 node->no_id, archive_dir, strerror(errno));
+		return;
+	}
+
+	sprintf(prefix, "slony1_log_%d_", rtcfg_nodeid);
+	while ((dp = readdir(dirp)) != NULL)
+	{
+		len = strlen(dp->d_name);
+		if (strncmp(dp->d_name, prefix, strlen(prefix)) != 0 ||
+			len < 9 || strcmp(dp->d_name + len - 9, ".sections") != 0)
+			continue;
+
+		memset(&tmp, 0, sizeof(tmp));
+		tmp.no_id = node->no_id;
+		tmp.archive_name = name;
+		tmp.archive_temp = temp;
+		snprintf(name, sizeof(name), "%s/%.*s", archive_dir,
+				 (int) (len - 9), dp->d_name);
+		snprintf(temp, sizeof(temp), "%s.tmp", name);
+		tmp.archive_first = strtoll(name + strlen(archive_dir) + 1 +
+									strlen(prefix), NULL, 10);
+		if (strlen(name) > 3 && strcmp(name + strlen(name) - 3, ".gz") == 0)
+		{
+#ifdef HAVE_LIBZ
+			tmp.archive_gz_level = (archive_compression > 0) ?
+				archive_compression : 6;
+#else
+			slon_log(SLON_WARN, "remoteWorkerThread_%d: "
+					 "Cannot recover compressed archive %s - slon was "
+					 "built without zlib\n", node->no_id, temp);
+			continue;
+#endif
+		}
+
+		/*
+		 * Read the section ends. Sections are consecutive, so the
+		 * counters need no checking beyond the first one.
+		 */
+		snprintf(line, sizeof(line), "%s/%s", archive_dir, dp->d_name);
+		if ((fp = fopen(line, "r")) == NULL)
+			continue;
+		while (fgets(line, sizeof(line), fp) != NULL)
+		{
+			if (sscanf(line, INT64_FORMAT " " INT64_FORMAT,
+					   &num, &offset) != 2)
+				break;
+			if (tmp.archive_sections == tmp.archive_sections_max)
+			{
+				off_t	   *offsets;
+
+				tmp.archive_sections_max =
+					(tmp.archive_sections_max == 0) ?
+					16 : tmp.archive_sections_max * 2;
+				offsets = (off_t *) realloc(tmp.archive_offsets,
+								   sizeof(off_t) * tmp.archive_sections_max);
+				if (offsets == NULL)
+					break;
+				tmp.archive_offsets = offsets;
+			}
+			tmp.archive_offsets[tmp.archive_sections++] = (off_t) offset;
+		}
+		fclose(fp);
+
+		slon_log(SLON_INFO, "remoteWorkerThread_%d: "
+				 "recovering archive %s\n", node->no_id, temp);
+		tmp.archive_active = true;
+		if (archive_publish(&tmp, last) < 0)
+			slon_log(SLON_WARN, "remoteWorkerThread_%d: "
+					 "Cannot recover archive %s\n", node->no_id, temp);
+		free(tmp.archive_offsets);
+	}
+	closedir(dirp);
+}
+
+
+/* ----------
+ * archive_index_append
+ *
+ *	Add the archive about to be published to the archive index. Each
+ *	line of the index holds the zero padded archive counter of one of
+ *	the first num sections and the name of the file containing it, so
+ *	slony_logshipper can find the archives following the one last
+ *	applied without reading the whole archive directory.
+ * ----------
+ */
+static int
+archive_index_append(SlonNode * node, int num)
+{
+	char		path[SLON_MAX_PATH];
+	char	   *fname;
+	FILE	   *fp;
+	int			i;
+	int			rc = 0;
+
+	if ((fname = strrchr(node->archive_name, '/')) == NULL)
+		fname = node->archive_name;
+	else
+		fname++;
+
+	snprintf(path, sizeof(path), "%s/%s", archive_dir, ARCHIVE_INDEX_NAME);
+	if ((fp = fopen(path, "a")) == NULL)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot open archive index %s - %s\n",
+				 node->no_id, path, strerror(errno));
+		return -1;
 	}
+	for (i = 0; i < num && rc >= 0; i++)
+		rc = fprintf(fp, "%020" INT64_MODIFIER "d %s\n",
+					 node->archive_first + i, fname);
+	if (fclose(fp) != 0 || rc < 0)
+	{
+		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
+				 "Cannot write to archive index %s - %s\n",
+				 node->no_id, path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* ----------
+ * archive_terminate
+ *
+ *	Called when the transaction of the current section is rolled back.
+ *	Sections committed earlier are published, the rest is discarded.
+ * ----------
+ */
+static void
+archive_terminate(SlonNode * node)
+{
+	if (!archive_dir)
+		return;
+
+	pthread_mutex_lock(&archive_lock);
+	if (node->archive_active)
+		(void) archive_publish(node, node->archive_first +
+							   node->archive_committed - 1);
+	pthread_mutex_unlock(&archive_lock);
 }
 
 /* ----------
@@ -5122,7 +5977,7 @@ archive_append_ds(SlonNode * node, SlonDString * ds)
 	if (!archive_dir)
 		return 0;
 
-	if (node->archive_fp == NULL)
+	if (!node->archive_active)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot write to archive file %s - not open\n",
@@ -5130,7 +5985,9 @@ archive_append_ds(SlonNode * node, SlonDString * ds)
 		return -1;
 	}
 
-	rc = fprintf(node->archive_fp, "%s\n", dstring_data(ds));
+	rc = archive_write(node, dstring_data(ds), strlen(dstring_data(ds)));
+	if (rc == 0)
+		rc = archive_write(node, "\n", 1);
 	if (rc < 0)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
@@ -5154,7 +6011,7 @@ archive_append_str(SlonNode * node, const char *s)
 	if (!archive_dir)
 		return 0;
 
-	if (node->archive_fp == NULL)
+	if (!node->archive_active)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot write to archive file %s - not open\n",
@@ -5162,7 +6019,9 @@ archive_append_str(SlonNode * node, const char *s)
 		return -1;
 	}
 
-	rc = fprintf(node->archive_fp, "%s\n", s);
+	rc = archive_write(node, s, strlen(s));
+	if (rc == 0)
+		rc = archive_write(node, "\n", 1);
 	if (rc < 0)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
@@ -5188,7 +6047,7 @@ archive_append_data(SlonNode * node, const char *s, int len)
 	if (!archive_dir)
 		return 0;
 
-	if (node->archive_fp == NULL)
+	if (!node->archive_active)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot write to archive file %s - not open\n",
@@ -5196,8 +6055,8 @@ archive_append_data(SlonNode * node, const char *s, int len)
 		return -1;
 	}
 
-	rc = fwrite(s, len, 1, node->archive_fp);
-	if (rc != 1)
+	rc = archive_write(node, s, len);
+	if (rc < 0)
 	{
 		slon_log(SLON_ERROR, "remoteWorkerThread_%d: "
 				 "Cannot write to archive file %s - %s\n",
@@ -5208,6 +6067,47 @@ archive_append_data(SlonNode * node, const char *s, int len)
 	return 0;
 }
 
+
+/*
+ * archive_write
+ *
+ *	Low level write of len bytes to the current archive. When the
+ *	archive is compressed, the deflate stream is cut with a full flush
+ *	every ARCHIVE_GZ_BLOCK_SIZE bytes of input, so that a damaged or
+ *	partially transferred archive can be recovered block by block. The
+ *	gzip member of a new section is started on its first write.
+ *	Returns 0 on success, -1 on error.
+ */
+static int
+archive_write(SlonNode * node, const char *s, size_t len)
+{
+	if (len == 0)
+		return 0;
+
+#ifdef HAVE_LIBZ
+	if (node->archive_gz_level > 0)
+	{
+		if (node->archive_gz == NULL && archive_reopen(node, "a") < 0)
+			return -1;
+		if (gzwrite(node->archive_gz, s, (unsigned) len) != (int) len)
+			return -1;
+		node->archive_gz_pending += len;
+		if (node->archive_gz_pending >= ARCHIVE_GZ_BLOCK_SIZE)
+		{
+			if (gzflush(node->archive_gz, Z_FULL_FLUSH) != Z_OK)
+				return -1;
+			node->archive_gz_pending = 0;
+		}
+		return 0;
+	}
+#endif
+
+	if (fwrite(s, len, 1, node->archive_fp) != 1)
+		return -1;
+	return 0;
+}
+
+
 /* ----------
  * given a string consisting of a list of actionseq values, return a
  * string that compresses this into a set of log_actionseq ranges
@@ -333,6 +333,33 @@ sched_get_status(void)
 }
 
 
+/* ----------
+ * sched_get_waitqueue
+ *
+ * Count the threads currently in the wait queue, split into those
+ * waiting for a database socket and those only waiting for a timeout.
+ * ----------
+ */
+void
+sched_get_waitqueue(int *num_sock, int *num_sleep)
+{
+	SlonConn   *conn;
+
+	*num_sock = 0;
+	*num_sleep = 0;
+
+	pthread_mutex_lock(&sched_master_lock);
+	for (conn = sched_waitqueue_head; conn; conn = conn->next)
+	{
+		if (conn->condition & (SCHED_WAIT_SOCK_READ | SCHED_WAIT_SOCK_WRITE))
+			(*num_sock)++;
+		else
+			(*num_sleep)++;
+	}
+	pthread_mutex_unlock(&sched_master_lock);
+}
+
+
 /* ----------
  * sched_wakeup_node
  *
@@ -72,6 +72,8 @@ static pthread_t local_event_thread;
 static pthread_t local_cleanup_thread;
 static pthread_t local_sync_thread;
 static pthread_t local_monitor_thread;
+static pthread_t local_metrics_thread;
+static bool metrics_thread_started = false;
 
 static pthread_t main_thread;
 static char *const * main_argv;
@@ -403,6 +405,11 @@ SlonMain(void)
 	slon_worker_pid = slon_pid;
 #endif
 
+	/*
+	 * From here on log messages are written by the log writer thread.
+	 */
+	slon_log_start();
+
 	if (pthread_mutex_init(&slon_wait_listen_lock, NULL) < 0)
 	{
 		slon_log(SLON_FATAL, "main: pthread_mutex_init() failed - %s\n",
@@ -813,6 +820,21 @@ SlonMain(void)
 		}
 	}
 
+	/*
+	 * Create the metrics thread if an endpoint is configured
+	 */
+	if (metrics_port > 0 ||
+		(metrics_socket != NULL && metrics_socket[0] != '\0'))
+	{
+		if (pthread_create(&local_metrics_thread, NULL, metricsThread_main, NULL) < 0)
+		{
+			slon_log(SLON_FATAL, "main: cannot create metricsThread - %s\n",
+					 strerror(errno));
+			slon_retry();
+		}
+		metrics_thread_started = true;
+	}
+
 	/*
 	 * Wait until the scheduler has shut down all remote connections
 	 */
@@ -851,7 +873,13 @@ SlonMain(void)
 		slon_log(SLON_ERROR, "main: cannot join monitorThread - %s\n",
 				 strerror(errno));
 
+	if (metrics_thread_started &&
+		pthread_join(local_metrics_thread, NULL) < 0)
+		slon_log(SLON_ERROR, "main: cannot join metricsThread - %s\n",
+				 strerror(errno));
+
 	slon_log(SLON_CONFIG, "main: done\n");
+	slon_log_stop();
 
 	exit(0);
 }
@@ -28,6 +28,9 @@
 #else
 #include <sys/time.h>
 #endif
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #ifndef INT64_FORMAT
 #define INT64_FORMAT "%" INT64_MODIFIER "d"
@@ -89,6 +92,26 @@ typedef struct SlonState_s SlonState;
 
 typedef struct SlonWorkMsg_s SlonWorkMsg;
 
+/* ----------
+ * SlonNodeStats
+ *
+ * Counters of the remote worker for one origin, reported by the
+ * metrics endpoint. Protected by the node's message_lock.
+ * ----------
+ */
+typedef struct
+{
+	int64		events;			/* events processed */
+	int64		syncs;			/* SYNC events applied */
+	int64		sync_groups;	/* SYNC groups applied */
+	int64		log_rows;		/* log rows copied */
+	int64		copy_bytes;		/* bytes of log data copied */
+	double		sync_time;		/* seconds spent in SYNC groups */
+	double		copy_time;		/* seconds spent selecting/copying log */
+	int64		last_seqno;		/* last event processed */
+	char		last_timestamp[64];		/* its origin timestamp */
+}	SlonNodeStats;
+
 /* ----------
  * SlonState
  * ----------
@@ -135,12 +158,29 @@ struct SlonNode_s
 	pthread_cond_t message_cond;	/* condition variable for queue */
 	SlonWorkMsg *message_head;
 	SlonWorkMsg *message_tail;
+	int			message_events; /* number of queued event messages */
+	SlonWorkMsg *message_pool;	/* recycled event message buffers */
+	int			message_pool_size;		/* number of buffers in the pool */
+	SlonNodeStats stats;		/* worker counters for the metrics thread */
 
 	char	   *archive_name;
 	char	   *archive_temp;
 	char	   *archive_counter;
 	char	   *archive_timestamp;
 	FILE	   *archive_fp;
+#ifdef HAVE_LIBZ
+	gzFile		archive_gz;		/* used instead of archive_fp if compressed */
+	size_t		archive_gz_pending;		/* bytes written since last flush */
+#endif
+	int			archive_gz_level;		/* compression level, 0 = plain */
+	bool		archive_active; /* archive file in progress */
+	bool		archive_rollover;		/* file may span SYNC groups */
+	int64		archive_first;	/* counter of the first section */
+	time_t		archive_opened; /* time the file was created */
+	off_t	   *archive_offsets;	/* file size at the end of each section */
+	int			archive_sections;		/* number of sections ended */
+	int			archive_sections_max;	/* allocated archive_offsets */
+	int			archive_committed;		/* sections known to be committed */
 
 	SlonNode   *prev;
 	SlonNode   *next;
@@ -204,6 +244,8 @@ struct SlonConn_s
  */
 #define		SLON_DSTRING_SIZE_INIT	256
 #define		SLON_DSTRING_SIZE_INC	2
+#define		SLON_DSTRING_POOL_SIZE	8	/* buffers kept per thread */
+#define		SLON_DSTRING_POOL_MAXBUF	(8 * 1024 * 1024)
 
 typedef struct
 {
@@ -212,16 +254,16 @@ typedef struct
 	char	   *data;
 }	SlonDString;
 
+/*
+ * Buffers released by dstring_free() are kept in a small per thread pool
+ * and handed out again by dstring_init(), so a thread that builds the
+ * same kind of queries over and over reuses buffers that have already
+ * grown to the size it needs. See slon_dstring_alloc() in dbutils.c.
+ */
 #define		dstring_init(__ds) \
 do { \
-	(__ds)->n_alloc = SLON_DSTRING_SIZE_INIT; \
 	(__ds)->n_used = 0; \
-	(__ds)->data = malloc(SLON_DSTRING_SIZE_INIT); \
-	if ((__ds)->data == NULL) { \
-		slon_log(SLON_FATAL, "dstring_init: malloc() - %s", \
-				strerror(errno)); \
-		slon_abort(); \
-	} \
+	(__ds)->data = slon_dstring_alloc(&((__ds)->n_alloc)); \
 } while (0)
 #define		dstring_reset(__ds) \
 do { \
@@ -230,24 +272,14 @@ do { \
 } while (0)
 #define		dstring_free(__ds) \
 do { \
-	free((__ds)->data); \
+	slon_dstring_release((__ds)->data, (__ds)->n_alloc); \
 	(__ds)->n_used = 0; \
 	(__ds)->data = NULL; \
 } while (0)
 #define		dstring_nappend(__ds,__s,__n) \
 do { \
 	if ((__ds)->n_used + (__n) >= (__ds)->n_alloc)	\
-	{ \
-		while ((__ds)->n_used + (__n) >= (__ds)->n_alloc) \
-			(__ds)->n_alloc *= SLON_DSTRING_SIZE_INC; \
-		(__ds)->data = realloc((__ds)->data, (__ds)->n_alloc); \
-		if ((__ds)->data == NULL) \
-		{ \
-			slon_log(SLON_FATAL, "dstring_nappend: realloc() - %s", \
-					strerror(errno)); \
-			slon_abort(); \
-		} \
-	} \
+		slon_dstring_grow((__ds), (__ds)->n_used + (__n)); \
 	memcpy(&((__ds)->data[(__ds)->n_used]), (__s), (__n)); \
 	(__ds)->n_used += (__n); \
 } while (0)
@@ -259,16 +291,7 @@ do { \
 #define		dstring_addchar(__ds,__c) \
 do { \
 	if ((__ds)->n_used + 1 >= (__ds)->n_alloc)	\
-	{ \
-		(__ds)->n_alloc *= SLON_DSTRING_SIZE_INC; \
-		(__ds)->data = realloc((__ds)->data, (__ds)->n_alloc); \
-		if ((__ds)->data == NULL) \
-		{ \
-			slon_log(SLON_FATAL, "dstring_addchar: realloc() - %s", \
-					strerror(errno)); \
-			slon_abort(); \
-		} \
-	} \
+		slon_dstring_grow((__ds), (__ds)->n_used + 1); \
 	(__ds)->data[(__ds)->n_used++] = (__c); \
 } while (0)
 #define		dstring_terminate(__ds) \
@@ -395,6 +418,7 @@ do { \
 	pthread_mutex_lock(&slon_watchdog_lock); \
 	if (slon_watchdog_pid >= 0) { \
 		slon_log(SLON_DEBUG2, "slon_abort() from pid=%d\n", slon_pid); \
+		slon_log_flush(); \
 		(void) kill(slon_watchdog_pid, SIGTERM);			\
 		slon_watchdog_pid = -1; \
 	} \
@@ -406,6 +430,7 @@ do { \
 	pthread_mutex_lock(&slon_watchdog_lock); \
 	if (slon_watchdog_pid >= 0) { \
 		slon_log(SLON_DEBUG2, "slon_restart() from pid=%d\n", slon_pid); \
+		slon_log_flush(); \
 		(void) kill(slon_watchdog_pid, SIGHUP);			\
 		slon_watchdog_pid = -1; \
 	} \
@@ -417,6 +442,7 @@ do { \
 	pthread_mutex_lock(&slon_watchdog_lock); \
 	if (slon_watchdog_pid >= 0) { \
 		slon_log(SLON_DEBUG2, "slon_retry() from pid=%d\n", slon_pid); \
+		slon_log_flush(); \
 		(void) kill(slon_watchdog_pid, SIGUSR1);			\
 		slon_watchdog_pid = -1; \
 	} \
@@ -542,6 +568,19 @@ extern void monitor_state(const char *actor, int node, pid_t conn_pid, const cha
 extern int	monitor_interval;
 extern bool monitor_threads;
 
+/* ----------
+ * Functions in metrics_thread.c
+ * ----------
+ */
+extern void *metricsThread_main(void *dummy);
+
+/* ----------
+ * Globals in metrics_thread.c
+ * ----------
+ */
+extern int	metrics_port;
+extern char *metrics_socket;
+
 
 /* ----------
  * Functions in local_listen.c
@@ -563,6 +602,13 @@ extern void *remoteListenThread_main(void *cdata);
  */
 extern int	sync_group_maxsize;
 extern int	explain_interval;
+extern int	remote_queue_maxsize;
+extern int	sync_metrics_size;
+extern int	archive_compression;
+extern int	archive_rollover_size;
+extern int	archive_rollover_interval;
+extern bool archive_fsync;
+extern bool sync_shared_fetch;
 
 
 /* ----------
@@ -580,6 +626,7 @@ extern void remoteWorker_event(int event_provider,
 				   char *ev_data5, char *ev_data6,
 				   char *ev_data7, char *ev_data8);
 extern void remoteWorker_wakeup(int no_id);
+extern bool remoteWorker_queue_full(SlonNode * node);
 extern void remoteWorker_confirm(int no_id,
 					 char *con_origin_c, char *con_received_c,
 					 char *con_seqno_c, char *con_timestamp_c);
@@ -595,6 +642,7 @@ extern int	sched_wait_conn(SlonConn * conn, int condition);
 extern int	sched_wait_time(SlonConn * conn, int condition, int msec);
 extern int	sched_msleep(SlonNode * node, int msec);
 extern int	sched_get_status(void);
+extern void sched_get_waitqueue(int *num_sock, int *num_sleep);
 extern int	sched_wakeup_node(int no_id);
 
 
@@ -607,11 +655,20 @@ extern void slon_disconnectdb(SlonConn * conn);
 extern SlonConn *slon_make_dummyconn(char *symname);
 extern void slon_free_dummyconn(SlonConn * conn);
 
+extern int	db_send_query(SlonConn * conn, const char *query);
+extern PGresult *db_get_result(SlonConn * conn);
+extern PGresult *db_exec(SlonConn * conn, const char *query);
 extern int	db_getLocalNodeId(PGconn *conn);
 extern int	db_checkSchemaVersion(PGconn *conn);
 
 extern void slon_mkquery(SlonDString * ds, char *fmt,...);
 extern void slon_appendquery(SlonDString * ds, char *fmt,...);
+
+extern char *slon_dstring_alloc(size_t *n_alloc);
+extern void slon_dstring_release(char *data, size_t n_alloc);
+extern void slon_dstring_grow(SlonDString * ds, size_t n_need);
+extern void slon_dstring_stats(int64 *num_alloc, int64 *num_realloc,
+				   int64 *num_reuse);
 extern char *sql_on_connection;
 
 /* ----------
@@ -8,6 +8,7 @@ OBJS = 	slon.obj		\
 	remote_worker.obj	\
 	sync_thread.obj		\
 	monitor_thread.obj   \
+	metrics_thread.obj   \
 	cleanup_thread.obj	\
 	scheduler.obj		\
 	dbutils.obj		\
@@ -46,6 +47,9 @@ sync_thread.obj: sync_thread.c
 monitor_thread.obj: monitor_thread.c
 	$(CPP) $(CPP_FLAGS) monitor_thread.c
 
+metrics_thread.obj: metrics_thread.c
+	$(CPP) $(CPP_FLAGS) metrics_thread.c
+
 cleanup_thread.obj: cleanup_thread.c
 	$(CPP) $(CPP_FLAGS)  cleanup_thread.c
 
@@ -15,13 +15,16 @@
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #endif
 
+#include <errno.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #ifdef WIN32
 #include "config_msvc.h"
@@ -38,12 +41,21 @@
 int			db_notice_silent = false;
 SlonikStmt *db_notice_stmt = NULL;
 
+/*
+ * Set while a statement runs whose event command may be sent without
+ * waiting for the result. See script_async_node() in slonik.c.
+ */
+int			db_async_stmt = false;
+
 extern int	current_try_level;
 
 /*
  * Local functions
  */
 static int	slon_appendquery_int(SlonDString * dsp, char *fmt, va_list ap);
+static int	db_xact_ready(SlonikStmt * stmt, SlonikAdmInfo * adminfo);
+static int	db_send_evcommand(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
+				  SlonDString * query);
 
 #ifdef HAVE_PQSETNOTICERECEIVER
 
@@ -246,7 +258,7 @@ db_exec_command(SlonikStmt * stmt, SlonikAdmInfo * adminfo, SlonDString * query)
 
 	db_notice_stmt = stmt;
 
-	if (db_begin_xact(stmt, adminfo, false) < 0)
+	if (db_xact_ready(stmt, adminfo) < 0)
 		return -1;
 
 	res = PQexec(adminfo->dbconn, dstring_data(query));
@@ -283,7 +295,10 @@ db_exec_evcommand(SlonikStmt * stmt, SlonikAdmInfo * adminfo, SlonDString * quer
 
 	db_notice_stmt = stmt;
 
-	if (db_begin_xact(stmt, adminfo, false) < 0)
+	if (db_async_stmt)
+		return db_send_evcommand(stmt, adminfo, query);
+
+	if (db_xact_ready(stmt, adminfo) < 0)
 		return -1;
 
 	res = PQexec(adminfo->dbconn, dstring_data(query));
@@ -330,7 +345,7 @@ db_exec_evcommand_p(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
 
 	db_notice_stmt = stmt;
 
-	if (db_begin_xact(stmt, adminfo, false) < 0)
+	if (db_xact_ready(stmt, adminfo) < 0)
 		return -1;
 
 	res = PQexecParams(adminfo->dbconn, dstring_data(query),
@@ -361,6 +376,114 @@ db_exec_evcommand_p(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
 }
 
 
+/* ----------
+ * db_send_evcommand
+ *
+ *	Send an event command without waiting for its result, which is
+ *	collected by db_pending_finish(). A begin deferred by
+ *	db_begin_xact() goes out in the same round trip.
+ * ----------
+ */
+static int
+db_send_evcommand(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
+				  SlonDString * query)
+{
+	SlonDString sendquery;
+
+	if (db_begin_xact(stmt, adminfo, false) < 0)
+		return -1;
+	if (adminfo->pending != DB_PENDING_NONE &&
+		db_pending_finish(adminfo) < 0)
+		return -1;
+
+	dstring_init(&sendquery);
+	if (adminfo->xact_deferred)
+		slon_mkquery(&sendquery, "begin transaction; %s",
+					 dstring_data(query));
+	else
+		slon_mkquery(&sendquery, "%s", dstring_data(query));
+	adminfo->xact_deferred = false;
+
+	if (PQsendQuery(adminfo->dbconn, dstring_data(&sendquery)) == 0)
+	{
+		fprintf(stderr, "%s:%d: %s - %s",
+				stmt->stmt_filename, stmt->stmt_lno,
+				dstring_data(query), PQerrorMessage(adminfo->dbconn));
+		dstring_free(&sendquery);
+		return -1;
+	}
+	dstring_free(&sendquery);
+
+	adminfo->pending = DB_PENDING_EVCOMMAND;
+	adminfo->pending_stmt = stmt;
+	adminfo->pending_query = strdup(dstring_data(query));
+
+	return 0;
+}
+
+
+/* ----------
+ * db_pending_finish
+ *
+ *	Wait for the result of a query sent by db_send_evcommand() or
+ *	db_commit_xact_send() and report errors the way the synchronous
+ *	functions do.
+ * ----------
+ */
+int
+db_pending_finish(SlonikAdmInfo * adminfo)
+{
+	SlonikStmt *stmt = adminfo->pending_stmt;
+	PGresult   *res;
+	PGresult   *last = NULL;
+	int			rc = 0;
+
+	if (adminfo->pending == DB_PENDING_NONE)
+		return 0;
+
+	db_notice_stmt = stmt;
+	while ((res = PQgetResult(adminfo->dbconn)) != NULL)
+	{
+		if (rc == 0 &&
+			PQresultStatus(res) != PGRES_COMMAND_OK &&
+			PQresultStatus(res) != PGRES_TUPLES_OK)
+		{
+			fprintf(stderr, "%s:%d: %s %s - %s",
+					stmt->stmt_filename, stmt->stmt_lno,
+					PQresStatus(PQresultStatus(res)),
+					adminfo->pending_query, PQresultErrorMessage(res));
+			rc = -1;
+		}
+		if (last != NULL)
+			PQclear(last);
+		last = res;
+	}
+
+	if (rc == 0 && adminfo->pending == DB_PENDING_EVCOMMAND)
+	{
+		if (last == NULL || PQresultStatus(last) != PGRES_TUPLES_OK ||
+			PQntuples(last) != 1)
+		{
+			fprintf(stderr, "%s:%d: %s - did not return 1 row",
+					stmt->stmt_filename, stmt->stmt_lno,
+					adminfo->pending_query);
+			rc = -1;
+		}
+		else
+			slon_scanint64(PQgetvalue(last, 0, 0), &(adminfo->last_event));
+	}
+	if (last != NULL)
+		PQclear(last);
+
+	adminfo->pending = DB_PENDING_NONE;
+	adminfo->pending_stmt = NULL;
+	free(adminfo->pending_query);
+	adminfo->pending_query = NULL;
+
+	return rc;
+}
+
+
 /* ----------
  * db_exec_select
  *
@@ -374,7 +497,7 @@ db_exec_select(SlonikStmt * stmt, SlonikAdmInfo * adminfo, SlonDString * query)
 
 	db_notice_stmt = stmt;
 
-	if (db_begin_xact(stmt, adminfo, false) < 0)
+	if (db_xact_ready(stmt, adminfo) < 0)
 		return NULL;
 
 	res = PQexec(adminfo->dbconn, dstring_data(query));
@@ -392,6 +515,208 @@ db_exec_select(SlonikStmt * stmt, SlonikAdmInfo * adminfo, SlonDString * query)
 }
 
 
+/* ----------
+ * db_exec_select_all
+ *
+ *	Send query[i] to adminfo[i] for all nnodes nodes without waiting in
+ *	between and collect the results as they arrive, so that talking to
+ *	many nodes costs about one round trip instead of one per node.
+ *	res[i] receives the last result of query[i], or NULL if it failed.
+ *	Queries that did not finish within timeout seconds (0 waits
+ *	forever) count as failed and their connection is closed. A node
+ *	that is not inside a transaction yet gets the begin in the same
+ *	round trip as its query, so nothing waits outside the deadline.
+ *	Returns the number of nodes that failed.
+ * ----------
+ */
+int
+db_exec_select_all(SlonikStmt * stmt, SlonikAdmInfo ** adminfo,
+				   SlonDString * query, PGresult ** res, int nnodes,
+				   int timeout)
+{
+	SlonDString sendquery;
+	bool	   *busy;
+	bool	   *failed;
+	int			nbusy = 0;
+	int			nfailed = 0;
+	time_t		deadline = 0;
+	int			i;
+
+	db_notice_stmt = stmt;
+
+	busy = (bool *) malloc(sizeof(bool) * (nnodes + 1));
+	failed = (bool *) malloc(sizeof(bool) * (nnodes + 1));
+	if (timeout > 0)
+		deadline = time(NULL) + timeout;
+
+	dstring_init(&sendquery);
+	for (i = 0; i < nnodes; i++)
+	{
+		res[i] = NULL;
+		busy[i] = false;
+		failed[i] = true;
+
+		if (adminfo[i]->pending != DB_PENDING_NONE &&
+			db_pending_finish(adminfo[i]) < 0)
+			continue;
+
+		/*
+		 * Start the transaction like db_begin_xact() would, but as part of
+		 * the query, the same way db_send_evcommand() sends a deferred
+		 * begin.
+		 */
+		dstring_reset(&sendquery);
+		if (!adminfo[i]->have_xact || adminfo[i]->xact_deferred)
+		{
+			dstring_append(&sendquery, "begin transaction; ");
+			if (!adminfo[i]->have_xact && current_try_level > 0)
+				slon_appendquery(&sendquery,
+								 "lock table \"_%s\".sl_event_lock; ",
+								 stmt->script->clustername);
+			adminfo[i]->have_xact = true;
+			adminfo[i]->xact_deferred = false;
+		}
+		dstring_append(&sendquery, dstring_data(&query[i]));
+		dstring_terminate(&sendquery);
+
+		if (PQsendQuery(adminfo[i]->dbconn, dstring_data(&sendquery)) == 0)
+		{
+			fprintf(stderr, "%s:%d: %s - %s",
+					stmt->stmt_filename, stmt->stmt_lno,
+					dstring_data(&query[i]),
+					PQerrorMessage(adminfo[i]->dbconn));
+			continue;
+		}
+		busy[i] = true;
+		failed[i] = false;
+		nbusy++;
+	}
+	dstring_free(&sendquery);
+
+	while (nbusy > 0)
+	{
+		fd_set		rmask;
+		struct timeval tv;
+		int			maxfd = -1;
+		int			rc;
+
+		FD_ZERO(&rmask);
+		for (i = 0; i < nnodes; i++)
+		{
+			if (!busy[i])
+				continue;
+			FD_SET(PQsocket(adminfo[i]->dbconn), &rmask);
+			if (PQsocket(adminfo[i]->dbconn) > maxfd)
+				maxfd = PQsocket(adminfo[i]->dbconn);
+		}
+
+		if (deadline > 0)
+		{
+			time_t		now = time(NULL);
+
+			if (now >= deadline)
+				break;
+			tv.tv_sec = deadline - now;
+			tv.tv_usec = 0;
+		}
+		rc = select(maxfd + 1, &rmask, NULL, NULL,
+					(deadline > 0) ? &tv : NULL);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s:%d: select() failed - %s\n",
+					stmt->stmt_filename, stmt->stmt_lno, strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < nnodes; i++)
+		{
+			if (!busy[i] || !FD_ISSET(PQsocket(adminfo[i]->dbconn), &rmask))
+				continue;
+
+			if (PQconsumeInput(adminfo[i]->dbconn) == 0)
+			{
+				fprintf(stderr, "%s:%d: %s - %s",
+						stmt->stmt_filename, stmt->stmt_lno,
+						dstring_data(&query[i]),
+						PQerrorMessage(adminfo[i]->dbconn));
+				failed[i] = true;
+				busy[i] = false;
+				nbusy--;
+				continue;
+			}
+			while (!PQisBusy(adminfo[i]->dbconn))
+			{
+				PGresult   *rres = PQgetResult(adminfo[i]->dbconn);
+
+				if (rres == NULL)
+				{
+					busy[i] = false;
+					nbusy--;
+					break;
+				}
+				if (PQresultStatus(rres) != PGRES_COMMAND_OK &&
+					PQresultStatus(rres) != PGRES_TUPLES_OK)
+				{
+					if (!failed[i])
+						fprintf(stderr, "%s:%d: %s %s - %s",
+								stmt->stmt_filename, stmt->stmt_lno,
+								PQresStatus(PQresultStatus(rres)),
+								dstring_data(&query[i]),
+								PQresultErrorMessage(rres));
+					failed[i] = true;
+					PQclear(rres);
+					continue;
+				}
+				if (res[i] != NULL)
+					PQclear(res[i]);
+				res[i] = rres;
+			}
+		}
+	}
+
+	/*
+	 * Whatever is still running has hit the timeout. The node may well be
+	 * unreachable, so neither a cancel request nor waiting for the rest of
+	 * the results would return. Drop the connection instead, the open
+	 * transaction dies with it and the next use of the node reconnects.
+	 */
+	for (i = 0; i < nnodes; i++)
+	{
+		if (!busy[i])
+			continue;
+
+		printf("%s:%d: node %d did not respond within %d seconds - "
+			   "closing connection\n",
+			   stmt->stmt_filename, stmt->stmt_lno,
+			   adminfo[i]->no_id, timeout);
+		PQfinish(adminfo[i]->dbconn);
+		adminfo[i]->dbconn = NULL;
+		adminfo[i]->have_xact = false;
+		adminfo[i]->xact_deferred = false;
+		failed[i] = true;
+	}
+
+	for (i = 0; i < nnodes; i++)
+	{
+		if (!failed[i])
+			continue;
+		if (res[i] != NULL)
+		{
+			PQclear(res[i]);
+			res[i] = NULL;
+		}
+		nfailed++;
+	}
+
+	free(busy);
+	free(failed);
+
+	return nfailed;
+}
+
+
 /* ----------
  * db_get_nodeid
  *
@@ -483,6 +808,17 @@ db_begin_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo, bool suppress_locking)
 	if (adminfo->have_xact)
 		return 0;
 
+	/*
+	 * A statement sending its event command asynchronously sends the
+	 * begin along with it.
+	 */
+	if (db_async_stmt && current_try_level == 0)
+	{
+		adminfo->have_xact = true;
+		adminfo->xact_deferred = true;
+		return 0;
+	}
+
 	res = PQexec(adminfo->dbconn, "begin transaction; ");
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
 	{
@@ -529,6 +865,43 @@ db_begin_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo, bool suppress_locking)
 }
 
 
+/* ----------
+ * db_xact_ready
+ *
+ *	Make sure a connection is idle and inside a transaction before a
+ *	query is executed synchronously.
+ * ----------
+ */
+static int
+db_xact_ready(SlonikStmt * stmt, SlonikAdmInfo * adminfo)
+{
+	PGresult   *res;
+
+	if (adminfo->pending != DB_PENDING_NONE &&
+		db_pending_finish(adminfo) < 0)
+		return -1;
+	if (db_begin_xact(stmt, adminfo, false) < 0)
+		return -1;
+	if (!adminfo->xact_deferred)
+		return 0;
+
+	adminfo->xact_deferred = false;
+	res = PQexec(adminfo->dbconn, "begin transaction; ");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		printf("%s:%d: begin transaction; - %s",
+			   stmt->stmt_filename, stmt->stmt_lno,
+			   PQresultErrorMessage(res));
+		PQclear(res);
+		adminfo->have_xact = false;
+		return -1;
+	}
+	PQclear(res);
+
+	return 0;
+}
+
+
 /* ----------
  * db_commit_xact
  *
@@ -540,9 +913,16 @@ db_commit_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo)
 {
 	PGresult   *res;
 
+	if (adminfo->pending != DB_PENDING_NONE)
+		(void) db_pending_finish(adminfo);
 	if (!adminfo->have_xact)
 		return 0;
 	adminfo->have_xact = false;
+	if (adminfo->xact_deferred)
+	{
+		adminfo->xact_deferred = false;
+		return 0;
+	}
 	res = PQexec(adminfo->dbconn, "commit transaction;");
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
 	{
@@ -558,6 +938,44 @@ db_commit_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo)
 }
 
 
+/* ----------
+ * db_commit_xact_send
+ *
+ *	Like db_commit_xact(), but only send the commit. The result is
+ *	collected by db_pending_finish(), so that the transactions on
+ *	several nodes can commit at the same time.
+ * ----------
+ */
+int
+db_commit_xact_send(SlonikStmt * stmt, SlonikAdmInfo * adminfo)
+{
+	if (adminfo->pending != DB_PENDING_NONE &&
+		db_pending_finish(adminfo) < 0)
+		return -1;
+	if (!adminfo->have_xact)
+		return 0;
+	adminfo->have_xact = false;
+	if (adminfo->xact_deferred)
+	{
+		adminfo->xact_deferred = false;
+		return 0;
+	}
+
+	if (PQsendQuery(adminfo->dbconn, "commit transaction;") == 0)
+	{
+		printf("%s:%d: commit transaction; - %s",
+			   stmt->stmt_filename, stmt->stmt_lno,
+			   PQerrorMessage(adminfo->dbconn));
+		return -1;
+	}
+	adminfo->pending = DB_PENDING_COMMIT;
+	adminfo->pending_stmt = stmt;
+	adminfo->pending_query = strdup("commit transaction;");
+
+	return 0;
+}
+
+
 /* ----------
  * db_rollback_xact
  *
@@ -569,9 +987,16 @@ db_rollback_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo)
 {
 	PGresult   *res;
 
+	if (adminfo->pending != DB_PENDING_NONE)
+		(void) db_pending_finish(adminfo);
 	if (!adminfo->have_xact)
 		return 0;
 	adminfo->have_xact = false;
+	if (adminfo->xact_deferred)
+	{
+		adminfo->xact_deferred = false;
+		return 0;
+	}
 	res = PQexec(adminfo->dbconn, "rollback transaction;");
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
 	{
@@ -725,6 +725,7 @@ stmt_failed_node    : lno K_FAILOVER '(' fail_node_list  ')' ';'
 						statement_option opt[] = {
 							STMT_OPTION_INT( O_ID, -1 ),
 							STMT_OPTION_INT( O_BACKUP_NODE, -1 ),
+							STMT_OPTION_INT( O_TIMEOUT, 0 ),
 							STMT_OPTION_END
 						};
 
@@ -742,6 +743,7 @@ stmt_failed_node    : lno K_FAILOVER '(' fail_node_list  ')' ';'
 						{
 							new->nodes->no_id			= opt[0].ival;
 							new->nodes->backup_node	= opt[1].ival;
+							new->nodes->timeout		= opt[2].ival;
 						}
 						else
 							parser_errors++;
@@ -756,6 +758,7 @@ fail_node_list      :   K_NODE '=' '(' option_list_items ')'
 						statement_option opt[] = {
 							STMT_OPTION_INT( O_ID, -1 ),
 							STMT_OPTION_INT( O_BACKUP_NODE, -1 ),
+							STMT_OPTION_INT( O_TIMEOUT, 0 ),
 							STMT_OPTION_END
 						};
 
@@ -766,6 +769,7 @@ fail_node_list      :   K_NODE '=' '(' option_list_items ')'
 						{
 							new->no_id			= opt[0].ival;
 							new->backup_node	= opt[1].ival;
+							new->timeout		= opt[2].ival;
 						}
 						else
 							parser_errors++;
@@ -779,6 +783,7 @@ fail_node_list      :   K_NODE '=' '(' option_list_items ')'
 						statement_option opt[] = {
 							STMT_OPTION_INT( O_ID, -1 ),
 							STMT_OPTION_INT( O_BACKUP_NODE, -1 ),
+							STMT_OPTION_INT( O_TIMEOUT, 0 ),
 							STMT_OPTION_END
 						};
 
@@ -789,6 +794,7 @@ fail_node_list      :   K_NODE '=' '(' option_list_items ')'
 						{
 							new->no_id			= opt[0].ival;
 							new->backup_node	= opt[1].ival;
+							new->timeout		= opt[2].ival;
 						}
 						else
 							parser_errors++;
@@ -1347,6 +1353,7 @@ stmt_lock_set		: lno K_LOCK K_SET option_list
 						statement_option opt[] = {
 							STMT_OPTION_INT( O_ID, -1 ),
 							STMT_OPTION_INT( O_ORIGIN, -1 ),
+							STMT_OPTION_INT( O_NEW_ORIGIN, -1 ),
 							STMT_OPTION_END
 						};
 
@@ -1361,6 +1368,7 @@ stmt_lock_set		: lno K_LOCK K_SET option_list
 						{
 							new->set_id			= opt[0].ival;
 							new->set_origin		= opt[1].ival;
+							new->new_origin		= opt[2].ival;
 						}
 						else
 							parser_errors++;
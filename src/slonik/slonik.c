@@ -22,6 +22,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <alloca.h>
 #else
 #include <winsock2.h>
@@ -42,7 +43,6 @@
 #include "config.h"
 #endif
 #include "../parsestatements/scanner.h"
-extern int	STMTS[MAXSTATEMENTS];
 
 
 #ifdef HAVE_PGPORT
@@ -52,6 +52,14 @@ extern int	STMTS[MAXSTATEMENTS];
 
 #define MAXPGPATH 256
 
+/*
+ * Poll interval bounds of the wait loops, see slonik_wait_backoff(),
+ * and how often they report what they are waiting for.
+ */
+#define SLONIK_WAIT_MIN_MS		10
+#define SLONIK_WAIT_MAX_MS		1000
+#define SLONIK_WAIT_REPORT_SECS	10
+
 /*
  * Global data
  */
@@ -62,6 +70,15 @@ int			block_stmt_no = 0;
 int			last_event_node = -1;
 int			auto_wait_disabled = 0;
 
+/*
+ * Nodes with a statement in flight whose transaction is committed by
+ * script_async_flush().
+ */
+static SlonikAdmInfo **async_batch = NULL;
+static SlonikStmt **async_batch_stmt = NULL;
+static int	async_batch_num = 0;
+static int	async_batch_max = 0;
+
 static char share_path[MAXPGPATH];
 #if HAVE_PGPORT
 static char myfull_path[MAXPGPATH];
@@ -123,12 +140,23 @@ static void script_commit_all(SlonikStmt * stmt,
 				  SlonikScript * script);
 static void script_rollback_all(SlonikStmt * stmt,
 					SlonikScript * script);
+static int	script_async_node(SlonikStmt * hdr);
+static int	script_async_add(SlonikStmt * hdr, int no_id);
+static int	script_async_flush(void);
 static void script_disconnect_all(SlonikScript * script);
 static void replace_tokens(SlonDString *dest, SlonDString *src, 
 					replacement_token *replacements);
+static void slonik_wait_backoff(int *delay_ms);
 static int slonik_set_add_single_table(SlonikStmt_set_add_table * stmt,
 							SlonikAdmInfo * adminfo1,
 							const char *fqname);
+static int slonik_set_add_tables(SlonikStmt_set_add_table * stmt,
+					  SlonikAdmInfo * adminfo1,
+					  PGresult *tables);
+static int slonik_set_add_sequences(SlonikStmt * stmt,
+						 SlonikAdmInfo * adminfo1,
+						 int set_id,
+						 PGresult *sequences);
 static int	slonik_get_next_tab_id(SlonikStmt * stmt);
 static int	slonik_get_next_sequence_id(SlonikStmt * stmt);
 static int	find_origin(SlonikStmt * stmt, int set_id);
@@ -551,6 +579,13 @@ script_check_stmts(SlonikScript * script, SlonikStmt * hdr)
 								   hdr->stmt_filename, hdr->stmt_lno);
 							errors++;
 						}
+						if (node->timeout < 0)
+						{
+							printf("%s:%d: Error: "
+								   "timeout must not be negative\n",
+								   hdr->stmt_filename, hdr->stmt_lno);
+							errors++;
+						}
 						if (script_check_adminfo(hdr, node->backup_node) < 0)
 							errors++;
 					}
@@ -763,17 +798,20 @@ script_check_stmts(SlonikScript * script, SlonikStmt * hdr)
 					{
 						printf("%s:%d: Error: "
 						   "'fully qualified name' and 'tables' can not both"
-							   " be specified", hdr->stmt_filename,
+							   " be specified\n", hdr->stmt_filename,
 							   hdr->stmt_lno);
 						errors++;
 					}
+					/*
+					 * The tables matched by a pattern each use their
+					 * primary key, see slonik_set_add_table().
+					 */
 					if (stmt->tables != NULL &&
 						stmt->use_key != NULL)
 					{
-
-						printf("%s:%d: ERROR: "
+						printf("%s:%d: Error: "
 							   "'key' can not be used with the 'tables' "
-							   "option.", hdr->stmt_filename,
+							   "option\n", hdr->stmt_filename,
 							   hdr->stmt_lno);
 						errors++;
 					}
@@ -1053,6 +1091,18 @@ script_check_stmts(SlonikScript * script, SlonikStmt * hdr)
 					}
 					else if (script_check_adminfo(hdr, stmt->set_origin) < 0)
 						errors++;
+					if (stmt->new_origin >= 0)
+					{
+						if (stmt->new_origin == stmt->set_origin)
+						{
+							printf("%s:%d: Error: "
+								   "new origin and origin are identical\n",
+								   hdr->stmt_filename, hdr->stmt_lno);
+							errors++;
+						}
+						else if (script_check_adminfo(hdr, stmt->new_origin) < 0)
+							errors++;
+					}
 				}
 				break;
 
@@ -1302,6 +1352,8 @@ script_exec_stmts(SlonikScript * script, SlonikStmt * hdr)
 	int64	   *events;
 	size_t		event_length;
 	int			idx = 0;
+	int			async_node;
+	int			i;
 	SlonikAdmInfo *curAdmInfo;
 
 	event_length = slonik_get_last_event_id(hdr, script, "ev_type <> 'SYNC' ",
@@ -1321,6 +1373,27 @@ script_exec_stmts(SlonikScript * script, SlonikStmt * hdr)
 		hdr->script = script;
 		block_stmt_no++;
 
+		/*
+		 * A statement that can be sent without waiting joins the batch,
+		 * unless its node already has one in flight. Anything else
+		 * waits for the batch to finish first.
+		 */
+		async_node = script_async_node(hdr);
+		for (i = 0; async_node >= 0 && i < async_batch_num; i++)
+		{
+			if (async_batch[i]->no_id == async_node)
+				break;
+		}
+		if (async_node < 0 || i < async_batch_num)
+		{
+			if (script_async_flush() < 0)
+			{
+				errors++;
+				break;
+			}
+		}
+		db_async_stmt = (async_node >= 0);
+
 		switch (hdr->stmt_type)
 		{
 			case STMT_TRY:
@@ -1755,15 +1828,22 @@ script_exec_stmts(SlonikScript * script, SlonikStmt * hdr)
 				break;
 
 		}
+		db_async_stmt = false;
 
 		if (current_try_level == 0)
 		{
-			if (errors == 0)
+			if (errors == 0 && async_node >= 0)
+			{
+				if (script_async_add(hdr, async_node) < 0)
+					errors++;
+			}
+			else if (errors == 0)
 			{
 				script_commit_all(hdr, script);
 			}
 			else
 			{
+				(void) script_async_flush();
 				script_rollback_all(hdr, script);
 			}
 		}
@@ -1771,10 +1851,149 @@ script_exec_stmts(SlonikScript * script, SlonikStmt * hdr)
 		hdr = hdr->next;
 	}
 
+	if (current_try_level == 0 && errors == 0)
+	{
+		if (script_async_flush() < 0)
+			errors++;
+	}
+
 	return -errors;
 }
 
 
+/* ----------
+ * script_async_node
+ *
+ *	Return the node a statement is executed on if it can be sent there
+ *	without waiting for the result, -1 otherwise. These statements run
+ *	a single event command on one node and neither wait for nor are
+ *	waited for by other events, so consecutive ones for different nodes
+ *	can all be in flight at the same time.
+ * ----------
+ */
+static int
+script_async_node(SlonikStmt * hdr)
+{
+	if (current_try_level != 0)
+		return -1;
+
+	switch (hdr->stmt_type)
+	{
+		case STMT_STORE_PATH:
+			return ((SlonikStmt_store_path *) hdr)->pa_client;
+
+		case STMT_SYNC:
+			return ((SlonikStmt_sync *) hdr)->no_id;
+
+			/*
+			 * These are ordered behind the previous event by the implicit
+			 * WAIT FOR EVENT, unless that is disabled.
+			 */
+		case STMT_DROP_PATH:
+			if (auto_wait_disabled)
+				return ((SlonikStmt_drop_path *) hdr)->ev_origin;
+			return -1;
+
+		case STMT_STORE_LISTEN:
+			if (auto_wait_disabled)
+				return ((SlonikStmt_store_listen *) hdr)->li_receiver;
+			return -1;
+
+		case STMT_DROP_LISTEN:
+			if (auto_wait_disabled)
+				return ((SlonikStmt_drop_listen *) hdr)->li_receiver;
+			return -1;
+
+		default:
+			return -1;
+	}
+}
+
+
+/* ----------
+ * script_async_add
+ *
+ *	Remember the node of a statement sent by script_exec_stmts() with
+ *	db_async_stmt set.
+ * ----------
+ */
+static int
+script_async_add(SlonikStmt * hdr, int no_id)
+{
+	SlonikAdmInfo *adminfo;
+	SlonikAdmInfo **newbatch;
+	SlonikStmt **newstmt;
+
+	if ((adminfo = get_adminfo(hdr, no_id)) == NULL)
+		return -1;
+
+	if (async_batch_num == async_batch_max)
+	{
+		async_batch_max = (async_batch_max == 0) ? 16 : async_batch_max * 2;
+		newbatch = (SlonikAdmInfo **) realloc(async_batch,
+								  sizeof(SlonikAdmInfo *) * async_batch_max);
+		if (newbatch != NULL)
+			async_batch = newbatch;
+		newstmt = (SlonikStmt **) realloc(async_batch_stmt,
+								  sizeof(SlonikStmt *) * async_batch_max);
+		if (newstmt != NULL)
+			async_batch_stmt = newstmt;
+		if (newbatch == NULL || newstmt == NULL)
+		{
+			printf("%s:%d: out of memory\n",
+				   hdr->stmt_filename, hdr->stmt_lno);
+			async_batch_max = async_batch_num;
+			db_rollback_xact(hdr, adminfo);
+			return -1;
+		}
+	}
+	async_batch[async_batch_num] = adminfo;
+	async_batch_stmt[async_batch_num] = hdr;
+	async_batch_num++;
+
+	return 0;
+}
+
+
+/* ----------
+ * script_async_flush
+ *
+ *	Collect the results of the statements in flight in script order.
+ *	The transactions of those before the first failed one are committed,
+ *	all at the same time, and the others are rolled back, so the outcome
+ *	is the same as if they had been executed one after another.
+ * ----------
+ */
+static int
+script_async_flush(void)
+{
+	int			failed = -1;
+	int			i;
+
+	for (i = 0; i < async_batch_num && failed < 0; i++)
+	{
+		if (db_pending_finish(async_batch[i]) < 0)
+			failed = i;
+	}
+
+	for (i = 0; i < async_batch_num; i++)
+	{
+		if (failed < 0 || i < failed)
+		{
+			if (db_commit_xact_send(async_batch_stmt[i], async_batch[i]) < 0)
+				db_rollback_xact(async_batch_stmt[i], async_batch[i]);
+		}
+		else
+			db_rollback_xact(async_batch_stmt[i], async_batch[i]);
+	}
+	for (i = 0; i < async_batch_num; i++)
+		(void) db_pending_finish(async_batch[i]);
+
+	async_batch_num = 0;
+	return (failed < 0) ? 0 : -1;
+}
+
+
 static void
 script_commit_all(SlonikStmt * stmt, SlonikScript * script)
 {
@@ -2797,6 +3016,9 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 	int		   *fail_node_ids = NULL;
 	bool         missing_paths=false;
 	int			rc = 0;
+	SlonikAdmInfo **nodeadmin = NULL;
+	SlonDString *nodequery = NULL;
+	PGresult  **nodetuples = NULL;
 
 
 	/**
@@ -3051,8 +3273,16 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 
 		/*
 		 * Connect to all these nodes and determine if there is a node daemon
-		 * running on that node.
+		 * running on that node. The queries go out to all nodes at once.
 		 */
+		nodeadmin = (SlonikAdmInfo **) malloc(sizeof(SlonikAdmInfo *) *
+											  (node_entry->num_nodes + 1));
+		nodequery = (SlonDString *) malloc(sizeof(SlonDString) *
+										   (node_entry->num_nodes + 1));
+		nodetuples = (PGresult **) malloc(sizeof(PGresult *) *
+										  (node_entry->num_nodes + 1));
+		for (i = 0; i < node_entry->num_nodes; i++)
+			dstring_init(&nodequery[i]);
 
 		for (i = 0; i < node_entry->num_nodes; i++)
 		{
@@ -3082,7 +3312,7 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 				pidcolumn="pid";
 			else 
 				pidcolumn="procpid";
-			slon_mkquery(&query,
+			slon_mkquery(&nodequery[i],
 						 "lock table \"_%s\".sl_config_lock; "
 						 "select nl_backendpid from \"_%s\".sl_nodelock "
 				   "    where nl_nodeid = \"_%s\".getLocalNodeId('_%s') and "
@@ -3093,14 +3323,26 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 						 stmt->hdr.script->clustername,
 						 stmt->hdr.script->clustername,
 						 pidcolumn);
-			res3 = db_exec_select((SlonikStmt *) stmt, nodeinfo[i].adminfo, &query);
-			if (res3 == NULL)
+			nodeadmin[i] = nodeinfo[i].adminfo;
+		}
+		PQclear(res1);
+		PQclear(res2);
+
+		if (db_exec_select_all((SlonikStmt *) stmt, nodeadmin, nodequery,
+							   nodetuples, node_entry->num_nodes,
+							   node_entry->timeout) > 0)
+		{
+			for (i = 0; i < node_entry->num_nodes; i++)
 			{
-				PQclear(res1);
-				PQclear(res2);
-				rc = -1;
-				goto cleanup;
+				if (nodetuples[i] != NULL)
+					PQclear(nodetuples[i]);
 			}
+			rc = -1;
+			goto cleanup;
+		}
+		for (i = 0; i < node_entry->num_nodes; i++)
+		{
+			res3 = nodetuples[i];
 			if (PQntuples(res3) == 0)
 			{
 				nodeinfo[i].has_slon = false;
@@ -3113,8 +3355,6 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 			}
 			PQclear(res3);
 		}
-		PQclear(res1);
-		PQclear(res2);
 		if (!has_candidate && node_entry->num_sets > 0 )
 		{
 			printf("%s:%d error no failover candidates for %d\n",
@@ -3128,32 +3368,55 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 		/*
 		 * Execute the preFailover() procedure on all failover candidate nodes
 		 * to stop them from receiving new messages from the failed node.
+		 * This too runs on all nodes at the same time, and so do the
+		 * commits.
 		 */
-
 		for (i = 0; i < node_entry->num_nodes; i++)
 		{
 			printf("executing preFailover(%d,%d) on %d\n",
 				   node_entry->no_id,
 				   nodeinfo[i].failover_candidate,
 				   nodeinfo[i].no_id);
-			slon_mkquery(&query,
+			slon_mkquery(&nodequery[i],
 						 "lock table \"_%s\".sl_config_lock; "
 						 "select \"_%s\".preFailover(%d,%s); ",
 						 stmt->hdr.script->clustername,
 						 stmt->hdr.script->clustername,
 						 node_entry->no_id, nodeinfo[i].failover_candidate ? "true" : "false");
-			if (db_exec_command((SlonikStmt *) stmt, nodeinfo[i].adminfo, &query) < 0)
-			{
+		}
+		if (db_exec_select_all((SlonikStmt *) stmt, nodeadmin, nodequery,
+							   nodetuples, node_entry->num_nodes,
+							   node_entry->timeout) > 0)
+			rc = -1;
+		for (i = 0; i < node_entry->num_nodes; i++)
+		{
+			if (nodetuples[i] != NULL)
+				PQclear(nodetuples[i]);
+		}
+		if (rc < 0)
+			goto cleanup;
+
+		for (i = 0; i < node_entry->num_nodes; i++)
+		{
+			if (db_commit_xact_send((SlonikStmt *) stmt, nodeadmin[i]) < 0)
 				rc = -1;
-				goto cleanup;
-			}
-			if (db_commit_xact((SlonikStmt *) stmt, nodeinfo[i].adminfo) < 0)
-			{
+		}
+		for (i = 0; i < node_entry->num_nodes; i++)
+		{
+			if (db_pending_finish(nodeadmin[i]) < 0)
 				rc = -1;
-				goto cleanup;
-			}
 		}
+		if (rc < 0)
+			goto cleanup;
 
+		for (i = 0; i < node_entry->num_nodes; i++)
+			dstring_free(&nodequery[i]);
+		free(nodeadmin);
+		free(nodequery);
+		free(nodetuples);
+		nodeadmin = NULL;
+		nodequery = NULL;
+		nodetuples = NULL;
 	}
 
 	/*
@@ -3213,6 +3476,7 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 			continue;
 		lock_set.hdr = stmt->hdr;
 		lock_set.set_origin = node_entry->temp_backup_node;
+		lock_set.new_origin = -1;
 		for (i = 0; i < node_entry->num_sets; i++)
 		{
 			lock_set.set_id = set_list[cur_origin_idx][i];
@@ -3282,6 +3546,16 @@ slonik_failed_node(SlonikStmt_failed_node * stmt)
 
 
 cleanup:
+	if (nodequery != NULL)
+	{
+		for (i = 0; i < node_entry->num_nodes; i++)
+			dstring_free(&nodequery[i]);
+		free(nodequery);
+	}
+	if (nodeadmin != NULL)
+		free(nodeadmin);
+	if (nodetuples != NULL)
+		free(nodetuples);
 	cur_origin_idx = 0;
 	for (node_entry = stmt->nodes; node_entry != NULL;
 		 node_entry = node_entry->next, cur_origin_idx++)
@@ -3312,15 +3586,33 @@ fail_node_restart(SlonikStmt_failed_node * stmt,
 {
 	int			n = 0;
 	int			i = 0;
-	SlonDString query;
-	PGresult   *res1;
-
-	dstring_init(&query);
+	int			delay_ms = 0;
+	int			num_wait;
+	int			rc = 0;
+	int		   *wait_idx;
+	SlonikAdmInfo **adminfo;
+	SlonDString *query;
+	PGresult  **res;
+
+	wait_idx = (int *) malloc(sizeof(int) * (node_entry->num_nodes + 1));
+	adminfo = (SlonikAdmInfo **) malloc(sizeof(SlonikAdmInfo *) *
+										(node_entry->num_nodes + 1));
+	query = (SlonDString *) malloc(sizeof(SlonDString) *
+								   (node_entry->num_nodes + 1));
+	res = (PGresult **) malloc(sizeof(PGresult *) *
+							   (node_entry->num_nodes + 1));
+	for (i = 0; i < node_entry->num_nodes; i++)
+		dstring_init(&query[i]);
 
 	while (n < node_entry->num_nodes)
 	{
-		sleep(1);
+		slonik_wait_backoff(&delay_ms);
+
+		/*
+		 * Poll all nodes whose old slon is still around in one round.
+		 */
 		n = 0;
+		num_wait = 0;
 		for (i = 0; i < node_entry->num_nodes; i++)
 		{
 			if (!nodeinfo[i].has_slon)
@@ -3329,7 +3621,7 @@ fail_node_restart(SlonikStmt_failed_node * stmt,
 				continue;
 			}
 
-			slon_mkquery(&query,
+			slon_mkquery(&query[num_wait],
 						 "select nl_backendpid from \"_%s\".sl_nodelock "
 						 "    where nl_backendpid <> %d "
 						 "    and nl_nodeid = \"_%s\".getLocalNodeId('_%s');",
@@ -3338,28 +3630,42 @@ fail_node_restart(SlonikStmt_failed_node * stmt,
 						 stmt->hdr.script->clustername,
 						 stmt->hdr.script->clustername
 				);
-			res1 = db_exec_select((SlonikStmt *) stmt, nodeinfo[i].adminfo, &query);
-			if (res1 == NULL)
-			{
-				dstring_free(&query);
-				return -1;
-			}
-			if (PQntuples(res1) == 1)
-			{
-				nodeinfo[i].has_slon = false;
-				n++;
-			}
+			adminfo[num_wait] = nodeinfo[i].adminfo;
+			wait_idx[num_wait++] = i;
+		}
+		if (num_wait == 0)
+			break;
 
-			PQclear(res1);
-			if (db_rollback_xact((SlonikStmt *) stmt, nodeinfo[i].adminfo) < 0)
+		if (db_exec_select_all((SlonikStmt *) stmt, adminfo, query, res,
+							   num_wait, node_entry->timeout) > 0)
+			rc = -1;
+		for (i = 0; i < num_wait; i++)
+		{
+			if (res[i] == NULL)
+				continue;
+			if (PQntuples(res[i]) == 1)
 			{
-				dstring_free(&query);
-				return -1;
+				nodeinfo[wait_idx[i]].has_slon = false;
+				n++;
 			}
+			PQclear(res[i]);
+		}
+		for (i = 0; i < num_wait; i++)
+		{
+			if (db_rollback_xact((SlonikStmt *) stmt, adminfo[i]) < 0)
+				rc = -1;
 		}
+		if (rc < 0)
+			break;
 	}
-	dstring_free(&query);
-	return 0;
+
+	for (i = 0; i < node_entry->num_nodes; i++)
+		dstring_free(&query[i]);
+	free(query);
+	free(res);
+	free(adminfo);
+	free(wait_idx);
+	return rc;
 }
 
 
@@ -3386,35 +3692,64 @@ fail_node_promote(SlonikStmt_failed_node * stmt,
 	SlonikAdmInfo *adminfo1;
 	SlonikStmt_wait_event wait_event;
 	int64 backup_node_seqno = 0;
+	SlonikAdmInfo **adminfo;
+	SlonDString *nodequery;
+	PGresult  **nodetuples;
 	
 	dstring_init(&query);
 	
 
 	/*
 	 * For every node determine the one with the event , preferring the backup
-	 * node.
+	 * node. All nodes are asked at the same time.
 	 */
+	adminfo = (SlonikAdmInfo **) malloc(sizeof(SlonikAdmInfo *) *
+										(node_entry->num_nodes + 1));
+	nodequery = (SlonDString *) malloc(sizeof(SlonDString) *
+									   (node_entry->num_nodes + 1));
+	nodetuples = (PGresult **) malloc(sizeof(PGresult *) *
+									  (node_entry->num_nodes + 1));
 	for (i = 0; i < node_entry->num_nodes; i++)
 	{
-
-		int64		ev_seqno;
-
-		//if (!nodeinfo[i].failover_candidate)
-		//	continue;
-		
-		slon_mkquery(&query,
+		dstring_init(&nodequery[i]);
+		slon_mkquery(&nodequery[i],
 					 "select max(ev_seqno) "
 					 "	from \"_%s\".sl_event "
 					 "	where ev_origin = %d; ",
 					 stmt->hdr.script->clustername,
 					 node_entry->no_id);
-		res1 = db_exec_select((SlonikStmt *) stmt,
-							  nodeinfo[i].adminfo, &query);
-		if (res1 == NULL)
+		adminfo[i] = nodeinfo[i].adminfo;
+	}
+	if (db_exec_select_all((SlonikStmt *) stmt, adminfo, nodequery,
+						   nodetuples, node_entry->num_nodes,
+						   node_entry->timeout) > 0)
+	{
+		for (i = 0; i < node_entry->num_nodes; i++)
 		{
-			rc=-1;
-			goto cleanup;
+			if (nodetuples[i] != NULL)
+				PQclear(nodetuples[i]);
 		}
+		rc = -1;
+	}
+	for (i = 0; i < node_entry->num_nodes; i++)
+		dstring_free(&nodequery[i]);
+	free(nodequery);
+	free(adminfo);
+	if (rc < 0)
+	{
+		free(nodetuples);
+		goto cleanup;
+	}
+
+	for (i = 0; i < node_entry->num_nodes; i++)
+	{
+
+		int64		ev_seqno;
+
+		//if (!nodeinfo[i].failover_candidate)
+		//	continue;
+
+		res1 = nodetuples[i];
 		slon_scanint64(PQgetvalue(res1, 0, 0), &ev_seqno);
 		if (nodeinfo[i].no_id == node_entry->backup_node) 
 		{
@@ -3431,6 +3766,7 @@ fail_node_promote(SlonikStmt_failed_node * stmt,
 		PQclear(res1);
 
 	}
+	free(nodetuples);
 	if( max_node_idx == -1)
 	{
 		/**
@@ -4080,8 +4416,6 @@ slonik_set_add_table(SlonikStmt_set_add_table * stmt)
 	int			origin = stmt->set_origin;
 	SlonDString query;
 	PGresult   *result;
-	int			idx;
-	char	   *table_name;
 	int			rc;
 
 	if (stmt->set_origin < 0)
@@ -4163,13 +4497,20 @@ slonik_set_add_table(SlonikStmt_set_add_table * stmt)
 		stmt->tables != NULL)
 	{
 		/**
-		 * query the catalog to get a list of tables.
+		 * query the catalog to get a list of tables together with
+		 * the key to use for each of them. script_check_stmts() rejects
+		 * KEY together with TABLES, so that is always the primary key.
 		 */
-		slon_mkquery(&query, "select table_schema || '.' || table_name "
+		slon_mkquery(&query, "select T.fqname, "
+					 "\"_%s\".determineIdxnameUnique(T.fqname, NULL) "
+					 "from (select table_schema || '.' || table_name as fqname "
 					 "from information_schema.tables where "
 					 "table_schema || '.'||table_name ~ E'%s' "
-					 " and table_type='BASE TABLE' order by 1", stmt->tables);
+					 " and table_type='BASE TABLE') T order by 1",
+					 stmt->hdr.script->clustername, stmt->tables);
+		db_notice_silent = true;
 		result = db_exec_select((SlonikStmt *) stmt, adminfo1, &query);
+		db_notice_silent = false;
 		if (result == NULL)
 		{
 			printf("%s:%d:Error unable to search for a list of tables. "
@@ -4180,20 +4521,7 @@ slonik_set_add_table(SlonikStmt_set_add_table * stmt)
 			return -1;
 
 		}
-		rc = 0;
-		for (idx = 0; idx < PQntuples(result); idx++)
-		{
-
-			table_name = PQgetvalue(result, idx, 0);
-			rc = slonik_set_add_single_table(stmt, adminfo1,
-											 table_name);
-			if (rc < 0)
-			{
-				PQclear(result);
-				dstring_terminate(&query);
-				return rc;
-			}
-		}
+		rc = slonik_set_add_tables(stmt, adminfo1, result);
 		PQclear(result);
 	}
 	else
@@ -4274,27 +4602,128 @@ slonik_set_add_single_table(SlonikStmt_set_add_table * stmt,
 }
 
 
-int
-slonik_set_add_sequence(SlonikStmt_set_add_sequence * stmt)
+/**
+ * adds all the tables in the result of a catalog query (fully
+ * qualified name and key) to the set with one call to setAddTables(),
+ * which generates a single SET_ADD_TABLES event for all of them.
+ *
+ * The tables get consecutive table ids, starting at the one given in
+ * the statement if any.
+ */
+static int
+slonik_set_add_tables(SlonikStmt_set_add_table * stmt,
+					  SlonikAdmInfo * adminfo1,
+					  PGresult *tables)
 {
-	SlonikAdmInfo *adminfo1;
-	int			origin = stmt->set_origin;
-	int			rc;
-	const char *sequence_name;
 	SlonDString query;
+	SlonDString tab_ids;
+	SlonDString fqnames;
+	SlonDString idxnames;
+	SlonDString comments;
+	PGresult   *res;
+	int			ntables = PQntuples(tables);
+	int			tab_id;
 	int			idx;
-	PGresult   *result;
+	int			rc = 0;
 
+	if (ntables == 0)
+		return 0;
 
-	if (stmt->set_origin < 0)
+	if (stmt->tab_id < 0)
 	{
-		origin = find_origin((SlonikStmt *) stmt, stmt->set_id);
-		if (origin < 0)
-		{
-			printf("%s:%d:Error: unable to determine the origin for set %d",
-				   stmt->hdr.stmt_filename, stmt->hdr.stmt_lno, stmt->set_id);
+		tab_id = slonik_get_next_tab_id((SlonikStmt *) stmt);
+		if (tab_id < 0)
 			return -1;
-		}
+	}
+	else
+		tab_id = stmt->tab_id;
+
+	dstring_init(&tab_ids);
+	dstring_init(&fqnames);
+	dstring_init(&idxnames);
+	dstring_init(&comments);
+	for (idx = 0; idx < ntables; idx++)
+	{
+		const char *sep = (idx == 0) ? "" : ",";
+
+		slon_appendquery(&tab_ids, "%s%d", sep, tab_id + idx);
+		slon_appendquery(&fqnames, "%s'%q'", sep,
+						 PQgetvalue(tables, idx, 0));
+		slon_appendquery(&idxnames, "%s'%q'", sep,
+						 PQgetvalue(tables, idx, 1));
+		slon_appendquery(&comments, "%s'%q'", sep, stmt->tab_comment);
+	}
+
+	dstring_init(&query);
+	slon_mkquery(&query,
+				 "lock table \"_%s\".sl_config_lock;"
+				 "select \"_%s\".setAddTables(%d, ARRAY[%s]::int4[], "
+				 "ARRAY[%s]::text[], ARRAY[%s]::name[], ARRAY[%s]::text[]); ",
+				 stmt->hdr.script->clustername,
+				 stmt->hdr.script->clustername,
+				 stmt->set_id, dstring_data(&tab_ids),
+				 dstring_data(&fqnames), dstring_data(&idxnames),
+				 dstring_data(&comments));
+	if (slonik_submitEvent((SlonikStmt *) stmt, adminfo1, &query,
+						   stmt->hdr.script, auto_wait_disabled) < 0)
+		rc = -1;
+
+	/**
+	 * add the sequences any of the tables depend on, again with
+	 * a single event.
+	 */
+	if (rc == 0 && stmt->add_sequences)
+	{
+		slon_mkquery(&query,
+					 "select S.seqname, 'sequence for ' || S.fqname "
+					 "from (select table_schema || '.' || table_name as fqname, "
+					 "ordinal_position, "
+					 "pg_get_serial_sequence(table_schema || '.' || table_name, "
+					 "column_name) as seqname "
+					 "from information_schema.columns where "
+					 "table_schema || '.' || table_name = ANY (ARRAY[%s]::text[])"
+					 ") S where S.seqname is not null "
+					 "order by S.fqname, S.ordinal_position",
+					 dstring_data(&fqnames));
+		res = db_exec_select((SlonikStmt *) stmt, adminfo1, &query);
+		if (res == NULL)
+			rc = -1;
+		else
+		{
+			rc = slonik_set_add_sequences((SlonikStmt *) stmt, adminfo1,
+										  stmt->set_id, res);
+			PQclear(res);
+		}
+	}
+
+	dstring_free(&query);
+	dstring_free(&tab_ids);
+	dstring_free(&fqnames);
+	dstring_free(&idxnames);
+	dstring_free(&comments);
+	return rc;
+}
+
+
+int
+slonik_set_add_sequence(SlonikStmt_set_add_sequence * stmt)
+{
+	SlonikAdmInfo *adminfo1;
+	int			origin = stmt->set_origin;
+	int			rc;
+	SlonDString query;
+	PGresult   *result;
+
+
+	if (stmt->set_origin < 0)
+	{
+		origin = find_origin((SlonikStmt *) stmt, stmt->set_id);
+		if (origin < 0)
+		{
+			printf("%s:%d:Error: unable to determine the origin for set %d",
+				   stmt->hdr.stmt_filename, stmt->hdr.stmt_lno, stmt->set_id);
+			return -1;
+		}
 	}
 
 	adminfo1 = get_active_adminfo((SlonikStmt *) stmt, origin);
@@ -4366,10 +4795,10 @@ slonik_set_add_sequence(SlonikStmt_set_add_sequence * stmt)
 		/**
 		 * query the catalog to get a list of tables.
 		 */
-		slon_mkquery(&query, "select sequence_schema || '.' || sequence_name "
-					 "from information_schema.sequences where "
+		slon_mkquery(&query, "select sequence_schema || '.' || sequence_name, "
+					 "'%q' from information_schema.sequences where "
 					 "sequence_schema || '.'||sequence_name ~ '%s' "
-					 "order by 1", stmt->sequences);
+					 "order by 1", stmt->seq_comment, stmt->sequences);
 		result = db_exec_select((SlonikStmt *) stmt, adminfo1, &query);
 		if (result == NULL)
 		{
@@ -4381,23 +4810,8 @@ slonik_set_add_sequence(SlonikStmt_set_add_sequence * stmt)
 			return -1;
 
 		}
-		rc = 0;
-		for (idx = 0; idx < PQntuples(result); idx++)
-		{
-
-			sequence_name = PQgetvalue(result, idx, 0);
-			rc = slonik_set_add_single_sequence((SlonikStmt *) stmt, adminfo1,
-												sequence_name,
-												stmt->set_id,
-												stmt->seq_comment, -1);
-
-			if (rc < 0)
-			{
-				PQclear(result);
-				dstring_terminate(&query);
-				return rc;
-			}
-		}
+		rc = slonik_set_add_sequences((SlonikStmt *) stmt, adminfo1,
+									  stmt->set_id, result);
 		PQclear(result);
 
 	}
@@ -4454,6 +4868,71 @@ slonik_set_add_single_sequence(SlonikStmt * stmt,
 }
 
 
+/**
+ * adds all the sequences in the result of a catalog query (fully
+ * qualified name and comment) to the set with one call to
+ * setAddSequences(), which generates a single SET_ADD_SEQUENCES event
+ * for all of them.
+ */
+static int
+slonik_set_add_sequences(SlonikStmt * stmt,
+						 SlonikAdmInfo * adminfo1,
+						 int set_id,
+						 PGresult *sequences)
+{
+	SlonDString query;
+	SlonDString seq_ids;
+	SlonDString fqnames;
+	SlonDString comments;
+	int			nseqs = PQntuples(sequences);
+	int			seq_id;
+	int			idx;
+	int			rc = 0;
+
+	if (nseqs == 0)
+		return 0;
+
+	seq_id = slonik_get_next_sequence_id(stmt);
+	if (seq_id < 0)
+		return -1;
+
+	dstring_init(&seq_ids);
+	dstring_init(&fqnames);
+	dstring_init(&comments);
+	for (idx = 0; idx < nseqs; idx++)
+	{
+		const char *sep = (idx == 0) ? "" : ",";
+
+		slon_appendquery(&seq_ids, "%s%d", sep, seq_id + idx);
+		slon_appendquery(&fqnames, "%s'%q'", sep,
+						 PQgetvalue(sequences, idx, 0));
+		slon_appendquery(&comments, "%s'%q'", sep,
+						 PQgetvalue(sequences, idx, 1));
+	}
+
+	dstring_init(&query);
+	slon_mkquery(&query,
+				 "lock table \"_%s\".sl_config_lock;"
+				 "select \"_%s\".setAddSequences(%d, ARRAY[%s]::int4[], "
+				 "ARRAY[%s]::text[], ARRAY[%s]::text[]); ",
+				 stmt->script->clustername,
+				 stmt->script->clustername,
+				 set_id, dstring_data(&seq_ids),
+				 dstring_data(&fqnames), dstring_data(&comments));
+	db_notice_silent = true;
+	if (slonik_submitEvent(stmt, adminfo1, &query,
+						   stmt->script, auto_wait_disabled) < 0)
+		rc = -1;
+	db_notice_silent = false;
+
+	dstring_free(&query);
+	dstring_free(&seq_ids);
+	dstring_free(&fqnames);
+	dstring_free(&comments);
+	return rc;
+}
+
+
 int
 slonik_set_drop_table(SlonikStmt_set_drop_table * stmt)
 {
@@ -4764,6 +5243,125 @@ slonik_unsubscribe_set(SlonikStmt_unsubscribe_set * stmt)
 }
 
 
+/*
+ * A switchover LOCK SET drains the new origin with SYNC rounds until one
+ * of them reaches it within SLONIK_DRAIN_LAG_MS, giving up on that after
+ * SLONIK_DRAIN_MAX_ROUNDS rounds.
+ */
+#define SLONIK_DRAIN_LAG_MS		200
+#define SLONIK_DRAIN_MAX_ROUNDS	20
+
+/* ----------
+ * slonik_lock_set_drain
+ *
+ *	Generate SYNC events on the set origin and wait for the new origin
+ *	to confirm each of them, until it follows closely enough that the
+ *	catch up after the lock is short.
+ * ----------
+ */
+static int
+slonik_lock_set_drain(SlonikStmt_lock_set * stmt, SlonikAdmInfo * adminfo1)
+{
+	SlonikAdmInfo *adminfo2;
+	SlonDString query;
+	PGresult   *res1;
+	char		ev_seqno_c[64];
+	int64		ev_seqno;
+	int			round;
+	int			waited_ms = 0;
+	int			delay_ms;
+	time_t		report_time;
+
+	adminfo2 = get_active_adminfo((SlonikStmt *) stmt, stmt->new_origin);
+	if (adminfo2 == NULL)
+		return -1;
+
+	dstring_init(&query);
+	for (round = 1; round <= SLONIK_DRAIN_MAX_ROUNDS; round++)
+	{
+		slon_mkquery(&query,
+					 "lock table \"_%s\".sl_event_lock;"
+					 "select \"_%s\".createEvent('_%s', 'SYNC'); ",
+					 stmt->hdr.script->clustername,
+					 stmt->hdr.script->clustername,
+					 stmt->hdr.script->clustername);
+		res1 = db_exec_select((SlonikStmt *) stmt, adminfo1, &query);
+		if (res1 == NULL)
+		{
+			dstring_free(&query);
+			return -1;
+		}
+		slon_scanint64(PQgetvalue(res1, 0, 0), &ev_seqno);
+		PQclear(res1);
+		if (db_commit_xact((SlonikStmt *) stmt, adminfo1) < 0)
+		{
+			dstring_free(&query);
+			return -1;
+		}
+
+		sprintf(ev_seqno_c, INT64_FORMAT, ev_seqno);
+		slon_mkquery(&query,
+					 "select 1 from \"_%s\".sl_confirm "
+					 "    where con_origin = %d and con_received = %d "
+					 "    and con_seqno >= '%s'; ",
+					 stmt->hdr.script->clustername,
+					 stmt->set_origin, stmt->new_origin, ev_seqno_c);
+
+		waited_ms = 0;
+		delay_ms = 0;
+		report_time = time(NULL) + SLONIK_WAIT_REPORT_SECS;
+		for (;;)
+		{
+			res1 = db_exec_select((SlonikStmt *) stmt, adminfo2, &query);
+			if (res1 == NULL)
+			{
+				dstring_free(&query);
+				return -1;
+			}
+			if (PQntuples(res1) > 0)
+			{
+				PQclear(res1);
+				break;
+			}
+			PQclear(res1);
+			if (db_rollback_xact((SlonikStmt *) stmt, adminfo2) < 0)
+			{
+				dstring_free(&query);
+				return -1;
+			}
+
+			if (time(NULL) >= report_time)
+			{
+				printf("%s:%d: waiting for node %d to catch up with "
+					   "set %d on node %d\n",
+					   stmt->hdr.stmt_filename, stmt->hdr.stmt_lno,
+					   stmt->new_origin, stmt->set_id, stmt->set_origin);
+				report_time = time(NULL) + SLONIK_WAIT_REPORT_SECS;
+			}
+			slonik_wait_backoff(&delay_ms);
+			waited_ms += delay_ms;
+		}
+		if (db_rollback_xact((SlonikStmt *) stmt, adminfo2) < 0)
+		{
+			dstring_free(&query);
+			return -1;
+		}
+
+		if (waited_ms <= SLONIK_DRAIN_LAG_MS)
+			break;
+	}
+	if (round > SLONIK_DRAIN_MAX_ROUNDS)
+		printf("%s:%d: NOTICE: node %d is still %d ms behind node %d "
+			   "after %d SYNC rounds, locking set %d anyway\n",
+			   stmt->hdr.stmt_filename, stmt->hdr.stmt_lno,
+			   stmt->new_origin, waited_ms, stmt->set_origin,
+			   SLONIK_DRAIN_MAX_ROUNDS, stmt->set_id);
+
+	dstring_free(&query);
+	return 0;
+}
+
+
 int
 slonik_lock_set(SlonikStmt_lock_set * stmt)
 {
@@ -4784,6 +5382,14 @@ slonik_lock_set(SlonikStmt_lock_set * stmt)
 		return -1;
 	}
 
+	/*
+	 * For a switchover first get the new origin close to current, so
+	 * that the set stays locked only briefly.
+	 */
+	if (stmt->new_origin >= 0 &&
+		slonik_lock_set_drain(stmt, adminfo1) < 0)
+		return -1;
+
 	/*
 	 * We issue the lockSet() and get the current xmax
 	 */
@@ -4813,32 +5419,19 @@ slonik_lock_set(SlonikStmt_lock_set * stmt)
 		return -1;
 	}
 
+	/*
+	 * waitXmin() sleeps on the locks of the transactions still running
+	 * and returns as soon as the last of them has ended.
+	 */
 	slon_mkquery(&query,
-				 "select pg_catalog.txid_snapshot_xmin(pg_catalog.txid_current_snapshot()) >= '%s'; ",
-				 maxxid_lock);
-
-	while (true)
+				 "select \"_%s\".waitXmin('%s'); ",
+				 stmt->hdr.script->clustername, maxxid_lock);
+	res2 = db_exec_select((SlonikStmt *) stmt, adminfo1, &query);
+	if (res2 == NULL)
 	{
-		res2 = db_exec_select((SlonikStmt *) stmt, adminfo1, &query);
-		if (res2 == NULL)
-		{
-			PQclear(res1);
-			dstring_free(&query);
-			return -1;
-		}
-
-		if (*PQgetvalue(res2, 0, 0) == 't')
-			break;
-
-		PQclear(res2);
-		if (db_rollback_xact((SlonikStmt *) stmt, adminfo1) < 0)
-		{
-			dstring_free(&query);
-			PQclear(res1);
-			return -1;
-		}
-
-		sleep(1);
+		PQclear(res1);
+		dstring_free(&query);
+		return -1;
 	}
 
 	PQclear(res1);
@@ -4915,6 +5508,102 @@ slonik_move_set(SlonikStmt_move_set * stmt)
 }
 
 
+/*
+ * Consecutive statements of an EXECUTE SCRIPT are submitted together in
+ * one call to ddlCaptureBatch() until the batch reaches this size.
+ */
+#define DDL_BATCH_SIZE		(256 * 1024)
+
+/*
+ * Longest statement text printed when a batch fails.
+ */
+#define DDL_ERROR_TEXT_MAX	1024
+
+/*
+ * Append a statement to the text[] literal in batch.
+ */
+static void
+slonik_ddl_batch_add(SlonDString * batch, const char *stmt, int len)
+{
+	char		delim = (batch->n_used == 0) ? '{' : ',';
+	int			i;
+
+	dstring_addchar(batch, delim);
+	dstring_addchar(batch, '"');
+	for (i = 0; i < len; i++)
+	{
+		if (stmt[i] == '"' || stmt[i] == '\\')
+			dstring_addchar(batch, '\\');
+		dstring_addchar(batch, stmt[i]);
+	}
+	dstring_addchar(batch, '"');
+}
+
+/*
+ * Submit the statements collected in batch. They are statements
+ * first_stmt to last_stmt of the script, found between the offsets start
+ * and end. On error these are reported instead of the whole batch, the
+ * server's error context names the statement that failed.
+ */
+static int
+slonik_ddl_batch_send(SlonikAdmInfo * adminfo, SlonDString * equery,
+					  SlonDString * batch, const char *script,
+					  int start, int end, int first_stmt, int last_stmt)
+{
+	PGresult   *res1;
+	const char *params[1];
+	int			first_line;
+	int			last_line;
+	int			i;
+
+	if (batch->n_used == 0)
+		return 0;
+	dstring_addchar(batch, '}');
+	dstring_terminate(batch);
+	params[0] = dstring_data(batch);
+
+	res1 = PQexecParams(adminfo->dbconn, dstring_data(equery), 1, NULL,
+						params, NULL, NULL, 0);
+	if (PQresultStatus(res1) != PGRES_TUPLES_OK)
+	{
+		while (start < end && isspace((unsigned char) script[start]))
+			start++;
+		first_line = 1;
+		for (i = 0; i < start; i++)
+		{
+			if (script[i] == '\n')
+				first_line++;
+		}
+		last_line = first_line;
+		for (; i < end; i++)
+		{
+			if (script[i] == '\n')
+				last_line++;
+		}
+
+		if (first_stmt == last_stmt)
+			fprintf(stderr, "%s [%.*s%s] - %s",
+					PQresStatus(PQresultStatus(res1)),
+					(end - start > DDL_ERROR_TEXT_MAX) ?
+					DDL_ERROR_TEXT_MAX : end - start, script + start,
+					(end - start > DDL_ERROR_TEXT_MAX) ? " ..." : "",
+					PQresultErrorMessage(res1));
+		else
+			fprintf(stderr, "%s [statements %d to %d, lines %d to %d "
+					"of the script] - %s",
+					PQresStatus(PQresultStatus(res1)),
+					first_stmt, last_stmt, first_line, last_line,
+					PQresultErrorMessage(res1));
+		PQclear(res1);
+		return -1;
+	}
+	PQclear(res1);
+	dstring_reset(batch);
+
+	return 0;
+}
+
+
 int
 slonik_ddl_script(SlonikStmt_ddl_script * stmt)
 {
@@ -4925,15 +5614,20 @@ slonik_ddl_script(SlonikStmt_ddl_script * stmt)
 	SlonDString script_rewritten;
 	PGresult   *res1;
 	size_t		num_read;
-	int			num_statements = -1,
-				stmtno;
 	char		buf[4096];
+	SlonDString batch;
+	char	   *script;
+	int			script_len;
+	int			cpos,
+				stmt_start,
+				n;
+	int			stmtno,
+				batch_first,
+				batch_start,
+				batch_end;
+	ScanState	ss;
 	replacement_token	replacements[4];
 
-#define PARMCOUNT 1
-
-	const char *params[PARMCOUNT];
-
 	adminfo1 = get_active_adminfo((SlonikStmt *) stmt, stmt->ev_origin);
 	if (adminfo1 == NULL)
 		return -1;
@@ -4987,14 +5681,14 @@ slonik_ddl_script(SlonikStmt_ddl_script * stmt)
 	dstring_free(&script_content);
 
 	/*
-	 * This prepares the statement that will be run over and over for each DDL
-	 * statement
+	 * This prepares the statement that will be run over and over for each batch
+	 * of DDL statements
 	 */
 	dstring_init(&equery);
 	if ((stmt->only_on_nodes == NULL) && (stmt->only_on_node < 0))
 	{
 		slon_mkquery(&equery,
-					 "select \"_%s\".ddlCapture($1, NULL::text);",
+					 "select \"_%s\".ddlCaptureBatch($1::text[], NULL::text);",
 					 stmt->hdr.script->clustername);
 	}
 	else
@@ -5002,66 +5696,75 @@ slonik_ddl_script(SlonikStmt_ddl_script * stmt)
 		if (stmt->only_on_node > 0)
 		{
 			slon_mkquery(&equery,
-						 "select \"_%s\".ddlCapture($1, '%d');",
+						 "select \"_%s\".ddlCaptureBatch($1::text[], '%d');",
 						 stmt->hdr.script->clustername, stmt->only_on_node);
 		}
 		else
 		{						/* stmt->only_on_nodes is populated */
 			slon_mkquery(&equery,
-						 "select \"_%s\".ddlCapture($1, '%s');",
+						 "select \"_%s\".ddlCaptureBatch($1::text[], '%s');",
 						 stmt->hdr.script->clustername, stmt->only_on_nodes);
 		}
 	}
 
 	/*
-	 * Split the script into a series of SQL statements - each needs to be
-	 * submitted separately
+	 * Split the script into a series of SQL statements. Each one is
+	 * captured and executed separately, but consecutive statements are
+	 * submitted in batches. Statements controlling the transaction are
+	 * sent on their own so that they fail individually.
 	 */
-	num_statements = scan_for_statements(dstring_data(&script_rewritten));
-
-	/* OOPS!  Something went wrong !!! */
-	if ((num_statements < 0) || (num_statements >= MAXSTATEMENTS))
-	{
-		printf("DDL - number of statements invalid - %d not between 0 and %d\n", num_statements, MAXSTATEMENTS);
-		dstring_free(&script_rewritten);
-		return -1;
-	}
+	script = dstring_data(&script_rewritten);
+	script_len = strlen(script);
+	scan_init(&ss);
 	dstring_init(&query);
-	for (stmtno = 0; stmtno < num_statements; stmtno++)
-	{
-		int			startpos,
-					endpos;
-		char	   *dest;
-
-		if (stmtno == 0)
-			startpos = 0;
-		else
-			startpos = STMTS[stmtno - 1];
-		endpos = STMTS[stmtno];
-		dest = (char *) malloc(endpos - startpos + 1);
-		if (dest == 0)
+	dstring_init(&batch);
+	cpos = 0;
+	stmt_start = 0;
+	stmtno = 0;
+	batch_first = 0;
+	batch_start = 0;
+	batch_end = 0;
+	while (cpos < script_len)
+	{
+		n = scan_statements(&ss, script + cpos, script_len - cpos);
+		if (n < 0)
 		{
-			printf("DDL Failure - could not allocate %d bytes of memory\n", endpos - startpos + 1);
-			return -1;
+			scan_finish(&ss);
+			n = script_len - cpos;
 		}
-		strncpy(dest, dstring_data(&script_rewritten) + startpos, endpos - startpos);
-		dest[STMTS[stmtno] - startpos] = '\0';
-		slon_mkquery(&query, "%s", dest);
-		free(dest);
+		cpos += n;
 
-		params[PARMCOUNT - 1] = dstring_data(&query);
+		/* Skip anything that is only white space and comments */
+		if (!ss.stmt_content)
+		{
+			stmt_start = cpos;
+			continue;
+		}
 
-		res1 = PQexecParams(adminfo1->dbconn, dstring_data(&equery), 1, NULL, params, NULL, NULL, 0);
-		if (PQresultStatus(res1) != PGRES_TUPLES_OK)
+		if (ss.stmt_xact_control &&
+			slonik_ddl_batch_send(adminfo1, &equery, &batch, script,
+								  batch_start, batch_end,
+								  batch_first, stmtno) < 0)
+			goto ddl_error;
+		if (batch.n_used == 0)
 		{
-			fprintf(stderr, "%s [%s] - %s",
-					PQresStatus(PQresultStatus(res1)),
-					dstring_data(&query), PQresultErrorMessage(res1));
-			PQclear(res1);
-			return -1;
+			batch_first = stmtno + 1;
+			batch_start = stmt_start;
 		}
-		PQclear(res1);
-	}
+		stmtno++;
+		batch_end = cpos;
+		slonik_ddl_batch_add(&batch, script + stmt_start, cpos - stmt_start);
+		if ((ss.stmt_xact_control || batch.n_used >= DDL_BATCH_SIZE) &&
+			slonik_ddl_batch_send(adminfo1, &equery, &batch, script,
+								  batch_start, batch_end,
+								  batch_first, stmtno) < 0)
+			goto ddl_error;
+		stmt_start = cpos;
+	}
+	if (slonik_ddl_batch_send(adminfo1, &equery, &batch, script,
+							  batch_start, batch_end, batch_first, stmtno) < 0)
+		goto ddl_error;
+	dstring_free(&batch);
 
 	/*
 	 * Finally call ddlScript_complete()
@@ -5105,6 +5808,13 @@ slonik_ddl_script(SlonikStmt_ddl_script * stmt)
 	dstring_free(&script_rewritten);
 	dstring_free(&query);
 	return 0;
+
+ddl_error:
+	dstring_free(&batch);
+	dstring_free(&equery);
+	dstring_free(&script_rewritten);
+	dstring_free(&query);
+	return -1;
 }
 
 
@@ -5217,9 +5927,10 @@ slonik_wait_event(SlonikStmt_wait_event * stmt)
 	PGresult   *res;
 	time_t		timeout;
 	time_t		now;
+	time_t		report_time;
 	int			all_confirmed = 0;
 	char		seqbuf[NAMEDATALEN];
-	int			loop_count = 0;
+	int			delay_ms = 0;
 	SlonDString outstanding_nodes;
 	int			tupindex;
 
@@ -5228,6 +5939,7 @@ slonik_wait_event(SlonikStmt_wait_event * stmt)
 		return -1;
 
 	time(&timeout);
+	report_time = timeout + SLONIK_WAIT_REPORT_SECS;
 	timeout += stmt->wait_timeout;
 	dstring_init(&query);
 	dstring_init(&outstanding_nodes);
@@ -5364,8 +6076,7 @@ slonik_wait_event(SlonikStmt_wait_event * stmt)
 			return -1;
 		}
 
-		loop_count++;
-		if (loop_count % 10 == 0 && stmt->wait_confirmed >= 0)
+		if (now >= report_time && stmt->wait_confirmed >= 0)
 		{
 			sprintf(seqbuf, INT64_FORMAT, adminfo->last_event);
 			printf("%s:%d: waiting for event (%d,%s) to be confirmed on node %d\n"
@@ -5374,7 +6085,7 @@ slonik_wait_event(SlonikStmt_wait_event * stmt)
 				   stmt->wait_confirmed);
 			fflush(stdout);
 		}
-		else if (loop_count % 10 == 0)
+		else if (now >= report_time)
 		{
 			sprintf(seqbuf, INT64_FORMAT, adminfo->last_event);
 			printf("%s:%d: waiting for event (%d,%s).  %s\n",
@@ -5384,7 +6095,9 @@ slonik_wait_event(SlonikStmt_wait_event * stmt)
 			fflush(stdout);
 
 		}
-		sleep(1);
+		if (now >= report_time)
+			report_time = now + SLONIK_WAIT_REPORT_SECS;
+		slonik_wait_backoff(&delay_ms);
 	}
 	dstring_free(&outstanding_nodes);
 	dstring_free(&query);
@@ -5465,6 +6178,42 @@ slonik_sleep(SlonikStmt_sleep * stmt)
 }
 
 
+/* ----------
+ * slonik_wait_backoff
+ *
+ *	Sleep between two polls of a wait loop. The delay starts at
+ *	SLONIK_WAIT_MIN_MS and doubles with every call up to
+ *	SLONIK_WAIT_MAX_MS, so that a wait finishes shortly after the
+ *	condition is met without polling the nodes more than once a second
+ *	during long waits. *delay_ms must be 0 before the first call.
+ * ----------
+ */
+static void
+slonik_wait_backoff(int *delay_ms)
+{
+#ifndef WIN32
+	struct timeval tv;
+#endif
+
+	if (*delay_ms == 0)
+		*delay_ms = SLONIK_WAIT_MIN_MS;
+	else if (*delay_ms < SLONIK_WAIT_MAX_MS)
+	{
+		*delay_ms *= 2;
+		if (*delay_ms > SLONIK_WAIT_MAX_MS)
+			*delay_ms = SLONIK_WAIT_MAX_MS;
+	}
+
+#ifndef WIN32
+	tv.tv_sec = *delay_ms / 1000;
+	tv.tv_usec = (*delay_ms % 1000) * 1000;
+	(void) select(0, NULL, NULL, NULL, &tv);
+#else
+	Sleep(*delay_ms);
+#endif
+}
+
+
 /*
  * scanint8 --- try to parse a string into an int8.
  *
@@ -6089,7 +6838,8 @@ slonik_wait_config_caughtup(SlonikAdmInfo * adminfo1,
 	SlonDString node_list;
 	int			wait_count = 0;
 	int			node_list_size = 0;
-	int			sleep_count = 0;
+	int			delay_ms = 0;
+	time_t		report_time = time(NULL) + SLONIK_WAIT_REPORT_SECS;
 	int64	   *behind_nodes = NULL;
 	int			idx;
 	int			cur_array_idx;
@@ -6242,8 +6992,7 @@ slonik_wait_config_caughtup(SlonikAdmInfo * adminfo1,
 		}						/* for .. PQntuples */
 		if (confirm_count < wait_count)
 		{
-			sleep_count++;
-			if (sleep_count % 10 == 0)
+			if (time(NULL) >= report_time)
 			{
 				/**
 				 * any elements in caught_up_nodes with a value 0
@@ -6280,9 +7029,10 @@ slonik_wait_config_caughtup(SlonikAdmInfo * adminfo1,
 				printf("waiting for events %s to be confirmed on node %d\n",
 					   dstring_data(&outstanding), adminfo1->no_id);
 				fflush(stdout);
+				report_time = time(NULL) + SLONIK_WAIT_REPORT_SECS;
 
-			}					/* every 10 iterations */
-			sleep(1);
+			}					/* every SLONIK_WAIT_REPORT_SECS */
+			slonik_wait_backoff(&delay_ms);
 		}
 		free(behind_nodes);
 
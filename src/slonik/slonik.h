@@ -120,10 +120,18 @@ struct SlonikAdmInfo_s
 	int			pg_version;
 	int			nodeid_checked;
 	int			have_xact;
+	int			xact_deferred;	/* begin is sent with the next async query */
+	int			pending;		/* DB_PENDING_* query sent, result unread */
+	SlonikStmt *pending_stmt;	/* statement that sent the pending query */
+	char	   *pending_query;
 	SlonikScript *script;
 	SlonikAdmInfo *next;
 };
 
+#define DB_PENDING_NONE			0
+#define DB_PENDING_EVCOMMAND	1
+#define DB_PENDING_COMMIT		2
+
 
 struct SlonikStmt_s
 {
@@ -208,6 +216,7 @@ struct failed_node_entry_s
 	int			no_id;
 	int			backup_node;
 	int			temp_backup_node;
+	int			timeout;		/* per node query timeout, 0 = none */
 	struct failed_node_entry_s *next;
 	int			num_sets;
 	int			num_nodes;
@@ -393,6 +402,7 @@ struct SlonikStmt_lock_set_s
 	SlonikStmt	hdr;
 	int			set_id;
 	int			set_origin;
+	int			new_origin;		/* switchover target to drain, or -1 */
 };
 
 
@@ -602,6 +612,7 @@ extern int	slon_scanint64(char *str, int64 *result);
  */
 extern int	db_notice_silent;
 extern int	db_notice_lno;
+extern int	db_async_stmt;
 
 #ifdef HAVE_PQSETNOTICERECEIVER
 void		db_notice_recv(void *arg, const PGresult *res);
@@ -621,6 +632,9 @@ int db_exec_evcommand_p(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
 					const int *paramFormats, int resultFormat);
 PGresult *db_exec_select(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
 			   SlonDString * query);
+int db_exec_select_all(SlonikStmt * stmt, SlonikAdmInfo ** adminfo,
+				   SlonDString * query, PGresult ** res, int nnodes,
+				   int timeout);
 int			db_get_version(SlonikStmt * stmt, SlonikAdmInfo * adminfo);
 int db_check_namespace(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
 				   char *clustername);
@@ -630,7 +644,9 @@ int			db_get_nodeid(SlonikStmt * stmt, SlonikAdmInfo * adminfo);
 int db_begin_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo,
 			  bool suppress_locking);
 int			db_commit_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo);
+int			db_commit_xact_send(SlonikStmt * stmt, SlonikAdmInfo * adminfo);
 int			db_rollback_xact(SlonikStmt * stmt, SlonikAdmInfo * adminfo);
+int			db_pending_finish(SlonikAdmInfo * adminfo);
 
 int			slon_mkquery(SlonDString * dsp, char *fmt,...);
 int			slon_appendquery(SlonDString * dsp, char *fmt,...);
@@ -18,7 +18,6 @@
 
 #include "scan.h"
 
-extern int STMTS[MAXSTATEMENTS];
 
 
 /*
@@ -70,7 +69,9 @@ int yydebug=1;
 %token	K_LOGFILE
 %token	K_MAX
 %token	K_ARCHIVES
+%token	K_AHEAD
 %token	K_ANALYZE
+%token	K_BATCH
 %token	K_AND
 %token	K_ARCHIVE
 %token	K_ARCHIVE_COMMENT
@@ -94,6 +95,7 @@ int yydebug=1;
 %token	K_NAMESPACE
 %token	K_NULL
 %token	K_ONLY
+%token	K_PARSE
 %token	K_POST
 %token	K_PRE
 %token	K_PROCESSING
@@ -102,6 +104,7 @@ int yydebug=1;
 %token	K_SELECT
 %token	K_SESSION_ROLE
 %token	K_SET
+%token	K_SIZE
 %token	K_START
 %token	K_START_ARCHIVE
 %token	K_START_CONFIG
@@ -153,6 +156,8 @@ conf_stmt			: K_CONF_COMMENT
 					| conf_dest_database
 					| conf_logfile
 					| conf_maxarchives
+					| conf_parseahead
+					| conf_batch
 					| conf_clustername
 					| conf_rename_object
 					| conf_preprocess
@@ -202,6 +207,26 @@ conf_maxarchives	: K_MAX K_ARCHIVES '=' num ';'
 					}
 					;
 
+conf_parseahead		: K_PARSE K_AHEAD '=' num ';'
+					{
+						parse_ahead = $4;
+					}
+					| K_PARSE K_AHEAD K_SIZE '=' num ';'
+					{
+						parse_ahead_size = $5;
+					}
+					;
+
+conf_batch			: K_BATCH K_ARCHIVES '=' num ';'
+					{
+						batch_archives = $4;
+					}
+					| K_BATCH K_SIZE '=' num ';'
+					{
+						batch_size = $4;
+					}
+					;
+
 conf_clustername	: K_CLUSTER K_NAME '=' literal ';'
 					{
 						if (cluster_name != NULL)
@@ -370,6 +395,32 @@ arch_tracking		: K_SELECT ident '.' arch_tracking_func '(' literal ',' literal '
 							dstring_free(&ds);
 					}
 
+/*
+ * slon appends further SYNC groups to an archive when archive rollover
+ * is configured. Each of them starts with its own tracking call, which
+ * is applied in the archive's transaction.
+ */
+arch_tracking_mark	: K_SELECT ident '.' arch_tracking_func '(' literal ',' literal ')' ';'
+					{
+						SlonDString	ds;
+
+						dstring_init(&ds);
+						slon_mkquery(&ds, "select %s.%s('%s', '%s');",
+								$2, $4, $6, $8);
+						free($2);
+						free($4);
+						free($6);
+						free($8);
+						if (process_simple_sql(dstring_data(&ds)) < 0)
+						{
+							dstring_free(&ds);
+							YYABORT;
+						}
+						else
+							dstring_free(&ds);
+					}
+					;
+
 arch_tracking_func	: T_TRACKING_FUNCTION
 					{
 						char   *ret;
@@ -397,6 +448,7 @@ arch_stmt			: arch_comment
 					| arch_finishtable
 					| arch_seqsetval
 					| arch_pgsetval
+					| arch_tracking_mark
 					| arch_exec_ddl
 					| arch_vacuum
 					| arch_analyze
@@ -597,9 +649,16 @@ arch_truncate		: K_TRUNCATE K_TABLE K_ONLY ident '.' ident K_CASCADE ';'
 					{
 						
 						TruncateStmt stmt;
+						int			rc;
+
 						stmt.namespace=$4;
 						stmt.tablename=$6;
-						process_truncate(&stmt);
+						rc = process_truncate(&stmt);
+						free($4);
+						free($6);
+
+						if (rc < 0)
+							YYABORT;
 
 					};
 
@@ -949,7 +1008,7 @@ arch_exec_ddl		: K_EXEC_DDL
 						/*
 						 * Just in case
 						 */
-						process_end_transaction("rollback;");
+						process_cleanup_transaction();
 
 						YYACCEPT;
 					}
@@ -1008,6 +1067,8 @@ ident				: T_IDENT
 ident_keywords		: K_START_CONFIG | K_START_ARCHIVE
 					| K_ARCHIVE
 					| K_ARCHIVES
+					| K_AHEAD
+					| K_BATCH
 					| K_CLUSTER
 					| K_COMMIT
 					| K_COPY
@@ -1022,11 +1083,13 @@ ident_keywords		: K_START_CONFIG | K_START_ARCHIVE
 					| K_MAX
 					| K_NAME
 					| K_NAMESPACE
+					| K_PARSE
 					| K_POST
 					| K_PRE
 					| K_PROCESSING
 					| K_RENAME
 					| K_SET
+					| K_SIZE
 					| K_START
 					| K_TRANSACTION
 					| K_TRUNCATE
@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <sys/wait.h>
@@ -27,6 +28,7 @@
 #include <signal.h>
 #include <dirent.h>
 #include <string.h>
+#include <pthread.h>
 #else
 #define sleep(x) Sleep(x*1000)
 #define vsnprintf _vsnprintf
@@ -39,12 +41,97 @@
 #include "config.h"
 
 
-typedef struct archscan_entry_s
+/*
+ * The archive index is appended to by slon's archive_close(). Every line
+ * is the zero padded archive counter, a blank and the file name.
+ */
+#define ARCHIVE_INDEX_NAME		"slony1_archive_index"
+
+/*
+ * How far before the binary search result the index is read, to catch
+ * lines that were appended slightly out of counter order.
+ */
+#define ARCHIVE_INDEX_BACKOFF	65536
+
+/*
+ * Cache of server side prepared statements used to apply the row
+ * level insert, update and delete statements. The parameterized query
+ * text itself is the key, it encodes table, command type, column list
+ * and which qualification columns are NULL.
+ */
+#define STMT_CACHE_SIZE		500
+#define STMT_CACHE_BUCKETS	256
+
+typedef struct stmt_cache_entry_s
+{
+	char	   *query;
+	unsigned int hash;
+	char		stmtname[32];
+	struct stmt_cache_entry_s *hash_next;
+	struct stmt_cache_entry_s *lru_prev;
+	struct stmt_cache_entry_s *lru_next;
+}	stmt_cache_entry;
+
+/*
+ * With parse ahead configured, a parser thread turns upcoming archives
+ * into lists of operations while the main thread applies the current
+ * one. The process_*() functions called by the grammar record into the
+ * batch of the archive being parsed instead of executing.
+ */
+typedef enum
+{
+	ARCH_OP_SIMPLE_SQL,
+	ARCH_OP_START_TRANSACTION,
+	ARCH_OP_END_TRANSACTION,
+	ARCH_OP_CLEANUP_TRANSACTION,
+	ARCH_OP_CHECK_AT_COUNTER,
+	ARCH_OP_INSERT,
+	ARCH_OP_UPDATE,
+	ARCH_OP_DELETE,
+	ARCH_OP_TRUNCATE,
+	ARCH_OP_COPY,
+	ARCH_OP_COPYDATA,
+	ARCH_OP_COPYEND
+}	ArchiveOpType;
+
+typedef struct ArchiveOp_s
+{
+	ArchiveOpType type;
+	char	   *sql;			/* SQL text, at_counter or COPY data */
+	char	   *namespace;
+	char	   *tablename;
+	AttElemList *list1;			/* attributes or changes */
+	AttElemList *list2;			/* qualification */
+	char	   *from;
+	int			only;
+	struct ArchiveOp_s *next;
+}	ArchiveOp;
+
+typedef struct ArchiveBatch_s
+{
+	char	   *fname;
+	char	   *destfname;
+	ArchiveOp  *ops_head;
+	ArchiveOp  *ops_tail;
+	int			errors;			/* pre processing and parse errors */
+	off_t		bytes;			/* archive size counted in pipeline_bytes */
+	SlonDString messages;		/* errlog output while parsing */
+	bool		done;
+	bool		cancelled;
+	struct ArchiveBatch_s *next;
+}	ArchiveBatch;
+
+/*
+ * Archives applied inside a destination transaction that is still open
+ * because of batch archives. Their post processing waits for the
+ * commit, on failure they go back into the queue.
+ */
+typedef struct MergedArchive_s
 {
 	char	   *fname;
-	struct archscan_entry_s *left;
-	struct archscan_entry_s *right;
-}	archscan_entry;
+	char	   *destfname;
+	struct MergedArchive_s *next;
+}	MergedArchive;
 
 /*
  * Global data
@@ -57,6 +144,10 @@ FILE	   *destinationfp = NULL;
 char	   *logfile_path = NULL;
 FILE	   *logfile_fp = NULL;
 int			max_archives = 1000;
+int			parse_ahead = 0;
+int			parse_ahead_size = 16777216;
+int			batch_archives = 1;
+int			batch_size = 0;
 PGconn	   *dbconn = NULL;
 bool		logfile_switch_requested = false;
 bool		wait_for_resume = false;
@@ -91,7 +182,9 @@ static int	opt_nowait = 0;
 /*
  * Local data
  */
-static archscan_entry *archscan_sort = NULL;
+static char **archscan_list = NULL;
+static int	archscan_num = 0;
+static int	archscan_max = 0;
 static char current_at_counter[64];
 static bool process_in_transaction = false;
 static char *current_archive_path = NULL;
@@ -99,6 +192,43 @@ static bool suppress_copy = false;
 static SlonDString errlog_messages;
 static int	archive_count = 0;
 
+static stmt_cache_entry *stmt_cache_hash[STMT_CACHE_BUCKETS];
+static stmt_cache_entry *stmt_cache_lru_head = NULL;
+static stmt_cache_entry *stmt_cache_lru_tail = NULL;
+static int	stmt_cache_num = 0;
+static int	stmt_cache_seq = 0;
+
+/*
+ * Consecutive inserts into the same table and column list are turned
+ * into a COPY. The first row is held back, if a second one with the
+ * same key follows, the COPY is started. A single row is applied with
+ * the prepared insert instead.
+ */
+static char *insert_pending_query = NULL;
+static SlonDString insert_pending_copy;
+static SlonDString insert_pending_data;
+static char **insert_pending_values = NULL;
+static int	insert_pending_nvalues = 0;
+static bool insert_copy_active = false;
+
+static pthread_t pipeline_thread;
+static bool pipeline_started = false;
+static int	pipeline_ipc_rc = 1;
+static pthread_mutex_t pipeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipeline_cond = PTHREAD_COND_INITIALIZER;
+static ArchiveBatch *pipeline_head = NULL;
+static ArchiveBatch *pipeline_tail = NULL;
+static int	pipeline_count = 0;
+static off_t pipeline_bytes = 0;
+static ArchiveBatch *parse_batch = NULL;
+static pthread_mutex_t errlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool merge_open = false;
+static int	merge_count = 0;
+static off_t merge_bytes = 0;
+static MergedArchive *merge_head = NULL;
+static MergedArchive *merge_tail = NULL;
+
 
 /*
  * Local functions
@@ -106,10 +236,50 @@ static int	archive_count = 0;
 static void usage(void);
 static int	process_archive(char *fname);
 static int	process_exec_sql(char *sql);
+static int	process_write_dest(char *sql);
+static int	process_exec_prepared(char *query, int nparams,
+					  char **values);
+static stmt_cache_entry *stmt_cache_lookup(char *query);
+static void stmt_cache_unlink(stmt_cache_entry * ent);
+static void stmt_cache_push(stmt_cache_entry * ent);
+static void stmt_cache_reset(void);
+static int	process_flush_inserts(void);
+static void insert_pending_clear(void);
+static void value_unquote(SlonDString * ds, char *literal);
+static void value_copy_escape(SlonDString * ds, char *value);
+static void free_values(char **values, int nvalues);
+static int	process_insert_db(InsertStmt *stmt, char *namespace,
+				  char *tablename);
+static void add_param(SlonDString * query, SlonDString * scratch, char *glue,
+		  char **values, int *nvalues, char *literal);
+static void add_qualification(SlonDString * query, SlonDString * scratch,
+				  AttElemList *qual, char **values, int *nvalues);
+static void copy_row(SlonDString * ds, char **values, int nvalues);
+static int	process_copy_int(CopyStmt *stmt);
+static bool pipeline_recording(void);
+static int	pipeline_recv(char *buf);
+static int	pipeline_apply(char *fname);
+static void pipeline_cancel(void);
+static void *pipeline_main(void *dummy);
+static void pipeline_parse(ArchiveBatch *batch);
+static ArchiveOp *pipeline_add_op(ArchiveOpType type);
+static int	pipeline_exec_op(ArchiveOp *op);
+static void pipeline_free_batch(ArchiveBatch *batch);
+static int	archive_finish(char *fname, char *destfname);
+static void destination_fname(SlonDString * ds, char *fname);
+static int	merge_commit(void);
+static void merge_abort(void);
+static int	merge_post_processing(void);
+static AttElemList *attlist_copy(AttElemList *list);
+static void attlist_free(AttElemList *list);
 static int	archscan(int optind, int argc, char **argv);
-static int archscan_sort_in(archscan_entry ** entpm, char *fname,
-				 int optind, int argc, char **argv);
-static int	archscan_sort_out(archscan_entry * ent);
+static int	archscan_index(char *counter_done, int optind, int argc,
+			   char **argv);
+static int	archscan_add(char *fname, int optind, int argc, char **argv);
+static int	archscan_cmp(const void *a, const void *b);
+static int	archscan_sort_out(void);
+static void archscan_reset(void);
+static long long archscan_counter(char *fname);
 static int	get_current_at_counter(void);
 static int	idents_are_distinct(char *id1, char *id2);
 static int	process_command(char *command, char *inarchive, char *outarchive);
@@ -342,6 +512,12 @@ main(int argc, const char *argv[])
 		if (dbconn != NULL)
 		{
 			if (PQstatus(dbconn) != CONNECTION_OK)
+			{
+				/*
+				 * An open batch transaction is lost with the connection.
+				 */
+				merge_abort();
+
 				while (PQstatus(dbconn) != CONNECTION_OK)
 				{
 					errlog(LOG_WARN, "bad database connection, try to recover\n");
@@ -355,6 +531,7 @@ main(int argc, const char *argv[])
 					if (shutdown_immed_requested)
 						break;
 				}
+			}
 		}
 
 		if (wait_for_resume)
@@ -367,13 +544,30 @@ main(int argc, const char *argv[])
 				break;
 		}
 
-		rc = ipc_recv_path(archive_path);
+		if (parse_ahead > 0)
+			rc = pipeline_recv(archive_path);
+		else
+			rc = ipc_recv_path(archive_path);
+
+		/*
+		 * Nothing more to merge into an open batch transaction right
+		 * now, so commit it.
+		 */
+		if (rc != 1 && merge_open)
+		{
+			if (merge_commit() < 0)
+			{
+				wait_for_resume = true;
+				if (rc == -2)
+					continue;
+			}
+		}
+
 		if (rc == 0)
 			break;
 
 		if (rc == -2)
 		{
-			archscan_sort = NULL;
 			errlog(LOG_INFO, "Queue is empty.  Going to rescan in %d seconds\n", rescan_interval);
 			sleep(rescan_interval);
 			if (archscan(optind, argc, (char **) argv) < 0)
@@ -391,7 +585,11 @@ main(int argc, const char *argv[])
 		}
 
 		current_archive_path = archive_path;
-		if (process_archive(archive_path) != 0)
+		if (parse_ahead > 0)
+			rc = pipeline_apply(archive_path);
+		else
+			rc = process_archive(archive_path);
+		if (rc != 0)
 		{
 			ProcessingCommand *errcmd;
 			SlonDString cmd;
@@ -418,6 +616,14 @@ main(int argc, const char *argv[])
 				process_end_transaction("rollback;");
 			}
 
+			/*
+			 * Archives parsed ahead and those merged into the failed
+			 * transaction go back into the queue as well.
+			 */
+			if (parse_ahead > 0)
+				pipeline_cancel();
+			merge_abort();
+
 			/*
 			 * Stop everything if we are in nowait mode anyway
 			 */
@@ -475,7 +681,6 @@ static int
 process_archive(char *fname)
 {
 	SlonDString destfname;
-	char	   *cp;
 	FILE	   *fp;
 	ProcessingCommand *cmd;
 
@@ -494,17 +699,7 @@ process_archive(char *fname)
 
 	if (destination_dir != NULL)
 	{
-		cp = strrchr(fname, '/');
-		if (cp == NULL)
-			cp = fname;
-		else
-			cp++;
-		dstring_init(&destfname);
-		dstring_append(&destfname, destination_dir);
-		dstring_addchar(&destfname, '/');
-		dstring_append(&destfname, cp);
-		dstring_terminate(&destfname);
-
+		destination_fname(&destfname, fname);
 		destinationfname = dstring_data(&destfname);
 	}
 	else
@@ -561,14 +756,8 @@ process_archive(char *fname)
 
 	if (parse_errors == 0)
 	{
-		for (cmd = post_processing_commands; cmd != NULL; cmd = cmd->next)
-		{
-			if (process_command(cmd->command, fname, destinationfname) < 0)
-			{
-				parse_errors++;
-				break;
-			}
-		}
+		if (archive_finish(fname, destinationfname) < 0)
+			parse_errors++;
 	}
 
 	if (destinationfname != NULL)
@@ -581,157 +770,1434 @@ process_archive(char *fname)
 }
 
 
-static int
-process_exec_sql(char *sql)
+/* ----------
+ * destination_fname
+ *
+ *	Initialize ds with the name of the destination file for archive
+ *	fname. The destination file always contains plain SQL, so a .gz
+ *	suffix of a compressed archive is dropped.
+ * ----------
+ */
+static void
+destination_fname(SlonDString * ds, char *fname)
 {
-	/*
-	 * If we have a database connection, throw the query over to there.
-	 */
-	if (dbconn != NULL)
-	{
-		PGresult   *res;
+	char	   *cp;
+	size_t		len;
 
-		res = PQexec(dbconn, sql);
-		if (PQresultStatus(res) != PGRES_COMMAND_OK &&
-			PQresultStatus(res) != PGRES_TUPLES_OK &&
-			PQresultStatus(res) != PGRES_EMPTY_QUERY)
-		{
-			errlog(LOG_ERROR, "%s: %sQuery was: %s\n",
-				   PQresStatus(PQresultStatus(res)),
-				   PQresultErrorMessage(res), sql);
-			PQclear(res);
+	cp = strrchr(fname, '/');
+	if (cp == NULL)
+		cp = fname;
+	else
+		cp++;
+	len = strlen(cp);
+	if (len > 3 && strcmp(cp + len - 3, ".gz") == 0)
+		len -= 3;
+
+	dstring_init(ds);
+	dstring_append(ds, destination_dir);
+	dstring_addchar(ds, '/');
+	dstring_nappend(ds, cp, len);
+	dstring_terminate(ds);
+}
 
-			return -1;
-		}
 
-		PQclear(res);
+/* ----------
+ * archive_finish
+ *
+ *	Run the post processing commands for an applied archive. If its
+ *	commit was deferred to batch it with the following archives, they
+ *	wait until the batch is committed. Otherwise the commands of the
+ *	archives batched so far run first.
+ * ----------
+ */
+static int
+archive_finish(char *fname, char *destfname)
+{
+	MergedArchive *merged;
+	ProcessingCommand *cmd;
+	int			rc = 0;
+
+	if (merge_open)
+	{
+		merged = (MergedArchive *) malloc(sizeof(MergedArchive));
+		merged->fname = strdup(fname);
+		merged->destfname = (destfname == NULL) ? NULL : strdup(destfname);
+		merged->next = NULL;
+		if (merge_tail == NULL)
+			merge_head = merged;
+		else
+			merge_tail->next = merged;
+		merge_tail = merged;
+
+		return 0;
 	}
 
-	if (destinationfp != NULL)
+	rc = merge_post_processing();
+
+	for (cmd = post_processing_commands; rc == 0 && cmd != NULL;
+		 cmd = cmd->next)
 	{
-		if (fputs(sql, destinationfp) == EOF)
-		{
-			errlog(LOG_ERROR, "%s: %s\n", destinationfname, strerror(errno));
-			return -1;
-		}
-		if (fputc('\n', destinationfp) == EOF)
-		{
-			errlog(LOG_ERROR, "%s: %s\n", destinationfname, strerror(errno));
-			return -1;
-		}
+		if (process_command(cmd->command, fname, destfname) < 0)
+			rc = -1;
 	}
 
-	return 0;
+	return rc;
 }
 
 
-int
-process_check_at_counter(char *at_counter)
+/* ----------
+ * merge_commit
+ *
+ *	Commit the open batch transaction and run the post processing of
+ *	the archives in it.
+ * ----------
+ */
+static int
+merge_commit(void)
 {
-	char		buf1[64];
-	char		buf2[64];
-	size_t		i;
-
-	if (destination_conninfo == NULL)
-		return 0;
+	PGresult   *res;
 
-	if (strlen(at_counter) > 20)
+	res = PQexec(dbconn, "commit;");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
 	{
-		errlog(LOG_ERROR, "at_counter %s too long in process_check_at_counter\n",
-			   at_counter);
+		errlog(LOG_ERROR, "%s: %sQuery was: commit;\n",
+			   PQresStatus(PQresultStatus(res)),
+			   PQresultErrorMessage(res));
+		PQclear(res);
+		merge_abort();
 		return -1;
 	}
+	PQclear(res);
 
-	if (get_current_at_counter() < 0)
-		return -1;
+	merge_open = false;
+	merge_count = 0;
+	merge_bytes = 0;
 
-	for (i = 0; i < (20 - strlen(current_at_counter)); i++)
-		buf1[i] = '0';
-	strcpy(&buf1[i], current_at_counter);
-	for (i = 0; i < (20 - strlen(at_counter)); i++)
-		buf2[i] = '0';
-	strcpy(&buf2[i], at_counter);
+	return merge_post_processing();
+}
 
-	if (strcmp(buf2, buf1) <= 0)
+
+/* ----------
+ * merge_post_processing
+ *
+ *	Run the post processing commands of the archives in a committed
+ *	batch transaction.
+ * ----------
+ */
+static int
+merge_post_processing(void)
+{
+	MergedArchive *merged;
+	ProcessingCommand *cmd;
+	int			rc = 0;
+
+	while ((merged = merge_head) != NULL)
 	{
-		errlog(LOG_WARN, "skip archive with counter %s - already applied\n",
-			   at_counter);
-		if (process_in_transaction)
-			process_end_transaction("rollback;");
-		return 1;
+		merge_head = merged->next;
+		for (cmd = post_processing_commands; rc == 0 && cmd != NULL;
+			 cmd = cmd->next)
+		{
+			if (process_command(cmd->command, merged->fname,
+								merged->destfname) < 0)
+				rc = -1;
+		}
+		free(merged->fname);
+		if (merged->destfname != NULL)
+			free(merged->destfname);
+		free(merged);
 	}
+	merge_tail = NULL;
 
-	return 0;
+	return rc;
 }
 
 
-int
-process_simple_sql(char *sql)
+/* ----------
+ * merge_abort
+ *
+ *	Roll back the open batch transaction, if any, and put the archives
+ *	that were in it back into the queue.
+ * ----------
+ */
+static void
+merge_abort(void)
 {
-	return process_exec_sql(sql);
+	MergedArchive *merged;
+	PGresult   *res;
+
+	if (merge_open && dbconn != NULL &&
+		PQtransactionStatus(dbconn) != PQTRANS_IDLE)
+	{
+		res = PQexec(dbconn, "rollback;");
+		PQclear(res);
+	}
+	merge_open = false;
+	merge_count = 0;
+	merge_bytes = 0;
+
+	while ((merged = merge_head) != NULL)
+	{
+		merge_head = merged->next;
+		ipc_send_path(merged->fname);
+		free(merged->fname);
+		if (merged->destfname != NULL)
+			free(merged->destfname);
+		free(merged);
+	}
+	merge_tail = NULL;
 }
 
 
-int
-process_insert(InsertStmt *stmt)
+/* ----------
+ * pipeline_recording
+ *
+ *	True if the caller is the parser thread, so the process_*()
+ *	functions must record into parse_batch instead of executing.
+ * ----------
+ */
+static bool
+pipeline_recording(void)
 {
-	SlonDString ds;
-	char	   *glue;
-	AttElem    *elem;
-	int			rc;
-	char	   *namespace;
-	char	   *tablename;
+	return (pipeline_started && pthread_equal(pthread_self(), pipeline_thread));
+}
 
-	if (lookup_rename(stmt->namespace, stmt->tablename,
-					  &namespace, &tablename) == 0)
-		return 0;
 
-	dstring_init(&ds);
-	slon_mkquery(&ds, "insert into %s.%s ", namespace, tablename);
-	glue = "(";
-	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+/* ----------
+ * pipeline_recv
+ *
+ *	Replacement for ipc_recv_path() when parsing ahead. Keeps up to
+ *	parse_ahead archives beyond the one to apply next in the hands of
+ *	the parser thread and returns the oldest of them.
+ * ----------
+ */
+static int
+pipeline_recv(char *buf)
+{
+	ArchiveBatch *batch;
+	char		path[MSGMAX];
+	int			rc = 1;
+
+	if (shutdown_immed_requested)
 	{
-		slon_appendquery(&ds, "%s%s", glue, elem->attname);
-		glue = ", ";
+		if (pipeline_ipc_rc != 1)
+			return 0;
+		return ipc_recv_path(buf);
 	}
-	slon_appendquery(&ds, ") values ");
-	glue = "(";
-	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+
+	while (pipeline_count <= parse_ahead)
 	{
-		if (elem->attvalue == NULL)
-			slon_appendquery(&ds, "%sNULL", glue);
+		/*
+		 * Once the queue is gone, only what we hold is left to apply.
+		 */
+		if (pipeline_ipc_rc != 1)
+		{
+			rc = pipeline_ipc_rc;
+			break;
+		}
+		rc = ipc_recv_path(path);
+		if (rc != 1)
+		{
+			if (rc != -2)
+				pipeline_ipc_rc = rc;
+			break;
+		}
+
+		/*
+		 * Start the parser thread on first use. This is after we
+		 * daemonized.
+		 */
+		if (!pipeline_started)
+		{
+			int			err;
+
+			if ((err = pthread_create(&pipeline_thread, NULL,
+									  pipeline_main, NULL)) != 0)
+			{
+				errlog(LOG_ERROR, "pthread_create() failed - %s\n",
+					   strerror(err));
+				ipc_send_path(path);
+				return -1;
+			}
+			pipeline_started = true;
+		}
+
+		batch = (ArchiveBatch *) malloc(sizeof(ArchiveBatch));
+		memset(batch, 0, sizeof(ArchiveBatch));
+		batch->fname = strdup(path);
+		dstring_init(&(batch->messages));
+		dstring_terminate(&(batch->messages));
+
+		pthread_mutex_lock(&pipeline_lock);
+		if (pipeline_tail == NULL)
+			pipeline_head = batch;
 		else
-			slon_appendquery(&ds, "%s'%s'", glue, elem->attvalue);
-		glue = ", ";
+			pipeline_tail->next = batch;
+		pipeline_tail = batch;
+		pipeline_count++;
+		pthread_cond_broadcast(&pipeline_cond);
+		pthread_mutex_unlock(&pipeline_lock);
 	}
-	dstring_addchar(&ds, ')');
-	dstring_addchar(&ds, ';');
-	dstring_terminate(&ds);
 
-	rc = process_exec_sql(dstring_data(&ds));
-	dstring_free(&ds);
+	/*
+	 * An empty queue, an error or the end of the queue only matter once
+	 * everything taken out of it is applied.
+	 */
+	if (pipeline_head == NULL)
+		return rc;
 
-	return rc;
+	strcpy(buf, pipeline_head->fname);
+	return 1;
 }
 
 
-int
-process_update(UpdateStmt *stmt)
+/* ----------
+ * pipeline_apply
+ *
+ *	Counterpart of process_archive() when parsing ahead. Waits for the
+ *	parser thread to finish the oldest archive and applies it.
+ * ----------
+ */
+static int
+pipeline_apply(char *fname)
 {
-	SlonDString ds;
-	char	   *glue;
-	AttElem    *elem;
+	ArchiveBatch *batch;
+	ArchiveOp  *op;
+	int			errors;
 	int			rc;
-	char	   *namespace;
-	char	   *tablename;
 
-	if (lookup_rename(stmt->namespace, stmt->tablename,
-					  &namespace, &tablename) == 0)
-		return 0;
+	pthread_mutex_lock(&pipeline_lock);
+	batch = pipeline_head;
+	while (!batch->done)
+		pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+	pipeline_head = batch->next;
+	if (pipeline_head == NULL)
+		pipeline_tail = NULL;
+	pipeline_count--;
+	pipeline_bytes -= batch->bytes;
+	pthread_cond_broadcast(&pipeline_cond);
+	pthread_mutex_unlock(&pipeline_lock);
 
-	dstring_init(&ds);
-	slon_mkquery(&ds, "update only %s.%s ", namespace, tablename);
-	glue = "set";
+	errlog(LOG_INFO, "Processing archive file %s\n", fname);
+
+	archive_count++;
+	if (archive_count >= max_archives)
+		ipc_set_shutdown_smart();
+
+	/*
+	 * Messages from parsing belong to this archive, the error commands
+	 * want to see them.
+	 */
+	pthread_mutex_lock(&errlog_lock);
+	dstring_append(&errlog_messages, dstring_data(&(batch->messages)));
+	pthread_mutex_unlock(&errlog_lock);
+
+	errors = batch->errors;
+	if (errors != 0)
+	{
+		pipeline_free_batch(batch);
+		return errors;
+	}
+
+	if (batch->destfname != NULL)
+	{
+		destinationfname = batch->destfname;
+		destinationfp = fopen(destinationfname, "w");
+		if (destinationfp == NULL)
+		{
+			errlog(LOG_ERROR, "cannot open %s - %s\n",
+				   destinationfname, strerror(errno));
+			destinationfname = NULL;
+			pipeline_free_batch(batch);
+			return 1;
+		}
+	}
+
+	for (op = batch->ops_head; op != NULL; op = op->next)
+	{
+		rc = pipeline_exec_op(op);
+		if (rc < 0)
+		{
+			errors++;
+			break;
+		}
+		if (rc == 1)
+			break;				/* archive was already applied */
+	}
+
+	if (destinationfname != NULL)
+	{
+		fclose(destinationfp);
+		destinationfp = NULL;
+
+		if (errors != 0)
+			unlink(destinationfname);
+	}
+
+	if (errors == 0)
+	{
+		if (archive_finish(fname, destinationfname) < 0)
+			errors++;
+	}
+
+	destinationfname = NULL;
+	pipeline_free_batch(batch);
+
+	return errors;
+}
+
+
+/* ----------
+ * pipeline_cancel
+ *
+ *	After an archive failed, wait for the parser thread to let go of
+ *	the archives parsed ahead and put them back into the queue.
+ * ----------
+ */
+static void
+pipeline_cancel(void)
+{
+	ArchiveBatch *batch;
+
+	pthread_mutex_lock(&pipeline_lock);
+	for (batch = pipeline_head; batch != NULL; batch = batch->next)
+		batch->cancelled = true;
+	pthread_cond_broadcast(&pipeline_cond);
+	for (batch = pipeline_head; batch != NULL; batch = batch->next)
+	{
+		while (!batch->done)
+			pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+	}
+	while ((batch = pipeline_head) != NULL)
+	{
+		pipeline_head = batch->next;
+		ipc_send_path(batch->fname);
+		pipeline_free_batch(batch);
+	}
+	pipeline_tail = NULL;
+	pipeline_count = 0;
+	pipeline_bytes = 0;
+	pthread_mutex_unlock(&pipeline_lock);
+}
+
+
+/* ----------
+ * pipeline_main
+ *
+ *	The parser thread. Runs the pre processing commands and parses the
+ *	queued archives in order. Every COPY data line of a parsed archive
+ *	is kept in memory until it is applied, so archives beyond the one
+ *	to apply next are only parsed while their files add up to no more
+ *	than parse_ahead_size bytes.
+ * ----------
+ */
+static void *
+pipeline_main(void *dummy)
+{
+	ArchiveBatch *batch;
+	struct stat st;
+
+	pthread_mutex_lock(&pipeline_lock);
+	while (true)
+	{
+		for (batch = pipeline_head; batch != NULL; batch = batch->next)
+		{
+			if (!batch->done)
+				break;
+		}
+		if (batch == NULL)
+		{
+			pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+			continue;
+		}
+
+		if (!batch->cancelled)
+		{
+			pthread_mutex_unlock(&pipeline_lock);
+			if (stat(batch->fname, &st) == 0)
+				batch->bytes = st.st_size;
+			pthread_mutex_lock(&pipeline_lock);
+
+			while (!batch->cancelled && batch != pipeline_head &&
+				   parse_ahead_size > 0 &&
+				   pipeline_bytes + batch->bytes > parse_ahead_size)
+				pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+		}
+		if (!batch->cancelled)
+		{
+			pipeline_bytes += batch->bytes;
+			pthread_mutex_unlock(&pipeline_lock);
+			pipeline_parse(batch);
+			pthread_mutex_lock(&pipeline_lock);
+		}
+		else
+			batch->bytes = 0;
+
+		batch->done = true;
+		pthread_cond_broadcast(&pipeline_cond);
+	}
+
+	return NULL;
+}
+
+
+/* ----------
+ * pipeline_parse
+ *
+ *	Parse one archive into its batch.
+ * ----------
+ */
+static void
+pipeline_parse(ArchiveBatch *batch)
+{
+	SlonDString destfname;
+	ProcessingCommand *cmd;
+	FILE	   *fp;
+
+	parse_batch = batch;
+
+	if (destination_dir != NULL)
+	{
+		destination_fname(&destfname, batch->fname);
+		batch->destfname = dstring_data(&destfname);
+	}
+
+	for (cmd = pre_processing_commands; cmd != NULL; cmd = cmd->next)
+	{
+		if (process_command(cmd->command, batch->fname, batch->destfname) < 0)
+		{
+			batch->errors++;
+			parse_batch = NULL;
+			return;
+		}
+	}
+
+	fp = fopen(batch->fname, "r");
+	if (fp == NULL)
+	{
+		errlog(LOG_ERROR, "cannot open %s - %s\n", batch->fname,
+			   strerror(errno));
+		batch->errors++;
+		parse_batch = NULL;
+		return;
+	}
+
+	scan_new_input_file(fp);
+	current_file = batch->fname;
+	scan_push_string("start_archive;");
+	parse_errors = 0;
+	parse_errors += yyparse();
+	fclose(fp);
+
+	batch->errors += parse_errors;
+	parse_batch = NULL;
+}
+
+
+/* ----------
+ * pipeline_add_op
+ *
+ *	Append a new operation to the batch being parsed.
+ * ----------
+ */
+static ArchiveOp *
+pipeline_add_op(ArchiveOpType type)
+{
+	ArchiveOp  *op;
+
+	op = (ArchiveOp *) malloc(sizeof(ArchiveOp));
+	memset(op, 0, sizeof(ArchiveOp));
+	op->type = type;
+
+	if (parse_batch->ops_tail == NULL)
+		parse_batch->ops_head = op;
+	else
+		parse_batch->ops_tail->next = op;
+	parse_batch->ops_tail = op;
+
+	return op;
+}
+
+
+/* ----------
+ * pipeline_exec_op
+ *
+ *	Apply one recorded operation. Returns -1 on error and 1 if the
+ *	archive turned out to be applied already.
+ * ----------
+ */
+static int
+pipeline_exec_op(ArchiveOp *op)
+{
+	switch (op->type)
+	{
+		case ARCH_OP_SIMPLE_SQL:
+			return process_simple_sql(op->sql);
+
+		case ARCH_OP_START_TRANSACTION:
+			return process_start_transaction(op->sql);
+
+		case ARCH_OP_END_TRANSACTION:
+			return process_end_transaction(op->sql);
+
+		case ARCH_OP_CLEANUP_TRANSACTION:
+			process_cleanup_transaction();
+			return 0;
+
+		case ARCH_OP_CHECK_AT_COUNTER:
+			return process_check_at_counter(op->sql);
+
+		case ARCH_OP_INSERT:
+			{
+				InsertStmt	stmt;
+
+				stmt.namespace = op->namespace;
+				stmt.tablename = op->tablename;
+				stmt.attributes = op->list1;
+				return process_insert(&stmt);
+			}
+
+		case ARCH_OP_UPDATE:
+			{
+				UpdateStmt	stmt;
+
+				stmt.namespace = op->namespace;
+				stmt.tablename = op->tablename;
+				stmt.changes = op->list1;
+				stmt.qualification = op->list2;
+				return process_update(&stmt);
+			}
+
+		case ARCH_OP_DELETE:
+			{
+				DeleteStmt	stmt;
+
+				stmt.namespace = op->namespace;
+				stmt.tablename = op->tablename;
+				stmt.only = op->only;
+				stmt.qualification = op->list2;
+				return process_delete(&stmt);
+			}
+
+		case ARCH_OP_TRUNCATE:
+			{
+				TruncateStmt stmt;
+
+				stmt.namespace = op->namespace;
+				stmt.tablename = op->tablename;
+				return process_truncate(&stmt);
+			}
+
+		case ARCH_OP_COPY:
+			{
+				CopyStmt	stmt;
+
+				stmt.namespace = op->namespace;
+				stmt.tablename = op->tablename;
+				stmt.attributes = op->list1;
+				stmt.from = op->from;
+				return process_copy_int(&stmt);
+			}
+
+		case ARCH_OP_COPYDATA:
+			return process_copydata(op->sql);
+
+		case ARCH_OP_COPYEND:
+			return process_copyend();
+	}
+
+	return -1;
+}
+
+
+static void
+pipeline_free_batch(ArchiveBatch *batch)
+{
+	ArchiveOp  *op;
+
+	while ((op = batch->ops_head) != NULL)
+	{
+		batch->ops_head = op->next;
+		if (op->sql != NULL)
+			free(op->sql);
+		if (op->namespace != NULL)
+			free(op->namespace);
+		if (op->tablename != NULL)
+			free(op->tablename);
+		if (op->from != NULL)
+			free(op->from);
+		attlist_free(op->list1);
+		attlist_free(op->list2);
+		free(op);
+	}
+	free(batch->fname);
+	if (batch->destfname != NULL)
+		free(batch->destfname);
+	dstring_free(&(batch->messages));
+	free(batch);
+}
+
+
+static AttElemList *
+attlist_copy(AttElemList *list)
+{
+	AttElemList *new;
+	AttElem    *elem;
+	AttElem    *nelem;
+
+	if (list == NULL)
+		return NULL;
+
+	new = (AttElemList *) malloc(sizeof(AttElemList));
+	new->list_head = NULL;
+	new->list_tail = NULL;
+	for (elem = list->list_head; elem != NULL; elem = elem->next)
+	{
+		nelem = (AttElem *) malloc(sizeof(AttElem));
+		nelem->attname = (elem->attname == NULL) ? NULL : strdup(elem->attname);
+		nelem->attvalue = (elem->attvalue == NULL) ? NULL : strdup(elem->attvalue);
+		nelem->next = NULL;
+		if (new->list_tail == NULL)
+			new->list_head = nelem;
+		else
+			new->list_tail->next = nelem;
+		new->list_tail = nelem;
+	}
+
+	return new;
+}
+
+
+static void
+attlist_free(AttElemList *list)
+{
+	AttElem    *elem;
+
+	if (list == NULL)
+		return;
+
+	while ((elem = list->list_head) != NULL)
+	{
+		list->list_head = elem->next;
+		if (elem->attname != NULL)
+			free(elem->attname);
+		if (elem->attvalue != NULL)
+			free(elem->attvalue);
+		free(elem);
+	}
+	free(list);
+}
+
+
+static int
+process_exec_sql(char *sql)
+{
+	int			rc = 0;
+
+	/*
+	 * Anything held back for the insert COPY must go first. Run the
+	 * query even if that failed, so a rollback still gets through and a
+	 * commit fails.
+	 */
+	if (process_flush_inserts() < 0)
+		rc = -1;
+
+	/*
+	 * If we have a database connection, throw the query over to there.
+	 */
+	if (dbconn != NULL)
+	{
+		PGresult   *res;
+
+		res = PQexec(dbconn, sql);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+			PQresultStatus(res) != PGRES_TUPLES_OK &&
+			PQresultStatus(res) != PGRES_EMPTY_QUERY)
+		{
+			errlog(LOG_ERROR, "%s: %sQuery was: %s\n",
+				   PQresStatus(PQresultStatus(res)),
+				   PQresultErrorMessage(res), sql);
+			PQclear(res);
+
+			return -1;
+		}
+
+		PQclear(res);
+	}
+
+	if (process_write_dest(sql) < 0)
+		return -1;
+
+	return rc;
+}
+
+
+/* ----------
+ * process_write_dest
+ *
+ *	Write one statement to the destination archive, if there is one.
+ * ----------
+ */
+static int
+process_write_dest(char *sql)
+{
+	if (destinationfp != NULL)
+	{
+		if (fputs(sql, destinationfp) == EOF)
+		{
+			errlog(LOG_ERROR, "%s: %s\n", destinationfname, strerror(errno));
+			return -1;
+		}
+		if (fputc('\n', destinationfp) == EOF)
+		{
+			errlog(LOG_ERROR, "%s: %s\n", destinationfname, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* ----------
+ * process_exec_prepared
+ *
+ *	Execute a parameterized insert, update or delete through the
+ *	prepared statement cache, preparing it on first use.
+ * ----------
+ */
+static int
+process_exec_prepared(char *query, int nparams, char **values)
+{
+	stmt_cache_entry *ent;
+	PGresult   *res;
+
+	if ((ent = stmt_cache_lookup(query)) == NULL)
+		return -1;
+
+	res = PQexecPrepared(dbconn, ent->stmtname, nparams,
+						 (const char *const *) values, NULL, NULL, 0);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		errlog(LOG_ERROR, "%s: %sQuery was: %s\n",
+			   PQresStatus(PQresultStatus(res)),
+			   PQresultErrorMessage(res), query);
+		PQclear(res);
+		return -1;
+	}
+	PQclear(res);
+
+	return 0;
+}
+
+
+/* ----------
+ * stmt_cache_lookup
+ *
+ *	Find the prepared statement for a query, or prepare it. The least
+ *	recently used statement is deallocated once the cache is full.
+ * ----------
+ */
+static stmt_cache_entry *
+stmt_cache_lookup(char *query)
+{
+	stmt_cache_entry *ent;
+	stmt_cache_entry **entp;
+	unsigned int hash = 0;
+	char	   *cp;
+	PGresult   *res;
+
+	for (cp = query; *cp != '\0'; cp++)
+		hash = hash * 31 + (unsigned char) *cp;
+
+	for (ent = stmt_cache_hash[hash % STMT_CACHE_BUCKETS]; ent != NULL;
+		 ent = ent->hash_next)
+	{
+		if (ent->hash == hash && strcmp(ent->query, query) == 0)
+		{
+			stmt_cache_unlink(ent);
+			stmt_cache_push(ent);
+			return ent;
+		}
+	}
+
+	if (stmt_cache_num >= STMT_CACHE_SIZE)
+	{
+		char		buf[64];
+
+		ent = stmt_cache_lru_tail;
+		snprintf(buf, sizeof(buf), "deallocate %s;", ent->stmtname);
+		res = PQexec(dbconn, buf);
+		PQclear(res);
+
+		for (entp = &stmt_cache_hash[ent->hash % STMT_CACHE_BUCKETS];
+			 *entp != ent; entp = &((*entp)->hash_next))
+			;
+		*entp = ent->hash_next;
+		stmt_cache_unlink(ent);
+		free(ent->query);
+		free(ent);
+		stmt_cache_num--;
+	}
+
+	ent = (stmt_cache_entry *) malloc(sizeof(stmt_cache_entry));
+	if (ent == NULL || (ent->query = strdup(query)) == NULL)
+	{
+		errlog(LOG_ERROR, "out of memory\n");
+		if (ent != NULL)
+			free(ent);
+		return NULL;
+	}
+	ent->hash = hash;
+	snprintf(ent->stmtname, sizeof(ent->stmtname), "slony_ls_%d",
+			 ++stmt_cache_seq);
+
+	res = PQprepare(dbconn, ent->stmtname, query, 0, NULL);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		errlog(LOG_ERROR, "%s: %sQuery was: %s\n",
+			   PQresStatus(PQresultStatus(res)),
+			   PQresultErrorMessage(res), query);
+		PQclear(res);
+		free(ent->query);
+		free(ent);
+		return NULL;
+	}
+	PQclear(res);
+
+	ent->hash_next = stmt_cache_hash[hash % STMT_CACHE_BUCKETS];
+	stmt_cache_hash[hash % STMT_CACHE_BUCKETS] = ent;
+	stmt_cache_push(ent);
+	stmt_cache_num++;
+
+	return ent;
+}
+
+
+static void
+stmt_cache_unlink(stmt_cache_entry * ent)
+{
+	if (ent->lru_prev == NULL)
+		stmt_cache_lru_head = ent->lru_next;
+	else
+		ent->lru_prev->lru_next = ent->lru_next;
+	if (ent->lru_next == NULL)
+		stmt_cache_lru_tail = ent->lru_prev;
+	else
+		ent->lru_next->lru_prev = ent->lru_prev;
+}
+
+
+static void
+stmt_cache_push(stmt_cache_entry * ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = stmt_cache_lru_head;
+	if (stmt_cache_lru_head == NULL)
+		stmt_cache_lru_tail = ent;
+	else
+		stmt_cache_lru_head->lru_prev = ent;
+	stmt_cache_lru_head = ent;
+}
+
+
+/* ----------
+ * stmt_cache_reset
+ *
+ *	Forget all cached statements. Only used when a new connection is
+ *	made, the statements died with the old one.
+ * ----------
+ */
+static void
+stmt_cache_reset(void)
+{
+	stmt_cache_entry *ent;
+
+	while ((ent = stmt_cache_lru_head) != NULL)
+	{
+		stmt_cache_unlink(ent);
+		free(ent->query);
+		free(ent);
+	}
+	memset(stmt_cache_hash, 0, sizeof(stmt_cache_hash));
+	stmt_cache_num = 0;
+}
+
+
+/* ----------
+ * process_flush_inserts
+ *
+ *	Apply the inserts held back for a COPY, either by finishing the
+ *	COPY or, for a single row, with the prepared insert.
+ * ----------
+ */
+static int
+process_flush_inserts(void)
+{
+	int			rc = 0;
+
+	if (insert_pending_query == NULL)
+		return 0;
+
+	if (insert_copy_active)
+	{
+		PGresult   *res;
+
+		if (PQputCopyEnd(dbconn, NULL) != 1)
+		{
+			errlog(LOG_ERROR, "%s", PQerrorMessage(dbconn));
+			rc = -1;
+		}
+		while ((res = PQgetResult(dbconn)) != NULL)
+		{
+			if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			{
+				errlog(LOG_ERROR, "%s: %sQuery was: %s\n",
+					   PQresStatus(PQresultStatus(res)),
+					   PQresultErrorMessage(res),
+					   dstring_data(&insert_pending_copy));
+				rc = -1;
+			}
+			PQclear(res);
+		}
+		insert_copy_active = false;
+	}
+	else
+		rc = process_exec_prepared(insert_pending_query,
+								   insert_pending_nvalues,
+								   insert_pending_values);
+
+	insert_pending_clear();
+
+	return rc;
+}
+
+
+static void
+insert_pending_clear(void)
+{
+	free(insert_pending_query);
+	insert_pending_query = NULL;
+	dstring_free(&insert_pending_copy);
+	dstring_free(&insert_pending_data);
+	free_values(insert_pending_values, insert_pending_nvalues);
+	insert_pending_values = NULL;
+	insert_pending_nvalues = 0;
+	insert_copy_active = false;
+}
+
+
+/* ----------
+ * value_unquote
+ *
+ *	Turn the content of a quoted literal, as delivered by the scanner,
+ *	into the value the server would have made of it. The scanner
+ *	leaves quotes doubled and backslashes doubled, the latter only
+ *	mean a single backslash without standard_conforming_strings.
+ * ----------
+ */
+static void
+value_unquote(SlonDString * ds, char *literal)
+{
+	const char *scs;
+	bool		backslash_quote;
+	char	   *cp;
+
+	scs = PQparameterStatus(dbconn, "standard_conforming_strings");
+	backslash_quote = (scs == NULL || strcmp(scs, "on") != 0);
+
+	dstring_reset(ds);
+	for (cp = literal; *cp != '\0'; cp++)
+	{
+		if ((*cp == '\'' || (*cp == '\\' && backslash_quote)) &&
+			cp[1] == *cp)
+			cp++;
+		dstring_addchar(ds, *cp);
+	}
+	dstring_terminate(ds);
+}
+
+
+/* ----------
+ * value_copy_escape
+ *
+ *	Append a value in COPY text format.
+ * ----------
+ */
+static void
+value_copy_escape(SlonDString * ds, char *value)
+{
+	char	   *cp;
+
+	if (value == NULL)
+	{
+		dstring_append(ds, "\\N");
+		return;
+	}
+	for (cp = value; *cp != '\0'; cp++)
+	{
+		switch (*cp)
+		{
+			case '\\':
+				dstring_append(ds, "\\\\");
+				break;
+			case '\n':
+				dstring_append(ds, "\\n");
+				break;
+			case '\r':
+				dstring_append(ds, "\\r");
+				break;
+			case '\t':
+				dstring_append(ds, "\\t");
+				break;
+			default:
+				dstring_addchar(ds, *cp);
+				break;
+		}
+	}
+}
+
+
+static void
+free_values(char **values, int nvalues)
+{
+	int			i;
+
+	if (values == NULL)
+		return;
+	for (i = 0; i < nvalues; i++)
+	{
+		if (values[i] != NULL)
+			free(values[i]);
+	}
+	free(values);
+}
+
+
+int
+process_check_at_counter(char *at_counter)
+{
+	char		buf1[64];
+	char		buf2[64];
+	size_t		i;
+
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_CHECK_AT_COUNTER)->sql = strdup(at_counter);
+		return 0;
+	}
+
+	if (destination_conninfo == NULL)
+		return 0;
+
+	if (strlen(at_counter) > 20)
+	{
+		errlog(LOG_ERROR, "at_counter %s too long in process_check_at_counter\n",
+			   at_counter);
+		return -1;
+	}
+
+	if (process_flush_inserts() < 0)
+		return -1;
+	if (get_current_at_counter() < 0)
+		return -1;
+
+	for (i = 0; i < (20 - strlen(current_at_counter)); i++)
+		buf1[i] = '0';
+	strcpy(&buf1[i], current_at_counter);
+	for (i = 0; i < (20 - strlen(at_counter)); i++)
+		buf2[i] = '0';
+	strcpy(&buf2[i], at_counter);
+
+	if (strcmp(buf2, buf1) <= 0)
+	{
+		errlog(LOG_WARN, "skip archive with counter %s - already applied\n",
+			   at_counter);
+
+		/*
+		 * Nothing of this archive was applied yet, so inside an open
+		 * batch transaction there is nothing to roll back.
+		 */
+		if (merge_open)
+		{
+			process_in_transaction = false;
+			process_write_dest("rollback;");
+		}
+		else if (process_in_transaction)
+			process_end_transaction("rollback;");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int
+process_simple_sql(char *sql)
+{
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_SIMPLE_SQL)->sql = strdup(sql);
+		return 0;
+	}
+
+	return process_exec_sql(sql);
+}
+
+
+int
+process_insert(InsertStmt *stmt)
+{
+	SlonDString ds;
+	char	   *glue;
+	AttElem    *elem;
+	int			rc;
+	char	   *namespace;
+	char	   *tablename;
+
+	if (pipeline_recording())
+	{
+		ArchiveOp  *op = pipeline_add_op(ARCH_OP_INSERT);
+
+		op->namespace = strdup(stmt->namespace);
+		op->tablename = strdup(stmt->tablename);
+		op->list1 = attlist_copy(stmt->attributes);
+		return 0;
+	}
+
+	if (lookup_rename(stmt->namespace, stmt->tablename,
+					  &namespace, &tablename) == 0)
+		return 0;
+
+	if (dbconn != NULL)
+	{
+		if (process_insert_db(stmt, namespace, tablename) < 0)
+			return -1;
+	}
+
+	if (destinationfp == NULL)
+		return 0;
+
+	dstring_init(&ds);
+	slon_mkquery(&ds, "insert into %s.%s ", namespace, tablename);
+	glue = "(";
+	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+	{
+		slon_appendquery(&ds, "%s%s", glue, elem->attname);
+		glue = ", ";
+	}
+	slon_appendquery(&ds, ") values ");
+	glue = "(";
+	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+	{
+		if (elem->attvalue == NULL)
+			slon_appendquery(&ds, "%sNULL", glue);
+		else
+			slon_appendquery(&ds, "%s'%s'", glue, elem->attvalue);
+		glue = ", ";
+	}
+	dstring_addchar(&ds, ')');
+	dstring_addchar(&ds, ';');
+	dstring_terminate(&ds);
+
+	rc = process_write_dest(dstring_data(&ds));
+	dstring_free(&ds);
+
+	return rc;
+}
+
+
+/* ----------
+ * process_insert_db
+ *
+ *	Apply an insert to the destination database. Runs of inserts with
+ *	the same column list are collected into a COPY, see
+ *	process_flush_inserts().
+ * ----------
+ */
+static int
+process_insert_db(InsertStmt *stmt, char *namespace, char *tablename)
+{
+	SlonDString query;
+	SlonDString scratch;
+	char	   *glue;
+	AttElem    *elem;
+	char	  **values;
+	int			nvalues = 0;
+	int			rc = 0;
+
+	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+		nvalues++;
+	values = (char **) malloc(sizeof(char *) * (nvalues + 1));
+	nvalues = 0;
+
+	dstring_init(&query);
+	dstring_init(&scratch);
+	slon_mkquery(&query, "insert into %s.%s ", namespace, tablename);
+	glue = "(";
+	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+	{
+		slon_appendquery(&query, "%s%s", glue, elem->attname);
+		glue = ", ";
+	}
+	slon_appendquery(&query, ") values ");
+	glue = "(";
+	for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+	{
+		add_param(&query, &scratch, glue, values, &nvalues, elem->attvalue);
+		glue = ", ";
+	}
+	slon_appendquery(&query, ");");
+
+#ifdef HAVE_PQPUTCOPYDATA
+	if (insert_pending_query != NULL &&
+		strcmp(insert_pending_query, dstring_data(&query)) != 0)
+		rc = process_flush_inserts();
+
+	if (rc < 0)
+	{
+		/* the transaction is aborted, nothing more to do here */
+	}
+	else if (insert_pending_query == NULL)
+	{
+		/*
+		 * Hold the row back until we know if more for the same table
+		 * follow.
+		 */
+		insert_pending_query = strdup(dstring_data(&query));
+		insert_pending_values = values;
+		insert_pending_nvalues = nvalues;
+		values = NULL;
+
+		dstring_init(&insert_pending_copy);
+		slon_mkquery(&insert_pending_copy, "copy %s.%s ", namespace, tablename);
+		glue = "(";
+		for (elem = stmt->attributes->list_head; elem != NULL; elem = elem->next)
+		{
+			slon_appendquery(&insert_pending_copy, "%s%s", glue, elem->attname);
+			glue = ", ";
+		}
+		slon_appendquery(&insert_pending_copy, ") from stdin;");
+		dstring_init(&insert_pending_data);
+		copy_row(&insert_pending_data, insert_pending_values,
+				 insert_pending_nvalues);
+	}
+	else
+	{
+		if (!insert_copy_active)
+		{
+			PGresult   *res;
+
+			res = PQexec(dbconn, dstring_data(&insert_pending_copy));
+			if (PQresultStatus(res) != PGRES_COPY_IN)
+			{
+				errlog(LOG_ERROR, "%s: %sQuery was: %s\n",
+					   PQresStatus(PQresultStatus(res)),
+					   PQresultErrorMessage(res),
+					   dstring_data(&insert_pending_copy));
+				rc = -1;
+			}
+			else
+				insert_copy_active = true;
+			PQclear(res);
+		}
+
+		if (rc == 0)
+		{
+			copy_row(&insert_pending_data, values, nvalues);
+			if (PQputCopyData(dbconn, dstring_data(&insert_pending_data),
+							  strlen(dstring_data(&insert_pending_data))) != 1)
+			{
+				errlog(LOG_ERROR, "%s", PQerrorMessage(dbconn));
+				rc = -1;
+			}
+			dstring_reset(&insert_pending_data);
+			dstring_terminate(&insert_pending_data);
+		}
+		else
+			insert_pending_clear();
+	}
+#else
+	rc = process_exec_prepared(dstring_data(&query), nvalues, values);
+#endif
+
+	free_values(values, nvalues);
+	dstring_free(&scratch);
+	dstring_free(&query);
+
+	return rc;
+}
+
+
+int
+process_update(UpdateStmt *stmt)
+{
+	SlonDString ds;
+	char	   *glue;
+	AttElem    *elem;
+	int			rc;
+	char	   *namespace;
+	char	   *tablename;
+
+	if (pipeline_recording())
+	{
+		ArchiveOp  *op = pipeline_add_op(ARCH_OP_UPDATE);
+
+		op->namespace = strdup(stmt->namespace);
+		op->tablename = strdup(stmt->tablename);
+		op->list1 = attlist_copy(stmt->changes);
+		op->list2 = attlist_copy(stmt->qualification);
+		return 0;
+	}
+
+	if (lookup_rename(stmt->namespace, stmt->tablename,
+					  &namespace, &tablename) == 0)
+		return 0;
+
+	if (process_flush_inserts() < 0)
+		return -1;
+
+	if (dbconn != NULL)
+	{
+		SlonDString scratch;
+		char	  **values;
+		int			nvalues = 0;
+
+		for (elem = stmt->changes->list_head; elem != NULL; elem = elem->next)
+			nvalues++;
+		for (elem = stmt->qualification->list_head; elem != NULL; elem = elem->next)
+			nvalues++;
+		values = (char **) malloc(sizeof(char *) * (nvalues + 1));
+		nvalues = 0;
+
+		dstring_init(&ds);
+		dstring_init(&scratch);
+		slon_mkquery(&ds, "update only %s.%s ", namespace, tablename);
+		glue = "set ";
+		for (elem = stmt->changes->list_head; elem != NULL; elem = elem->next)
+		{
+			slon_appendquery(&ds, "%s%s=", glue, elem->attname);
+			add_param(&ds, &scratch, "", values, &nvalues, elem->attvalue);
+			glue = ", ";
+		}
+		add_qualification(&ds, &scratch, stmt->qualification,
+						  values, &nvalues);
+		dstring_addchar(&ds, ';');
+		dstring_terminate(&ds);
+
+		rc = process_exec_prepared(dstring_data(&ds), nvalues, values);
+		free_values(values, nvalues);
+		dstring_free(&scratch);
+		dstring_free(&ds);
+		if (rc < 0)
+			return -1;
+	}
+
+	if (destinationfp == NULL)
+		return 0;
+
+	dstring_init(&ds);
+	slon_mkquery(&ds, "update only %s.%s ", namespace, tablename);
+	glue = "set";
 	for (elem = stmt->changes->list_head; elem != NULL; elem = elem->next)
 	{
 		if (elem->attvalue == NULL)
@@ -756,7 +2222,7 @@ process_update(UpdateStmt *stmt)
 	dstring_addchar(&ds, ';');
 	dstring_terminate(&ds);
 
-	rc = process_exec_sql(dstring_data(&ds));
+	rc = process_write_dest(dstring_data(&ds));
 	dstring_free(&ds);
 
 	return rc;
@@ -773,10 +2239,59 @@ process_delete(DeleteStmt *stmt)
 	char	   *namespace;
 	char	   *tablename;
 
+	if (pipeline_recording())
+	{
+		ArchiveOp  *op = pipeline_add_op(ARCH_OP_DELETE);
+
+		op->namespace = strdup(stmt->namespace);
+		op->tablename = strdup(stmt->tablename);
+		op->only = stmt->only;
+		op->list2 = attlist_copy(stmt->qualification);
+		return 0;
+	}
+
 	if (lookup_rename(stmt->namespace, stmt->tablename,
 					  &namespace, &tablename) == 0)
 		return 0;
 
+	if (process_flush_inserts() < 0)
+		return -1;
+
+	if (dbconn != NULL)
+	{
+		SlonDString scratch;
+		char	  **values;
+		int			nvalues = 0;
+
+		if (stmt->qualification != NULL)
+		{
+			for (elem = stmt->qualification->list_head; elem != NULL; elem = elem->next)
+				nvalues++;
+		}
+		values = (char **) malloc(sizeof(char *) * (nvalues + 1));
+		nvalues = 0;
+
+		dstring_init(&ds);
+		dstring_init(&scratch);
+		slon_mkquery(&ds, "delete from %s%s.%s",
+					 (stmt->only) ? "only " : "", namespace, tablename);
+		if (stmt->qualification != NULL)
+			add_qualification(&ds, &scratch, stmt->qualification,
+							  values, &nvalues);
+		dstring_addchar(&ds, ';');
+		dstring_terminate(&ds);
+
+		rc = process_exec_prepared(dstring_data(&ds), nvalues, values);
+		free_values(values, nvalues);
+		dstring_free(&scratch);
+		dstring_free(&ds);
+		if (rc < 0)
+			return -1;
+	}
+
+	if (destinationfp == NULL)
+		return 0;
+
 	dstring_init(&ds);
 	slon_mkquery(&ds, "delete from %s%s.%s",
 				 (stmt->only) ? "only " : "", namespace, tablename);
@@ -794,13 +2309,86 @@ process_delete(DeleteStmt *stmt)
 			glue = " and";
 		}
 	}
-	dstring_addchar(&ds, ';');
-	dstring_terminate(&ds);
+	dstring_addchar(&ds, ';');
+	dstring_terminate(&ds);
+
+	rc = process_write_dest(dstring_data(&ds));
+	dstring_free(&ds);
+
+	return rc;
+}
+
+
+/* ----------
+ * add_param
+ *
+ *	Append the next $n placeholder to a parameterized query and
+ *	remember the unquoted value for it. NULL stays a NULL parameter.
+ * ----------
+ */
+static void
+add_param(SlonDString * query, SlonDString * scratch, char *glue,
+		  char **values, int *nvalues, char *literal)
+{
+	if (literal == NULL)
+		values[*nvalues] = NULL;
+	else
+	{
+		value_unquote(scratch, literal);
+		values[*nvalues] = strdup(dstring_data(scratch));
+	}
+	(*nvalues)++;
+	slon_appendquery(query, "%s$%d", glue, *nvalues);
+}
+
+
+/* ----------
+ * add_qualification
+ *
+ *	Append the where clause of a parameterized update or delete. NULL
+ *	key values become IS NULL, so they are part of the query text.
+ * ----------
+ */
+static void
+add_qualification(SlonDString * query, SlonDString * scratch,
+				  AttElemList *qual, char **values, int *nvalues)
+{
+	char	   *glue = " where";
+	AttElem    *elem;
+
+	for (elem = qual->list_head; elem != NULL; elem = elem->next)
+	{
+		if (elem->attvalue == NULL)
+			slon_appendquery(query, "%s %s IS NULL", glue, elem->attname);
+		else
+		{
+			slon_appendquery(query, "%s %s=", glue, elem->attname);
+			add_param(query, scratch, "", values, nvalues, elem->attvalue);
+		}
+		glue = " and";
+	}
+}
 
-	rc = process_exec_sql(dstring_data(&ds));
-	dstring_free(&ds);
 
-	return rc;
+/* ----------
+ * copy_row
+ *
+ *	Append one row in COPY text format.
+ * ----------
+ */
+static void
+copy_row(SlonDString * ds, char **values, int nvalues)
+{
+	int			i;
+
+	for (i = 0; i < nvalues; i++)
+	{
+		if (i > 0)
+			dstring_addchar(ds, '\t');
+		value_copy_escape(ds, values[i]);
+	}
+	dstring_addchar(ds, '\n');
+	dstring_terminate(ds);
 }
 
 
@@ -812,6 +2400,15 @@ process_truncate(TruncateStmt *stmt)
 	char	   *namespace;
 	char	   *tablename;
 
+	if (pipeline_recording())
+	{
+		ArchiveOp  *op = pipeline_add_op(ARCH_OP_TRUNCATE);
+
+		op->namespace = strdup(stmt->namespace);
+		op->tablename = strdup(stmt->tablename);
+		return 0;
+	}
+
 	if (lookup_rename(stmt->namespace, stmt->tablename,
 					  &namespace, &tablename) == 0)
 		return 0;
@@ -829,6 +2426,33 @@ process_truncate(TruncateStmt *stmt)
 
 int
 process_copy(CopyStmt *stmt)
+{
+	if (pipeline_recording())
+	{
+		ArchiveOp  *op = pipeline_add_op(ARCH_OP_COPY);
+
+		op->namespace = strdup(stmt->namespace);
+		op->tablename = strdup(stmt->tablename);
+		op->list1 = attlist_copy(stmt->attributes);
+		op->from = strdup(stmt->from);
+	}
+	else if (process_copy_int(stmt) < 0)
+		return -1;
+
+	scan_copy_start();
+
+	return 0;
+}
+
+
+/* ----------
+ * process_copy_int
+ *
+ *	Start a COPY on the destination, without touching the scanner.
+ * ----------
+ */
+static int
+process_copy_int(CopyStmt *stmt)
 {
 	SlonDString ds;
 	char	   *glue;
@@ -841,11 +2465,13 @@ process_copy(CopyStmt *stmt)
 					  &namespace, &tablename) == 0)
 	{
 		suppress_copy = true;
-		scan_copy_start();
 		return 0;
 	}
 	suppress_copy = false;
 
+	if (process_flush_inserts() < 0)
+		return -1;
+
 	dstring_init(&ds);
 	slon_mkquery(&ds, "copy %s.%s ", namespace, tablename);
 	glue = "(";
@@ -887,8 +2513,6 @@ process_copy(CopyStmt *stmt)
 
 	dstring_free(&ds);
 
-	scan_copy_start();
-
 	return 0;
 }
 
@@ -898,6 +2522,12 @@ process_copydata(char *line)
 {
 	PGresult   *res;
 
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_COPYDATA)->sql = strdup(line);
+		return 0;
+	}
+
 	if (suppress_copy)
 		return 0;
 
@@ -939,6 +2569,12 @@ process_copydata(char *line)
 int
 process_copyend(void)
 {
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_COPYEND);
+		return 0;
+	}
+
 	if (suppress_copy)
 		return 0;
 
@@ -993,6 +2629,12 @@ process_copyend(void)
 int
 process_start_transaction(char *sql)
 {
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_START_TRANSACTION)->sql = strdup(sql);
+		return 0;
+	}
+
 	if (process_in_transaction)
 	{
 		errlog(LOG_ERROR, "already inside a transaction\n");
@@ -1000,6 +2642,12 @@ process_start_transaction(char *sql)
 	}
 	process_in_transaction = true;
 
+	/*
+	 * The previous archive left its transaction open for us.
+	 */
+	if (merge_open)
+		return process_write_dest(sql);
+
 	return process_exec_sql(sql);
 }
 
@@ -1007,6 +2655,12 @@ process_start_transaction(char *sql)
 int
 process_end_transaction(char *sql)
 {
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_END_TRANSACTION)->sql = strdup(sql);
+		return 0;
+	}
+
 	if (!process_in_transaction)
 	{
 		errlog(LOG_ERROR, "not inside a transaction\n");
@@ -1014,7 +2668,77 @@ process_end_transaction(char *sql)
 	}
 	process_in_transaction = false;
 
-	return process_exec_sql(sql);
+	/*
+	 * With batch archives, the commit of an archive is deferred so the
+	 * next ones can go into the same transaction, until the count or
+	 * size limit is reached. The at_counter update of each archive is
+	 * part of the transaction, so a crash loses the whole batch and the
+	 * counter still matches what was applied.
+	 */
+	if (batch_archives > 1 && dbconn != NULL &&
+		current_archive_path != NULL && strcmp(sql, "commit;") == 0)
+	{
+		struct stat st;
+
+		if (stat(current_archive_path, &st) == 0)
+			merge_bytes += st.st_size;
+		merge_count++;
+
+		if (merge_count < batch_archives &&
+			(batch_size <= 0 || merge_bytes < batch_size))
+		{
+			if (process_flush_inserts() < 0)
+				return -1;
+			merge_open = true;
+			return process_write_dest(sql);
+		}
+	}
+
+	if (process_exec_sql(sql) < 0)
+		return -1;
+
+	if (strcmp(sql, "commit;") == 0)
+	{
+		merge_open = false;
+		merge_count = 0;
+		merge_bytes = 0;
+	}
+
+	return 0;
+}
+
+
+/* ----------
+ * process_cleanup_transaction
+ *
+ *	Roll back a transaction left open by an archive, if there is one.
+ * ----------
+ */
+int
+process_cleanup_transaction(void)
+{
+	if (pipeline_recording())
+	{
+		pipeline_add_op(ARCH_OP_CLEANUP_TRANSACTION);
+		return 0;
+	}
+
+	/*
+	 * The DDL script carries the commit of its archive. If that went
+	 * through, it took the archives batched before it along.
+	 */
+	if (merge_open && dbconn != NULL &&
+		PQtransactionStatus(dbconn) == PQTRANS_IDLE)
+	{
+		merge_open = false;
+		merge_count = 0;
+		merge_bytes = 0;
+	}
+
+	if (!process_in_transaction)
+		return 0;
+
+	return process_end_transaction("rollback;");
 }
 
 
@@ -1070,6 +2794,8 @@ errlog(log_level level, char *fmt,...)
 		"DEBUG", "INFO", "WARN", "ERROR"
 	};
 
+	pthread_mutex_lock(&errlog_lock);
+
 	if (logfile_switch_requested && logfile_path != NULL)
 	{
 		if (logfile_fp != stdout)
@@ -1097,7 +2823,20 @@ errlog(log_level level, char *fmt,...)
 		fputs(errbuf, logfile_fp);
 		fflush(logfile_fp);
 	}
-	dstring_append(&errlog_messages, errbuf);
+
+	/*
+	 * The parser thread collects its messages with the archive, they
+	 * are added when it gets applied.
+	 */
+	if (pipeline_recording() && parse_batch != NULL)
+	{
+		dstring_append(&(parse_batch->messages), errbuf);
+		dstring_terminate(&(parse_batch->messages));
+	}
+	else
+		dstring_append(&errlog_messages, errbuf);
+
+	pthread_mutex_unlock(&errlog_lock);
 }
 
 
@@ -1260,6 +2999,7 @@ get_current_at_counter(void)
 			return -1;
 		}
 		PQsetNoticeProcessor(dbconn, notice_processor, NULL);
+		stmt_cache_reset();
 	}
 
 	dstring_init(&query);
@@ -1336,6 +3076,30 @@ archscan(int optind, int argc, char **argv)
 			strcat(counter_done_buf, "0");
 		strcat(counter_done_buf, current_at_counter);
 		strcat(counter_done_buf, ".sql");
+
+		/*
+		 * Try to find the archives following the current one through the
+		 * index maintained by slon, before reading the whole directory.
+		 */
+		switch (archscan_index(counter_done_buf, optind, argc, argv))
+		{
+			case 1:
+				if (archscan_sort_out() < 0)
+				{
+					PQfinish(dbconn);
+					ipc_finish(true);
+					return -1;
+				}
+				return 0;
+
+			case 0:
+				break;
+
+			default:
+				PQfinish(dbconn);
+				ipc_finish(true);
+				return -1;
+		}
 	}
 	else
 	{
@@ -1356,20 +3120,30 @@ archscan(int optind, int argc, char **argv)
 	}
 	while ((dp = readdir(dirp)) != NULL)
 	{
-		if (strlen(dp->d_name) > 24 &&
-			strcmp(dp->d_name + strlen(dp->d_name) - 24,
-				   counter_done_buf) <= 0)
+		size_t		namelen = strlen(dp->d_name);
+
+		/*
+		 * Compressed archives are named like the plain ones with a .gz
+		 * suffix appended. Look at the name without it.
+		 */
+		if (namelen > 18 &&
+			strcmp(dp->d_name + namelen - 7, ".sql.gz") == 0)
+			namelen -= 3;
+
+		if (namelen > 24 &&
+			strncmp(dp->d_name + namelen - 24,
+					counter_done_buf, 24) <= 0)
 		{
 			continue;
 		}
 
-		if (strlen(dp->d_name) > 15 &&
+		if (namelen > 15 &&
 			strncmp(dp->d_name, "slony1_log_", 11) == 0 &&
-			strcmp(dp->d_name + strlen(dp->d_name) - 4, ".sql") == 0)
+			strncmp(dp->d_name + namelen - 4, ".sql", 4) == 0)
 		{
-			if (archscan_sort_in(&archscan_sort, dp->d_name, optind,
-								 argc, argv) < 0)
+			if (archscan_add(dp->d_name, optind, argc, argv) < 0)
 			{
+				closedir(dirp);
 				PQfinish(dbconn);
 				ipc_finish(true);
 				return -1;
@@ -1378,7 +3152,7 @@ archscan(int optind, int argc, char **argv)
 	}
 	closedir(dirp);
 
-	if (archscan_sort_out(archscan_sort) < 0)
+	if (archscan_sort_out() < 0)
 	{
 		PQfinish(dbconn);
 		ipc_finish(true);
@@ -1389,12 +3163,220 @@ archscan(int optind, int argc, char **argv)
 }
 
 
+/* ----------
+ * archscan_index
+ *
+ *	Collect the archives following counter_done from the archive index.
+ *	The index has a line for every archive counter, naming the file that
+ *	contains it. An archive spanning several SYNC groups is named after
+ *	the first of them. A binary search over the file offset finds the
+ *	first line needed, so only the tail of a long index is read.
+ *	Returns 1 if the index could
+ *	be used, 0 if the directory has to be scanned instead because the
+ *	index is missing or does not match the files present, and -1 on
+ *	error.
+ * ----------
+ */
+static int
+archscan_index(char *counter_done, int optind, int argc, char **argv)
+{
+	SlonDString path;
+	FILE	   *fp;
+	struct stat st;
+	off_t		lo;
+	off_t		hi;
+	off_t		mid;
+	char		line[1024];
+	char		lastname[1024];
+	char	   *cp;
+	char	  **lines = NULL;
+	char	  **newlines;
+	int			num = 0;
+	int			max = 0;
+	long long	expect;
+	int			len;
+	int			i;
+
+	dstring_init(&path);
+	dstring_append(&path, archive_dir);
+	dstring_append(&path, "/" ARCHIVE_INDEX_NAME);
+	dstring_terminate(&path);
+	fp = fopen(dstring_data(&path), "r");
+	dstring_free(&path);
+	if (fp == NULL)
+		return 0;
+	if (fstat(fileno(fp), &st) < 0)
+	{
+		fclose(fp);
+		return 0;
+	}
+
+	/*
+	 * Find an offset from where on all lines are beyond counter_done.
+	 */
+	lo = 0;
+	hi = st.st_size;
+	while (hi - lo > ARCHIVE_INDEX_BACKOFF)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (fseeko(fp, mid, SEEK_SET) < 0 ||
+			fgets(line, sizeof(line), fp) == NULL ||
+			fgets(line, sizeof(line), fp) == NULL)
+		{
+			hi = mid;
+			continue;
+		}
+		if (strncmp(line, counter_done, 20) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	lo = (lo > ARCHIVE_INDEX_BACKOFF) ? lo - ARCHIVE_INDEX_BACKOFF : 0;
+	if (fseeko(fp, lo, SEEK_SET) < 0 ||
+		(lo > 0 && fgets(line, sizeof(line), fp) == NULL))
+	{
+		fclose(fp);
+		return 0;
+	}
+
+	/*
+	 * Read the remaining lines.
+	 */
+	lastname[0] = '\0';
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		len = strlen(line);
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len < 22 || line[20] != ' ' ||
+			strspn(line, "0123456789") != 20 ||
+			strchr(line + 21, '/') != NULL ||
+			archscan_counter(line + 21) < 0 ||
+			archscan_counter(line + 21) > strtoll(line, NULL, 10))
+			continue;
+
+		strcpy(lastname, line + 21);
+		if (strncmp(line, counter_done, 20) <= 0)
+			continue;
+		if (num == max)
+		{
+			max = (max == 0) ? 1024 : max * 2;
+			newlines = (char **) realloc(lines, sizeof(char *) * max);
+			if (newlines == NULL)
+				break;
+			lines = newlines;
+		}
+		if ((lines[num] = strdup(line)) == NULL)
+			break;
+		num++;
+	}
+	if (!feof(fp))
+	{
+		errlog(LOG_ERROR, "out of memory in archscan_index()\n");
+		fclose(fp);
+		while (num > 0)
+			free(lines[--num]);
+		free(lines);
+		return -1;
+	}
+	fclose(fp);
+
+	/*
+	 * The counters found must continue the current one without gaps and
+	 * the archives containing them must all exist.
+	 */
+	qsort(lines, num, sizeof(char *), archscan_cmp);
+	expect = strtoll(counter_done, NULL, 10) + 1;
+	dstring_init(&path);
+	for (i = 0; i < num; i++)
+	{
+		if (i > 0 && strcmp(lines[i], lines[i - 1]) == 0)
+			continue;
+		if (strtoll(lines[i], NULL, 10) != expect)
+			break;
+		expect++;
+		if (i > 0 && strcmp(lines[i] + 21, lines[i - 1] + 21) == 0)
+			continue;
+
+		dstring_reset(&path);
+		dstring_append(&path, archive_dir);
+		dstring_addchar(&path, '/');
+		dstring_append(&path, lines[i] + 21);
+		dstring_terminate(&path);
+		if (stat(dstring_data(&path), &st) < 0)
+			break;
+		if (archscan_add(lines[i] + 21, optind, argc, argv) < 0)
+		{
+			while (num > 0)
+				free(lines[--num]);
+			free(lines);
+			dstring_free(&path);
+			return -1;
+		}
+	}
+
+	/*
+	 * An empty index tells nothing. An archive following the last one in
+	 * the index means that the index is behind the directory, like when
+	 * the archives were copied without it.
+	 */
+	if (lastname[0] == '\0')
+		i = -1;
+	else if (i == num)
+	{
+		char		next[32];
+
+		if ((cp = strstr(lastname, ".sql")) != NULL)
+			*cp = '\0';
+		lastname[strlen(lastname) - 20] = '\0';
+		sprintf(next, "%020lld.sql", expect);
+
+		dstring_reset(&path);
+		dstring_append(&path, archive_dir);
+		dstring_addchar(&path, '/');
+		dstring_append(&path, lastname);
+		dstring_append(&path, next);
+		dstring_terminate(&path);
+		if (stat(dstring_data(&path), &st) == 0)
+			i = -1;
+		else
+		{
+			dstring_append(&path, ".gz");
+			dstring_terminate(&path);
+			if (stat(dstring_data(&path), &st) == 0)
+				i = -1;
+		}
+	}
+	dstring_free(&path);
+	len = num;
+	while (num > 0)
+		free(lines[--num]);
+	free(lines);
+
+	if (i != len)
+	{
+		errlog(LOG_WARN, "archive index %s/%s does not match the archive "
+			   "directory - scanning the directory\n",
+			   archive_dir, ARCHIVE_INDEX_NAME);
+		archscan_reset();
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* ----------
+ * archscan_add
+ *
+ *	Remember an archive file name for archscan_sort_out().
+ * ----------
+ */
 static int
-archscan_sort_in(archscan_entry ** entp, char *fname, int optind,
-				 int argc, char **argv)
+archscan_add(char *fname, int optind, int argc, char **argv)
 {
-	archscan_entry *ent;
 	char	   *cp1;
+	char	  **newlist;
 
 	/*
 	 * Ignore files that compare higher or equal to any of our command line
@@ -1413,66 +3395,113 @@ archscan_sort_in(archscan_entry ** entp, char *fname, int optind,
 		optind++;
 	}
 
-	if (*entp == NULL)
+	if (archscan_num == archscan_max)
 	{
-		ent = (archscan_entry *) malloc(sizeof(archscan_entry));
-		if (ent == NULL)
+		archscan_max = (archscan_max == 0) ? 1024 : archscan_max * 2;
+		newlist = (char **) realloc(archscan_list,
+									sizeof(char *) * archscan_max);
+		if (newlist == NULL)
 		{
-			errlog(LOG_ERROR, "out of memory in archscan_sort_in()\n");
+			errlog(LOG_ERROR, "out of memory in archscan_add()\n");
+			archscan_reset();
 			return -1;
 		}
-		if ((ent->fname = strdup(fname)) == NULL)
-		{
-			errlog(LOG_ERROR, "out of memory in archscan_sort_in()\n");
-			return -1;
-		}
-		ent->left = ent->right = NULL;
-
-		*entp = ent;
-		return 0;
+		archscan_list = newlist;
+	}
+	if ((archscan_list[archscan_num] = strdup(fname)) == NULL)
+	{
+		errlog(LOG_ERROR, "out of memory in archscan_add()\n");
+		archscan_reset();
+		return -1;
 	}
+	archscan_num++;
 
-	if (strcmp(fname, (*entp)->fname) < 0)
-		return archscan_sort_in(&((*entp)->left), fname, optind, argc, argv);
-	else
-		return archscan_sort_in(&((*entp)->right), fname, optind, argc, argv);
+	return 0;
 }
 
 
 static int
-archscan_sort_out(archscan_entry * ent)
+archscan_cmp(const void *a, const void *b)
 {
-	char	   *buf;
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
 
-	if (ent == NULL)
-		return 0;
 
-	if (archscan_sort_out(ent->left) < 0)
-		return -1;
+/* ----------
+ * archscan_sort_out
+ *
+ *	Queue the collected archives in file name order.
+ * ----------
+ */
+static int
+archscan_sort_out(void)
+{
+	char	   *buf;
+	int			i;
 
-	buf = (char *) malloc(strlen(archive_dir) + strlen(ent->fname) + 2);
-	if (buf == NULL)
-	{
-		errlog(LOG_ERROR, "out of memory in archscan_sort_out()\n");
-		return -1;
-	}
-	strcpy(buf, archive_dir);
-	strcat(buf, "/");
-	strcat(buf, ent->fname);
-	if (ipc_send_path(buf) < 0)
+	qsort(archscan_list, archscan_num, sizeof(char *), archscan_cmp);
+	for (i = 0; i < archscan_num; i++)
 	{
+		if (i > 0 && strcmp(archscan_list[i], archscan_list[i - 1]) == 0)
+			continue;
+
+		buf = (char *) malloc(strlen(archive_dir) +
+							  strlen(archscan_list[i]) + 2);
+		if (buf == NULL)
+		{
+			errlog(LOG_ERROR, "out of memory in archscan_sort_out()\n");
+			archscan_reset();
+			return -1;
+		}
+		strcpy(buf, archive_dir);
+		strcat(buf, "/");
+		strcat(buf, archscan_list[i]);
+		if (ipc_send_path(buf) < 0)
+		{
+			free(buf);
+			archscan_reset();
+			return -1;
+		}
 		free(buf);
-		return -1;
 	}
-	free(buf);
+	archscan_reset();
 
-	if (archscan_sort_out(ent->right) < 0)
-		return -1;
+	return 0;
+}
 
-	free(ent->fname);
-	free(ent);
 
-	return 0;
+static void
+archscan_reset(void)
+{
+	int			i;
+
+	for (i = 0; i < archscan_num; i++)
+		free(archscan_list[i]);
+	free(archscan_list);
+	archscan_list = NULL;
+	archscan_num = 0;
+	archscan_max = 0;
+}
+
+
+/* ----------
+ * archscan_counter
+ *
+ *	Return the archive counter contained in an archive file name, or -1.
+ * ----------
+ */
+static long long
+archscan_counter(char *fname)
+{
+	char	   *cp;
+
+	if ((cp = strstr(fname, ".sql")) == NULL || cp - fname < 20)
+		return -1;
+	cp -= 20;
+	if (strspn(cp, "0123456789") != 20)
+		return -1;
+
+	return strtoll(cp, NULL, 10);
 }
 
 
@@ -188,6 +188,10 @@ extern char *destination_dir;
 extern char *destination_conninfo;
 extern char *logfile_path;
 extern int	max_archives;
+extern int	parse_ahead;
+extern int	parse_ahead_size;
+extern int	batch_archives;
+extern int	batch_size;
 extern char *cluster_name;
 extern char *namespace;
 
@@ -203,6 +207,7 @@ extern int	process_check_at_counter(char *at_counter);
 extern int	process_simple_sql(char *sql);
 extern int	process_start_transaction(char *sql);
 extern int	process_end_transaction(char *sql);
+extern int	process_cleanup_transaction(void);
 extern int	process_insert(InsertStmt *stmt);
 extern int	process_update(UpdateStmt *stmt);
 extern int	process_delete(DeleteStmt *stmt);
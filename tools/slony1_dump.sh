@@ -14,7 +14,7 @@
 # Check for correct usage
 # ----
 if test $# -lt 2 ; then
-	echo "usage: $0 subscriber-dbname clustername [-omit_copy ]" >&2
+	echo "usage: $0 subscriber-dbname clustername [-omit_copy ] [-apply_cache ]" >&2
 	exit 1
 fi
 
@@ -26,19 +26,46 @@ dbname=$1
 cluster=$2
 clname="\"_$2\""
 omit_copy=0
-if test $# -eq 3; then
-	if [ "$3" = "-omit_copy" ];
-	then
-		omit_copy=1
-	else
-		echo "usage: $0 subscriber-dbname clustername [-omit_copy ]" >&2
-		exit 1	
-    fi
-fi
+apply_cache=0
+shift 2
+for arg in "$@"; do
+	case "$arg" in
+		-omit_copy)
+			omit_copy=1
+			;;
+		-apply_cache)
+			apply_cache=1
+			;;
+		*)
+			echo "usage: $0 subscriber-dbname clustername [-omit_copy ] [-apply_cache ]" >&2
+			exit 1
+			;;
+	esac
+done
 
 pgc="\"pg_catalog\""
 nodeid=`psql -q -At -c "select \"_$cluster\".getLocalNodeId('_$cluster')" $dbname`
 
+# ----
+# With -apply_cache the archive is applied by the logApplyArchive()
+# C trigger of the Slony-I module the subscriber uses, which must then
+# be installed on the log shipping target as well.
+# ----
+if [ "$apply_cache" = "1" ]; then
+	apply_probin=`psql -q -At -d $dbname -c \
+			"select probin from $pgc.pg_proc P, $pgc.pg_namespace N
+				where N.oid = P.pronamespace and N.nspname = '_$cluster'
+					and P.proname = 'logapply'"`
+	apply_prosrc=`psql -q -At -d $dbname -c \
+			"select prosrc || 'Archive' from $pgc.pg_proc P, $pgc.pg_namespace N
+				where N.oid = P.pronamespace and N.nspname = '_$cluster'
+					and P.proname = 'logapply'"`
+	if [ -z "$apply_probin" ]; then
+		echo "$0: logApply() not found in cluster $cluster" >&2
+		exit 1
+	fi
+fi
+
 # ----
 # Get a list of all replicated table ID's this subscriber receives,
 # and remember the table names.
@@ -280,12 +307,18 @@ begin
 
 		execute v_command;
 	end if;
-    if NEW.log_cmdtype = 'S' then
-          execute 'set session_replication_role to local;';
-          execute NEW.log_cmdargs[1];  
-          execute 'set session_replication_role to replica;';
-
-    end if;
+	-- log_cmdargs holds the first statement, the node list and the
+	-- sequence list, then the remaining statements of the batch
+	if NEW.log_cmdtype = 'S' then
+		execute 'set session_replication_role to local;';
+		execute NEW.log_cmdargs[1];
+		v_idx = 4;
+		while v_idx <= v_nargs loop
+			execute NEW.log_cmdargs[v_idx];
+			v_idx = v_idx + 1;
+		end loop;
+		execute 'set session_replication_role to replica;';
+	end if;
 	if NEW.log_cmdtype = 'T' then
 		execute 'TRUNCATE TABLE ONLY ' ||
 			$clname.slon_quote_brute(NEW.log_tablenspname) || '.' ||
@@ -295,9 +328,26 @@ begin
 	return NULL;
 end;
 \$\$ language plpgsql;
+_EOF_
+
+if [ "$apply_cache" = "1" ]; then
+	cat <<_EOF_
+create or replace function $clname.logApplyArchive() returns trigger
+	as '$apply_probin', '$apply_prosrc'
+	language C;
+create trigger apply_trigger
+		before INSERT on $clname.sl_log_archive
+		for each row execute procedure $clname.logApplyArchive('_$cluster');
+_EOF_
+else
+	cat <<_EOF_
 create trigger apply_trigger
 		before INSERT on $clname.sl_log_archive
 		for each row execute procedure $clname.log_apply();
+_EOF_
+fi
+
+cat <<_EOF_
 alter table $clname.sl_log_archive
 	  enable replica trigger apply_trigger;
 set session_replication_role='replica';